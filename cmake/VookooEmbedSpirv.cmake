@@ -0,0 +1,67 @@
+# Embed SPIR-V binaries in C++ headers so that programs read no shader files at run time.
+#
+#   include(VookooEmbedSpirv)
+#   vookoo_embed_spirv(myapp ${CMAKE_CURRENT_BINARY_DIR}/shader.vert.spv ...)
+#
+# Each file becomes embedded/<file name>.hpp in the current binary directory, holding
+#
+#   namespace shaders { inline constexpr uint32_t shader_vert[] = { ... }; }
+#
+# named after the file without its .spv suffix, with other punctuation replaced by '_'.
+# The array can be passed straight to vku::ShaderModule, which uses it without copying:
+#
+#   #include <shader.vert.spv.hpp>
+#   vku::ShaderModule vert{device, shaders::shader_vert};
+#
+# Run as a script, cmake -DINPUT=<spv> -DOUTPUT=<hpp> -DNAME=<array> -P VookooEmbedSpirv.cmake,
+# it converts one file.
+
+if(CMAKE_SCRIPT_MODE_FILE)
+  file(READ ${INPUT} hex HEX)
+  string(LENGTH "${hex}" length)
+  math(EXPR remainder "${length} % 8")
+  if(length EQUAL 0 OR NOT remainder EQUAL 0)
+    message(FATAL_ERROR "${INPUT} is not a SPIR-V file")
+  endif()
+
+  # SPIR-V words are little endian; eight to a line.
+  string(REGEX REPLACE "(..)(..)(..)(..)" "0x\\4\\3\\2\\1," words "${hex}")
+  string(REGEX REPLACE "((0x........,)(0x........,)(0x........,)(0x........,)(0x........,)(0x........,)(0x........,)(0x........,))" "\\1\n  " words "${words}")
+
+  file(WRITE ${OUTPUT}.tmp
+    "// Generated by VookooEmbedSpirv.cmake from ${INPUT}\n"
+    "#pragma once\n"
+    "#include <cstdint>\n"
+    "\n"
+    "namespace shaders {\n"
+    "inline constexpr uint32_t ${NAME}[] = {\n"
+    "  ${words}\n"
+    "};\n"
+    "}\n"
+  )
+  # Leave the header alone if nothing changed, so its users are not rebuilt.
+  file(COPY_FILE ${OUTPUT}.tmp ${OUTPUT} ONLY_IF_DIFFERENT)
+  file(REMOVE ${OUTPUT}.tmp)
+  return()
+endif()
+
+function(vookoo_embed_spirv target)
+  set(dir ${CMAKE_CURRENT_BINARY_DIR}/embedded)
+  foreach(spv ${ARGN})
+    get_filename_component(file ${spv} NAME)
+    string(REGEX REPLACE "\\.spv$" "" name ${file})
+    string(MAKE_C_IDENTIFIER ${name} name)
+    # Several targets may embed the same file, eg. a shader shared by all of them; make the rule once.
+    get_property(embedded DIRECTORY PROPERTY VOOKOO_EMBEDDED_SPIRV)
+    if(NOT "${dir}/${file}.hpp" IN_LIST embedded)
+      add_custom_command(
+        OUTPUT ${dir}/${file}.hpp
+        COMMAND ${CMAKE_COMMAND} -DINPUT=${spv} -DOUTPUT=${dir}/${file}.hpp -DNAME=${name} -P ${CMAKE_CURRENT_FUNCTION_LIST_FILE}
+        DEPENDS ${spv} ${CMAKE_CURRENT_FUNCTION_LIST_FILE}
+      )
+      set_property(DIRECTORY APPEND PROPERTY VOOKOO_EMBEDDED_SPIRV ${dir}/${file}.hpp)
+    endif()
+    target_sources(${target} PRIVATE ${dir}/${file}.hpp)
+  endforeach()
+  target_include_directories(${target} PRIVATE ${dir})
+endfunction()
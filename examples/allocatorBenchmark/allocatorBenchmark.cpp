@@ -0,0 +1,90 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// Vookoo allocator benchmark
+//
+// Creates many small buffers, first with one vkAllocateMemory call each and
+// then sub-allocated from vku::MemoryAllocator blocks, and prints the timings.
+//
+
+#define VKU_NO_GLFW
+#include <vku/vku.hpp>
+#include <vku/vku_framework.hpp>
+#include <chrono>
+
+int main() {
+
+  vku::InstanceMaker im{};
+  im.defaultLayers();
+  vku::DeviceMaker dm{};
+  dm.defaultLayers();
+
+  vku::Framework fw{im, dm};
+  if (!fw.ok()) {
+    std::cout << "Framework creation failed" << std::endl;
+    exit(1);
+  }
+
+  auto device = fw.device();
+  auto memprops = fw.memprops();
+
+  static constexpr uint32_t N = 100000;
+  static constexpr vk::DeviceSize bufferSize = 256;
+  auto usage = vk::BufferUsageFlagBits::eUniformBuffer | vk::BufferUsageFlagBits::eTransferDst;
+
+  using clock = std::chrono::high_resolution_clock;
+  auto ms = [](clock::duration d) { return std::chrono::duration<double, std::milli>(d).count(); };
+
+  ////////////////////////////////////////
+  //
+  // One allocation per buffer.
+  // Drivers cap the number of live allocations (often at 4096),
+  // so this run stops well short of N and the time is scaled up.
+  uint32_t perObjectCount = std::min(N, fw.physicalDevice().getProperties().limits.maxMemoryAllocationCount / 2);
+  double perObjectMs = 0;
+  {
+    std::vector<vku::GenericBuffer> buffers;
+    buffers.reserve(perObjectCount);
+    auto start = clock::now();
+    for (uint32_t i = 0; i != perObjectCount; ++i) {
+      buffers.emplace_back(device, memprops, usage, bufferSize, vk::MemoryPropertyFlagBits::eDeviceLocal);
+    }
+    auto created = clock::now();
+    buffers.clear();
+    auto destroyed = clock::now();
+    perObjectMs = ms(destroyed - start);
+    std::cout << "per-object:    " << perObjectCount << " buffers, create " << ms(created - start)
+              << " ms, destroy " << ms(destroyed - created) << " ms\n";
+  }
+
+  ////////////////////////////////////////
+  //
+  // Sub-allocated from shared blocks.
+  double subAllocatedMs = 0;
+  {
+    vku::MemoryAllocator allocator{device, fw.physicalDevice()};
+    std::vector<vku::GenericBuffer> buffers;
+    buffers.reserve(N);
+    auto start = clock::now();
+    for (uint32_t i = 0; i != N; ++i) {
+      buffers.emplace_back(device, allocator, usage, bufferSize, vk::MemoryPropertyFlagBits::eDeviceLocal);
+    }
+    auto created = clock::now();
+    auto stats = allocator.stats();
+    buffers.clear();
+    auto destroyed = clock::now();
+    subAllocatedMs = ms(destroyed - start);
+    std::cout << "sub-allocated: " << N << " buffers, create " << ms(created - start)
+              << " ms, destroy " << ms(destroyed - created) << " ms, "
+              << stats.blockCount << " blocks, " << stats.bytesReserved / 1024 << " KiB reserved\n";
+  }
+
+  if (perObjectCount) {
+    double perObjectPerBuffer = perObjectMs * 1000 / perObjectCount;
+    double subAllocatedPerBuffer = subAllocatedMs * 1000 / N;
+    std::cout << "per buffer:    " << perObjectPerBuffer << " us per-object, "
+              << subAllocatedPerBuffer << " us sub-allocated ("
+              << perObjectPerBuffer / std::max(subAllocatedPerBuffer, 1e-9) << "x)\n";
+  }
+
+  device.waitIdle();
+}
@@ -61,7 +61,10 @@ int main() {
   vku::DeviceMaker dm{};
   dm.defaultLayers();
 
-  vku::Framework fw{im, dm};
+  // Extended dynamic state lets one pipeline draw the cube with either cull mode.
+  vku::FrameworkOptions fo{};
+  fo.useExtendedDynamicState = true;
+  vku::Framework fw{im, dm, fo};
   if (!fw.ok()) {
     std::cout << "Framework creation failed" << std::endl;
     exit(1);
@@ -299,6 +302,13 @@ int main() {
     glm::vec4(0.5, 0.5, 0.5, 1)
   );
 */
+  ////////////////////////////////////////////////////////
+  //
+  // Collect the texture uploads into one staging buffer and one submission,
+  // on the transfer queue if the device has one.
+
+  vku::UploadBatch uploads{device, fw.memprops(), fw.transferQueueFamilyIndex(), fw.graphicsQueueFamilyIndex()};
+
   ////////////////////////////////////////////////////////
   //
   // Create a texture : imgLogo
@@ -308,7 +318,7 @@ int main() {
     std::vector<uint8_t> pixels(gimp_logo.width * gimp_logo.height * gimp_logo.bytes_per_pixel, // R     G     B     A 
       0x00);
 		GIMP_LOGO_RUN_LENGTH_DECODE(pixels.data(), gimp_logo.rle_pixel_data, gimp_logo.width * gimp_logo.height, gimp_logo.bytes_per_pixel);
-    imgLogo.upload(device, pixels, window.commandPool(), fw.memprops(), fw.graphicsQueue());
+    uploads.add(imgLogo, pixels);
   }
 
   ////////////////////////////////////////////////////////
@@ -320,7 +330,7 @@ int main() {
     std::vector<uint8_t> pixels(gimp_text1.width * gimp_text1.height * gimp_text1.bytes_per_pixel, // R     G     B     A 
       0x00);
 		GIMP_TEXT1_RUN_LENGTH_DECODE(pixels.data(), gimp_text1.rle_pixel_data, gimp_text1.width * gimp_text1.height, gimp_text1.bytes_per_pixel);
-    imgText1.upload(device, pixels, window.commandPool(), fw.memprops(), fw.graphicsQueue());
+    uploads.add(imgText1, pixels);
   }
 
   ////////////////////////////////////////////////////////
@@ -332,7 +342,7 @@ int main() {
     std::vector<uint8_t> pixels(gimp_text2.width * gimp_text2.height * gimp_text2.bytes_per_pixel, // R     G     B     A 
       0x00);
 		GIMP_TEXT2_RUN_LENGTH_DECODE(pixels.data(), gimp_text2.rle_pixel_data, gimp_text2.width * gimp_text2.height, gimp_text2.bytes_per_pixel);
-    imgText2.upload(device, pixels, window.commandPool(), fw.memprops(), fw.graphicsQueue());
+    uploads.add(imgText2, pixels);
   }
 
   ////////////////////////////////////////////////////////
@@ -357,7 +367,7 @@ int main() {
   {
     std::vector<uint8_t> pixels( contentFbo.info().extent.width * contentFbo.info().extent.height * 4, // 4bytes(RGBA)  
       0x00);
-    contentFbo.upload(device, pixels, window.commandPool(), fw.memprops(), fw.graphicsQueue());
+    uploads.add(contentFbo, pixels);
   }
 
   ////////////////////////////////////////
@@ -369,9 +379,12 @@ int main() {
   {
     std::vector<uint8_t> pixels( reflectionFbo.info().extent.width * reflectionFbo.info().extent.height * 4 * reflectionFbo.info().arrayLayers, // 4bytes(RGBA)  6 Layers 
       0x00);
-    reflectionFbo.upload(device, pixels, window.commandPool(), fw.memprops(), fw.graphicsQueue());
+    uploads.add(reflectionFbo, pixels);
   }
 
+  // Rendering on the graphics queue is ordered after the uploads; no need to wait here.
+  uploads.submit(fw.transferQueue(), fw.graphicsQueue());
+
   ////////////////////////////////////////
   //
   // Create Sampler with Linear filter and Nearest mipmap mode
@@ -469,6 +482,7 @@ int main() {
   vk::UniquePipeline maskPipeline;
   vk::UniquePipeline pipelineCULLFRONT;
   vk::UniquePipeline pipelineCULLBACK;
+  vku::DynamicStateValues cubeState;
   vk::UniquePipelineLayout pipelineLayout; 
   vk::UniqueRenderPass displacementRenderPass;
   vk::UniqueRenderPass maskRenderPass;
@@ -554,13 +568,6 @@ int main() {
       .blendColorBlendOp(vk::BlendOp::eAdd)
       .blendAlphaBlendOp(vk::BlendOp::eAdd);
   
-    // Create a pipeline using a renderPass built for our window.
-    pm.cullMode(vk::CullModeFlagBits::eFront);
-    pipelineCULLFRONT = pm.createUnique(device, fw.pipelineCache(), *pipelineLayout, window.renderPass());
-  
-    pm.cullMode(vk::CullModeFlagBits::eBack);
-    pipelineCULLBACK = pm.createUnique(device, fw.pipelineCache(), *pipelineLayout, window.renderPass());
-  
     // Build the renderpass 
     displacementRenderPass = RenderPassCommon( displacementFbo );
   
@@ -598,6 +605,19 @@ int main() {
     // Build the pipeline for this renderpass.
     pm.cullMode(vk::CullModeFlagBits::eBack);
     maskPipeline = pm.createUnique(device, fw.pipelineCache(), *pipelineLayout, *maskRenderPass);
+
+    // Create a pipeline using a renderPass built for our window.
+    // Where the device has extended dynamic state the cull mode is set while recording,
+    // so the one pipeline draws both halves of the cube. Otherwise build one per cull mode.
+    pm.dynamicProfile(fw.dynamicStateSupport());
+    pm.cullMode(vk::CullModeFlagBits::eFront);
+    pipelineCULLFRONT = pm.createUnique(device, fw.pipelineCache(), *pipelineLayout, window.renderPass());
+    cubeState = pm.dynamicValues();
+
+    if (!pm.isDynamic(vk::DynamicState::eCullMode)) {
+      pm.cullMode(vk::CullModeFlagBits::eBack);
+      pipelineCULLBACK = pm.createUnique(device, fw.pipelineCache(), *pipelineLayout, window.renderPass());
+    }
   
     ////////////////////////////////////////
     //
@@ -1213,6 +1233,10 @@ int main() {
         cb.bindVertexBuffers(0, buffer.buffer(), vk::DeviceSize(0));
         cb.bindIndexBuffer(ibo.buffer(), vk::DeviceSize(0), vk::IndexType::eUint32);
         cb.bindPipeline(vk::PipelineBindPoint::eGraphics, *pipelineCULLFRONT);
+        cb.setViewport(0, viewport);
+        cb.setScissor(0, vk::Rect2D{{0, 0}, {window.width(), window.height()}});
+        cubeState.cullMode = vk::CullModeFlagBits::eFront;
+        fw.dynamicStateRecorder().record(cb, cubeState);
         cb.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, *pipelineLayout, 0, descriptorSets, nullptr);
         pushConstant_frag.face = CubeFaces::FRONT;
         pushConstant_frag.typeId = CubeTypes::FINAL;
@@ -1222,7 +1246,9 @@ int main() {
         cb.drawIndexed(indices.size(), 1, 0, 0, 0);
 
         // Pass : Cube Cull Back, CubeTypes::FINAL
-        cb.bindPipeline(vk::PipelineBindPoint::eGraphics, *pipelineCULLBACK);
+        if (pipelineCULLBACK) cb.bindPipeline(vk::PipelineBindPoint::eGraphics, *pipelineCULLBACK);
+        cubeState.cullMode = vk::CullModeFlagBits::eBack;
+        fw.dynamicStateRecorder().record(cb, cubeState);
         pushConstant_frag.face = CubeFaces::BACK;
         pushConstant_frag.typeId = CubeTypes::FINAL;
         cb.pushConstants(
@@ -111,10 +111,6 @@ int main() {
   // Build the final pipeline
   // Make a pipeline to use the vertex format and shaders.
 
-  // Create two shaders, vertex and fragment.
-  vku::ShaderModule vert{device, BINARY_DIR "cybertruck.vert.spv"};
-  vku::ShaderModule frag{device, BINARY_DIR "cybertruck.frag.spv"};
-
   // Make a default pipeline layout. This shows how pointers
   // to resources are layed out.
   vku::PipelineLayoutMaker plm{};
@@ -122,36 +118,36 @@ int main() {
 
   auto pipelineLayout = plm.createUnique(device);
 
-  auto buildPipeline = [&]() {
-    // https://learnopengl.com/Getting-started/Coordinate-Systems
-    // https://www.khronos.org/opengl/wiki/Face_Culling
-    // https://matthewwellings.com/blog/the-new-vulkan-coordinate-system/
-    // https://www.saschawillems.de/blog/2019/03/29/flipping-the-vulkan-viewport/
-    // Note above miss fact that minDepth = 0.5f also needs to be set
-    // flip viewport to match opengl ( +x > Right, +y ^ UP, +z towards viewer from screen ), instead of vulkan default
-    // also requires pipeline set with cullMode:BACK and frontFace:CounterClockWise
-    auto viewport = vk::Viewport{
-      0.0f,                                     //Vulkan default:0
-      static_cast<float>(window.height()),      //Vulkan default:0
-      static_cast<float>(window.width()),   //Vulkan default:width
-      -static_cast<float>(window.height()),//Vulkan default:height
-      0.5f,                              //Vulkan default:0
-      1.0f                               //Vulkan default:1
-    };
-  
-    vku::PipelineMaker pm{window.width(), window.height()};
-    pm.shader(vk::ShaderStageFlagBits::eVertex, vert)
-      .shader(vk::ShaderStageFlagBits::eFragment, frag)
-      .vertexBinding(0, sizeof(Vertex))
-      .vertexAttribute(0, 0, vk::Format::eR32G32Sfloat, offsetof(Vertex, pos))
-      .viewport(viewport) // viewport set to match openGL, affects cullMode and frontFace
-      .frontFace(vk::FrontFace::eCounterClockwise) // openGL default, GL_CCW face is front
-      .cullMode(vk::CullModeFlagBits::eBack); // openGL default, GL_BACK is the face to be culled
-  
-    // Create a pipeline using a renderPass built for our window.
-    return pm.createUnique(device, fw.pipelineCache(), *pipelineLayout, window.renderPass());
-  };
-  auto pipeline = buildPipeline();
+  // The viewport is dynamic, so the pipeline survives window resizes.
+  vku::PipelineMaker pm{};
+  pm.dynamicProfile()
+    .vertexBinding(0, sizeof(Vertex))
+    .vertexAttribute(0, 0, vk::Format::eR32G32Sfloat, offsetof(Vertex, pos))
+    .frontFace(vk::FrontFace::eCounterClockwise) // openGL default, GL_CCW face is front
+    .cullMode(vk::CullModeFlagBits::eBack); // openGL default, GL_BACK is the face to be culled
+
+#ifdef VOOKOO_SHADERC_SUPPORT
+  // Compile the shaders at runtime and rebuild the pipeline whenever they are saved.
+  vku::ShaderCompiler compiler{BINARY_DIR "shadercache"};
+  vku::ShaderWatcher watcher{device, compiler, fw.pipelineCache()};
+  auto pipelineId = watcher.add(std::move(pm), {
+      {SOURCE_DIR "examples/cybertruck/cybertruck.vert", vk::ShaderStageFlagBits::eVertex},
+      {SOURCE_DIR "examples/cybertruck/cybertruck.frag", vk::ShaderStageFlagBits::eFragment},
+    }, *pipelineLayout, window.renderPass());
+  if (pipelineId == vku::ShaderWatcher::invalidId) {
+    std::cout << "Shader compilation failed" << std::endl;
+    exit(1);
+  }
+#else
+  // Create two shaders, vertex and fragment.
+  vku::ShaderModule vert{device, BINARY_DIR "cybertruck.vert.spv"};
+  vku::ShaderModule frag{device, BINARY_DIR "cybertruck.frag.spv"};
+  pm.shader(vk::ShaderStageFlagBits::eVertex, vert)
+    .shader(vk::ShaderStageFlagBits::eFragment, frag);
+
+  // Create a pipeline using a renderPass built for our window.
+  auto pipeline = pm.createUnique(device, fw.pipelineCache(), *pipelineLayout, window.renderPass());
+#endif
 
   ////////////////////////////////////////
   //
@@ -167,13 +163,32 @@ int main() {
       glfwGetCursorPos(glfwwindow, &xpos, &ypos);
     };
 
-    static auto ww = window.width();
-    static auto wh = window.height();
-    if (ww != window.width() || wh != window.height()) {
-      ww = window.width();
-      wh = window.height();
-      pipeline = buildPipeline();
-    }
+    auto ww = window.width();
+    auto wh = window.height();
+
+#ifdef VOOKOO_SHADERC_SUPPORT
+    // Pick up any pipelines rebuilt since the last frame.
+    watcher.beginFrame();
+    vk::Pipeline current = watcher.pipeline(pipelineId);
+#else
+    vk::Pipeline current = *pipeline;
+#endif
+
+    // https://learnopengl.com/Getting-started/Coordinate-Systems
+    // https://www.khronos.org/opengl/wiki/Face_Culling
+    // https://matthewwellings.com/blog/the-new-vulkan-coordinate-system/
+    // https://www.saschawillems.de/blog/2019/03/29/flipping-the-vulkan-viewport/
+    // Note above miss fact that minDepth = 0.5f also needs to be set
+    // flip viewport to match opengl ( +x > Right, +y ^ UP, +z towards viewer from screen ), instead of vulkan default
+    // also requires pipeline set with cullMode:BACK and frontFace:CounterClockWise
+    auto viewport = vk::Viewport{
+      0.0f,                                     //Vulkan default:0
+      static_cast<float>(wh),      //Vulkan default:0
+      static_cast<float>(ww),   //Vulkan default:width
+      -static_cast<float>(wh),//Vulkan default:height
+      0.5f,                              //Vulkan default:0
+      1.0f                               //Vulkan default:1
+    };
 
     Uniform uniform {
       .iResolution = glm::vec4(ww, wh, 1., 0.),
@@ -193,7 +208,9 @@ int main() {
 
         cb.beginRenderPass(rpbi, vk::SubpassContents::eInline);
         cb.bindVertexBuffers(0, buffer.buffer(), vk::DeviceSize(0));
-        cb.bindPipeline(vk::PipelineBindPoint::eGraphics, *pipeline);
+        cb.bindPipeline(vk::PipelineBindPoint::eGraphics, current);
+        cb.setViewport(0, viewport); // viewport set to match openGL, affects cullMode and frontFace
+        cb.setScissor(0, vk::Rect2D{{0, 0}, {ww, wh}});
         cb.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, *pipelineLayout, 0, descriptorSets, nullptr);
         cb.draw(vertices.size(), 1, 0, 0);
         cb.endRenderPass();
@@ -66,8 +66,9 @@ int main() {
     { .MVP = glm::rotate(glm::radians(45.f), glm::vec3(0, 0, 1)) }
   };
 
-  // Create, but do not upload the uniform buffer as a device local buffer.
-  vku::UniformBuffer ubo(device, fw.memprops(), objects.size()*sizeof(PER_OBJECT));
+  // Per-frame uniforms are streamed through a persistently mapped ring,
+  // one slot per frame in flight. Each object gets its own aligned range.
+  vku::UploadRing ring(device, fw.physicalDevice(), window.framesInFlight(), 64*1024);
 
   ////////////////////////////////////////
   //
@@ -123,7 +124,7 @@ int main() {
     .beginDescriptorSet(descriptorSets[0])
     // layout (binding = 0) uniform PER_OBJECT
     .beginBuffers(0, 0, vk::DescriptorType::eUniformBufferDynamic)
-    .buffer(ubo.buffer(), 0, sizeof(PER_OBJECT))
+    .buffer(ring.buffer(), 0, sizeof(PER_OBJECT))
 
     //-- update the descriptor sets with their pointers (but not data).
     .update(device);
@@ -137,16 +138,19 @@ int main() {
   vku::ShaderModule vert{device, BINARY_DIR "dynamicUniformBuffer.vert.spv"};
   vku::ShaderModule frag{device, BINARY_DIR "dynamicUniformBuffer.frag.spv"};
 
+  // The registry shares this pipeline with any identical one built elsewhere.
   auto buildPipeline = [&]() {
     // Make a pipeline to use the vertex format and shaders.
-    vku::PipelineMaker pm{ window.width(), window.height() };
-    return pm
+    // The viewport is dynamic and set by the window, so resizing keeps this pipeline.
+    vku::PipelineMaker pm{};
+    pm.dynamicProfile();
+    pm
       .shader(vk::ShaderStageFlagBits::eVertex, vert)
       .shader(vk::ShaderStageFlagBits::eFragment, frag)
       .vertexBinding(0, sizeof(Vertex))
       .vertexAttribute(0, 0, vk::Format::eR32G32Sfloat, offsetof(Vertex, pos))
-      .vertexAttribute(1, 0, vk::Format::eR32G32B32Sfloat, offsetof(Vertex, colour))
-      .createUnique(device, fw.pipelineCache(), *pipelineLayout, window.renderPass());
+      .vertexAttribute(1, 0, vk::Format::eR32G32B32Sfloat, offsetof(Vertex, colour));
+    return fw.pipelineRegistry().get(pm, *pipelineLayout, window.renderPass());
   };
   auto pipeline = buildPipeline();
 
@@ -156,35 +160,22 @@ int main() {
 
     window.draw(device, fw.graphicsQueue(),
       [&](vk::CommandBuffer cb, int imageIndex, vk::RenderPassBeginInfo &rpbi) {
-        static auto ww = window.width();
-        static auto wh = window.height();
-        if (ww != window.width() || wh != window.height()) {
-          ww = window.width();
-          wh = window.height();
-          pipeline = buildPipeline();
-        }
+        // This frame's slot of the ring is free once the window has waited for
+        // the fence of its frame slot, which it does before calling us.
+        ring.beginFrame(device, window.frameIndex());
 
         vk::CommandBufferBeginInfo cbbi{};
         cb.begin(cbbi);
 
-        cb.updateBuffer(ubo.buffer(), 0, objects.size()*sizeof(PER_OBJECT), &objects[0]); // validation error if inside {beginRenderPass...endRenderPass}
-        // We may or may not need this barrier. It is probably a good precaution.
-        ubo.barrier(
-          cb,
-          vk::PipelineStageFlagBits::eHost, //srcStageMask
-          vk::PipelineStageFlagBits::eFragmentShader, //dstStageMask
-          vk::DependencyFlagBits::eByRegion, //dependencyFlags
-          vk::AccessFlagBits::eHostWrite, //srcAccessMask
-          vk::AccessFlagBits::eShaderRead, //dstAccessMask
-          fw.graphicsQueueFamilyIndex(), //srcQueueFamilyIndex
-          fw.graphicsQueueFamilyIndex() //dstQueueFamilyIndex
-        );
-
+        // Host coherent writes made before the submit are visible to the GPU, so no
+        // updateBuffer or barrier is needed.
         cb.beginRenderPass(rpbi, vk::SubpassContents::eInline);
-        cb.bindPipeline(vk::PipelineBindPoint::eGraphics, *pipeline);
+        cb.bindPipeline(vk::PipelineBindPoint::eGraphics, pipeline);
+        window.setViewport(cb);
         cb.bindVertexBuffers(0, buffer.buffer(), vk::DeviceSize(0));
         for(unsigned int i=0; i<objects.size(); ++i) {
-          uint32_t offset = i * static_cast<uint32_t>(sizeof(PER_OBJECT)); // offset is key to demonstrating dynamicUniformBuffer 
+          auto range = ring.push(objects[i]);
+          uint32_t offset = vku::UploadRing::dynamicOffset(range); // offset is key to demonstrating dynamicUniformBuffer 
           cb.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, *pipelineLayout, 0, {descriptorSets[0]}, {offset});
           cb.draw(vertices.size(), 1, 0, 0);
         }
@@ -194,7 +185,7 @@ int main() {
       }
     );
 
-    // animate transforms locally (next frame, syncronize to GPU via cb.updateBuffer(ubo.buffer()...)
+    // animate transforms locally (next frame, copied to the GPU via ring.push(...))
     objects[0].MVP *= glm::rotate(glm::radians(-0.5f), glm::vec3(0, 0, 1));
     objects[1].MVP *= glm::rotate(glm::radians( 1.0f), glm::vec3(0, 0, 1));
 
@@ -121,8 +121,8 @@ int main() {
   vku::ColorAttachmentImage iChannelPong{device, fw.memprops(), advectionSize, advectionSize, vk::Format::eR32G32B32A32Sfloat};
   vku::TextureImage2D iChannel1{device, fw.memprops(), advectionSize, advectionSize, 1, vk::Format::eR8G8B8A8Unorm};
 
-  iChannelPing.upload(device, pixels0, window.commandPool(), fw.memprops(), fw.graphicsQueue(), vk::ImageLayout::eGeneral);
-  iChannelPong.upload(device, pixels0, window.commandPool(), fw.memprops(), fw.graphicsQueue(), vk::ImageLayout::eGeneral);
+  iChannelPing.upload(device, pixels0, window.commandPool(), fw.memprops(), fw.graphicsQueue());
+  iChannelPong.upload(device, pixels0, window.commandPool(), fw.memprops(), fw.graphicsQueue());
   iChannel1.upload(device, pixels1, window.commandPool(), fw.memprops(), fw.graphicsQueue());
 
   // Create linearSampler
@@ -172,7 +172,7 @@ int main() {
     .buffer(ubo.buffer(), 0, sizeof(Uniform))
     // layout (binding = 1) uniform sampler2D iChannel0
     .beginImages(1, 0, vk::DescriptorType::eCombinedImageSampler)
-    .image(*linearSampler, iChannelPing.imageView(), vk::ImageLayout::eGeneral)
+    .image(*linearSampler, iChannelPing.imageView(), vk::ImageLayout::eShaderReadOnlyOptimal)
     // layout (binding = 2) uniform sampler2D iChannel1
     .beginImages(2, 0, vk::DescriptorType::eCombinedImageSampler)
     .image(*linearSampler, iChannel1.imageView(), vk::ImageLayout::eShaderReadOnlyOptimal)
@@ -184,7 +184,7 @@ int main() {
     .buffer(ubo.buffer(), 0, sizeof(Uniform))
     // layout (binding = 1) uniform sampler2D iChannel0
     .beginImages(1, 0, vk::DescriptorType::eCombinedImageSampler)
-    .image(*linearSampler, iChannelPong.imageView(), vk::ImageLayout::eGeneral)
+    .image(*linearSampler, iChannelPong.imageView(), vk::ImageLayout::eShaderReadOnlyOptimal)
     // layout (binding = 2) uniform sampler2D iChannel1
     .beginImages(2, 0, vk::DescriptorType::eCombinedImageSampler)
     .image(*linearSampler, iChannel1.imageView(), vk::ImageLayout::eShaderReadOnlyOptimal)
@@ -196,181 +196,137 @@ int main() {
   //
   // Build the final pipeline
 
+  vku::PipelineMaker pm{window.width(), window.height()};
+  pm.vertexBinding(0, sizeof(Vertex))
+    .vertexAttribute(0, 0, vk::Format::eR32G32B32Sfloat, offsetof(Vertex, pos))
+    .depthTestEnable(VK_TRUE)
+    .cullMode(vk::CullModeFlagBits::eBack)
+    .frontFace(vk::FrontFace::eClockwise)
+    .viewport(viewport);
+
+#ifdef VOOKOO_SHADERC_SUPPORT
+  // Compile the shaders at runtime and rebuild the pipelines whenever they are saved.
+  vku::ShaderCompiler compiler{BINARY_DIR "shadercache"};
+  vku::ShaderWatcher watcher{device, compiler, fw.pipelineCache()};
+  auto finalPipeline = watcher.add(std::move(pm), {
+      {SOURCE_DIR "examples/flockaroo/flockaroo.vert", vk::ShaderStageFlagBits::eVertex},
+      {SOURCE_DIR "examples/flockaroo/flockaroo.frag", vk::ShaderStageFlagBits::eFragment},
+    }, *pipelineLayout, window.renderPass());
+#else
   vku::ShaderModule final_vert{device, BINARY_DIR "flockaroo.vert.spv"};
   vku::ShaderModule final_frag{device, BINARY_DIR "flockaroo.frag.spv"};
 
-  vku::PipelineMaker pm{window.width(), window.height()};
   auto finalPipeline = pm
     .shader(vk::ShaderStageFlagBits::eVertex, final_vert)
     .shader(vk::ShaderStageFlagBits::eFragment, final_frag)
-    .vertexBinding(0, sizeof(Vertex))
-    .vertexAttribute(0, 0, vk::Format::eR32G32B32Sfloat, offsetof(Vertex, pos))
-    .depthTestEnable(VK_TRUE)
-    .cullMode(vk::CullModeFlagBits::eBack)
-    .frontFace(vk::FrontFace::eClockwise)
-    .viewport(viewport)
     .createUnique(device, fw.pipelineCache(), *pipelineLayout, window.renderPass());
+#endif
 
   ////////////////////////////////////////
   //
-  // Build the advection pipeline
-  // (added effort required to construct ping&pong output framebuffers) 
-
-  vku::ShaderModule advection_vert{device, BINARY_DIR "flockaroo.vert.spv"};
-  vku::ShaderModule advection_frag{device, BINARY_DIR "advection.frag.spv"};
-
-  ////////////////////////////////////////
-  //
-  // Helper for building shared Advection render passes
-  // that only differ by particular output attachment iChannelX.format() 
-  //
-  auto RenderPassAdvection = [&device](vk::Format iChannelXformat)->vk::UniqueRenderPass {
-    // Build the renderpass writing to iChannelX 
-    vku::RenderpassMaker rpm;
-    return rpm
-      // The only colour attachment.
-     .attachmentBegin(iChannelXformat)
-     .attachmentSamples(vk::SampleCountFlagBits::e1)
-     .attachmentLoadOp(vk::AttachmentLoadOp::eDontCare)
-     .attachmentStoreOp(vk::AttachmentStoreOp::eStore)
-     .attachmentStencilLoadOp(vk::AttachmentLoadOp::eDontCare)
-     .attachmentStencilStoreOp(vk::AttachmentStoreOp::eDontCare)
-     .attachmentInitialLayout(vk::ImageLayout::eUndefined)
-     .attachmentFinalLayout(vk::ImageLayout::eGeneral)
-      // A subpass to render using the above attachment(s).
-     .subpassBegin(vk::PipelineBindPoint::eGraphics)
-     .subpassColorAttachment(vk::ImageLayout::eGeneral, 0)
-      // Define dependencies, https://gpuopen.com/vulkan-barriers-explained/
-      //
-      //  [ ]TOP_OF_PIPE -------------------------------------------------
-      //  [ ]DRAW_INDIRECT
-      //  [ ]VERTEX_INPUT
-      //  [ ]VERTEX_SHADER
-      //  [ ]TESSELLATION_CONTROL_SHADER
-      //  [ ]TESSELLATION_EVALUATION_SHADER  [ ]COMPUTE_SHADER  [ ]TRANSFER
-      //  [ ]GEOMETRY_SHADER
-      //  [ ]EARLY_FRAGMENT_TESTS
-      //  [S]FRAGMENT_SHADER
-      //  [ ]LATE_FRAGMENT_TESTS
-      //  [ ]COLOR_ATTACHMENT_OUTPUT
-      //  [ ]BOTTOM_OF_PIPE ----------------------------------------------
-      //
-      //  [ ]TOP_OF_PIPE -------------------------------------------------
-      //  [ ]DRAW_INDIRECT
-      //  [ ]VERTEX_INPUT
-      //  [ ]VERTEX_SHADER
-      //  [ ]TESSELLATION_CONTROL_SHADER
-      //  [ ]TESSELLATION_EVALUATION_SHADER  [ ]COMPUTE_SHADER  [ ]TRANSFER
-      //  [ ]GEOMETRY_SHADER
-      //  [ ]EARLY_FRAGMENT_TESTS
-      //  [ ]FRAGMENT_SHADER
-      //  [ ]LATE_FRAGMENT_TESTS
-      //  [D]COLOR_ATTACHMENT_OUTPUT
-      //  [ ]BOTTOM_OF_PIPE ----------------------------------------------
-      //
-      // The special value VK_SUBPASS_EXTERNAL refers to the 
-      // implicit subpass before or after the render pass depending on 
-      // whether it is specified in srcSubpass or dstSubpass.
-      //
-      // dependency: If srcSubpass is equal to VK_SUBPASS_EXTERNAL, 
-      // the first synchronization scope includes commands that occur earlier
-      // in submission order than the vkCmdBeginRenderPass used to begin the
-      // render pass instance.` 
-     .dependencyBegin(VK_SUBPASS_EXTERNAL, 0)
-     //VK_ACCESS_INPUT_ATTACHMENT_READ_BIT
-     //VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT
-     .dependencySrcAccessMask(vk::AccessFlagBits::eInputAttachmentRead)
-     .dependencySrcStageMask(vk::PipelineStageFlagBits::eFragmentShader)
-     //VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT
-     //VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT
-     .dependencyDstAccessMask(vk::AccessFlagBits::eColorAttachmentWrite)
-     .dependencyDstStageMask(vk::PipelineStageFlagBits::eColorAttachmentOutput)
-     .dependencyDependencyFlags(vk::DependencyFlagBits::eByRegion)
-     // dependency: If dstSubpass is equal to VK_SUBPASS_EXTERNAL, 
-     // the second synchronization scope includes commands that occur later
-     // in submission order than the vkCmdEndRenderPass used to end the 
-     // render pass instance.
-     .dependencyBegin(0, VK_SUBPASS_EXTERNAL)
-     //VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT
-     //VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT
-     .dependencySrcAccessMask(vk::AccessFlagBits::eColorAttachmentWrite)
-     .dependencySrcStageMask(vk::PipelineStageFlagBits::eColorAttachmentOutput)
-     //VK_ACCESS_INPUT_ATTACHMENT_READ_BIT
-     //VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT
-     .dependencyDstAccessMask(vk::AccessFlagBits::eInputAttachmentRead)
-     .dependencyDstStageMask(vk::PipelineStageFlagBits::eFragmentShader)
-     .dependencyDependencyFlags(vk::DependencyFlagBits::eByRegion)
-     // Finally use the maker method to construct this renderpass
-     .createUnique(device);
-  };
+  // Build a render graph for each parity of iFrame.
+  // Advection samples one of iChannelPing&iChannelPong and draws to the other,
+  // then the final pass samples the result. The graph makes the advection
+  // render pass and framebuffer and inserts the barriers between the passes.
+
+  vk::Pipeline advectionCurrent;
+  vk::Pipeline finalCurrent;
+  vk::RenderPassBeginInfo windowRpbi;
+  Uniform uniform{};
+
+  vku::RenderGraph graphs[2] = {{device, fw.physicalDevice()}, {device, fw.physicalDevice()}};
+  vku::RenderGraph::Pass advectionPass;
+  for (int parity = 0; parity != 2; ++parity) {
+    auto &graph = graphs[parity];
+    auto uniforms = graph.importBuffer("ubo", ubo);
+    auto src = graph.importImage(parity ? "iChannelPong" : "iChannelPing", parity ? iChannelPong : iChannelPing);
+    auto dst = graph.importImage(parity ? "iChannelPing" : "iChannelPong", parity ? iChannelPing : iChannelPong);
+    auto noise = graph.importImage("iChannel1", iChannel1);
+
+    graph.addPass("uniforms")
+      .transferDst(uniforms)
+      .execute([&](vk::CommandBuffer cb) {
+        // Copy the uniform data to the buffer. (note this is done
+        // inline and so we can discard "uniform" afterwards)
+        cb.updateBuffer(ubo.buffer(), 0, sizeof(Uniform), &uniform);
+      });
+
+    // First renderpass. Compute advection.
+    auto advection = graph.addPass("advection")
+      .use(uniforms, vku::ResourceUse::uniformBuffer())
+      .sampled(src)
+      .sampled(noise)
+      .colorAttachment(dst, std::array<float, 4>{0, 0, 0, 0})
+      .execute([&, parity](vk::CommandBuffer cb) {
+        cb.bindPipeline(vk::PipelineBindPoint::eGraphics, advectionCurrent);
+        cb.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, *pipelineLayout, 0, {descriptorSets[parity]}, {});
+        cb.drawIndexed(indices.size(), 1, 0, 0, 0);
+      });
+
+    // Second renderpass. Draw the final image.
+    // This uses the window's render pass, so the graph runs it as a plain pass.
+    graph.addPass("final")
+      .use(uniforms, vku::ResourceUse::uniformBuffer())
+      .sampled(dst)
+      .sampled(noise)
+      .sideEffects()
+      .execute([&, parity](vk::CommandBuffer cb) {
+        cb.beginRenderPass(windowRpbi, vk::SubpassContents::eInline);
+        cb.bindPipeline(vk::PipelineBindPoint::eGraphics, finalCurrent);
+        cb.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, *pipelineLayout, 0, {descriptorSets[(parity+1)%2]}, {});
+        cb.drawIndexed(indices.size(), 1, 0, 0, 0);
+        cb.endRenderPass();
+      });
 
-  // Build the Advection renderpass able to write to either iChannelPing or iChannelPong (depends on image format of both being identical)
-  assert(vk::Format::eR32G32B32A32Sfloat == iChannelPing.format() && iChannelPing.format()==iChannelPong.format());
-  vk::UniqueRenderPass advectionRenderPass = RenderPassAdvection(vk::Format::eR32G32B32A32Sfloat); 
+    graph.compile();
+    if (parity == 0) advectionPass = advection;
+  }
 
   // Build the shared pipeline (ping&pong) for Advection renderpass.
+  // The render passes of both graphs are compatible, so one pipeline serves both.
   vku::PipelineMaker spm{advectionSize, advectionSize};
-  auto advectionPipeline = spm
-    .shader(vk::ShaderStageFlagBits::eVertex, advection_vert)
-    .shader(vk::ShaderStageFlagBits::eFragment, advection_frag)
-    .vertexBinding(0, sizeof(Vertex))
+  spm.vertexBinding(0, sizeof(Vertex))
     .vertexAttribute(0, 0, vk::Format::eR32G32B32Sfloat, offsetof(Vertex, pos))
     .cullMode( vk::CullModeFlagBits::eBack )
-    .frontFace( vk::FrontFace::eClockwise )
-    .createUnique(device, fw.pipelineCache(), *pipelineLayout, *advectionRenderPass);
-
-  ////////////////////////////////////////
-  //
-  // Build UniqueFramebuffers for Advection's ping&pong passes
-  //
-  // Render passes operate in conjunction with framebuffers. 
-  // Framebuffers represent a collection of specific memory attachments that a render pass instance uses.
-
-  auto UniqueFramebuffers = [&device, &advectionSize](vk::UniqueRenderPass &RenderPassX, vku::ColorAttachmentImage &iChannelX) -> vk::UniqueFramebuffer {
-    // RenderPassX writes to output iChannelX
-    vk::ImageView attachmentsPassX[] = {iChannelX.imageView()};
-    vk::FramebufferCreateInfo fbciPassX{{}, *RenderPassX, sizeof(attachmentsPassX)/sizeof(vk::ImageView), attachmentsPassX, advectionSize, advectionSize, 1 };
-    vk::UniqueFramebuffer FrameBufferPassX = device.createFramebufferUnique(fbciPassX);
-    return FrameBufferPassX;
-  };
-  vk::UniqueFramebuffer advectionFrameBufferPing = UniqueFramebuffers( advectionRenderPass, iChannelPing );
-  vk::UniqueFramebuffer advectionFrameBufferPong = UniqueFramebuffers( advectionRenderPass, iChannelPong );
-
-  ////////////////////////////////////////
-  //
-  // Build a RenderPassBeginInfo for advection
-  //
-
-  // Match in order of attachments to clear the image.
-  // kludge: Is there a better way to get really what's needed; sizeof(attachmentsP?ng)/sizeof(vk::ImageView)?
-  vk::ImageView attachmentsPing[] = {iChannelPong.imageView()};
-  std::array<vk::ClearValue, sizeof(attachmentsPing)/sizeof(vk::ImageView)> clearColours{
-    vk::ClearColorValue{}
-  };
+    .frontFace( vk::FrontFace::eClockwise );
+
+#ifdef VOOKOO_SHADERC_SUPPORT
+  auto advectionPipeline = watcher.add(std::move(spm), {
+      {SOURCE_DIR "examples/flockaroo/flockaroo.vert", vk::ShaderStageFlagBits::eVertex},
+      {SOURCE_DIR "examples/flockaroo/advection.frag", vk::ShaderStageFlagBits::eFragment},
+    }, *pipelineLayout, graphs[0].renderPass(advectionPass));
+  if (finalPipeline == vku::ShaderWatcher::invalidId || advectionPipeline == vku::ShaderWatcher::invalidId) {
+    std::cout << "Shader compilation failed" << std::endl;
+    exit(1);
+  }
+#else
+  vku::ShaderModule advection_vert{device, BINARY_DIR "flockaroo.vert.spv"};
+  vku::ShaderModule advection_frag{device, BINARY_DIR "advection.frag.spv"};
 
-  // when index=0 write to iChannelPong, when index=1 write to iChannelPing   
-  vk::RenderPassBeginInfo advectionRpbi[]={{
-    *advectionRenderPass,
-    *advectionFrameBufferPong,
-    vk::Rect2D{{0, 0}, {advectionSize, advectionSize}},
-    (uint32_t) clearColours.size(),
-    clearColours.data()
-  },{
-    *advectionRenderPass,
-    *advectionFrameBufferPing,
-    vk::Rect2D{{0, 0}, {advectionSize, advectionSize}},
-    (uint32_t) clearColours.size(),
-    clearColours.data()
-  }};
+  auto advectionPipeline = spm
+    .shader(vk::ShaderStageFlagBits::eVertex, advection_vert)
+    .shader(vk::ShaderStageFlagBits::eFragment, advection_frag)
+    .createUnique(device, fw.pipelineCache(), *pipelineLayout, graphs[0].renderPass(advectionPass));
+#endif
 
   int iFrame = 0;
   while (!glfwWindowShouldClose(glfwwindow)) {
     glfwPollEvents();
 
+#ifdef VOOKOO_SHADERC_SUPPORT
+    // Pick up any pipelines rebuilt since the last frame.
+    watcher.beginFrame();
+    advectionCurrent = watcher.pipeline(advectionPipeline);
+    finalCurrent = watcher.pipeline(finalPipeline);
+#else
+    advectionCurrent = *advectionPipeline;
+    finalCurrent = *finalPipeline;
+#endif
+
     window.draw(device, fw.graphicsQueue(),
       [&](vk::CommandBuffer cb, int imageIndex, vk::RenderPassBeginInfo &rpbi) {
         
-        Uniform uniform {
+        uniform = Uniform{
           .iResolution = glm::vec4(window.width(), window.height(), 1., 0.),
           .iFrame = {iFrame, 0, 0, 0},
           .iChannelResolution = {
@@ -385,27 +341,13 @@ int main() {
         vk::CommandBufferBeginInfo bi{};
         cb.begin(bi);
 
-        // Copy the uniform data to the buffer. (note this is done
-        // inline and so we can discard "unform" afterwards)
-        cb.updateBuffer(ubo.buffer(), 0, sizeof(Uniform), &uniform);
-
         // vertex attributes common/shared by following render passes
         cb.bindVertexBuffers(0, vbo.buffer(), vk::DeviceSize(0));
         cb.bindIndexBuffer(ibo.buffer(), vk::DeviceSize(0), vk::IndexType::eUint32);
 
-        // First renderpass. Compute advection.
-        cb.beginRenderPass(advectionRpbi[iFrame%2], vk::SubpassContents::eInline);
-        cb.bindPipeline(vk::PipelineBindPoint::eGraphics, *advectionPipeline);
-        cb.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, *pipelineLayout, 0, {descriptorSets[iFrame%2]}, {});
-        cb.drawIndexed(indices.size(), 1, 0, 0, 0);
-        cb.endRenderPass();
-
-        // Second renderpass. Draw the final image.
-        cb.beginRenderPass(rpbi, vk::SubpassContents::eInline);
-        cb.bindPipeline(vk::PipelineBindPoint::eGraphics, *finalPipeline);
-        cb.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, *pipelineLayout, 0, {descriptorSets[(iFrame+1)%2]}, {});
-        cb.drawIndexed(indices.size(), 1, 0, 0, 0);
-        cb.endRenderPass();
+        // Update the uniforms and run both passes.
+        windowRpbi = rpbi;
+        graphs[iFrame%2].execute(cb);
 
         cb.end();
       }
@@ -42,15 +42,14 @@ int main() {
   ////////////////////////////////////////
   //
   // Create a buffer to store the results in.
-  // Note: this won't work for everyone. With some devices you
-  // may need to explictly upload and download data.
+  // This lives in fast device memory; the results are downloaded afterwards.
   static constexpr int N = 128;
   auto mybuf = vku::GenericBuffer(
       device, 
       memprops, 
-      vk::BufferUsageFlagBits::eStorageBuffer, 
+      vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eTransferSrc, 
       N * sizeof(float), 
-      vk::MemoryPropertyFlagBits::eHostVisible
+      vk::MemoryPropertyFlagBits::eDeviceLocal
   );
 
   ////////////////////////////////////////
@@ -98,19 +97,14 @@ int main() {
 
   ////////////////////////////////////////
   //
-  // Create Command Pool
+  // Create a pool of command buffers and fences for the compute queue.
   //
-  vk::CommandPoolCreateInfo cpci{ 
-    vk::CommandPoolCreateFlagBits::eTransient 
-           | vk::CommandPoolCreateFlagBits::eResetCommandBuffer, 
-    fw.computeQueueFamilyIndex()
-  };
-  auto commandPool = device.createCommandPoolUnique(cpci);
+  vku::SubmitPool pool{device, fw.computeQueueFamilyIndex(), fw.computeQueue()};
 
   ////////////////////////////////////////
   //
   // Run compute shader on the GPU.
-  vku::executeImmediately(device, *commandPool, fw.computeQueue(), 
+  pool.submit(
     [&](vk::CommandBuffer cb) {
       PushConstants cu{
         .value = 2.0f,
@@ -124,15 +118,18 @@ int main() {
     }
   );
 
-  device.waitIdle();
+  ////////////////////////////////////////
+  //
+  // Copy the results back to host cached memory.
+  // The copy is ordered after the dispatch on the same queue.
+  auto result = mybuf.download(device, memprops, pool);
 
   ////////////////////////////////////////
   //
   // Show result of compute shader -> (2.0f + 0..127)
-  float *values = static_cast<float*>( mybuf.map(device) );
-  std::for_each(values, values+N, [](float &value){ 
+  auto values = result.get<float>();
+  std::for_each(values.begin(), values.end(), [](float &value){ 
     std::cout << value << " "; 
   });
   std::cout << std::endl;
-  mybuf.unmap(device);
 }
@@ -89,7 +89,9 @@ int main() {
 
   auto buildPipeline = [&]() {
     // Make a pipeline to use the vertex format and shaders.
-    vku::PipelineMaker pm{window.width(), window.height()};
+    // The viewport is dynamic and set by the window, so resizing keeps this pipeline.
+    vku::PipelineMaker pm{};
+    pm.dynamicProfile();
     return pm
       .shader(vk::ShaderStageFlagBits::eVertex, vert)
       .shader(vk::ShaderStageFlagBits::eFragment, frag)
@@ -111,17 +113,11 @@ int main() {
   // Static command buffer, so only need to create the command buffer(s) once.
   window.setStaticCommands(
     [&](vk::CommandBuffer cb, int imageIndex, vk::RenderPassBeginInfo &rpbi) {
-      static auto ww = window.width();
-      static auto wh = window.height();
-      if (ww != window.width() || wh != window.height()) {
-        ww = window.width();
-        wh = window.height();
-        pipeline = buildPipeline();
-      }
       vk::CommandBufferBeginInfo bi{};
       cb.begin(bi);
       cb.beginRenderPass(rpbi, vk::SubpassContents::eInline);
       cb.bindPipeline(vk::PipelineBindPoint::eGraphics, *pipeline);
+      window.setViewport(cb);
       cb.bindVertexBuffers(  VERTEX_BUFFER_BIND_ID,  bufferVertices.buffer(), vk::DeviceSize(0)); // Binding point VERTEX_BUFFER_BIND_ID : Mesh vertex buffer
       cb.bindVertexBuffers(INSTANCE_BUFFER_BIND_ID, bufferInstances.buffer(), vk::DeviceSize(0)); // Binding point INSTANCE_BUFFER_BIND_ID : Instance data buffer
       cb.draw(vertices.size(), instances.size(), 0, 0);
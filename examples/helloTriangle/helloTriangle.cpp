@@ -12,6 +12,10 @@
 #include <vku/vku.hpp>
 #include <glm/glm.hpp>
 
+// The compiled shaders, embedded by vookoo_embed_spirv in the CMake files.
+#include <helloTriangle.vert.spv.hpp>
+#include <helloTriangle.frag.spv.hpp>
+
 int main() {
   // Initialise the GLFW framework.
   glfwInit();
@@ -52,8 +56,9 @@ int main() {
 
   // Create two shaders, vertex and fragment. See the files helloTriangle.vert
   // and helloTriangle.frag for details.
-  vku::ShaderModule vert{device, BINARY_DIR "helloTriangle.vert.spv"};
-  vku::ShaderModule frag{device, BINARY_DIR "helloTriangle.frag.spv"};
+  // The SPIR-V is built into the program, so no files are read here.
+  vku::ShaderModule vert{device, shaders::helloTriangle_vert};
+  vku::ShaderModule frag{device, shaders::helloTriangle_frag};
 
   // We will use this simple vertex description.
   // It has a 2D location (x, y) and a colour (r, g, b)
@@ -81,7 +86,9 @@ int main() {
 
   auto buildPipeline = [&]() {
     // Make a pipeline to use the vertex format and shaders.
-    vku::PipelineMaker pm{ window.width(), window.height() };
+    // The viewport is dynamic and set by the window, so resizing keeps this pipeline.
+    vku::PipelineMaker pm{};
+    pm.dynamicProfile();
     return pm
       .shader(vk::ShaderStageFlagBits::eVertex, vert)
       .shader(vk::ShaderStageFlagBits::eFragment, frag)
@@ -94,18 +101,12 @@ int main() {
 
   // Static scene, so only need to create the command buffer(s) once.
   window.setStaticCommands(
-    [&pipeline, &buffer, &window, &vertices, &buildPipeline](vk::CommandBuffer cb, int imageIndex, vk::RenderPassBeginInfo &rpbi) {
-      static auto ww = window.width();
-      static auto wh = window.height();
-      if (ww != window.width() || wh != window.height()) {
-        ww = window.width();
-        wh = window.height();
-        pipeline = buildPipeline();
-      }
+    [&pipeline, &buffer, &window, &vertices](vk::CommandBuffer cb, int imageIndex, vk::RenderPassBeginInfo &rpbi) {
       vk::CommandBufferBeginInfo cbbi{};
       cb.begin(cbbi);
       cb.beginRenderPass(rpbi, vk::SubpassContents::eInline);
       cb.bindPipeline(vk::PipelineBindPoint::eGraphics, *pipeline);
+      window.setViewport(cb);
       cb.bindVertexBuffers(0, buffer.buffer(), vk::DeviceSize(0));
       cb.draw(vertices.size(), 1, 0, 0);
       cb.endRenderPass();
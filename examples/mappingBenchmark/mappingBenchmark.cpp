@@ -0,0 +1,99 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// Vookoo mapping benchmark
+//
+// Writes many small updates to host visible memory, mapping and unmapping
+// for every write and then through persistently mapped memory,
+// on both coherent and non-coherent memory types.
+//
+
+#define VKU_NO_GLFW
+#include <vku/vku.hpp>
+#include <vku/vku_framework.hpp>
+#include <chrono>
+
+int main() {
+
+  vku::InstanceMaker im{};
+  im.defaultLayers();
+  vku::DeviceMaker dm{};
+  dm.defaultLayers();
+
+  vku::Framework fw{im, dm};
+  if (!fw.ok()) {
+    std::cout << "Framework creation failed" << std::endl;
+    exit(1);
+  }
+
+  auto device = fw.device();
+  auto memprops = fw.memprops();
+
+  static constexpr uint32_t N = 100000;
+  static constexpr vk::DeviceSize updateSize = 256;
+  std::array<uint8_t, updateSize> data{};
+  auto usage = vk::BufferUsageFlagBits::eUniformBuffer;
+
+  using clock = std::chrono::high_resolution_clock;
+  auto us = [](clock::duration d) { return std::chrono::duration<double, std::micro>(d).count() / N; };
+
+  using pfb = vk::MemoryPropertyFlagBits;
+
+  // Host visible memory without eHostCoherent needs an explicit flush after each write.
+  vk::MemoryPropertyFlags nonCoherentFlags{};
+  for (uint32_t i = 0; i != memprops.memoryTypeCount; ++i) {
+    auto flags = memprops.memoryTypes[i].propertyFlags;
+    if ((flags & pfb::eHostVisible) && !(flags & pfb::eHostCoherent)) {
+      nonCoherentFlags = flags;
+      break;
+    }
+  }
+
+  auto run = [&](const char *name, vk::MemoryPropertyFlags memflags, bool coherent) {
+    if (!memflags) {
+      std::cout << name << ": no suitable memory type on this device\n";
+      return;
+    }
+    vku::GenericBuffer perCall{device, memprops, usage, updateSize, memflags};
+    vku::GenericBuffer persistent{device, memprops, usage, updateSize, memflags, true};
+    if (perCall.coherent() != coherent) {
+      std::cout << name << ": no suitable memory type on this device\n";
+      return;
+    }
+
+    auto start = clock::now();
+    for (uint32_t i = 0; i != N; ++i) {
+      data[0] = uint8_t(i);
+      perCall.updateLocal(device, data.data(), updateSize);
+    }
+    auto mapped = clock::now();
+    for (uint32_t i = 0; i != N; ++i) {
+      data[0] = uint8_t(i);
+      persistent.updateLocal(device, data.data(), updateSize);
+    }
+    auto done = clock::now();
+
+    std::cout << name << ": map per call " << us(mapped - start) << " us, persistent " << us(done - mapped)
+              << " us per " << updateSize << " byte update\n";
+  };
+
+  run("coherent", pfb::eHostVisible | pfb::eHostCoherent, true);
+  run("non-coherent", nonCoherentFlags, false);
+
+  ////////////////////////////////////////
+  //
+  // The same writes through an UploadRing, which is always coherent and persistently mapped.
+  vku::UploadRing ring{device, fw.physicalDevice(), 2, 1024 * 1024};
+  uint32_t frame = 0;
+  auto start = clock::now();
+  for (uint32_t i = 0; i != N; ++i) {
+    data[0] = uint8_t(i);
+    if (!ring.push(data)) {
+      ring.beginFrame(device, ++frame);
+      (void)ring.push(data);
+    }
+  }
+  auto done = clock::now();
+  std::cout << "upload ring: " << us(done - start) << " us per " << updateSize << " byte update\n";
+
+  device.waitIdle();
+}
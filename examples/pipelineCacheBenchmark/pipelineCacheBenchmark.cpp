@@ -0,0 +1,142 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// Vookoo pipeline cache benchmark
+//
+// Builds the pipelines of the first few examples with an empty pipeline cache,
+// saves the cache, then builds them again from the saved blob and prints both
+// timings. No window is needed.
+//
+// Drivers often keep their own shader cache on disk as well, so a second run
+// of this program may show a faster "cold" time than the first.
+//
+
+#define VKU_NO_GLFW
+#include <vku/vku.hpp>
+#include <vku/vku_framework.hpp>
+#include <glm/glm.hpp>
+#include <chrono>
+
+#include <helloTriangle.vert.spv.hpp>
+#include <helloTriangle.frag.spv.hpp>
+#include <pushConstants.vert.spv.hpp>
+#include <pushConstants.frag.spv.hpp>
+#include <uniforms.vert.spv.hpp>
+#include <uniforms.frag.spv.hpp>
+#include <texture.vert.spv.hpp>
+#include <texture.frag.spv.hpp>
+#include <helloCompute.comp.spv.hpp>
+
+int main() {
+
+  vku::InstanceMaker im{};
+  im.defaultLayers();
+  vku::DeviceMaker dm{};
+  dm.defaultLayers();
+
+  vku::Framework fw{im, dm};
+  if (!fw.ok()) {
+    std::cout << "Framework creation failed" << std::endl;
+    exit(1);
+  }
+
+  auto device = fw.device();
+
+  ////////////////////////////////////////
+  //
+  // Stand in for the window's render pass: one colour attachment.
+  vku::RenderpassMaker rpm;
+  auto renderPass = rpm
+    .attachmentBegin(vk::Format::eB8G8R8A8Unorm)
+    .attachmentLoadOp(vk::AttachmentLoadOp::eClear)
+    .attachmentStoreOp(vk::AttachmentStoreOp::eStore)
+    .attachmentFinalLayout(vk::ImageLayout::eShaderReadOnlyOptimal)
+    .subpassBegin(vk::PipelineBindPoint::eGraphics)
+    .subpassColorAttachment(vk::ImageLayout::eColorAttachmentOptimal, 0)
+    .createUnique(device);
+
+  ////////////////////////////////////////
+  //
+  // The layouts of the examples whose pipelines are built.
+  using ss = vk::ShaderStageFlagBits;
+  using dt = vk::DescriptorType;
+
+  vku::PipelineLayoutMaker emptyPlm{};
+  auto emptyLayout = emptyPlm.createUnique(device);
+
+  vku::PipelineLayoutMaker pushPlm{};
+  pushPlm.pushConstantRange(ss::eAll, 0, sizeof(glm::vec4) + sizeof(glm::mat4));
+  auto pushLayout = pushPlm.createUnique(device);
+
+  vku::DescriptorSetLayoutMaker uniformDslm{};
+  uniformDslm.buffer(0, dt::eUniformBuffer, ss::eAll, 1);
+  auto uniformSetLayout = uniformDslm.createUnique(device);
+  vku::PipelineLayoutMaker uniformPlm{};
+  uniformPlm.descriptorSetLayout(*uniformSetLayout);
+  auto uniformLayout = uniformPlm.createUnique(device);
+
+  vku::DescriptorSetLayoutMaker textureDslm{};
+  textureDslm.buffer(0, dt::eUniformBuffer, ss::eVertex|ss::eFragment, 1);
+  textureDslm.image(1, dt::eCombinedImageSampler, ss::eFragment, 1);
+  auto textureSetLayout = textureDslm.createUnique(device);
+  vku::PipelineLayoutMaker texturePlm{};
+  texturePlm.descriptorSetLayout(*textureSetLayout);
+  auto textureLayout = texturePlm.createUnique(device);
+
+  vku::DescriptorSetLayoutMaker computeDslm{};
+  computeDslm.buffer(0, dt::eStorageBuffer, ss::eCompute, 1);
+  auto computeSetLayout = computeDslm.createUnique(device);
+  vku::PipelineLayoutMaker computePlm{};
+  computePlm.descriptorSetLayout(*computeSetLayout).pushConstantRange(ss::eCompute, 0, 16);
+  auto computeLayout = computePlm.createUnique(device);
+
+  struct Vertex { glm::vec2 pos; glm::vec3 colour; };
+
+  // Build every pipeline into cache, returning the time taken.
+  auto buildAll = [&](vk::PipelineCache cache) {
+    auto start = std::chrono::high_resolution_clock::now();
+    std::vector<vk::UniquePipeline> pipelines;
+
+    auto graphics = [&](std::span<const uint32_t> vertCode, std::span<const uint32_t> fragCode, vk::PipelineLayout layout) {
+      vku::ShaderModule vert{device, vertCode};
+      vku::ShaderModule frag{device, fragCode};
+      vku::PipelineMaker pm{};
+      pm.dynamicProfile();
+      pm.shader(ss::eVertex, vert);
+      pm.shader(ss::eFragment, frag);
+      pm.vertexBinding(0, (uint32_t)sizeof(Vertex));
+      pm.vertexAttribute(0, 0, vk::Format::eR32G32Sfloat, (uint32_t)offsetof(Vertex, pos));
+      pm.vertexAttribute(1, 0, vk::Format::eR32G32B32Sfloat, (uint32_t)offsetof(Vertex, colour));
+      pipelines.push_back(pm.createUnique(device, cache, layout, *renderPass));
+    };
+    graphics(shaders::helloTriangle_vert, shaders::helloTriangle_frag, *emptyLayout);
+    graphics(shaders::pushConstants_vert, shaders::pushConstants_frag, *pushLayout);
+    graphics(shaders::uniforms_vert, shaders::uniforms_frag, *uniformLayout);
+    graphics(shaders::texture_vert, shaders::texture_frag, *textureLayout);
+
+    vku::ShaderModule comp{device, shaders::helloCompute_comp};
+    vku::ComputePipelineMaker cpm{};
+    cpm.shader(ss::eCompute, comp);
+    pipelines.push_back(cpm.createUnique(device, cache, *computeLayout));
+
+    return std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+  };
+
+  std::string filename = BINARY_DIR "pipelineCacheBenchmark.cache";
+
+  // Cold: nothing in the cache.
+  auto coldCache = device.createPipelineCacheUnique(vk::PipelineCacheCreateInfo{});
+  double cold = buildAll(*coldCache);
+  if (!vku::savePipelineCache(device, *coldCache, filename)) {
+    std::cout << "Could not save " << filename << std::endl;
+    exit(1);
+  }
+
+  // Warm: start from the blob saved above, as the next run of a program would.
+  auto warmCache = vku::loadPipelineCache(device, fw.physicalDevice(), filename);
+  double warm = buildAll(*warmCache);
+
+  std::cout << "cold cache: " << cold << " ms\n";
+  std::cout << "warm cache: " << warm << " ms (" << cold / std::max(warm, 1e-6) << "x)\n";
+
+  device.waitIdle();
+}
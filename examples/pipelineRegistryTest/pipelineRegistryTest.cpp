@@ -0,0 +1,70 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// Vookoo pipeline registry test
+//
+// Asks a PipelineRegistry for the same maker twice and checks that only one
+// pipeline is built. No window is needed; exits with 1 on failure.
+//
+
+#define VKU_NO_GLFW
+#include <vku/vku.hpp>
+#include <vku/vku_framework.hpp>
+#include <glm/glm.hpp>
+
+#include <helloTriangle.vert.spv.hpp>
+#include <helloTriangle.frag.spv.hpp>
+
+int main() {
+
+  vku::InstanceMaker im{};
+  im.defaultLayers();
+  vku::DeviceMaker dm{};
+  dm.defaultLayers();
+
+  vku::Framework fw{im, dm};
+  if (!fw.ok()) {
+    std::cout << "Framework creation failed" << std::endl;
+    exit(1);
+  }
+
+  auto device = fw.device();
+
+  vku::RenderpassMaker rpm;
+  auto renderPass = rpm
+    .attachmentBegin(vk::Format::eB8G8R8A8Unorm)
+    .attachmentLoadOp(vk::AttachmentLoadOp::eClear)
+    .attachmentStoreOp(vk::AttachmentStoreOp::eStore)
+    .attachmentFinalLayout(vk::ImageLayout::eShaderReadOnlyOptimal)
+    .subpassBegin(vk::PipelineBindPoint::eGraphics)
+    .subpassColorAttachment(vk::ImageLayout::eColorAttachmentOptimal, 0)
+    .createUnique(device);
+
+  vku::PipelineLayoutMaker plm{};
+  auto pipelineLayout = plm.createUnique(device);
+
+  struct Vertex { glm::vec2 pos; glm::vec3 colour; };
+
+  vku::ShaderModule vert{device, shaders::helloTriangle_vert};
+  vku::ShaderModule frag{device, shaders::helloTriangle_frag};
+
+  // No blend attachment, so building uses the default one.
+  vku::PipelineMaker pm{};
+  pm.dynamicProfile();
+  pm.shader(vk::ShaderStageFlagBits::eVertex, vert);
+  pm.shader(vk::ShaderStageFlagBits::eFragment, frag);
+  pm.vertexBinding(0, (uint32_t)sizeof(Vertex));
+  pm.vertexAttribute(0, 0, vk::Format::eR32G32Sfloat, (uint32_t)offsetof(Vertex, pos));
+  pm.vertexAttribute(1, 0, vk::Format::eR32G32B32Sfloat, (uint32_t)offsetof(Vertex, colour));
+
+  vku::PipelineRegistry registry{device, fw.pipelineCache()};
+  auto first = registry.get(pm, *pipelineLayout, *renderPass);
+  auto second = registry.get(pm, *pipelineLayout, *renderPass);
+
+  auto stats = registry.stats();
+  std::cout << stats.pipelines << " pipelines, " << stats.hits << " hits, " << stats.misses << " misses\n";
+  if (!first || first != second || stats.pipelines != 1 || stats.misses != 1 || stats.hits != 1) {
+    std::cout << "FAILED: the same maker built more than one pipeline\n";
+    exit(1);
+  }
+  std::cout << "passed\n";
+}
@@ -97,7 +97,9 @@ int main() {
 
   auto buildPipeline = [&]() {
     // Make a pipeline to use the vertex format and shaders.
-    vku::PipelineMaker pm{ window.width(), window.height() };
+    // The viewport is dynamic and set by the window, so resizing keeps this pipeline.
+    vku::PipelineMaker pm{};
+    pm.dynamicProfile();
     return pm
       .shader(vk::ShaderStageFlagBits::eVertex, vert)
       .shader(vk::ShaderStageFlagBits::eFragment, frag)
@@ -123,17 +125,11 @@ int main() {
     window.draw(
       device, fw.graphicsQueue(),
       [&](vk::CommandBuffer cb, int imageIndex, vk::RenderPassBeginInfo &rpbi) {
-        static auto ww = window.width();
-        static auto wh = window.height();
-        if (ww != window.width() || wh != window.height()) {
-          ww = window.width();
-          wh = window.height();
-          pipeline = buildPipeline();
-        }
         vk::CommandBufferBeginInfo cbbi{};
         cb.begin(cbbi);
         cb.beginRenderPass(rpbi, vk::SubpassContents::eInline);
         cb.bindPipeline(vk::PipelineBindPoint::eGraphics, *pipeline);
+        window.setViewport(cb);
         cb.bindVertexBuffers(0, buffer.buffer(), vk::DeviceSize(0));
 
         // draw multiple triangles with different push constants.
@@ -67,8 +67,11 @@ int main() {
   //
   // Build the pipeline
 
+  // The registry shares this pipeline with any identical one built elsewhere.
   auto buildPipeline = [&]() {
-    vku::PipelineMaker pm{window.width(), window.height()};
+    // The viewport is dynamic and set by the window, so resizing keeps this pipeline.
+    vku::PipelineMaker pm{};
+    pm.dynamicProfile();
     pm.shader(vk::ShaderStageFlagBits::eVertex, vert_);
     pm.shader(vk::ShaderStageFlagBits::eFragment, frag_);
     pm.vertexBinding(0, (uint32_t)sizeof(Vertex));
@@ -76,8 +79,7 @@ int main() {
     pm.vertexAttribute(1, 0, vk::Format::eR32G32B32Sfloat, (uint32_t)offsetof(Vertex, colour));
 
     auto renderPass = window.renderPass();
-    auto cache = fw.pipelineCache();
-    return  pm.createUnique(device, cache, *pipelineLayout, renderPass);
+    return fw.pipelineRegistry().get(pm, *pipelineLayout, renderPass);
   };
 
   auto pipeline = buildPipeline();
@@ -88,7 +90,7 @@ int main() {
 
   vku::TextureImage2D texture{device, fw.memprops(), 2, 2, 1, vk::Format::eR8G8B8A8Unorm};
   std::vector<uint8_t> pixels = { 0xff, 0xff, 0xff, 0xff,  0x00, 0xff, 0xff, 0xff,  0xff, 0x00, 0xff, 0xff,  0xff, 0xff, 0x00, 0xff, };
-  texture.upload(device, pixels, window.commandPool(), fw.memprops(), fw.graphicsQueue());
+  texture.upload(device, pixels, window.commandPool(), fw.memprops(), fw.graphicsQueue(), vk::ImageLayout::eShaderReadOnlyOptimal, fw.synchronization2());
 
   ////////////////////////////////////////
   //
@@ -120,17 +122,11 @@ int main() {
   // Set the static render commands for the main renderpass.
   window.setStaticCommands(
       [&](vk::CommandBuffer cb, int imageIndex, vk::RenderPassBeginInfo &rpbi) {
-        static auto ww = window.width();
-        static auto wh = window.height();
-        if (window.width() != ww || window.height() != wh) {
-          ww = window.width();
-          wh = window.height();
-          pipeline = buildPipeline();
-        }
         vk::CommandBufferBeginInfo bi{};
         cb.begin(bi);
         cb.beginRenderPass(rpbi, vk::SubpassContents::eInline);
-        cb.bindPipeline(vk::PipelineBindPoint::eGraphics, *pipeline);
+        cb.bindPipeline(vk::PipelineBindPoint::eGraphics, pipeline);
+        window.setViewport(cb);
         cb.bindVertexBuffers(0, vbo.buffer(), vk::DeviceSize(0));
         cb.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, *pipelineLayout,
                               0, descriptorSets, nullptr);
@@ -111,39 +111,13 @@ int main() {
   // Create a pipeline using a renderPass built for our window.
   auto pipeline = pm.createUnique(fw.device(), fw.pipelineCache(), *pipelineLayout, window.renderPass());
 
-  // define number of threads
-  const uint32_t Nthreads = std::thread::hardware_concurrency();
-  std::cout << "Nthreads = " << Nthreads << std::endl;
-
-  // allocate array of threads to be reused from frame to frame
-  std::vector<std::thread> v( Nthreads );
-  
-  // allocate command pools and secondary buffers, required to be separate pools per thread
-  std::vector<vk::UniqueCommandPool> scp;
-  std::vector<std::vector<vk::UniqueCommandBuffer>> scb;
-  for (int i=0; i<Nthreads; ++i) {
-    // add pool
-    scp.emplace_back( 
-      fw.device().createCommandPoolUnique(
-        vk::CommandPoolCreateInfo{ 
-          vk::CommandPoolCreateFlagBits::eResetCommandBuffer,
-          fw.graphicsQueueFamilyIndex()
-        }
-      )
-    );
-    // add secondary command buffer(s) per pool
-    scb.emplace_back( 
-      std::move(
-        fw.device().allocateCommandBuffersUnique( 
-          vk::CommandBufferAllocateInfo{
-            *scp.back(), // per thread pool 
-            vk::CommandBufferLevel::eSecondary,
-            (uint32_t)window.numImageIndices() // a secondary command buffer per each swap image, access via *scb[i_th thread][j_th imageindex]
-          }
-        )
-      )
-    );
-  }
+  // Worker threads persist from frame to frame and each owns a command pool
+  // per frame in flight, so recording never creates threads or pools.
+  vku::ParallelRecorder recorder{fw.device(), fw.graphicsQueueFamilyIndex(), window.framesInFlight()};
+  std::cout << "Nthreads = " << recorder.threads() << std::endl;
+
+  // Number of objects recorded into each secondary command buffer.
+  const uint32_t chunkSize = 16;
 
   // begin rendering frames
   int frame = 0;
@@ -158,11 +132,13 @@ int main() {
       fw.device(), fw.graphicsQueue(),
       [&](vk::CommandBuffer cb, int imageIndex, vk::RenderPassBeginInfo &rpbi) {
 
-        // shared state used by each kernel thread
+        // The window has waited for this frame slot, so its command pools can be reset.
+        recorder.beginFrame(window.frameIndex());
+
+        // shared state used by each worker thread
         vk::CommandBufferInheritanceInfo inheritanceInfo;
         inheritanceInfo.setRenderPass( rpbi.renderPass );
         inheritanceInfo.setFramebuffer( rpbi.framebuffer );
-        vk::CommandBufferBeginInfo commandBufferBeginInfo(vk::CommandBufferUsageFlagBits::eRenderPassContinue, &inheritanceInfo);
 
         // Multi-threaded command buffer generation aka multi-threaded rendering:
         //
@@ -170,26 +146,24 @@ int main() {
         //     You populate different secondary-level (VK_COMMAND_BUFFER_LEVEL_SECONDARY) command buffers per thread.
         //     In your main thread you have a primary command buffer.
         //     After all threads are done building you call vkCmdExecuteCommands with your secondary-level command buffers.
-        //     You submit the primary command buffer and get a fence back.
-        //     A few frames down the line you check if the fence is triggered and if it is you free, or even better, re-use the command buffers.
-        //     To re-use the command buffers you reset them. When some thread asks for a command buffer you give back one of the reset ones.
         //
-        // For example, consider Nthreads=3 and N objects
+        // The objects are split into chunks of chunkSize, each recorded into its own secondary buffer.
+        // Threads which finish early steal chunks from the others.
+        //
+        // For example, consider 3 threads, N=12 objects and chunkSize=2
         // 1234567890AB  N
-        // 012           i=0; i<Nthreads; ++i
-        // 0^^3  6  9    on Thread i=0: j=0;j<N;j+=Nthreads
-        //  1^ 4  7  A   on Thread i=1: j=1;j<N;j+=Nthreads
-        //   2  5  8  B  on Thread i=2: j=2;j<N;j+=Nthreads
+        // 001122334455  chunks
+        // 0011          on Thread 0: chunks 0, 1
+        //     2233      on Thread 1: chunks 2, 3
+        //         4455  on Thread 2: chunks 4, 5 (or fewer if another thread steals one)
 
         // build (multi-threaded) list of secondary command buffers to be executed later
-        std::vector<vk::CommandBuffer> commandBuffers;
-        { // threadRenderCode
-          auto kernel = [&](const int i)->void{  
-            vk::CommandBuffer cmdBuffer = *scb[i][imageIndex];
-            cmdBuffer.begin(commandBufferBeginInfo);
+        std::vector<vk::CommandBuffer> commandBuffers = recorder.record(
+          N, chunkSize, inheritanceInfo,
+          [&](vk::CommandBuffer cmdBuffer, uint32_t begin, uint32_t end) {
             cmdBuffer.bindPipeline(vk::PipelineBindPoint::eGraphics, *pipeline);
             cmdBuffer.bindVertexBuffers(0, buffer.buffer(), vk::DeviceSize(0));
-            for (int j=i; j<N; j+=Nthreads) {
+            for (uint32_t j=begin; j<end; ++j) {
               // update p here
               PushConstant *p = &P[j];
               p->transform *= glm::rotate(glm::radians(1.0f*(1.0f-j/float(N))), glm::vec3(0, 0, 1));
@@ -204,25 +178,9 @@ int main() {
                 *pipelineLayout, vk::ShaderStageFlagBits::eAll, 0, sizeof(PushConstant), p
               );
               cmdBuffer.draw(vertices.size(), 1, 0, 0); // since secondary buffer, not drawn yet, just recorded for later
-            };
-            cmdBuffer.end();
-          };
-
-          // *** spawn separate rendering kernel threads to build separate command buffers in parallel *** 
-          for (int i=0; i<Nthreads; ++i) {
-            v[i] = std::thread( kernel, i );
-          }
-
-          // wait for all of the kernel threads to finish
-          for (int i=0; i<Nthreads; ++i) {
-            v[i].join();
-          }
-          
-          // accumulate secondary command buffers built by kernel threads
-          for (int i=0; i<Nthreads; ++i) {
-            commandBuffers.push_back( *scb[i][imageIndex] );
+            }
           }
-        } 
+        );
 
         // execute accumlated commandBuffers
         vk::CommandBufferBeginInfo bi{};
@@ -24,14 +24,45 @@
 #include <fstream>
 #include <iostream>
 #include <unordered_map>
+#include <map>
+#include <mutex>
 #include <vector>
 #include <functional>
 #include <cstddef>
+#include <limits>
+#include <algorithm>
+#include <numeric>
+#include <span>
+#include <filesystem>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <thread>
+#include <future>
+#include <condition_variable>
+#include <deque>
+#include <chrono>
+#include <atomic>
+#include <sstream>
+#include <iomanip>
+#include <optional>
+#include <stdexcept>
+#include <random>
 
 #ifdef VOOKOO_SPIRV_SUPPORT
   #include <unified1/spirv.hpp11>
 #endif
 
+#ifdef VOOKOO_SHADERC_SUPPORT
+  #include <shaderc/shaderc.hpp>
+  #ifdef __linux__
+    #include <sys/inotify.h>
+    #include <poll.h>
+    #include <unistd.h>
+  #endif
+#endif
+
 #include <vulkan/vulkan.hpp>
 
 namespace vku {
@@ -57,29 +88,847 @@ inline int findMemoryTypeIndex(const vk::PhysicalDeviceMemoryProperties &memprop
   return -1;
 }
 
-/// Execute commands immediately and wait for the device to finish.
+/// Execute commands immediately and wait for them to finish.
+/// Only this submission is waited for; other work on the device carries on.
 inline void executeImmediately(vk::Device device, vk::CommandPool commandPool, vk::Queue queue, const std::function<void (vk::CommandBuffer cb)> &func) {
   vk::CommandBufferAllocateInfo cbai{ commandPool, vk::CommandBufferLevel::ePrimary, 1 };
 
   auto cbs = device.allocateCommandBuffers(cbai);
-  cbs[0].begin(vk::CommandBufferBeginInfo{});
+  cbs[0].begin(vk::CommandBufferBeginInfo{vk::CommandBufferUsageFlagBits::eOneTimeSubmit});
   func(cbs[0]);
   cbs[0].end();
 
+  auto fence = device.createFenceUnique(vk::FenceCreateInfo{});
   vk::SubmitInfo submit;
   submit.commandBufferCount = static_cast<uint32_t>(cbs.size());
   submit.pCommandBuffers = cbs.data();
-  queue.submit(submit, vk::Fence{});
-  device.waitIdle();
+  queue.submit(submit, *fence);
+  (void)device.waitForFences(*fence, VK_TRUE, std::numeric_limits<uint64_t>::max());
 
   device.freeCommandBuffers(commandPool, cbs);
 }
 
+/// A small pool of reusable command buffers and fences for one-shot submissions to one queue.
+/// Each submission waits only on its own fence, and submit() returns a handle so the caller
+/// can overlap other work before waiting. Resources passed to submit() (eg. staging buffers)
+/// are kept alive until the GPU has finished with them.
+///
+///     vku::SubmitPool pool{device, fw.graphicsQueueFamilyIndex(), fw.graphicsQueue()};
+///     auto done = buffer.upload(device, fw.memprops(), pool, data);
+///     ... other work ...
+///     done.wait();
+class SubmitPool {
+public:
+  /// A waitable handle for one submission.
+  class Submission {
+  public:
+    Submission() = default;
+
+    /// Block until the GPU has finished this submission.
+    void wait() const { if (pool_) pool_->wait(slot_, serial_); }
+
+    /// Returns true once the GPU has finished this submission.
+    [[nodiscard]] bool ready() const { return !pool_ || pool_->ready(slot_, serial_); }
+  private:
+    friend class SubmitPool;
+    Submission(SubmitPool *pool, uint32_t slot, uint64_t serial) : pool_(pool), slot_(slot), serial_(serial) {}
+    SubmitPool *pool_ = nullptr;
+    uint32_t slot_ = 0;
+    uint64_t serial_ = 0;
+  };
+
+  SubmitPool() = default;
+
+  /// Make a pool of up to maxInFlight command buffers for queue.
+  /// When they are all in flight, the next submit waits for the oldest.
+  SubmitPool(vk::Device device, uint32_t queueFamilyIndex, vk::Queue queue, uint32_t maxInFlight = 4)
+  : device_(device), queue_(queue), maxInFlight_(std::max(maxInFlight, 1U)) {
+    typedef vk::CommandPoolCreateFlagBits ccbits;
+    vk::CommandPoolCreateInfo cpci{ ccbits::eTransient|ccbits::eResetCommandBuffer, queueFamilyIndex };
+    commandPool_ = device.createCommandPoolUnique(cpci);
+  }
+
+  SubmitPool(const SubmitPool &) = delete;
+  SubmitPool &operator=(const SubmitPool &) = delete;
+
+  /// Record commands with func and submit them.
+  /// Any extra arguments are moved into the pool and destroyed once the commands complete.
+  template<class... Resources>
+  Submission submit(const std::function<void (vk::CommandBuffer cb)> &func, Resources &&...resources) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    uint32_t index = acquire();
+    auto &slot = slots_[index];
+    (slot.resources.push_back(std::make_shared<std::decay_t<Resources>>(std::forward<Resources>(resources))), ...);
+
+    vk::CommandBuffer cb = *slot.cb;
+    cb.begin(vk::CommandBufferBeginInfo{vk::CommandBufferUsageFlagBits::eOneTimeSubmit});
+    func(cb);
+    cb.end();
+
+    device_.resetFences(*slot.fence);
+    vk::SubmitInfo submit;
+    submit.commandBufferCount = 1;
+    submit.pCommandBuffers = &cb;
+    queue_.submit(submit, *slot.fence);
+    slot.busy = true;
+    slot.submitted = ++submitCount_;
+    return Submission{this, index, slot.serial};
+  }
+
+  /// Record, submit and wait for the commands to finish.
+  void executeImmediately(const std::function<void (vk::CommandBuffer cb)> &func) {
+    submit(func).wait();
+  }
+
+  /// Wait for every submission made through the pool.
+  void waitAll() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (uint32_t i = 0; i != slots_.size(); ++i) {
+      retire(i);
+    }
+  }
+
+  [[nodiscard]] vk::Queue queue() const { return queue_; }
+  [[nodiscard]] vk::CommandPool commandPool() const { return *commandPool_; }
+
+  ~SubmitPool() {
+    if (device_) waitAll();
+  }
+private:
+  struct Slot {
+    vk::UniqueCommandBuffer cb;
+    vk::UniqueFence fence;
+    std::vector<std::shared_ptr<void>> resources;
+    // Incremented each time the slot is recycled, so stale Submissions read as finished.
+    uint64_t serial = 0;
+    uint64_t submitted = 0;
+    bool busy = false;
+  };
+
+  // Find a free slot, making or recycling one if need be. Called with the mutex held.
+  uint32_t acquire() {
+    for (uint32_t i = 0; i != slots_.size(); ++i) {
+      if (!slots_[i].busy || device_.getFenceStatus(*slots_[i].fence) == vk::Result::eSuccess) {
+        retire(i);
+        return i;
+      }
+    }
+
+    if (slots_.size() < maxInFlight_) {
+      Slot slot;
+      vk::CommandBufferAllocateInfo cbai{ *commandPool_, vk::CommandBufferLevel::ePrimary, 1 };
+      slot.cb = std::move(device_.allocateCommandBuffersUnique(cbai)[0]);
+      slot.fence = device_.createFenceUnique(vk::FenceCreateInfo{});
+      slots_.push_back(std::move(slot));
+      return static_cast<uint32_t>(slots_.size() - 1);
+    }
+
+    // Everything is in flight: wait for the oldest submission.
+    auto oldest = std::min_element(slots_.begin(), slots_.end(), [](const Slot &a, const Slot &b) { return a.submitted < b.submitted; });
+    auto index = static_cast<uint32_t>(oldest - slots_.begin());
+    retire(index);
+    return index;
+  }
+
+  // Wait for a slot's work and release its resources. Called with the mutex held.
+  void retire(uint32_t index) {
+    auto &slot = slots_[index];
+    if (!slot.busy) return;
+    (void)device_.waitForFences(*slot.fence, VK_TRUE, std::numeric_limits<uint64_t>::max());
+    slot.resources.clear();
+    slot.cb->reset(vk::CommandBufferResetFlags{});
+    slot.busy = false;
+    slot.serial++;
+  }
+
+  void wait(uint32_t index, uint64_t serial) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (slots_[index].serial == serial) retire(index);
+  }
+
+  bool ready(uint32_t index, uint64_t serial) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto &slot = slots_[index];
+    return slot.serial != serial || !slot.busy || device_.getFenceStatus(*slot.fence) == vk::Result::eSuccess;
+  }
+
+  vk::Device device_;
+  vk::Queue queue_;
+  vk::UniqueCommandPool commandPool_;
+  std::vector<Slot> slots_;
+  uint32_t maxInFlight_ = 4;
+  uint64_t submitCount_ = 0;
+  std::mutex mutex_;
+};
+
+/// A point on a timeline semaphore. The work it stands for is done once the semaphore's counter reaches value.
+struct TimelinePoint {
+  vk::Semaphore semaphore;
+  uint64_t value = 0;
+
+  explicit operator bool() const { return semaphore && value != 0; }
+};
+
+/// A timeline point for a submission to wait on, and the stages that wait for it.
+struct TimelineWait {
+  TimelinePoint point;
+  vk::PipelineStageFlags stage = vk::PipelineStageFlagBits::eAllCommands;
+};
+
+/// One queue and a timeline semaphore that counts its submissions.
+/// Each submit() signals the next value of the counter and returns it. The host can poll or wait
+/// for that value, and submissions to other queues can wait for point(value). Nothing else needs
+/// fences. Needs a device made with DeviceMaker::enableTimelineSemaphore().
+///
+///     auto &transfer = fw.transferTimeline();
+///     auto &graphics = fw.graphicsTimeline();
+///     uint64_t uploaded = transfer.submit([&](vk::CommandBuffer cb) { ... }, std::move(stagingBuffer));
+///     uint64_t drawn = graphics.submit(drawCb, vku::TimelineWait{transfer.point(uploaded), vk::PipelineStageFlagBits::eVertexInput});
+///     ...
+///     if (graphics.reached(drawn)) { ... }
+class TimelineQueue {
+public:
+  TimelineQueue() = default;
+
+  /// Make a timeline for queue, whose family is queueFamilyIndex.
+  TimelineQueue(vk::Device device, vk::Queue queue, uint32_t queueFamilyIndex)
+  : device_(device), queue_(queue) {
+    vk::SemaphoreTypeCreateInfo stci{vk::SemaphoreType::eTimeline, 0};
+    semaphore_ = device.createSemaphoreUnique(vk::SemaphoreCreateInfo{{}, &stci});
+
+    typedef vk::CommandPoolCreateFlagBits ccbits;
+    vk::CommandPoolCreateInfo cpci{ ccbits::eTransient|ccbits::eResetCommandBuffer, queueFamilyIndex };
+    commandPool_ = device.createCommandPoolUnique(cpci);
+  }
+
+  TimelineQueue(const TimelineQueue &) = delete;
+  TimelineQueue &operator=(const TimelineQueue &) = delete;
+
+  /// Submit command buffers that start once waits are reached. Returns the value they signal.
+  uint64_t submit(vk::ArrayProxy<const vk::CommandBuffer> const &cbs, vk::ArrayProxy<const TimelineWait> const &waits = {}) {
+    return submitWith([&](uint64_t value) {
+      std::vector<vk::Semaphore> semaphores;
+      std::vector<vk::PipelineStageFlags> stages;
+      std::vector<uint64_t> values;
+      for (auto &wait : waits) {
+        if (!wait.point) continue;
+        semaphores.push_back(wait.point.semaphore);
+        stages.push_back(wait.stage);
+        values.push_back(wait.point.value);
+      }
+
+      vk::Semaphore signal = *semaphore_;
+      vk::TimelineSemaphoreSubmitInfo tssi;
+      tssi.waitSemaphoreValueCount = static_cast<uint32_t>(values.size());
+      tssi.pWaitSemaphoreValues = values.data();
+      tssi.signalSemaphoreValueCount = 1;
+      tssi.pSignalSemaphoreValues = &value;
+
+      vk::SubmitInfo submit;
+      submit.pNext = &tssi;
+      submit.waitSemaphoreCount = static_cast<uint32_t>(semaphores.size());
+      submit.pWaitSemaphores = semaphores.data();
+      submit.pWaitDstStageMask = stages.data();
+      submit.commandBufferCount = cbs.size();
+      submit.pCommandBuffers = cbs.data();
+      submit.signalSemaphoreCount = 1;
+      submit.pSignalSemaphores = &signal;
+      queue_.submit(submit, vk::Fence{});
+    });
+  }
+
+  /// Record commands with func and submit them once waits are reached. Returns the value they signal.
+  /// Any extra arguments are moved into the timeline and destroyed once the commands complete.
+  template<class... Resources>
+  uint64_t submitAfter(vk::ArrayProxy<const TimelineWait> const &waits, const std::function<void (vk::CommandBuffer cb)> &func, Resources &&...resources) {
+    std::lock_guard<std::mutex> lock(recordMutex_);
+    auto &recorded = acquire();
+    (recorded.resources.push_back(std::make_shared<std::decay_t<Resources>>(std::forward<Resources>(resources))), ...);
+
+    vk::CommandBuffer cb = *recorded.cb;
+    cb.begin(vk::CommandBufferBeginInfo{vk::CommandBufferUsageFlagBits::eOneTimeSubmit});
+    func(cb);
+    cb.end();
+
+    recorded.value = submit(cb, waits);
+    return recorded.value;
+  }
+
+  /// Record commands with func and submit them. Returns the value they signal.
+  template<class... Resources>
+  uint64_t submit(const std::function<void (vk::CommandBuffer cb)> &func, Resources &&...resources) {
+    return submitAfter(vk::ArrayProxy<const TimelineWait>{}, func, std::forward<Resources>(resources)...);
+  }
+
+  /// Make a submission of your own that signals the next value, eg. one that also uses binary semaphores.
+  /// func must signal semaphore() with the value it is passed. Returns that value.
+  /// Submissions through the timeline are serialized, so the values are signalled in order.
+  uint64_t submitWith(const std::function<void (uint64_t value)> &func) {
+    std::lock_guard<std::mutex> lock(submitMutex_);
+    func(value_ + 1);
+    return ++value_;
+  }
+
+  /// Record, submit and wait for the commands to finish.
+  void executeImmediately(const std::function<void (vk::CommandBuffer cb)> &func) {
+    wait(submit(func));
+  }
+
+  /// Returns true if the GPU has reached value. Values already seen to be reached are not queried again.
+  [[nodiscard]] bool reached(uint64_t value) const {
+    return value <= completed_ || value <= completed();
+  }
+
+  /// Read the value the GPU has reached.
+  uint64_t completed() const {
+    uint64_t value = device_.getSemaphoreCounterValue(*semaphore_);
+    uint64_t seen = completed_;
+    while (seen < value && !completed_.compare_exchange_weak(seen, value)) {}
+    return value;
+  }
+
+  /// Wait for the GPU to reach value. Returns false on timeout.
+  bool wait(uint64_t value, uint64_t timeout = std::numeric_limits<uint64_t>::max()) const {
+    if (value <= completed_) return true;
+    vk::Semaphore semaphore = *semaphore_;
+    vk::SemaphoreWaitInfo swi{{}, semaphore, value};
+    if (device_.waitSemaphores(swi, timeout) != vk::Result::eSuccess) return false;
+    uint64_t seen = completed_;
+    while (seen < value && !completed_.compare_exchange_weak(seen, value)) {}
+    return true;
+  }
+
+  /// Wait for every submission so far.
+  void waitIdle() const { wait(value_); }
+
+  /// Wait for points on any timelines. If any is true, return once one of them is reached.
+  static bool wait(vk::Device device, vk::ArrayProxy<const TimelinePoint> const &points, bool any = false, uint64_t timeout = std::numeric_limits<uint64_t>::max()) {
+    std::vector<vk::Semaphore> semaphores;
+    std::vector<uint64_t> values;
+    for (auto &point : points) {
+      if (!point) continue;
+      semaphores.push_back(point.semaphore);
+      values.push_back(point.value);
+    }
+    if (semaphores.empty()) return true;
+    vk::SemaphoreWaitInfo swi{any ? vk::SemaphoreWaitFlagBits::eAny : vk::SemaphoreWaitFlags{}, semaphores, values};
+    return device.waitSemaphores(swi, timeout) == vk::Result::eSuccess;
+  }
+
+  /// Get a point on this timeline for other queues to wait on.
+  [[nodiscard]] TimelinePoint point(uint64_t value) const { return TimelinePoint{*semaphore_, value}; }
+
+  /// Get the value of the latest submission.
+  [[nodiscard]] uint64_t value() const { return value_; }
+
+  [[nodiscard]] vk::Semaphore semaphore() const { return *semaphore_; }
+  [[nodiscard]] vk::Queue queue() const { return queue_; }
+
+  ~TimelineQueue() {
+    if (semaphore_) waitIdle();
+  }
+private:
+  struct Recorded {
+    vk::UniqueCommandBuffer cb;
+    std::vector<std::shared_ptr<void>> resources;
+    uint64_t value = 0;
+  };
+
+  // Reuse the oldest command buffer if the GPU has finished it. Called with recordMutex_ held.
+  Recorded &acquire() {
+    if (!recorded_.empty() && reached(recorded_.front().value)) {
+      Recorded old = std::move(recorded_.front());
+      recorded_.pop_front();
+      old.resources.clear();
+      old.cb->reset(vk::CommandBufferResetFlags{});
+      recorded_.push_back(std::move(old));
+    } else {
+      Recorded fresh;
+      vk::CommandBufferAllocateInfo cbai{ *commandPool_, vk::CommandBufferLevel::ePrimary, 1 };
+      fresh.cb = std::move(device_.allocateCommandBuffersUnique(cbai)[0]);
+      recorded_.push_back(std::move(fresh));
+    }
+    recorded_.back().value = std::numeric_limits<uint64_t>::max();
+    return recorded_.back();
+  }
+
+  vk::Device device_;
+  vk::Queue queue_;
+  vk::UniqueSemaphore semaphore_;
+  vk::UniqueCommandPool commandPool_;
+  std::deque<Recorded> recorded_;
+  std::atomic<uint64_t> value_ = 0;
+  mutable std::atomic<uint64_t> completed_ = 0;
+  std::mutex submitMutex_;
+  std::mutex recordMutex_;
+};
+
+/// Record secondary command buffers on a pool of long-lived worker threads.
+/// Each thread has its own command pool for each frame in flight. beginFrame() resets a
+/// frame's pools with one vkResetCommandPool each, and their buffers are then reused.
+/// record() splits a range of draws into chunks and records each chunk into its own secondary
+/// command buffer. Threads that run out of chunks steal them from the others, so uneven draw
+/// costs still balance. The calling thread records chunks too.
+///
+/// Example:
+///
+///     vku::ParallelRecorder recorder{device, fw.graphicsQueueFamilyIndex(), window.framesInFlight()};
+///     ...
+///     window.draw(device, queue, [&](vk::CommandBuffer cb, int imageIndex, vk::RenderPassBeginInfo &rpbi) {
+///       recorder.beginFrame(window.frameIndex());
+///       vk::CommandBufferInheritanceInfo inheritance{rpbi.renderPass, 0, rpbi.framebuffer};
+///       auto secondaries = recorder.record(numDraws, 16, inheritance, [&](vk::CommandBuffer scb, uint32_t begin, uint32_t end) {
+///         for (uint32_t i = begin; i != end; ++i) { ... }
+///       });
+///       cb.begin(vk::CommandBufferBeginInfo{});
+///       cb.beginRenderPass(rpbi, vk::SubpassContents::eSecondaryCommandBuffers);
+///       cb.executeCommands(secondaries);
+///       ...
+///     });
+///
+class ParallelRecorder {
+public:
+  /// Records items [begin, end) into a secondary command buffer that has already been begun.
+  typedef void (recordFunc_t)(vk::CommandBuffer cb, uint32_t begin, uint32_t end);
+
+  ParallelRecorder() = default;
+
+  /// Start threads workers (one per core if zero, counting the calling thread) with command pools
+  /// for queueFamilyIndex and frames frames in flight.
+  ParallelRecorder(vk::Device device, uint32_t queueFamilyIndex, uint32_t frames = 2, uint32_t threads = 0)
+  : device_(device) {
+    if (threads == 0) threads = std::max(std::thread::hardware_concurrency(), 1U);
+    frames = std::max(frames, 1U);
+
+    // The last pool of each frame belongs to the calling thread.
+    vk::CommandPoolCreateInfo cpci{ vk::CommandPoolCreateFlagBits::eTransient, queueFamilyIndex };
+    pools_.resize(frames);
+    for (auto &framePools : pools_) {
+      framePools.resize(threads);
+      for (auto &pool : framePools) {
+        pool.pool = device.createCommandPoolUnique(cpci);
+      }
+    }
+
+    queues_ = std::vector<ChunkQueue>(threads);
+    for (uint32_t i = 0; i + 1 < threads; ++i) {
+      workers_.emplace_back([this, i] { work(i); });
+    }
+  }
+
+  ParallelRecorder(const ParallelRecorder &) = delete;
+  ParallelRecorder &operator=(const ParallelRecorder &) = delete;
+
+  /// Reset the command pools of frame so its buffers can be recorded again.
+  /// The GPU must have finished the buffers last recorded for frame.
+  /// Window::draw has already waited for this before calling its dynamic function.
+  void beginFrame(uint32_t frame) {
+    frame_ = frame % pools_.size();
+    for (auto &pool : pools_[frame_]) {
+      device_.resetCommandPool(*pool.pool, vk::CommandPoolResetFlags{});
+      pool.used = 0;
+    }
+  }
+
+  /// Record count items, chunkSize at a time, into secondary command buffers begun with inheritance.
+  /// Returns the buffers in item order, ready for executeCommands.
+  /// If func throws on any thread, the remaining chunks are skipped and the first exception
+  /// is rethrown here once every thread has stopped.
+  std::vector<vk::CommandBuffer> record(uint32_t count, uint32_t chunkSize, const vk::CommandBufferInheritanceInfo &inheritance,
+                                        const std::function<recordFunc_t> &func) {
+    chunkSize = std::max(chunkSize, 1U);
+    uint32_t chunks = (count + chunkSize - 1) / chunkSize;
+    results_.assign(chunks, vk::CommandBuffer{});
+    if (chunks == 0) return results_;
+
+    // Give each thread a contiguous run of chunks to start with.
+    auto threads = static_cast<uint32_t>(queues_.size());
+    for (uint32_t t = 0; t != threads; ++t) {
+      std::lock_guard<std::mutex> lock(queues_[t].mutex);
+      queues_[t].chunks.clear();
+      for (uint32_t c = chunks * t / threads; c != chunks * (t + 1) / threads; ++c) {
+        queues_[t].chunks.push_back(c);
+      }
+    }
+
+    count_ = count;
+    chunkSize_ = chunkSize;
+    inheritance_ = &inheritance;
+    func_ = &func;
+    steals_ = 0;
+    failed_ = false;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      active_ = static_cast<uint32_t>(workers_.size());
+      job_++;
+    }
+    start_.notify_all();
+
+    try {
+      recordChunks(threads - 1);
+    } catch (...) {
+      fail(std::current_exception());
+    }
+
+    std::unique_lock<std::mutex> lock(mutex_);
+    done_.wait(lock, [this] { return active_ == 0; });
+    if (error_) std::rethrow_exception(std::exchange(error_, nullptr));
+    return results_;
+  }
+
+  /// Number of threads that record, including the calling thread.
+  [[nodiscard]] uint32_t threads() const { return static_cast<uint32_t>(queues_.size()); }
+
+  /// Number of chunks that moved between threads in the last record().
+  [[nodiscard]] uint32_t steals() const { return steals_; }
+
+  ~ParallelRecorder() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stop_ = true;
+    }
+    start_.notify_all();
+    for (auto &worker : workers_) worker.join();
+  }
+private:
+  // A command pool owned by one thread for one frame, with the buffers made from it so far.
+  struct ThreadPool {
+    vk::UniqueCommandPool pool;
+    std::vector<vk::UniqueCommandBuffer> buffers;
+    size_t used = 0;
+  };
+
+  // Chunks waiting to be recorded by one thread. Other threads steal from the back.
+  struct ChunkQueue {
+    std::mutex mutex;
+    std::deque<uint32_t> chunks;
+  };
+
+  bool takeChunk(uint32_t thread, uint32_t &chunk) {
+    if (failed_) return false;
+    {
+      auto &own = queues_[thread];
+      std::lock_guard<std::mutex> lock(own.mutex);
+      if (!own.chunks.empty()) {
+        chunk = own.chunks.front();
+        own.chunks.pop_front();
+        return true;
+      }
+    }
+
+    for (size_t i = 1; i != queues_.size(); ++i) {
+      auto &victim = queues_[(thread + i) % queues_.size()];
+      std::lock_guard<std::mutex> lock(victim.mutex);
+      if (!victim.chunks.empty()) {
+        chunk = victim.chunks.back();
+        victim.chunks.pop_back();
+        steals_++;
+        return true;
+      }
+    }
+    return false;
+  }
+
+  void recordChunks(uint32_t thread) {
+    auto &pool = pools_[frame_][thread];
+    vk::CommandBufferUsageFlags usage = vk::CommandBufferUsageFlagBits::eOneTimeSubmit;
+    if (inheritance_->renderPass) usage |= vk::CommandBufferUsageFlagBits::eRenderPassContinue;
+
+    uint32_t chunk = 0;
+    while (takeChunk(thread, chunk)) {
+      if (pool.used == pool.buffers.size()) {
+        vk::CommandBufferAllocateInfo cbai{ *pool.pool, vk::CommandBufferLevel::eSecondary, 1 };
+        pool.buffers.push_back(std::move(device_.allocateCommandBuffersUnique(cbai)[0]));
+      }
+      vk::CommandBuffer cb = *pool.buffers[pool.used++];
+
+      uint32_t begin = chunk * chunkSize_;
+      uint32_t end = std::min(begin + chunkSize_, count_);
+      cb.begin(vk::CommandBufferBeginInfo{usage, inheritance_});
+      (*func_)(cb, begin, end);
+      cb.end();
+      results_[chunk] = cb;
+    }
+  }
+
+  void work(uint32_t thread) {
+    uint64_t job = 0;
+    for (;;) {
+      {
+        std::unique_lock<std::mutex> lock(mutex_);
+        start_.wait(lock, [&] { return stop_ || job_ != job; });
+        if (stop_) return;
+        job = job_;
+      }
+
+      // An exception escaping a worker would terminate the program, so hand it to record().
+      try {
+        recordChunks(thread);
+      } catch (...) {
+        fail(std::current_exception());
+      }
+
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (--active_ == 0) done_.notify_all();
+    }
+  }
+
+  // Keep the first exception for record() and stop handing out chunks.
+  void fail(std::exception_ptr error) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!error_) error_ = error;
+    failed_ = true;
+  }
+
+  vk::Device device_;
+  std::vector<std::vector<ThreadPool>> pools_;
+  std::vector<ChunkQueue> queues_;
+  std::vector<vk::CommandBuffer> results_;
+  size_t frame_ = 0;
+  uint32_t count_ = 0;
+  uint32_t chunkSize_ = 1;
+  const vk::CommandBufferInheritanceInfo *inheritance_ = nullptr;
+  const std::function<recordFunc_t> *func_ = nullptr;
+  std::atomic<uint32_t> steals_ = 0;
+  std::atomic<bool> failed_ = false;
+  std::exception_ptr error_;
+  std::mutex mutex_;
+  std::condition_variable start_;
+  std::condition_variable done_;
+  uint64_t job_ = 0;
+  uint32_t active_ = 0;
+  bool stop_ = false;
+  std::vector<std::thread> workers_;
+};
+
+/// A future-like handle to data being copied from the GPU to host memory.
+/// Copies of the handle share the same result.
+///
+///     auto result = buffer.download(device, fw.memprops(), pool);
+///     ... other work ...
+///     auto values = result.get<float>();
+class Readback {
+public:
+  Readback() = default;
+
+  /// Returns true once the copy has finished.
+  [[nodiscard]] bool ready() const { return !s_ || s_->submission.ready(); }
+
+  /// Block until the copy has finished.
+  void wait() const { if (s_) s_->submission.wait(); }
+
+  /// Wait for the copy and return a pointer to the bytes.
+  [[nodiscard]] const void *data() const {
+    if (!s_) return nullptr;
+    wait();
+    if (!s_->invalidated) {
+      if (!s_->coherent) s_->device.invalidateMappedMemoryRanges(s_->range);
+      s_->invalidated = true;
+    }
+    return s_->ptr;
+  }
+
+  /// Wait for the copy and return the data as a vector of T.
+  template<class T>
+  [[nodiscard]] std::vector<T> get() const {
+    auto *p = static_cast<const T *>(data());
+    return p ? std::vector<T>(p, p + size() / sizeof(T)) : std::vector<T>{};
+  }
+
+  [[nodiscard]] vk::DeviceSize size() const { return s_ ? s_->size : 0; }
+
+  explicit operator bool() const { return bool(s_); }
+
+  /// Make a handle for size bytes at ptr that become valid when submission completes.
+  /// range is the memory to invalidate for non-coherent memory and owner keeps the memory alive.
+  Readback(vk::Device device, SubmitPool::Submission submission, const void *ptr, vk::DeviceSize size, bool coherent, vk::MappedMemoryRange range, std::shared_ptr<void> owner) {
+    s_ = std::make_shared<State>(State{device, submission, ptr, size, coherent, range, std::move(owner), false});
+  }
+private:
+  struct State {
+    vk::Device device;
+    SubmitPool::Submission submission;
+    const void *ptr;
+    vk::DeviceSize size;
+    bool coherent;
+    vk::MappedMemoryRange range;
+    std::shared_ptr<void> owner;
+    bool invalidated;
+  };
+  std::shared_ptr<State> s_;
+};
+
+/// How a resource is about to be used: the pipeline stages, the accesses and, for images, the layout.
+/// Barriers are built from the previous use and the next one, so no stage waits longer than it must.
+struct ResourceUse {
+  vk::PipelineStageFlags2 stages{};
+  vk::AccessFlags2 access{};
+  vk::ImageLayout layout = vk::ImageLayout::eUndefined;
+
+  static ResourceUse transferSrc() { return {vk::PipelineStageFlagBits2::eTransfer, vk::AccessFlagBits2::eTransferRead, vk::ImageLayout::eTransferSrcOptimal}; }
+  static ResourceUse transferDst() { return {vk::PipelineStageFlagBits2::eTransfer, vk::AccessFlagBits2::eTransferWrite, vk::ImageLayout::eTransferDstOptimal}; }
+  static ResourceUse sampled(vk::PipelineStageFlags2 stages = vk::PipelineStageFlagBits2::eFragmentShader) { return {stages, vk::AccessFlagBits2::eShaderSampledRead, vk::ImageLayout::eShaderReadOnlyOptimal}; }
+  static ResourceUse storageRead(vk::PipelineStageFlags2 stages = vk::PipelineStageFlagBits2::eComputeShader) { return {stages, vk::AccessFlagBits2::eShaderStorageRead, vk::ImageLayout::eGeneral}; }
+  static ResourceUse storageWrite(vk::PipelineStageFlags2 stages = vk::PipelineStageFlagBits2::eComputeShader) { return {stages, vk::AccessFlagBits2::eShaderStorageRead|vk::AccessFlagBits2::eShaderStorageWrite, vk::ImageLayout::eGeneral}; }
+  static ResourceUse colorAttachment() { return {vk::PipelineStageFlagBits2::eColorAttachmentOutput, vk::AccessFlagBits2::eColorAttachmentRead|vk::AccessFlagBits2::eColorAttachmentWrite, vk::ImageLayout::eColorAttachmentOptimal}; }
+  static ResourceUse depthAttachment() { return {vk::PipelineStageFlagBits2::eEarlyFragmentTests|vk::PipelineStageFlagBits2::eLateFragmentTests, vk::AccessFlagBits2::eDepthStencilAttachmentRead|vk::AccessFlagBits2::eDepthStencilAttachmentWrite, vk::ImageLayout::eDepthStencilAttachmentOptimal}; }
+  static ResourceUse inputAttachment(vk::ImageLayout layout = vk::ImageLayout::eShaderReadOnlyOptimal) { return {vk::PipelineStageFlagBits2::eFragmentShader, vk::AccessFlagBits2::eInputAttachmentRead, layout}; }
+  static ResourceUse depthRead() { return {vk::PipelineStageFlagBits2::eEarlyFragmentTests|vk::PipelineStageFlagBits2::eLateFragmentTests, vk::AccessFlagBits2::eDepthStencilAttachmentRead, vk::ImageLayout::eDepthStencilReadOnlyOptimal}; }
+  static ResourceUse present() { return {vk::PipelineStageFlagBits2::eNone, vk::AccessFlagBits2::eNone, vk::ImageLayout::ePresentSrcKHR}; }
+  static ResourceUse hostRead() { return {vk::PipelineStageFlagBits2::eHost, vk::AccessFlagBits2::eHostRead}; }
+  static ResourceUse vertexBuffer() { return {vk::PipelineStageFlagBits2::eVertexInput, vk::AccessFlagBits2::eVertexAttributeRead}; }
+  static ResourceUse indexBuffer() { return {vk::PipelineStageFlagBits2::eVertexInput, vk::AccessFlagBits2::eIndexRead}; }
+  static ResourceUse uniformBuffer(vk::PipelineStageFlags2 stages = vk::PipelineStageFlagBits2::eVertexShader|vk::PipelineStageFlagBits2::eFragmentShader) { return {stages, vk::AccessFlagBits2::eUniformRead}; }
+
+  /// The use that setLayout() assumes for a layout when no better information is given.
+  static ResourceUse forLayout(vk::ImageLayout layout) {
+    typedef vk::ImageLayout il;
+    typedef vk::PipelineStageFlagBits2 psb;
+    switch (layout) {
+      case il::eTransferSrcOptimal: return transferSrc();
+      case il::eTransferDstOptimal: return transferDst();
+      case il::eShaderReadOnlyOptimal: return sampled(psb::eVertexShader|psb::eFragmentShader|psb::eComputeShader);
+      case il::eGeneral: return storageWrite(psb::eVertexShader|psb::eFragmentShader|psb::eComputeShader);
+      case il::eColorAttachmentOptimal: return colorAttachment();
+      case il::eDepthStencilAttachmentOptimal: return depthAttachment();
+      case il::eDepthStencilReadOnlyOptimal: return depthRead();
+      case il::ePresentSrcKHR: return present();
+      default: return {psb::eAllCommands, vk::AccessFlagBits2::eMemoryRead|vk::AccessFlagBits2::eMemoryWrite, layout};
+    }
+  }
+
+  /// Use this for state of unknown history, eg. after an external layout change.
+  static ResourceUse unknown(vk::ImageLayout layout = vk::ImageLayout::eUndefined) {
+    return {vk::PipelineStageFlagBits2::eAllCommands, vk::AccessFlagBits2::eMemoryWrite, layout};
+  }
+
+  bool operator==(const ResourceUse &rhs) const = default;
+
+  /// True if any of the accesses write memory.
+  [[nodiscard]] bool writes() const {
+    typedef vk::AccessFlagBits2 afb;
+    const vk::AccessFlags2 writeBits = afb::eShaderWrite|afb::eShaderStorageWrite|afb::eColorAttachmentWrite|afb::eDepthStencilAttachmentWrite|afb::eTransferWrite|afb::eHostWrite|afb::eMemoryWrite;
+    return bool(access & writeBits);
+  }
+};
+
+/// Collects barriers and records them together.
+/// With synchronization2 enabled on the device this is one vkCmdPipelineBarrier2 call.
+/// Otherwise it is one vkCmdPipelineBarrier call with the stage masks combined.
+class BarrierBatch {
+public:
+  /// Pass true if the device was made with DeviceMaker::enableSynchronization2().
+  explicit BarrierBatch(bool synchronization2 = false) : synchronization2_(synchronization2) {}
+
+  BarrierBatch &memory(const vk::MemoryBarrier2 &barrier) {
+    memory_.push_back(barrier);
+    return *this;
+  }
+
+  BarrierBatch &buffer(const vk::BufferMemoryBarrier2 &barrier) {
+    buffers_.push_back(barrier);
+    return *this;
+  }
+
+  /// Add a barrier between two uses of a buffer range.
+  BarrierBatch &buffer(vk::Buffer buffer, const ResourceUse &prev, const ResourceUse &next, vk::DeviceSize offset = 0, vk::DeviceSize size = VK_WHOLE_SIZE) {
+    buffers_.emplace_back(prev.stages, prev.access, next.stages, next.access, VK_QUEUE_FAMILY_IGNORED, VK_QUEUE_FAMILY_IGNORED, buffer, offset, size);
+    return *this;
+  }
+
+  BarrierBatch &image(const vk::ImageMemoryBarrier2 &barrier) {
+    images_.push_back(barrier);
+    return *this;
+  }
+
+  [[nodiscard]] bool empty() const { return memory_.empty() && buffers_.empty() && images_.empty(); }
+
+  // The original synchronization flags are the low 32 bits of the synchronization2 ones.
+  // Bits above those only exist in synchronization2 and map to the older bits that cover them.
+  static vk::PipelineStageFlags legacyStages(vk::PipelineStageFlags2 stages) {
+    typedef vk::PipelineStageFlagBits2 psb;
+    typedef vk::PipelineStageFlagBits ps;
+    auto bits = static_cast<VkPipelineStageFlags2>(stages);
+    vk::PipelineStageFlags result(static_cast<VkPipelineStageFlags>(bits & 0xffffffffULL));
+    vk::PipelineStageFlags2 transfer = psb::eCopy|psb::eBlit|psb::eResolve|psb::eClear;
+    vk::PipelineStageFlags2 vertexInput = psb::eIndexInput|psb::eVertexAttributeInput;
+    if (stages & transfer) result |= ps::eTransfer;
+    if (stages & vertexInput) result |= ps::eVertexInput;
+    if (stages & psb::ePreRasterizationShaders) result |= ps::eAllGraphics;
+    // Anything else, such as video stages, waits for all commands.
+    auto known = static_cast<VkPipelineStageFlags2>(transfer|vertexInput|psb::ePreRasterizationShaders);
+    if ((bits & ~known) >> 32) result |= ps::eAllCommands;
+    return result;
+  }
+
+  static vk::AccessFlags legacyAccess(vk::AccessFlags2 access) {
+    typedef vk::AccessFlagBits2 afb;
+    typedef vk::AccessFlagBits af;
+    auto bits = static_cast<VkAccessFlags2>(access);
+    vk::AccessFlags result(static_cast<VkAccessFlags>(bits & 0xffffffffULL));
+    // Split read and write bits that only exist in synchronization2.
+    if (access & (afb::eShaderSampledRead|afb::eShaderStorageRead)) result |= af::eShaderRead;
+    if (access & afb::eShaderStorageWrite) result |= af::eShaderWrite;
+    // Anything else, such as video access, is covered by the generic memory bits.
+    auto known = static_cast<VkAccessFlags2>(afb::eShaderSampledRead|afb::eShaderStorageRead|afb::eShaderStorageWrite);
+    if ((bits & ~known) >> 32) result |= af::eMemoryRead|af::eMemoryWrite;
+    return result;
+  }
+
+  /// Record all the barriers and empty the batch.
+  void flush(vk::CommandBuffer cb) {
+    if (empty()) return;
+    if (synchronization2_) {
+      vk::DependencyInfo di{};
+      di.setMemoryBarriers(memory_).setBufferMemoryBarriers(buffers_).setImageMemoryBarriers(images_);
+      cb.pipelineBarrier2(di);
+    } else {
+      recordLegacy(cb);
+    }
+    memory_.clear();
+    buffers_.clear();
+    images_.clear();
+  }
+private:
+  void recordLegacy(vk::CommandBuffer cb) const {
+    vk::PipelineStageFlags2 src{}, dst{};
+    std::vector<vk::MemoryBarrier> mbs;
+    std::vector<vk::BufferMemoryBarrier> bmbs;
+    std::vector<vk::ImageMemoryBarrier> imbs;
+    for (auto &b : memory_) {
+      src |= b.srcStageMask; dst |= b.dstStageMask;
+      mbs.emplace_back(legacyAccess(b.srcAccessMask), legacyAccess(b.dstAccessMask));
+    }
+    for (auto &b : buffers_) {
+      src |= b.srcStageMask; dst |= b.dstStageMask;
+      bmbs.emplace_back(legacyAccess(b.srcAccessMask), legacyAccess(b.dstAccessMask), b.srcQueueFamilyIndex, b.dstQueueFamilyIndex, b.buffer, b.offset, b.size);
+    }
+    for (auto &b : images_) {
+      src |= b.srcStageMask; dst |= b.dstStageMask;
+      imbs.emplace_back(legacyAccess(b.srcAccessMask), legacyAccess(b.dstAccessMask), b.oldLayout, b.newLayout, b.srcQueueFamilyIndex, b.dstQueueFamilyIndex, b.image, b.subresourceRange);
+    }
+    // Empty stage masks are not allowed without synchronization2.
+    auto srcStages = src ? legacyStages(src) : vk::PipelineStageFlags{vk::PipelineStageFlagBits::eTopOfPipe};
+    auto dstStages = dst ? legacyStages(dst) : vk::PipelineStageFlags{vk::PipelineStageFlagBits::eBottomOfPipe};
+    cb.pipelineBarrier(srcStages, dstStages, vk::DependencyFlags{}, mbs, bmbs, imbs);
+  }
+
+  bool synchronization2_ = false;
+  std::vector<vk::MemoryBarrier2> memory_;
+  std::vector<vk::BufferMemoryBarrier2> buffers_;
+  std::vector<vk::ImageMemoryBarrier2> images_;
+};
+
 /// Scale a value by mip level, but do not reduce to zero.
 inline uint32_t mipScale(uint32_t value, uint32_t mipLevel) {
   return std::max(value >> mipLevel, static_cast<uint32_t>(1));
 }
 
+/// Round value up to a multiple of alignment.
+inline vk::DeviceSize roundUp(vk::DeviceSize value, vk::DeviceSize alignment) {
+  return (value + alignment - 1) / alignment * alignment;
+}
+
 /// Load a binary file into a vector.
 /// The vector will be zero-length if this fails.
 inline std::vector<uint8_t> loadFile(const std::string &filename) {
@@ -94,6 +943,71 @@ inline std::vector<uint8_t> loadFile(const std::string &filename) {
   return bytes;
 }
 
+/// Write a binary file so that readers never see a partial file.
+/// The data goes to a temporary file which is then renamed over filename.
+/// The temporary name is unique, so threads or processes saving the same file don't share it.
+inline bool saveFileAtomic(const std::string &filename, const void *data, size_t size) {
+  std::random_device random;
+  std::ostringstream name;
+  name << filename << '.' << std::hex << std::hash<std::thread::id>{}(std::this_thread::get_id())
+       << '.' << std::chrono::steady_clock::now().time_since_epoch().count()
+       << '.' << random() << random() << ".tmp";
+  std::string tmpname = name.str();
+  std::error_code ec;
+  {
+    std::ofstream os(tmpname, std::ios::binary|std::ios::trunc);
+    os.write(static_cast<const char*>(data), static_cast<std::streamsize>(size));
+    if (!os.good()) {
+      os.close();
+      std::filesystem::remove(tmpname, ec);
+      return false;
+    }
+  }
+  std::filesystem::rename(tmpname, filename, ec);
+  if (ec) std::filesystem::remove(tmpname, ec);
+  return !ec;
+}
+
+/// 64 bit FNV-1a hash of some bytes. Pass the previous result as hash to hash several pieces.
+inline uint64_t fnv1a(const void *data, size_t size, uint64_t hash = 0xcbf29ce484222325ULL) {
+  auto bytes = static_cast<const uint8_t *>(data);
+  for (size_t i = 0; i != size; ++i) {
+    hash = (hash ^ bytes[i]) * 0x100000001b3ULL;
+  }
+  return hash;
+}
+
+/// Returns true if a pipeline cache blob was made by this driver and device.
+/// Drivers should reject foreign blobs themselves, but not all of them do.
+inline bool validPipelineCacheData(const std::vector<uint8_t> &bytes, const vk::PhysicalDeviceProperties &props) {
+  VkPipelineCacheHeaderVersionOne header{};
+  if (bytes.size() < sizeof(header)) return false;
+  memcpy(&header, bytes.data(), sizeof(header));
+  return header.headerSize >= sizeof(header) && header.headerSize <= bytes.size()
+    && header.headerVersion == VK_PIPELINE_CACHE_HEADER_VERSION_ONE
+    && header.vendorID == props.vendorID
+    && header.deviceID == props.deviceID
+    && memcmp(header.pipelineCacheUUID, props.pipelineCacheUUID.data(), VK_UUID_SIZE) == 0;
+}
+
+/// Make a pipeline cache from a file saved by savePipelineCache.
+/// If the file is missing or was made by another device the cache starts empty.
+inline vk::UniquePipelineCache loadPipelineCache(vk::Device device, vk::PhysicalDevice physicalDevice, const std::string &filename) {
+  auto bytes = loadFile(filename);
+  vk::PipelineCacheCreateInfo ci{};
+  if (validPipelineCacheData(bytes, physicalDevice.getProperties())) {
+    ci.initialDataSize = bytes.size();
+    ci.pInitialData = bytes.data();
+  }
+  return device.createPipelineCacheUnique(ci);
+}
+
+/// Save a pipeline cache to a file, atomically.
+inline bool savePipelineCache(vk::Device device, vk::PipelineCache cache, const std::string &filename) {
+  auto bytes = device.getPipelineCacheData(cache);
+  return saveFileAtomic(filename, bytes.data(), bytes.size());
+}
+
 /// Description of blocks for compressed formats.
 struct BlockParams {
   uint8_t blockWidth;
@@ -390,6 +1304,9 @@ public:
     return *this;
   }
 
+  /// Get the version of the api (zero if it was never set).
+  [[nodiscard]] uint32_t apiVersion() const { return app_info_.apiVersion; }
+
   /// Create a self-deleting (unique) instance.
   [[nodiscard]] vk::UniqueInstance createUnique() const {
     return vk::createInstanceUnique(
@@ -406,6 +1323,150 @@ private:
   vk::ApplicationInfo app_info_;
 };
 
+/// The extended dynamic states a device supports, from Vulkan 1.3 or
+/// VK_EXT_extended_dynamic_state, VK_EXT_extended_dynamic_state2 and VK_EXT_extended_dynamic_state3.
+/// Enable them with DeviceMaker::enableExtendedDynamicState() and use them with PipelineMaker::dynamicProfile().
+struct DynamicStateSupport {
+  /// Both the instance and the device are Vulkan 1.3, so the first two groups are core.
+  bool core13 = false;
+
+  /// Cull mode, front face, depth test, depth write, depth compare op and stencil test.
+  bool extendedDynamicState = false;
+
+  /// Depth bias enable and rasterizer discard enable.
+  bool extendedDynamicState2 = false;
+
+  /// Polygon mode (VK_EXT_extended_dynamic_state3).
+  bool polygonMode = false;
+
+  /// Depth clamp enable (VK_EXT_extended_dynamic_state3).
+  bool depthClampEnable = false;
+
+  /// Find what physicalDevice supports.
+  /// apiVersion is the version the instance was made with, which must be at least 1.1.
+  static DynamicStateSupport query(vk::PhysicalDevice physicalDevice, uint32_t apiVersion) {
+    DynamicStateSupport support;
+    support.core13 = std::min(apiVersion, physicalDevice.getProperties().apiVersion) >= VK_API_VERSION_1_3;
+
+    bool eds1 = false, eds2 = false, eds3 = false;
+    for (auto &ext : physicalDevice.enumerateDeviceExtensionProperties()) {
+      std::string_view name = ext.extensionName.data();
+      eds1 = eds1 || name == VK_EXT_EXTENDED_DYNAMIC_STATE_EXTENSION_NAME;
+      eds2 = eds2 || name == VK_EXT_EXTENDED_DYNAMIC_STATE_2_EXTENSION_NAME;
+      eds3 = eds3 || name == VK_EXT_EXTENDED_DYNAMIC_STATE_3_EXTENSION_NAME;
+    }
+
+    // Only chain the feature structures of extensions the device has.
+    vk::PhysicalDeviceExtendedDynamicStateFeaturesEXT eds1f;
+    vk::PhysicalDeviceExtendedDynamicState2FeaturesEXT eds2f;
+    vk::PhysicalDeviceExtendedDynamicState3FeaturesEXT eds3f;
+    void *next = nullptr;
+    if (eds1 && !support.core13) { eds1f.pNext = next; next = &eds1f; }
+    if (eds2 && !support.core13) { eds2f.pNext = next; next = &eds2f; }
+    if (eds3) { eds3f.pNext = next; next = &eds3f; }
+    if (next) {
+      vk::PhysicalDeviceFeatures2 features2;
+      features2.pNext = next;
+      physicalDevice.getFeatures2(&features2);
+    }
+
+    support.extendedDynamicState = support.core13 || eds1f.extendedDynamicState == VK_TRUE;
+    support.extendedDynamicState2 = support.core13 || eds2f.extendedDynamicState2 == VK_TRUE;
+    support.polygonMode = eds3f.extendedDynamicState3PolygonMode == VK_TRUE;
+    support.depthClampEnable = eds3f.extendedDynamicState3DepthClampEnable == VK_TRUE;
+    return support;
+  }
+
+  /// The states a pipeline can make dynamic, including viewport and scissor.
+  [[nodiscard]] std::vector<vk::DynamicState> states() const {
+    typedef vk::DynamicState ds;
+    std::vector<vk::DynamicState> result{ds::eViewport, ds::eScissor};
+    if (extendedDynamicState) {
+      result.insert(result.end(), {ds::eCullMode, ds::eFrontFace, ds::eDepthTestEnable,
+                                   ds::eDepthWriteEnable, ds::eDepthCompareOp, ds::eStencilTestEnable});
+    }
+    if (extendedDynamicState2) {
+      result.insert(result.end(), {ds::eDepthBiasEnable, ds::eRasterizerDiscardEnable});
+    }
+    if (polygonMode) result.push_back(ds::ePolygonModeEXT);
+    if (depthClampEnable) result.push_back(ds::eDepthClampEnableEXT);
+    return result;
+  }
+};
+
+/// Values for the states made dynamic by PipelineMaker::dynamicProfile().
+/// Change these between draws instead of building another pipeline.
+/// The defaults match those of PipelineMaker.
+struct DynamicStateValues {
+  vk::CullModeFlags cullMode = vk::CullModeFlagBits::eNone;
+  vk::FrontFace frontFace = vk::FrontFace::eCounterClockwise;
+  vk::Bool32 depthTestEnable = VK_FALSE;
+  vk::Bool32 depthWriteEnable = VK_TRUE;
+  vk::CompareOp depthCompareOp = vk::CompareOp::eLessOrEqual;
+  vk::Bool32 stencilTestEnable = VK_FALSE;
+  vk::Bool32 depthBiasEnable = VK_FALSE;
+  vk::Bool32 rasterizerDiscardEnable = VK_FALSE;
+  vk::PolygonMode polygonMode = vk::PolygonMode::eFill;
+  vk::Bool32 depthClampEnable = VK_FALSE;
+};
+
+/// Record DynamicStateValues using the core or extension commands of a device.
+/// The commands are looked up with vkGetDeviceProcAddr so no dynamic dispatcher is needed.
+class DynamicStateRecorder {
+public:
+  DynamicStateRecorder() = default;
+
+  /// Load the commands for the states in support.
+  DynamicStateRecorder(vk::Device device, const DynamicStateSupport &support) {
+    auto load = [&](const char *core, const char *ext) { return device.getProcAddr(support.core13 ? core : ext); };
+    if (support.extendedDynamicState) {
+      setCullMode_ = reinterpret_cast<PFN_vkCmdSetCullMode>(load("vkCmdSetCullMode", "vkCmdSetCullModeEXT"));
+      setFrontFace_ = reinterpret_cast<PFN_vkCmdSetFrontFace>(load("vkCmdSetFrontFace", "vkCmdSetFrontFaceEXT"));
+      setDepthTestEnable_ = reinterpret_cast<PFN_vkCmdSetDepthTestEnable>(load("vkCmdSetDepthTestEnable", "vkCmdSetDepthTestEnableEXT"));
+      setDepthWriteEnable_ = reinterpret_cast<PFN_vkCmdSetDepthWriteEnable>(load("vkCmdSetDepthWriteEnable", "vkCmdSetDepthWriteEnableEXT"));
+      setDepthCompareOp_ = reinterpret_cast<PFN_vkCmdSetDepthCompareOp>(load("vkCmdSetDepthCompareOp", "vkCmdSetDepthCompareOpEXT"));
+      setStencilTestEnable_ = reinterpret_cast<PFN_vkCmdSetStencilTestEnable>(load("vkCmdSetStencilTestEnable", "vkCmdSetStencilTestEnableEXT"));
+    }
+    if (support.extendedDynamicState2) {
+      setDepthBiasEnable_ = reinterpret_cast<PFN_vkCmdSetDepthBiasEnable>(load("vkCmdSetDepthBiasEnable", "vkCmdSetDepthBiasEnableEXT"));
+      setRasterizerDiscardEnable_ = reinterpret_cast<PFN_vkCmdSetRasterizerDiscardEnable>(load("vkCmdSetRasterizerDiscardEnable", "vkCmdSetRasterizerDiscardEnableEXT"));
+    }
+    if (support.polygonMode) {
+      setPolygonMode_ = reinterpret_cast<PFN_vkCmdSetPolygonModeEXT>(device.getProcAddr("vkCmdSetPolygonModeEXT"));
+    }
+    if (support.depthClampEnable) {
+      setDepthClampEnable_ = reinterpret_cast<PFN_vkCmdSetDepthClampEnableEXT>(device.getProcAddr("vkCmdSetDepthClampEnableEXT"));
+    }
+  }
+
+  /// Set every state the device supports.
+  /// Every state made dynamic in the bound pipeline must be set before drawing.
+  void record(vk::CommandBuffer cb, const DynamicStateValues &values) const {
+    auto c = static_cast<VkCommandBuffer>(cb);
+    if (setCullMode_) setCullMode_(c, static_cast<VkCullModeFlags>(values.cullMode));
+    if (setFrontFace_) setFrontFace_(c, static_cast<VkFrontFace>(values.frontFace));
+    if (setDepthTestEnable_) setDepthTestEnable_(c, values.depthTestEnable);
+    if (setDepthWriteEnable_) setDepthWriteEnable_(c, values.depthWriteEnable);
+    if (setDepthCompareOp_) setDepthCompareOp_(c, static_cast<VkCompareOp>(values.depthCompareOp));
+    if (setStencilTestEnable_) setStencilTestEnable_(c, values.stencilTestEnable);
+    if (setDepthBiasEnable_) setDepthBiasEnable_(c, values.depthBiasEnable);
+    if (setRasterizerDiscardEnable_) setRasterizerDiscardEnable_(c, values.rasterizerDiscardEnable);
+    if (setPolygonMode_) setPolygonMode_(c, static_cast<VkPolygonMode>(values.polygonMode));
+    if (setDepthClampEnable_) setDepthClampEnable_(c, values.depthClampEnable);
+  }
+private:
+  PFN_vkCmdSetCullMode setCullMode_ = nullptr;
+  PFN_vkCmdSetFrontFace setFrontFace_ = nullptr;
+  PFN_vkCmdSetDepthTestEnable setDepthTestEnable_ = nullptr;
+  PFN_vkCmdSetDepthWriteEnable setDepthWriteEnable_ = nullptr;
+  PFN_vkCmdSetDepthCompareOp setDepthCompareOp_ = nullptr;
+  PFN_vkCmdSetStencilTestEnable setStencilTestEnable_ = nullptr;
+  PFN_vkCmdSetDepthBiasEnable setDepthBiasEnable_ = nullptr;
+  PFN_vkCmdSetRasterizerDiscardEnable setRasterizerDiscardEnable_ = nullptr;
+  PFN_vkCmdSetPolygonModeEXT setPolygonMode_ = nullptr;
+  PFN_vkCmdSetDepthClampEnableEXT setDepthClampEnable_ = nullptr;
+};
+
 /// Factory for devices.
 class DeviceMaker {
 public:
@@ -496,22 +1557,119 @@ public:
 	return *this;
   }
 
-  /// Create a new logical device.
-  [[nodiscard]] vk::UniqueDevice createUnique(vk::PhysicalDevice physical_device) const {
-    auto dci = vk::DeviceCreateInfo{
-      {},
-      static_cast<uint32_t>(qci_.size()), qci_.data(),
-      static_cast<uint32_t>(layers_.size()), layers_.data(),
-      static_cast<uint32_t>(device_extensions_.size()), device_extensions_.data()
-    };
+  /// Enable vkCmdPipelineBarrier2 and friends. Needs an instance made with apiVersion(VK_API_VERSION_1_3).
+  DeviceMaker &enableSynchronization2 ()
+  {
+	s2fs_.emplace_back();
+	s2fs_.back().setSynchronization2(true);
+	return *this;
+  }
 
-    //
-    if (!pdfs_.empty())
+  /// Enable timeline semaphores, for TimelineQueue. Core in Vulkan 1.2.
+  DeviceMaker &enableTimelineSemaphore ()
+  {
+	tsfs_.emplace_back();
+	tsfs_.back().setTimelineSemaphore(true);
+	return *this;
+  }
+
+  /// Enable the extensions and features needed for the dynamic states in support.
+  DeviceMaker &enableExtendedDynamicState (const DynamicStateSupport &support)
+  {
+	if (!support.core13 && support.extendedDynamicState) {
+	  extension(VK_EXT_EXTENDED_DYNAMIC_STATE_EXTENSION_NAME);
+	  eds1fs_.emplace_back();
+	  eds1fs_.back().setExtendedDynamicState(true);
+	}
+	if (!support.core13 && support.extendedDynamicState2) {
+	  extension(VK_EXT_EXTENDED_DYNAMIC_STATE_2_EXTENSION_NAME);
+	  eds2fs_.emplace_back();
+	  eds2fs_.back().setExtendedDynamicState2(true);
+	}
+	if (support.polygonMode || support.depthClampEnable) {
+	  extension(VK_EXT_EXTENDED_DYNAMIC_STATE_3_EXTENSION_NAME);
+	  eds3fs_.emplace_back();
+	  eds3fs_.back().setExtendedDynamicState3PolygonMode(support.polygonMode);
+	  eds3fs_.back().setExtendedDynamicState3DepthClampEnable(support.depthClampEnable);
+	}
+	return *this;
+  }
+
+  /// Enable VK_EXT_graphics_pipeline_library, for PipelineMaker::createLibraryUnique() and PipelineLibrary.
+  DeviceMaker &enableGraphicsPipelineLibrary ()
+  {
+	extension(VK_KHR_PIPELINE_LIBRARY_EXTENSION_NAME);
+	extension(VK_EXT_GRAPHICS_PIPELINE_LIBRARY_EXTENSION_NAME);
+	gplfs_.emplace_back();
+	gplfs_.back().setGraphicsPipelineLibrary(true);
+	return *this;
+  }
+
+  /// Create a new logical device.
+  [[nodiscard]] vk::UniqueDevice createUnique(vk::PhysicalDevice physical_device) const {
+    auto dci = vk::DeviceCreateInfo{
+      {},
+      static_cast<uint32_t>(qci_.size()), qci_.data(),
+      static_cast<uint32_t>(layers_.size()), layers_.data(),
+      static_cast<uint32_t>(device_extensions_.size()), device_extensions_.data()
+    };
+
+    //
+    if (!pdfs_.empty())
 		dci.setPEnabledFeatures(&pdfs_.front());
 
+    // Chain the optional feature structures.
+    void *next = nullptr;
+    vk::PhysicalDeviceSynchronization2Features s2f;
+    if (!s2fs_.empty()) {
+      s2f = s2fs_.front();
+      s2f.pNext = next;
+      next = &s2f;
+    }
+
+    vk::PhysicalDeviceTimelineSemaphoreFeatures tsf;
+    if (!tsfs_.empty()) {
+      tsf = tsfs_.front();
+      tsf.pNext = next;
+      next = &tsf;
+    }
+
+    vk::PhysicalDeviceExtendedDynamicStateFeaturesEXT eds1f;
+    if (!eds1fs_.empty()) {
+      eds1f = eds1fs_.front();
+      eds1f.pNext = next;
+      next = &eds1f;
+    }
+
+    vk::PhysicalDeviceExtendedDynamicState2FeaturesEXT eds2f;
+    if (!eds2fs_.empty()) {
+      eds2f = eds2fs_.front();
+      eds2f.pNext = next;
+      next = &eds2f;
+    }
+
+    vk::PhysicalDeviceExtendedDynamicState3FeaturesEXT eds3f;
+    if (!eds3fs_.empty()) {
+      eds3f = eds3fs_.front();
+      eds3f.pNext = next;
+      next = &eds3f;
+    }
+
+    vk::PhysicalDeviceGraphicsPipelineLibraryFeaturesEXT gplf;
+    if (!gplfs_.empty()) {
+      gplf = gplfs_.front();
+      gplf.pNext = next;
+      next = &gplf;
+    }
+
     // required to enable and use multiview
-    if (!mvfs_.empty())
-		dci.pNext = &mvfs_.front();
+    vk::PhysicalDeviceMultiviewFeatures mvf;
+    if (!mvfs_.empty()) {
+      mvf = mvfs_.front();
+      mvf.pNext = next;
+      next = &mvf;
+    }
+    dci.pNext = next;
 
     return physical_device.createDeviceUnique(dci);
   }
@@ -522,6 +1680,12 @@ private:
   std::vector<vk::DeviceQueueCreateInfo> qci_;
   std::vector<vk::PhysicalDeviceFeatures> pdfs_;
   std::vector<vk::PhysicalDeviceMultiviewFeatures> mvfs_;
+  std::vector<vk::PhysicalDeviceSynchronization2Features> s2fs_;
+  std::vector<vk::PhysicalDeviceTimelineSemaphoreFeatures> tsfs_;
+  std::vector<vk::PhysicalDeviceExtendedDynamicStateFeaturesEXT> eds1fs_;
+  std::vector<vk::PhysicalDeviceExtendedDynamicState2FeaturesEXT> eds2fs_;
+  std::vector<vk::PhysicalDeviceExtendedDynamicState3FeaturesEXT> eds3fs_;
+  std::vector<vk::PhysicalDeviceGraphicsPipelineLibraryFeaturesEXT> gplfs_;
 
   vk::ApplicationInfo app_info_;
 };
@@ -629,6 +1793,32 @@ public:
     return *this;
   }
 
+  /// Add an input attachment to the subpass. Like colour attachments, add them one after another.
+  RenderpassMaker& subpassInputAttachment(vk::ImageLayout layout, uint32_t attachment) {
+    vk::SubpassDescription &subpass = s.subpassDescriptions.back();
+    auto *p = getAttachmentReference();
+    p->layout = layout;
+    p->attachment = attachment;
+    if (subpass.inputAttachmentCount == 0) {
+      subpass.pInputAttachments = p;
+    }
+    subpass.inputAttachmentCount++;
+    return *this;
+  }
+
+  /// Keep the contents of an attachment through a subpass that does not reference it,
+  /// for a later subpass to use. Like colour attachments, add them one after another.
+  RenderpassMaker& subpassPreserveAttachment(uint32_t attachment) {
+    vk::SubpassDescription &subpass = s.subpassDescriptions.back();
+    auto *p = getPreserveAttachment();
+    *p = attachment;
+    if (subpass.preserveAttachmentCount == 0) {
+      subpass.pPreserveAttachments = p;
+    }
+    subpass.preserveAttachmentCount++;
+    return *this;
+  }
+
   RenderpassMaker& subpassDepthStencilAttachment(vk::ImageLayout layout, uint32_t attachment) {
     vk::SubpassDescription &subpass = s.subpassDescriptions.back();
     auto *p = getAttachmentReference();
@@ -683,18 +1873,312 @@ private:
     return (s.num_refs < max_refs) ? &s.attachmentReferences[s.num_refs++] : nullptr;
   }
 
+  uint32_t *getPreserveAttachment() {
+    return (s.num_preserves < max_refs) ? &s.preserveAttachments[s.num_preserves++] : nullptr;
+  }
+
   struct State {
     std::vector<vk::AttachmentDescription> attachmentDescriptions;
     std::vector<vk::SubpassDescription> subpassDescriptions;
     std::vector<vk::SubpassDependency> subpassDependencies;
     std::array<vk::AttachmentReference, max_refs> attachmentReferences;
     int num_refs = 0;
+    std::array<uint32_t, max_refs> preserveAttachments;
+    int num_preserves = 0;
     bool ok_ = false;
   };
 
   State s;
 };
 
+#ifdef VOOKOO_SHADERC_SUPPORT
+/// Options for ShaderCompiler. Everything here is part of the cache key.
+struct ShaderCompileOptions {
+  /// Macros defined before the source, as name and value.
+  std::vector<std::pair<std::string, std::string>> defines;
+
+  /// Directories searched for #include <...> and, after the including file's own directory, #include "...".
+  std::vector<std::string> includeDirs;
+
+  /// Run the SPIR-V optimiser, which in this shaderc optimises for size.
+  bool optimize = false;
+
+  /// Keep debug information such as variable names.
+  bool debugInfo = false;
+
+  /// Add a macro definition.
+  ShaderCompileOptions &define(const std::string &name, const std::string &value = "") {
+    defines.emplace_back(name, value);
+    return *this;
+  }
+
+  /// Add an include directory.
+  ShaderCompileOptions &includeDir(const std::string &dir) {
+    includeDirs.push_back(dir);
+    return *this;
+  }
+};
+
+/// Compile GLSL to SPIR-V with shaderc, keeping the results in an on-disk cache.
+/// Cache entries are named by a hash of the source, stage and options and record
+/// the hash of each included file, so a warm start does not run the compiler at all.
+/// Compiling is thread safe.
+///
+/// Example:
+///
+///     vku::ShaderCompiler compiler{"shadercache"};
+///     vku::ShaderModule frag{device, compiler, SOURCE_DIR "blur.frag", vk::ShaderStageFlagBits::eFragment};
+///
+class ShaderCompiler {
+public:
+  struct Result {
+    std::vector<uint32_t> spirv;
+
+    /// Files pulled in by #include.
+    std::vector<std::string> dependencies;
+
+    /// Compiler errors and warnings.
+    std::string messages;
+
+    bool ok = false;
+
+    /// True if the result came from the cache.
+    bool cached = false;
+  };
+
+  /// Cache compiled shaders in cacheDir, or not at all if it is empty.
+  explicit ShaderCompiler(const std::string &cacheDir = "") : cacheDir_(cacheDir) {
+    if (!cacheDir_.empty()) {
+      std::error_code ec;
+      std::filesystem::create_directories(cacheDir_, ec);
+    }
+  }
+
+  /// Compile GLSL source. name is used for errors and to find relative includes.
+  Result compile(std::string_view source, const std::string &name, vk::ShaderStageFlagBits stage, const ShaderCompileOptions &options = {}) const {
+    uint64_t hash = key(source, name, stage, options);
+
+    Result result;
+    if (load(hash, result)) return result;
+
+    shaderc::CompileOptions copts;
+    for (auto &[macro, value] : options.defines) copts.AddMacroDefinition(macro, value);
+    copts.SetOptimizationLevel(options.optimize ? shaderc_optimization_level_size : shaderc_optimization_level_zero);
+    if (options.debugInfo) copts.SetGenerateDebugInfo();
+    copts.SetIncluder(std::make_unique<Includer>(options.includeDirs, result.dependencies));
+
+    auto spv = compiler_.CompileGlslToSpv(source.data(), source.size(), shaderKind(stage), name.c_str(), copts);
+    result.messages = spv.GetErrorMessage();
+    if (spv.GetCompilationStatus() != shaderc_compilation_status_success) return result;
+
+    result.spirv.assign(spv.cbegin(), spv.cend());
+    result.ok = true;
+    save(hash, result);
+    return result;
+  }
+
+  /// Compile a GLSL file.
+  Result compileFile(const std::string &filename, vk::ShaderStageFlagBits stage, const ShaderCompileOptions &options = {}) const {
+    auto bytes = loadFile(filename);
+    if (bytes.empty()) {
+      Result result;
+      result.messages = "cannot read " + filename + "\n";
+      return result;
+    }
+    return compile(std::string_view(reinterpret_cast<const char *>(bytes.data()), bytes.size()), filename, stage, options);
+  }
+
+  /// Compile one GLSL file once for each set of options, on up to threads threads (one per core if zero).
+  /// Results are in the same order as variants.
+  std::vector<Result> compileVariants(const std::string &filename, vk::ShaderStageFlagBits stage,
+                                      const std::vector<ShaderCompileOptions> &variants, uint32_t threads = 0) const {
+    std::vector<Result> results(variants.size());
+    if (threads == 0) threads = std::max(std::thread::hardware_concurrency(), 1U);
+    threads = std::min(threads, static_cast<uint32_t>(variants.size()));
+
+    std::atomic<size_t> next = 0;
+    std::vector<std::thread> workers;
+    for (uint32_t i = 0; i != threads; ++i) {
+      workers.emplace_back([&]() {
+        for (size_t v = next++; v < variants.size(); v = next++) {
+          results[v] = compileFile(filename, stage, variants[v]);
+        }
+      });
+    }
+    for (auto &worker : workers) worker.join();
+    return results;
+  }
+
+  /// Every combination of one value from each axis, added to base.
+  /// eg. axes {{"SHADOWS", {"0", "1"}}, {"LIGHTS", {"1", "4", "8"}}} gives six variants.
+  static std::vector<ShaderCompileOptions> permutations(const ShaderCompileOptions &base,
+      const std::vector<std::pair<std::string, std::vector<std::string>>> &axes) {
+    std::vector<ShaderCompileOptions> result{base};
+    for (auto &[macro, values] : axes) {
+      std::vector<ShaderCompileOptions> next;
+      for (auto &options : result) {
+        for (auto &value : values) {
+          next.push_back(options);
+          next.back().define(macro, value);
+        }
+      }
+      result = std::move(next);
+    }
+    return result;
+  }
+private:
+  // Serves #include from the including file's directory and the include directories,
+  // recording each file found.
+  class Includer : public shaderc::CompileOptions::IncluderInterface {
+  public:
+    Includer(const std::vector<std::string> &dirs, std::vector<std::string> &dependencies)
+    : dirs_(dirs), dependencies_(dependencies) {
+    }
+
+    shaderc_include_result *GetInclude(const char *requested, shaderc_include_type type, const char *requesting, size_t) override {
+      auto data = new Data;
+      std::vector<std::filesystem::path> candidates;
+      if (type == shaderc_include_type_relative) candidates.push_back(std::filesystem::path(requesting).parent_path() / requested);
+      for (auto &dir : dirs_) candidates.push_back(std::filesystem::path(dir) / requested);
+
+      for (auto &path : candidates) {
+        auto bytes = loadFile(path.string());
+        if (!bytes.empty()) {
+          data->name = path.string();
+          data->content.assign(bytes.begin(), bytes.end());
+          dependencies_.push_back(data->name);
+          break;
+        }
+      }
+
+      // An empty name tells shaderc the include failed; content is the error.
+      if (data->name.empty()) data->content = std::string("cannot find include file ") + requested;
+      data->result = shaderc_include_result{data->name.data(), data->name.size(), data->content.data(), data->content.size(), data};
+      return &data->result;
+    }
+
+    void ReleaseInclude(shaderc_include_result *result) override {
+      delete static_cast<Data *>(result->user_data);
+    }
+  private:
+    struct Data {
+      shaderc_include_result result;
+      std::string name;
+      std::string content;
+    };
+
+    std::vector<std::string> dirs_;
+    std::vector<std::string> &dependencies_;
+  };
+
+  static shaderc_shader_kind shaderKind(vk::ShaderStageFlagBits stage) {
+    switch (stage) {
+      case vk::ShaderStageFlagBits::eVertex: return shaderc_glsl_vertex_shader;
+      case vk::ShaderStageFlagBits::eFragment: return shaderc_glsl_fragment_shader;
+      case vk::ShaderStageFlagBits::eCompute: return shaderc_glsl_compute_shader;
+      case vk::ShaderStageFlagBits::eGeometry: return shaderc_glsl_geometry_shader;
+      case vk::ShaderStageFlagBits::eTessellationControl: return shaderc_glsl_tess_control_shader;
+      case vk::ShaderStageFlagBits::eTessellationEvaluation: return shaderc_glsl_tess_evaluation_shader;
+      default: return shaderc_glsl_infer_from_source;
+    }
+  }
+
+  // Relative includes resolve against the directory of name, so identical source in two
+  // directories must not share an entry.
+  static uint64_t key(std::string_view source, const std::string &name, vk::ShaderStageFlagBits stage, const ShaderCompileOptions &options) {
+    auto addString = [](uint64_t hash, std::string_view str) {
+      auto size = static_cast<uint64_t>(str.size());
+      return fnv1a(str.data(), str.size(), fnv1a(&size, sizeof(size), hash));
+    };
+    uint64_t hash = fnv1a(&cacheVersion, sizeof(cacheVersion));
+    hash = fnv1a(&stage, sizeof(stage), hash);
+    hash = addString(hash, source);
+    std::error_code ec;
+    auto dir = std::filesystem::weakly_canonical(std::filesystem::path(name).parent_path(), ec);
+    hash = addString(hash, ec ? std::filesystem::path(name).parent_path().string() : dir.string());
+    for (auto &[macro, value] : options.defines) hash = addString(addString(hash, macro), value);
+    for (auto &dir : options.includeDirs) hash = addString(hash, dir);
+    uint8_t flags = (options.optimize ? 1 : 0) | (options.debugInfo ? 2 : 0);
+    return fnv1a(&flags, sizeof(flags), hash);
+  }
+
+  [[nodiscard]] std::string cacheFile(uint64_t hash) const {
+    char name[32];
+    snprintf(name, sizeof(name), "%016llx.spvc", static_cast<unsigned long long>(hash));
+    return (std::filesystem::path(cacheDir_) / name).string();
+  }
+
+  // Cache entry layout, all little endian words:
+  //   version, dependency count,
+  //   for each dependency: name length, name bytes padded to a word, content hash (two words),
+  //   SPIR-V.
+  bool load(uint64_t hash, Result &result) const {
+    if (cacheDir_.empty()) return false;
+    auto bytes = loadFile(cacheFile(hash));
+    size_t pos = 0;
+    auto read = [&](void *dst, size_t size) {
+      if (pos + size > bytes.size()) return false;
+      memcpy(dst, bytes.data() + pos, size);
+      pos += (size + 3) & ~size_t(3);
+      return true;
+    };
+
+    uint32_t version = 0, count = 0;
+    if (!read(&version, 4) || version != cacheVersion || !read(&count, 4)) return false;
+
+    std::vector<std::string> dependencies;
+    for (uint32_t i = 0; i != count; ++i) {
+      uint32_t length = 0;
+      uint64_t contentHash = 0;
+      if (!read(&length, 4) || pos + length > bytes.size()) return false;
+      std::string name(length, '\0');
+      if (!read(name.data(), length) || !read(&contentHash, 8)) return false;
+
+      // A changed include makes the entry stale.
+      auto content = loadFile(name);
+      if (content.empty() || fnv1a(content.data(), content.size()) != contentHash) return false;
+      dependencies.push_back(std::move(name));
+    }
+
+    if (pos >= bytes.size() || (bytes.size() - pos) % 4 != 0) return false;
+    result.spirv.resize((bytes.size() - pos) / 4);
+    memcpy(result.spirv.data(), bytes.data() + pos, bytes.size() - pos);
+    result.dependencies = std::move(dependencies);
+    result.ok = true;
+    result.cached = true;
+    return true;
+  }
+
+  void save(uint64_t hash, const Result &result) const {
+    if (cacheDir_.empty()) return;
+    std::vector<uint8_t> bytes;
+    auto write = [&](const void *src, size_t size) {
+      auto pos = bytes.size();
+      bytes.resize(pos + ((size + 3) & ~size_t(3)));
+      if (size) memcpy(bytes.data() + pos, src, size);
+    };
+
+    auto count = static_cast<uint32_t>(result.dependencies.size());
+    write(&cacheVersion, 4);
+    write(&count, 4);
+    for (auto &name : result.dependencies) {
+      auto content = loadFile(name);
+      uint64_t contentHash = fnv1a(content.data(), content.size());
+      auto length = static_cast<uint32_t>(name.size());
+      write(&length, 4);
+      write(name.data(), length);
+      write(&contentHash, 8);
+    }
+    write(result.spirv.data(), result.spirv.size() * 4);
+    saveFileAtomic(cacheFile(hash), bytes.data(), bytes.size());
+  }
+
+  static constexpr uint32_t cacheVersion = 1;
+  std::string cacheDir_;
+  shaderc::Compiler compiler_;
+};
+#endif
+
 /// Class for building shader modules and extracting metadata from shaders.
 class ShaderModule {
 public:
@@ -714,25 +2198,40 @@ public:
     file.seekg(0, std::ios::beg);
     file.read(reinterpret_cast<char *>(s.opcodes_.data()), static_cast<std::streamsize>(s.opcodes_.size() * 4));
 
-    vk::ShaderModuleCreateInfo ci;
-    ci.codeSize = s.opcodes_.size() * 4;
-    ci.pCode = s.opcodes_.data();
-    s.module_ = device.createShaderModuleUnique(ci);
-
-    s.ok_ = true;
+    s.code_ = s.opcodes_;
+    create(device);
   }
 
   /// Construct a shader module from a memory
   template<class InIter>
   ShaderModule(const vk::Device &device, InIter begin, InIter end) {
     s.opcodes_.assign(begin, end);
-    vk::ShaderModuleCreateInfo ci;
-    ci.codeSize = s.opcodes_.size() * 4;
-    ci.pCode = s.opcodes_.data();
-    s.module_ = device.createShaderModuleUnique(ci);
+    s.code_ = s.opcodes_;
+    create(device);
+  }
 
-    s.ok_ = true;
+  /// Construct a shader module from SPIR-V that outlives it, eg. an array made by vookoo_embed_spirv.
+  /// The code is used in place, not copied.
+  ShaderModule(const vk::Device &device, std::span<const uint32_t> code) {
+    s.code_ = code;
+    create(device);
+  }
+
+#ifdef VOOKOO_SHADERC_SUPPORT
+  /// Construct a shader module by compiling a GLSL file, or fetching it from the compiler's cache.
+  /// If compilation fails the errors are printed and ok() is false.
+  ShaderModule(const vk::Device &device, const ShaderCompiler &compiler, const std::string &filename,
+               vk::ShaderStageFlagBits stage, const ShaderCompileOptions &options = {}) {
+    auto result = compiler.compileFile(filename, stage, options);
+    if (!result.ok) {
+      return;
+    }
+
+    s.opcodes_ = std::move(result.spirv);
+    s.code_ = s.opcodes_;
+    create(device);
   }
+#endif
 
 #ifdef VOOKOO_SPIRV_SUPPORT
   /// A variable in a shader.
@@ -762,37 +2261,37 @@ public:
   /// This exposes the Uniforms, inputs, outputs, push constants.
   /// See spv::StorageClass for more details.
   std::vector<Variable> getVariables() const {
-    auto bound = s.opcodes_[3];
+    auto bound = s.code_[3];
 
     std::unordered_map<int, int> bindings;
     std::unordered_map<int, int> locations;
     std::unordered_map<int, int> sets;
     std::unordered_map<int, std::string> debugNames;
 
-    for (int i = 5; i != s.opcodes_.size(); i += s.opcodes_[i] >> 16) {
-      spv::Op op = spv::Op(s.opcodes_[i] & 0xffff);
+    for (int i = 5; i != s.code_.size(); i += s.code_[i] >> 16) {
+      spv::Op op = spv::Op(s.code_[i] & 0xffff);
       if (op == spv::Op::OpDecorate) {
-        int name = s.opcodes_[i + 1];
-        auto decoration = spv::Decoration(s.opcodes_[i + 2]);
+        int name = s.code_[i + 1];
+        auto decoration = spv::Decoration(s.code_[i + 2]);
         if (decoration == spv::Decoration::Binding) {
-          bindings[name] = s.opcodes_[i + 3];
+          bindings[name] = s.code_[i + 3];
         } else if (decoration == spv::Decoration::Location) {
-          locations[name] = s.opcodes_[i + 3];
+          locations[name] = s.code_[i + 3];
         } else if (decoration == spv::Decoration::DescriptorSet) {
-          sets[name] = s.opcodes_[i + 3];
+          sets[name] = s.code_[i + 3];
         }
       } else if (op == spv::Op::OpName) {
-        int name = s.opcodes_[i + 1];
-        debugNames[name] = (const char *)&s.opcodes_[i + 2];
+        int name = s.code_[i + 1];
+        debugNames[name] = (const char *)&s.code_[i + 2];
       }
     }
 
     std::vector<Variable> result;
-    for (int i = 5; i != s.opcodes_.size(); i += s.opcodes_[i] >> 16) {
-      spv::Op op = spv::Op(s.opcodes_[i] & 0xffff);
+    for (int i = 5; i != s.code_.size(); i += s.code_[i] >> 16) {
+      spv::Op op = spv::Op(s.code_[i] & 0xffff);
       if (op == spv::Op::OpVariable) {
-        int name = s.opcodes_[i + 1];
-        auto sc = spv::StorageClass(s.opcodes_[i + 3]);
+        int name = s.code_[i + 1];
+        auto sc = spv::StorageClass(s.code_[i + 3]);
         Variable b;
         b.debugName = debugNames[name];
         b.name = name;
@@ -810,19 +2309,22 @@ public:
   [[nodiscard]] bool ok() const { return s.ok_; }
   [[nodiscard]] VkShaderModule module() const { return *s.module_; }
 
+  /// The SPIR-V words of the shader.
+  [[nodiscard]] std::span<const uint32_t> code() const { return s.code_; }
+
   /// Write a C++ consumable dump of the shader.
   /// Todo: make this more idiomatic.
   std::ostream &write(std::ostream &os) const {
     os << "static const uint32_t shader[] = {\n";
     char tmp[256];
-    auto p = s.opcodes_.begin();
+    auto p = s.code_.begin();
     snprintf(
       tmp, sizeof(tmp), "  0x%08x,0x%08x,0x%08x,0x%08x,0x%08x,\n", p[0], p[1], p[2], p[3], p[4]);
     os << tmp;
-    for (int i = 5; i != s.opcodes_.size(); i += static_cast<int>(s.opcodes_[i] >> 16)) {
+    for (int i = 5; i != s.code_.size(); i += static_cast<int>(s.code_[i] >> 16)) {
       char *ptr = tmp + 2, *e = tmp + sizeof(tmp) - 2;
-      for (int j = i; j != i + (s.opcodes_[i] >> 16); ++j) {
-        ptr += snprintf(ptr, e-ptr, "0x%08x,", s.opcodes_[j]);
+      for (int j = i; j != i + (s.code_[i] >> 16); ++j) {
+        ptr += snprintf(ptr, e-ptr, "0x%08x,", s.code_[j]);
         if (ptr > e-16) { *ptr++ = '\n'; *ptr = 0; os << tmp; ptr = tmp + 2; }
       }
       *ptr++ = '\n';
@@ -834,8 +2336,21 @@ public:
   }
 
 private:
+  // Make the module from s.code_.
+  void create(const vk::Device &device) {
+    vk::ShaderModuleCreateInfo ci;
+    ci.codeSize = s.code_.size_bytes();
+    ci.pCode = s.code_.data();
+    s.module_ = device.createShaderModuleUnique(ci);
+
+    s.ok_ = true;
+  }
+
   struct State {
+    // Owned SPIR-V, unless the module was made from a span.
     std::vector<uint32_t> opcodes_;
+    // The SPIR-V in use, either opcodes_ or the caller's span.
+    std::span<const uint32_t> code_;
     vk::UniqueShaderModule module_;
     bool ok_ = false;
   };
@@ -897,6 +2412,56 @@ struct SpecConst {
 
 };
 
+/// A byte string that identifies pipeline state, built field by field.
+/// Used by PipelineRegistry to find pipelines that have already been built.
+/// Handles such as shader modules and layouts are identified by value, not contents.
+class PipelineKey {
+public:
+  PipelineKey() = default;
+
+  /// Add a plain value such as an enum, flag set, number or handle.
+  template<class T>
+  PipelineKey &add(const T &value) {
+    static_assert(std::is_trivially_copyable_v<T>, "PipelineKey::add needs a plain value");
+    key_.append(reinterpret_cast<const char *>(&value), sizeof(value));
+    return *this;
+  }
+
+  /// Add a string, or nothing if str is null.
+  PipelineKey &add(const char *str) {
+    std::string_view view = str ? str : "";
+    add(view.size());
+    key_.append(view);
+    return *this;
+  }
+
+  /// Add raw bytes.
+  PipelineKey &add(const void *data, size_t size) {
+    add(size);
+    if (size) key_.append(static_cast<const char *>(data), size);
+    return *this;
+  }
+
+  /// Add a shader stage with its entry point and specialization constants.
+  PipelineKey &add(const vk::PipelineShaderStageCreateInfo &stage) {
+    add(stage.flags).add(stage.stage).add(stage.module).add(stage.pName);
+    auto spec = stage.pSpecializationInfo;
+    add(spec ? spec->mapEntryCount : 0U);
+    if (spec) {
+      for (uint32_t i = 0; i != spec->mapEntryCount; ++i) {
+        auto &entry = spec->pMapEntries[i];
+        add(entry.constantID).add(entry.offset).add(entry.size);
+      }
+      add(spec->pData, spec->dataSize);
+    }
+    return *this;
+  }
+
+  [[nodiscard]] const std::string &str() const { return key_; }
+private:
+  std::string key_;
+};
+
 /// A class for building pipelines.
 /// All the state of the pipeline is exposed through individual calls.
 /// The pipeline encapsulates all the OpenGL state in a single object.
@@ -955,14 +2520,207 @@ public:
 	init();
   }
   
+  /// A graphics pipeline create info plus the state it points to that is not stored in the maker.
+  /// The maker must outlive it, and it must not be copied as it points at itself.
+  struct CreateInfo {
+    vk::GraphicsPipelineCreateInfo info;
+    vk::PipelineViewportStateCreateInfo viewportState;
+    vk::PipelineVertexInputStateCreateInfo vertexInputState;
+    vk::PipelineDynamicStateCreateInfo dynamicState;
+    vk::PipelineColorBlendStateCreateInfo colorBlendState;
+    vk::PipelineColorBlendAttachmentState defaultBlend;
+
+    CreateInfo() = default;
+    CreateInfo(const CreateInfo &) = delete;
+    CreateInfo &operator=(const CreateInfo &) = delete;
+  };
+
   vk::UniquePipeline createUnique(const vk::Device &device,
                             const vk::PipelineCache &pipelineCache,
                             const vk::PipelineLayout &pipelineLayout,
-                            const vk::RenderPass &renderPass, bool defaultBlend=true) {
+                            const vk::RenderPass &renderPass, bool defaultBlend=true) const {
+    CreateInfo ci;
+    createInfo(ci, pipelineLayout, renderPass, defaultBlend);
+
+    auto [result, pipeline] = device.createGraphicsPipelineUnique(pipelineCache, ci.info);
+    // TODO check result for vk::Result::ePipelineCompileRequiredEXT
+    return std::move(pipeline);
+  }
+
+  /// A key covering everything createUnique() would use to build the pipeline.
+  /// Makers with equal keys build identical pipelines.
+  /// With parts, the key covers only the state of those graphics pipeline library parts.
+  [[nodiscard]] PipelineKey key(const vk::PipelineLayout &pipelineLayout,
+                                const vk::RenderPass &renderPass, bool defaultBlend=true,
+                                vk::GraphicsPipelineLibraryFlagsEXT parts = allLibraryParts()) const {
+    typedef vk::GraphicsPipelineLibraryFlagBitsEXT gpl;
+    PipelineKey key;
+    key.add(parts);
+
+    // Vertex input alone does not depend on the layout or render pass.
+    if (parts & ~vk::GraphicsPipelineLibraryFlagsEXT(gpl::eVertexInputInterface)) {
+      key.add(pipelineLayout).add(renderPass).add(subpass_);
+    }
+
+    key.add(dynamicState_.size());
+    for (auto &d : dynamicState_) key.add(d);
+
+    // Leave out state set while recording, so makers that differ only in that share a pipeline.
+    typedef vk::DynamicState dyn;
+    auto unlessDynamic = [&](vk::DynamicState state, const auto &value) {
+      if (!isDynamic(state)) key.add(value);
+    };
+
+    auto addStages = [&](bool fragment) {
+      for (auto &stage : modules_) {
+        if ((stage.stage == vk::ShaderStageFlagBits::eFragment) == fragment) key.add(stage);
+      }
+    };
+
+    auto addMultisample = [&]() {
+      auto &ms = multisampleState_;
+      key.add(ms.flags).add(ms.rasterizationSamples).add(ms.sampleShadingEnable).add(ms.minSampleShading);
+      auto maskWords = ms.pSampleMask ? (static_cast<uint32_t>(ms.rasterizationSamples) + 31) / 32 : 0;
+      key.add(ms.pSampleMask, maskWords * sizeof(vk::SampleMask));
+      key.add(ms.alphaToCoverageEnable).add(ms.alphaToOneEnable);
+    };
+
+    if (parts & gpl::eVertexInputInterface) {
+      key.add(vertexBindingDescriptions_.size());
+      for (auto &b : vertexBindingDescriptions_) key.add(b.binding).add(b.stride).add(b.inputRate);
+      key.add(vertexAttributeDescriptions_.size());
+      for (auto &a : vertexAttributeDescriptions_) key.add(a.location).add(a.binding).add(a.format).add(a.offset);
+
+      auto &ia = inputAssemblyState_;
+      key.add(ia.flags).add(ia.topology).add(ia.primitiveRestartEnable);
+    }
+
+    if (parts & gpl::ePreRasterizationShaders) {
+      addStages(false);
+      key.add(tessellationState_.patchControlPoints);
+
+      key.add(viewport_.size());
+      if (!isDynamic(dyn::eViewport)) {
+        for (auto &v : viewport_) key.add(v.x).add(v.y).add(v.width).add(v.height).add(v.minDepth).add(v.maxDepth);
+      }
+      key.add(scissor_.size());
+      if (!isDynamic(dyn::eScissor)) {
+        for (auto &s : scissor_) key.add(s.offset.x).add(s.offset.y).add(s.extent.width).add(s.extent.height);
+      }
+
+      auto &rs = rasterizationState_;
+      key.add(rs.flags);
+      unlessDynamic(dyn::eDepthClampEnableEXT, rs.depthClampEnable);
+      unlessDynamic(dyn::eRasterizerDiscardEnable, rs.rasterizerDiscardEnable);
+      unlessDynamic(dyn::ePolygonModeEXT, rs.polygonMode);
+      unlessDynamic(dyn::eCullMode, rs.cullMode);
+      unlessDynamic(dyn::eFrontFace, rs.frontFace);
+      unlessDynamic(dyn::eDepthBiasEnable, rs.depthBiasEnable);
+      unlessDynamic(dyn::eDepthBias, rs.depthBiasConstantFactor);
+      unlessDynamic(dyn::eDepthBias, rs.depthBiasClamp);
+      unlessDynamic(dyn::eDepthBias, rs.depthBiasSlopeFactor);
+      unlessDynamic(dyn::eLineWidth, rs.lineWidth);
+    }
+
+    if (parts & gpl::eFragmentShader) {
+      addStages(true);
+      addMultisample();
+
+      auto &ds = depthStencilState_;
+      key.add(ds.flags);
+      unlessDynamic(dyn::eDepthTestEnable, ds.depthTestEnable);
+      unlessDynamic(dyn::eDepthWriteEnable, ds.depthWriteEnable);
+      unlessDynamic(dyn::eDepthCompareOp, ds.depthCompareOp);
+      key.add(ds.depthBoundsTestEnable);
+      unlessDynamic(dyn::eStencilTestEnable, ds.stencilTestEnable);
+      for (auto &op : {ds.front, ds.back}) {
+        key.add(op.failOp).add(op.passOp).add(op.depthFailOp).add(op.compareOp);
+        key.add(op.compareMask).add(op.writeMask).add(op.reference);
+      }
+      key.add(ds.minDepthBounds).add(ds.maxDepthBounds);
+    }
+
+    if (parts & gpl::eFragmentOutputInterface) {
+      addMultisample();
+
+      auto &cb = colorBlendState_;
+      key.add(cb.flags).add(cb.logicOpEnable).add(cb.logicOp);
+      unlessDynamic(dyn::eBlendConstants, cb.blendConstants);
+      key.add(colorBlendAttachments_.size()).add(defaultBlend && colorBlendAttachments_.empty());
+      for (auto &a : colorBlendAttachments_) {
+        key.add(a.blendEnable).add(a.srcColorBlendFactor).add(a.dstColorBlendFactor).add(a.colorBlendOp);
+        key.add(a.srcAlphaBlendFactor).add(a.dstAlphaBlendFactor).add(a.alphaBlendOp).add(a.colorWriteMask);
+      }
+    }
+    return key;
+  }
+
+  /// All four parts of a graphics pipeline library.
+  static vk::GraphicsPipelineLibraryFlagsEXT allLibraryParts() {
+    typedef vk::GraphicsPipelineLibraryFlagBitsEXT gpl;
+    return gpl::eVertexInputInterface|gpl::ePreRasterizationShaders|gpl::eFragmentShader|gpl::eFragmentOutputInterface;
+  }
+
+  /// Create some parts of this pipeline as a library (VK_EXT_graphics_pipeline_library).
+  /// Link libraries covering all four parts with link(). PipelineLibrary does this for you.
+  vk::UniquePipeline createLibraryUnique(const vk::Device &device,
+                            const vk::PipelineCache &pipelineCache,
+                            const vk::PipelineLayout &pipelineLayout,
+                            const vk::RenderPass &renderPass,
+                            vk::GraphicsPipelineLibraryFlagsEXT parts, bool defaultBlend=true) const {
+    typedef vk::GraphicsPipelineLibraryFlagBitsEXT gpl;
+    CreateInfo ci;
+    createInfo(ci, pipelineLayout, renderPass, defaultBlend);
+
+    // Each shader stage belongs to one part; state of other parts is ignored.
+    std::vector<vk::PipelineShaderStageCreateInfo> stages;
+    for (auto &stage : modules_) {
+      bool fragment = stage.stage == vk::ShaderStageFlagBits::eFragment;
+      if (parts & (fragment ? gpl::eFragmentShader : gpl::ePreRasterizationShaders)) stages.push_back(stage);
+    }
+    ci.info.stageCount = static_cast<uint32_t>(stages.size());
+    ci.info.pStages = stages.data();
+
+    vk::GraphicsPipelineLibraryCreateInfoEXT libraryInfo{parts};
+    ci.info.pNext = &libraryInfo;
+    ci.info.flags |= vk::PipelineCreateFlagBits::eLibraryKHR|vk::PipelineCreateFlagBits::eRetainLinkTimeOptimizationInfoEXT;
+
+    auto [result, pipeline] = device.createGraphicsPipelineUnique(pipelineCache, ci.info);
+    return std::move(pipeline);
+  }
+
+  /// Link libraries made by createLibraryUnique() into a pipeline.
+  /// Without optimize this is quick but the pipeline may run slower;
+  /// with it the link may take as long as building the whole pipeline.
+  static vk::UniquePipeline link(const vk::Device &device,
+                            const vk::PipelineCache &pipelineCache,
+                            const vk::PipelineLayout &pipelineLayout,
+                            vk::ArrayProxy<const vk::Pipeline> const &libraries, bool optimize=false) {
+    vk::PipelineLibraryCreateInfoKHR libraryInfo{libraries.size(), libraries.data()};
+    vk::GraphicsPipelineCreateInfo pipelineInfo{};
+    pipelineInfo.pNext = &libraryInfo;
+    pipelineInfo.layout = pipelineLayout;
+    if (optimize) pipelineInfo.flags = vk::PipelineCreateFlagBits::eLinkTimeOptimizationEXT;
+
+    auto [result, pipeline] = device.createGraphicsPipelineUnique(pipelineCache, pipelineInfo);
+    return std::move(pipeline);
+  }
 
-    // Add default colour blend attachment if necessary.
+  /// Fill in ci for this pipeline without creating it.
+  /// PipelineCompiler uses this to create many pipelines in one call.
+  /// The maker is left unchanged, so its key() stays the same after building.
+  void createInfo(CreateInfo &ci,
+                  const vk::PipelineLayout &pipelineLayout,
+                  const vk::RenderPass &renderPass, bool defaultBlend=true) const {
+    // Use a default colour blend attachment if necessary.
+    auto &colorBlendState = ci.colorBlendState;
+    colorBlendState = colorBlendState_;
+    auto count = static_cast<uint32_t>(colorBlendAttachments_.size());
+    colorBlendState.attachmentCount = count;
+    colorBlendState.pAttachments = count ? colorBlendAttachments_.data() : nullptr;
     if (colorBlendAttachments_.empty() && defaultBlend) {
-      vk::PipelineColorBlendAttachmentState blend{};
+      auto &blend = ci.defaultBlend;
+      blend = vk::PipelineColorBlendAttachmentState{};
       blend.blendEnable = 0;
       blend.srcColorBlendFactor = vk::BlendFactor::eOne;
       blend.dstColorBlendFactor = vk::BlendFactor::eZero;
@@ -972,25 +2730,29 @@ public:
       blend.alphaBlendOp = vk::BlendOp::eAdd;
       typedef vk::ColorComponentFlagBits ccbf;
       blend.colorWriteMask = ccbf::eR|ccbf::eG|ccbf::eB|ccbf::eA;
-      colorBlendAttachments_.push_back(blend);
+      colorBlendState.attachmentCount = 1;
+      colorBlendState.pAttachments = &blend;
     }
 
-    auto count = static_cast<uint32_t>(colorBlendAttachments_.size());
-    colorBlendState_.attachmentCount = count;
-    colorBlendState_.pAttachments = count ? colorBlendAttachments_.data() : nullptr;
-
-    vk::PipelineViewportStateCreateInfo viewportState{
-        {}, static_cast<uint32_t>(viewport_.size()), viewport_.data(), static_cast<uint32_t>(scissor_.size()), scissor_.data()};
+    // A dynamic viewport or scissor still needs a count.
+    auto viewportCount = viewport_.empty() && isDynamic(vk::DynamicState::eViewport) ? 1U : static_cast<uint32_t>(viewport_.size());
+    auto scissorCount = scissor_.empty() && isDynamic(vk::DynamicState::eScissor) ? 1U : static_cast<uint32_t>(scissor_.size());
+    auto &viewportState = ci.viewportState;
+    viewportState = vk::PipelineViewportStateCreateInfo{
+        {}, viewportCount, viewport_.empty() ? nullptr : viewport_.data(), scissorCount, scissor_.empty() ? nullptr : scissor_.data()};
 
-    vk::PipelineVertexInputStateCreateInfo vertexInputState;
+    auto &vertexInputState = ci.vertexInputState;
+    vertexInputState = vk::PipelineVertexInputStateCreateInfo{};
     vertexInputState.vertexAttributeDescriptionCount = static_cast<uint32_t>(vertexAttributeDescriptions_.size());
     vertexInputState.pVertexAttributeDescriptions = vertexAttributeDescriptions_.data();
     vertexInputState.vertexBindingDescriptionCount = static_cast<uint32_t>(vertexBindingDescriptions_.size());
     vertexInputState.pVertexBindingDescriptions = vertexBindingDescriptions_.data();
 
-    vk::PipelineDynamicStateCreateInfo dynState{{}, static_cast<uint32_t>(dynamicState_.size()), dynamicState_.data()};
+    auto &dynState = ci.dynamicState;
+    dynState = vk::PipelineDynamicStateCreateInfo{{}, static_cast<uint32_t>(dynamicState_.size()), dynamicState_.data()};
 
-    vk::GraphicsPipelineCreateInfo pipelineInfo{};
+    auto &pipelineInfo = ci.info;
+    pipelineInfo = vk::GraphicsPipelineCreateInfo{};
     pipelineInfo.pVertexInputState = &vertexInputState;
     pipelineInfo.stageCount = static_cast<uint32_t>(modules_.size());
     pipelineInfo.pStages = modules_.data();
@@ -998,17 +2760,13 @@ public:
     pipelineInfo.pViewportState = &viewportState;
     pipelineInfo.pRasterizationState = &rasterizationState_;
     pipelineInfo.pMultisampleState = &multisampleState_;
-    pipelineInfo.pColorBlendState = &colorBlendState_;
+    pipelineInfo.pColorBlendState = &colorBlendState;
     pipelineInfo.pDepthStencilState = &depthStencilState_;
     pipelineInfo.layout = pipelineLayout;
     pipelineInfo.renderPass = renderPass;
     pipelineInfo.pDynamicState = dynamicState_.empty() ? nullptr : &dynState;
     pipelineInfo.subpass = subpass_;
     pipelineInfo.pTessellationState = &tessellationState_;
-
-    auto [result, pipeline] = device.createGraphicsPipelineUnique(pipelineCache, pipelineInfo);
-    // TODO check result for vk::Result::ePipelineCompileRequiredEXT
-    return std::move(pipeline);
   }
 
   /// Add a shader module to the pipeline.
@@ -1190,6 +2948,45 @@ public:
   PipelineMaker &blendConstants(float r, float g, float b, float a) { float *bc = colorBlendState_.blendConstants; bc[0] = r; bc[1] = g; bc[2] = b; bc[3] = a; return *this; }
 
   PipelineMaker &dynamicState(vk::DynamicState value) { dynamicState_.push_back(value); return *this; }
+
+  /// Use the module to instead of from in every stage, eg. after recompiling a shader.
+  PipelineMaker &replaceShader(vk::ShaderModule from, vk::ShaderModule to) {
+    for (auto &stage : modules_) {
+      if (stage.module == from) stage.module = to;
+    }
+    return *this;
+  }
+
+  /// Make the viewport, scissor and the extended states in support dynamic.
+  /// One pipeline then serves every window size and cull or depth setting.
+  /// Set the viewport with Window::setViewport() and the rest with DynamicStateRecorder.
+  PipelineMaker &dynamicProfile(const DynamicStateSupport &support = {}) {
+    for (auto state : support.states()) {
+      if (!isDynamic(state)) dynamicState_.push_back(state);
+    }
+    return *this;
+  }
+
+  /// Returns true if state has been made dynamic.
+  [[nodiscard]] bool isDynamic(vk::DynamicState state) const {
+    return std::find(dynamicState_.begin(), dynamicState_.end(), state) != dynamicState_.end();
+  }
+
+  /// The values this maker has for the states that dynamicProfile() makes dynamic.
+  [[nodiscard]] DynamicStateValues dynamicValues() const {
+    DynamicStateValues values;
+    values.cullMode = rasterizationState_.cullMode;
+    values.frontFace = rasterizationState_.frontFace;
+    values.depthTestEnable = depthStencilState_.depthTestEnable;
+    values.depthWriteEnable = depthStencilState_.depthWriteEnable;
+    values.depthCompareOp = depthStencilState_.depthCompareOp;
+    values.stencilTestEnable = depthStencilState_.stencilTestEnable;
+    values.depthBiasEnable = rasterizationState_.depthBiasEnable;
+    values.rasterizerDiscardEnable = rasterizationState_.rasterizerDiscardEnable;
+    values.polygonMode = rasterizationState_.polygonMode;
+    values.depthClampEnable = rasterizationState_.depthClampEnable;
+    return values;
+  }
 private:
   vk::PipelineInputAssemblyStateCreateInfo inputAssemblyState_;
   std::vector<vk::Viewport> viewport_;
@@ -1284,685 +3081,4060 @@ public:
     return *this;
   }
 
+  /// Add a shader module with specialized constants to the pipeline.
+  ComputePipelineMaker& shader(vk::ShaderStageFlagBits stage, const vku::ShaderModule &shader,
+                 std::vector<SpecConst> specConstants,
+                 const char *entryPoint = "main") {
+    specConstants_ = std::move(specConstants);
+    updateSpecData();
+    return this->shader(stage, shader, entryPoint);
+  }
+
+  /// Set one specialization constant, replacing any earlier value with the same id.
+  /// eg. specConstant(0, 64U) for a shader with layout(local_size_x_id = 0) in;
+  template<class T>
+  ComputePipelineMaker &specConstant(uint32_t constantID, T value) {
+    std::erase_if(specConstants_, [=](const SpecConst &c) { return c.constantID == constantID; });
+    specConstants_.emplace_back(constantID, value);
+    updateSpecData();
+    return *this;
+  }
+
   /// Set the compute shader module.
+  /// This replaces any specialization constants with those of value.
   ComputePipelineMaker &module(const vk::PipelineShaderStageCreateInfo &value) {
     stage_ = value;
+    specConstants_.clear();
+    specData_.reset();
     return *this;
   }
 
   /// Create a managed handle to a compute shader.
   [[nodiscard]] vk::UniquePipeline createUnique(vk::Device device, const vk::PipelineCache &pipelineCache, const vk::PipelineLayout &pipelineLayout) const {
-    vk::ComputePipelineCreateInfo pipelineInfo{};
+    auto [ result, pipeline ] = device.createComputePipelineUnique(pipelineCache, createInfo(pipelineLayout));
+    // TODO check result for vk::Result::ePipelineCompileRequiredEXT
+    return std::move(pipeline);
+  }
 
+  /// The create info for this pipeline. The maker must outlive it.
+  [[nodiscard]] vk::ComputePipelineCreateInfo createInfo(const vk::PipelineLayout &pipelineLayout) const {
+    vk::ComputePipelineCreateInfo pipelineInfo{};
     pipelineInfo.stage = stage_;
     pipelineInfo.layout = pipelineLayout;
+    return pipelineInfo;
+  }
 
-    auto [ result, pipeline ] = device.createComputePipelineUnique(pipelineCache, pipelineInfo);
-    // TODO check result for vk::Result::ePipelineCompileRequiredEXT
-    return std::move(pipeline);
+  /// A key covering everything createUnique() would use to build the pipeline.
+  [[nodiscard]] PipelineKey key(const vk::PipelineLayout &pipelineLayout) const {
+    PipelineKey key;
+    key.add(pipelineLayout).add(stage_);
+    return key;
   }
 private:
+  void updateSpecData() {
+    // Copies of the maker share the data, which is never changed once made.
+    specData_ = std::make_shared<PipelineMaker::SpecData>(specConstants_);
+    stage_.pSpecializationInfo = &specData_->specializationInfo_;
+  }
+
   vk::PipelineShaderStageCreateInfo stage_;
+  std::vector<SpecConst> specConstants_;
+  std::shared_ptr<PipelineMaker::SpecData> specData_;
 };
 
-/// A generic buffer that may be used as a vertex buffer, uniform buffer or other kinds of memory resident data.
-/// Buffers require memory objects which represent GPU and CPU resources.
-class GenericBuffer {
+/// Build many graphics and compute pipelines on a pool of worker threads.
+/// Pipelines that share a pipeline cache are grouped into single vkCreate*Pipelines calls
+/// and the groups are shared out among the workers.
+///
+/// The makers and the cache must stay alive until the futures are ready.
+///
+/// Example:
+///
+///     vku::PipelineCompiler compiler{device};
+///     auto opaque = compiler.add(opaqueMaker, cache, layout, renderPass);
+///     auto blended = compiler.add(blendedMaker, cache, layout, renderPass);
+///     compiler.compile();
+///     auto opaquePipeline = opaque.get();
+///
+class PipelineCompiler {
 public:
-  GenericBuffer() = default;
+  /// How long one pipeline took to build.
+  struct Timing {
+    /// Build time in nanoseconds.
+    /// This comes from the driver when creation feedback is on, otherwise it is the time of the whole call.
+    uint64_t nanoseconds = 0;
 
-  GenericBuffer(vk::Device device, const vk::PhysicalDeviceMemoryProperties &memprops, vk::BufferUsageFlags usage, vk::DeviceSize size, vk::MemoryPropertyFlags memflags = vk::MemoryPropertyFlagBits::eDeviceLocal) {
-    // Create the buffer object without memory.
-    vk::BufferCreateInfo ci{};
-    ci.size = size_ = size;
-    ci.usage = usage;
-    ci.sharingMode = vk::SharingMode::eExclusive;
-    buffer_ = device.createBufferUnique(ci);
+    /// Number of pipelines created by the same call.
+    uint32_t batchSize = 0;
 
-    // Find out how much memory and which heap to allocate from.
-    auto memreq = device.getBufferMemoryRequirements(*buffer_);
+    /// True if nanoseconds came from pipeline creation feedback.
+    bool fromDriver = false;
 
-    // Create a memory object to bind to the buffer.
-    vk::MemoryAllocateInfo mai{};
-    mai.allocationSize = memreq.size;
-    mai.memoryTypeIndex = vku::findMemoryTypeIndex(memprops, memreq.memoryTypeBits, memflags);
-    mem_ = device.allocateMemoryUnique(mai);
+    /// True if the driver reported a pipeline cache hit.
+    bool cacheHit = false;
 
-    device.bindBufferMemory(*buffer_, *mem_, 0);
-  }
+    /// True if the pipeline was created.
+    bool ok = false;
+  };
 
-  /// For a host visible buffer, copy memory to the buffer object.
-  void updateLocal(const vk::Device &device, const void *value, vk::DeviceSize size) const {
-    void *ptr = device.mapMemory(*mem_, 0, size_, vk::MemoryMapFlags{});
-    memcpy(ptr, value, (size_t)size);
-    flush(device);
-    device.unmapMemory(*mem_);
+  /// Start threads workers (one per core if zero) making up to maxBatch pipelines per call.
+  /// creationFeedback needs Vulkan 1.3 or VK_EXT_pipeline_creation_feedback and gives true per-pipeline times.
+  PipelineCompiler(vk::Device device, uint32_t threads = 0, uint32_t maxBatch = 16, bool creationFeedback = false)
+  : device_(device), maxBatch_(std::max(maxBatch, 1U)), creationFeedback_(creationFeedback) {
+    if (threads == 0) threads = std::max(std::thread::hardware_concurrency(), 1U);
+    for (uint32_t i = 0; i != threads; ++i) {
+      workers_.emplace_back([this] { work(); });
+    }
   }
 
-  /// For a purely device local buffer, copy memory to the buffer object immediately.
-  /// Note that this will stall the pipeline!
-  void upload(vk::Device device, const vk::PhysicalDeviceMemoryProperties &memprops, vk::CommandPool commandPool, vk::Queue queue, const void *value, vk::DeviceSize size) const {
-    if (size == 0) return;
-    using buf = vk::BufferUsageFlagBits;
-    using pfb = vk::MemoryPropertyFlagBits;
-    auto tmp = vku::GenericBuffer(device, memprops, buf::eTransferSrc, size, pfb::eHostVisible);
-    tmp.updateLocal(device, value, size);
+  PipelineCompiler(const PipelineCompiler &) = delete;
+  PipelineCompiler &operator=(const PipelineCompiler &) = delete;
+
+  /// Queue a graphics pipeline. Nothing is built until compile() is called.
+  std::future<vk::UniquePipeline> add(PipelineMaker &maker, vk::PipelineCache cache, vk::PipelineLayout layout, vk::RenderPass renderPass, bool defaultBlend = true) {
+    auto job = std::make_unique<GraphicsJob>();
+    maker.createInfo(job->ci, layout, renderPass, defaultBlend);
+    auto future = job->promise.get_future();
+    std::lock_guard<std::mutex> lock(mutex_);
+    job->index = timings_.size();
+    timings_.emplace_back();
+    graphics_[static_cast<VkPipelineCache>(cache)].push_back(std::move(job));
+    return future;
+  }
 
-    vku::executeImmediately(device, commandPool, queue, [&](vk::CommandBuffer cb) {
-      vk::BufferCopy bc{0, 0, size};
-      cb.copyBuffer(tmp.buffer(), *buffer_, bc);
-    });
+  /// Queue a compute pipeline. Nothing is built until compile() is called.
+  std::future<vk::UniquePipeline> add(const ComputePipelineMaker &maker, vk::PipelineCache cache, vk::PipelineLayout layout) {
+    auto job = std::make_unique<ComputeJob>();
+    job->info = maker.createInfo(layout);
+    auto future = job->promise.get_future();
+    std::lock_guard<std::mutex> lock(mutex_);
+    job->index = timings_.size();
+    timings_.emplace_back();
+    compute_[static_cast<VkPipelineCache>(cache)].push_back(std::move(job));
+    return future;
   }
 
-  template<typename T>
-  void upload(vk::Device device, const vk::PhysicalDeviceMemoryProperties &memprops, vk::CommandPool commandPool, vk::Queue queue, const std::vector<T> &value) const {
-    upload(device, memprops, commandPool, queue, value.data(), value.size() * sizeof(T));
+  /// Hand every queued pipeline to the workers.
+  void compile() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      dispatch(graphics_, [this](vk::PipelineCache cache, std::vector<std::unique_ptr<GraphicsJob>> &jobs) {
+        std::vector<vk::GraphicsPipelineCreateInfo> infos;
+        for (auto &job : jobs) infos.push_back(job->ci.info);
+        build(jobs, infos, [&](uint32_t count, const vk::GraphicsPipelineCreateInfo *pInfos, vk::Pipeline *pipelines) {
+          return device_.createGraphicsPipelines(cache, count, pInfos, nullptr, pipelines);
+        });
+      });
+      dispatch(compute_, [this](vk::PipelineCache cache, std::vector<std::unique_ptr<ComputeJob>> &jobs) {
+        std::vector<vk::ComputePipelineCreateInfo> infos;
+        for (auto &job : jobs) infos.push_back(job->info);
+        build(jobs, infos, [&](uint32_t count, const vk::ComputePipelineCreateInfo *pInfos, vk::Pipeline *pipelines) {
+          return device_.createComputePipelines(cache, count, pInfos, nullptr, pipelines);
+        });
+      });
+    }
+    ready_.notify_all();
   }
 
-  template<typename T>
-  void upload(vk::Device device, const vk::PhysicalDeviceMemoryProperties &memprops, vk::CommandPool commandPool, vk::Queue queue, const T &value) const {
-    upload(device, memprops, commandPool, queue, &value, sizeof(value));
+  /// Block until every pipeline passed to compile() has been built.
+  void wait() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    idle_.wait(lock, [this] { return outstanding_ == 0; });
   }
 
-  void barrier(vk::CommandBuffer cb, vk::PipelineStageFlags srcStageMask, vk::PipelineStageFlags dstStageMask, vk::DependencyFlags dependencyFlags, vk::AccessFlags srcAccessMask, vk::AccessFlags dstAccessMask, uint32_t srcQueueFamilyIndex, uint32_t dstQueueFamilyIndex) const {
-    vk::BufferMemoryBarrier bmb{srcAccessMask, dstAccessMask, srcQueueFamilyIndex, dstQueueFamilyIndex, *buffer_, 0, size_};
-    cb.pipelineBarrier(srcStageMask, dstStageMask, dependencyFlags, nullptr, bmb, nullptr);
+  /// Timings for every pipeline added so far, in the order they were added.
+  /// Entries for pipelines that have not been built yet are zero.
+  [[nodiscard]] std::vector<Timing> timings() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return timings_;
   }
 
-  template<class Type, class Allocator>
-  void updateLocal(const vk::Device &device, const std::vector<Type, Allocator> &value) const {
-    updateLocal(device, static_cast<const void*>(value.data()), static_cast<vk::DeviceSize>(value.size() * sizeof(Type)));
+  ~PipelineCompiler() {
+    compile();
+    wait();
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stop_ = true;
+    }
+    ready_.notify_all();
+    for (auto &worker : workers_) worker.join();
   }
+private:
+  struct GraphicsJob {
+    PipelineMaker::CreateInfo ci;
+    std::promise<vk::UniquePipeline> promise;
+    size_t index = 0;
+  };
 
-  template<class Type>
-  void updateLocal(const vk::Device &device, const Type &value) const {
-    updateLocal(device, static_cast<const void*>(&value), static_cast<vk::DeviceSize>(sizeof(Type)));
+  struct ComputeJob {
+    vk::ComputePipelineCreateInfo info;
+    std::promise<vk::UniquePipeline> promise;
+    size_t index = 0;
+  };
+
+  // Split each cache's jobs into batches, enough to keep every worker busy. Called with the mutex held.
+  template<class Job, class Create>
+  void dispatch(std::map<VkPipelineCache, std::vector<std::unique_ptr<Job>>> &pending, Create create) {
+    size_t threads = workers_.size();
+    for (auto &[cache, jobs] : pending) {
+      size_t perBatch = std::clamp<size_t>((jobs.size() + threads - 1) / threads, 1, maxBatch_);
+      for (size_t begin = 0; begin < jobs.size(); begin += perBatch) {
+        auto end = std::min(begin + perBatch, jobs.size());
+        auto batch = std::make_shared<std::vector<std::unique_ptr<Job>>>(
+          std::make_move_iterator(jobs.begin() + begin), std::make_move_iterator(jobs.begin() + end));
+        tasks_.emplace_back([create, cache = vk::PipelineCache(cache), batch] { create(cache, *batch); });
+        ++outstanding_;
+      }
+    }
+    pending.clear();
   }
 
-  [[nodiscard]] void *map(const vk::Device &device) const { return device.mapMemory(*mem_, 0, size_, vk::MemoryMapFlags{}); };
-  void unmap(const vk::Device &device) const { return device.unmapMemory(*mem_); };
+  // Create one batch of pipelines, record the timings and fulfil the promises.
+  template<class Job, class Info, class Create>
+  void build(std::vector<std::unique_ptr<Job>> &jobs, std::vector<Info> &infos, Create create) {
+    auto count = static_cast<uint32_t>(infos.size());
+    std::vector<vk::PipelineCreationFeedback> feedback(count);
+    std::vector<vk::PipelineCreationFeedbackCreateInfo> feedbackInfo(count);
+    if (creationFeedback_) {
+      for (uint32_t i = 0; i != count; ++i) {
+        feedbackInfo[i].pPipelineCreationFeedback = &feedback[i];
+        feedbackInfo[i].pNext = infos[i].pNext;
+        infos[i].pNext = &feedbackInfo[i];
+      }
+    }
 
-  void flush(const vk::Device &device) const {
-    vk::MappedMemoryRange mr{*mem_, 0, VK_WHOLE_SIZE};
-    return device.flushMappedMemoryRanges(mr);
+    std::vector<vk::Pipeline> pipelines(count);
+    auto start = std::chrono::steady_clock::now();
+    vk::Result result = create(count, infos.data(), pipelines.data());
+    auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      typedef vk::PipelineCreationFeedbackFlagBits fbits;
+      for (uint32_t i = 0; i != count; ++i) {
+        auto &timing = timings_[jobs[i]->index];
+        bool valid = creationFeedback_ && (feedback[i].flags & fbits::eValid);
+        timing.nanoseconds = valid ? feedback[i].duration : static_cast<uint64_t>(elapsed);
+        timing.batchSize = count;
+        timing.fromDriver = valid;
+        timing.cacheHit = valid && (feedback[i].flags & fbits::eApplicationPipelineCacheHit);
+        timing.ok = static_cast<bool>(pipelines[i]);
+      }
+    }
+
+    // Pipelines the driver could not make throw from their future's get().
+    for (uint32_t i = 0; i != count; ++i) {
+      if (!pipelines[i] && result != vk::Result::eSuccess) {
+        jobs[i]->promise.set_exception(std::make_exception_ptr(vk::SystemError(vk::make_error_code(result), "vku::PipelineCompiler")));
+        continue;
+      }
+      jobs[i]->promise.set_value(vk::UniquePipeline(pipelines[i], vk::ObjectDestroy<vk::Device, VULKAN_HPP_DEFAULT_DISPATCHER_TYPE>(device_)));
+    }
   }
 
-  void invalidate(const vk::Device &device) const {
-    vk::MappedMemoryRange mr{*mem_, 0, VK_WHOLE_SIZE};
-    return device.invalidateMappedMemoryRanges(mr);
+  void work() {
+    for (;;) {
+      std::function<void ()> task;
+      {
+        std::unique_lock<std::mutex> lock(mutex_);
+        ready_.wait(lock, [this] { return stop_ || !tasks_.empty(); });
+        if (tasks_.empty()) return;
+        task = std::move(tasks_.front());
+        tasks_.pop_front();
+      }
+      task();
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        --outstanding_;
+      }
+      idle_.notify_all();
+    }
   }
 
-  [[nodiscard]] vk::Buffer buffer() const { return *buffer_; }
-  [[nodiscard]] vk::DeviceMemory mem() const { return *mem_; }
-  [[nodiscard]] vk::DeviceSize size() const { return size_; }
-private:
-  vk::UniqueBuffer buffer_;
-  vk::UniqueDeviceMemory mem_;
-  vk::DeviceSize size_;
+  vk::Device device_;
+  uint32_t maxBatch_ = 16;
+  bool creationFeedback_ = false;
+  std::map<VkPipelineCache, std::vector<std::unique_ptr<GraphicsJob>>> graphics_;
+  std::map<VkPipelineCache, std::vector<std::unique_ptr<ComputeJob>>> compute_;
+  std::deque<std::function<void ()>> tasks_;
+  std::vector<Timing> timings_;
+  size_t outstanding_ = 0;
+  bool stop_ = false;
+  mutable std::mutex mutex_;
+  std::condition_variable ready_;
+  std::condition_variable idle_;
+  std::vector<std::thread> workers_;
 };
 
-/// This class is a specialisation of GenericBuffer for high performance vertex buffers on the GPU.
-/// You must upload the contents before use.
-class VertexBuffer : public GenericBuffer {
+/// Share pipelines between makers with identical state.
+/// get() returns the pipeline already built for an identical maker, or builds and keeps a new one.
+///
+/// Every pipeline remembers the generation it was last asked for in.
+/// Call nextGeneration() once per frame and evict() to destroy pipelines that have not
+/// been asked for recently. The registry is not thread safe.
+///
+/// Example:
+///
+///     vku::PipelineRegistry registry{device, fw.pipelineCache()};
+///     vk::Pipeline pipeline = registry.get(pm, *pipelineLayout, renderPass);
+///     ...
+///     registry.nextGeneration();
+///     registry.evict(framesInFlight);
+///
+class PipelineRegistry {
 public:
-  VertexBuffer() = default;
+  struct Stats {
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    uint64_t evictions = 0;
+    size_t pipelines = 0;
+  };
 
-  VertexBuffer(const vk::Device &device, const vk::PhysicalDeviceMemoryProperties &memprops, size_t size) : GenericBuffer(device, memprops, vk::BufferUsageFlagBits::eVertexBuffer | vk::BufferUsageFlagBits::eTransferDst, size, vk::MemoryPropertyFlagBits::eDeviceLocal) {
+  PipelineRegistry() = default;
+
+  /// Build new pipelines with the given cache.
+  explicit PipelineRegistry(vk::Device device, vk::PipelineCache pipelineCache = {})
+  : device_(device), pipelineCache_(pipelineCache) {
   }
-};
 
-/// This class is a specialisation of GenericBuffer for low performance vertex buffers on the host.
-class HostVertexBuffer : public GenericBuffer {
-public:
-  HostVertexBuffer() = default;
+  /// Get a graphics pipeline, building it only if no identical pipeline exists.
+  /// Throws if the pipeline can't be built.
+  vk::Pipeline get(const PipelineMaker &maker, const vk::PipelineLayout &pipelineLayout,
+                   const vk::RenderPass &renderPass, bool defaultBlend=true) {
+    return find(maker.key(pipelineLayout, renderPass, defaultBlend), [&]() {
+      return maker.createUnique(device_, pipelineCache_, pipelineLayout, renderPass, defaultBlend);
+    });
+  }
 
-  template<class Type, class Allocator>
-  HostVertexBuffer(const vk::Device &device, const vk::PhysicalDeviceMemoryProperties &memprops, const std::vector<Type, Allocator> &value) : GenericBuffer(device, memprops, vk::BufferUsageFlagBits::eVertexBuffer, value.size() * sizeof(Type), vk::MemoryPropertyFlagBits::eHostVisible) {
-    updateLocal(device, value);
+  /// Get a compute pipeline, building it only if no identical pipeline exists.
+  vk::Pipeline get(const ComputePipelineMaker &maker, const vk::PipelineLayout &pipelineLayout) {
+    return find(maker.key(pipelineLayout), [&]() {
+      return maker.createUnique(device_, pipelineCache_, pipelineLayout);
+    });
   }
-};
 
-/// This class is a specialisation of GenericBuffer for high performance index buffers.
-/// You must upload the contents before use.
-class IndexBuffer : public GenericBuffer {
-public:
-  IndexBuffer() = default;
+  /// Start a new generation, eg. at the start of each frame.
+  uint64_t nextGeneration() { return ++generation_; }
+
+  /// Destroy pipelines not asked for in the last maxAge generations.
+  /// maxAge must cover any frames the GPU may still be drawing with them.
+  /// Returns the number of pipelines destroyed.
+  size_t evict(uint64_t maxAge) {
+    size_t count = 0;
+    for (auto it = pipelines_.begin(); it != pipelines_.end(); ) {
+      if (generation_ - it->second.lastUsed > maxAge) {
+        it = pipelines_.erase(it);
+        count++;
+      } else {
+        ++it;
+      }
+    }
+    stats_.evictions += count;
+    return count;
+  }
 
-  IndexBuffer(const vk::Device &device, const vk::PhysicalDeviceMemoryProperties &memprops, vk::DeviceSize size) : GenericBuffer(device, memprops, vk::BufferUsageFlagBits::eIndexBuffer | vk::BufferUsageFlagBits::eTransferDst, size, vk::MemoryPropertyFlagBits::eDeviceLocal) {
+  /// Destroy every pipeline. None may still be in use by the GPU.
+  void clear() {
+    stats_.evictions += pipelines_.size();
+    pipelines_.clear();
   }
-};
 
-/// This class is a specialisation of GenericBuffer for low performance vertex buffers in CPU memory.
-class HostIndexBuffer : public GenericBuffer {
-public:
-  HostIndexBuffer() = default;
+  [[nodiscard]] uint64_t generation() const { return generation_; }
 
-  template<class Type, class Allocator>
-  HostIndexBuffer(const vk::Device &device, const vk::PhysicalDeviceMemoryProperties &memprops, const std::vector<Type, Allocator> &value) : GenericBuffer(device, memprops, vk::BufferUsageFlagBits::eIndexBuffer, value.size() * sizeof(Type), vk::MemoryPropertyFlagBits::eHostVisible) {
-    updateLocal(device, value);
+  [[nodiscard]] Stats stats() const {
+    Stats result = stats_;
+    result.pipelines = pipelines_.size();
+    return result;
   }
-};
+private:
+  struct Entry {
+    vk::UniquePipeline pipeline;
+    uint64_t lastUsed = 0;
+  };
 
-/// This class is a specialisation of GenericBuffer for uniform buffers.
-class UniformBuffer : public GenericBuffer {
-public:
-  UniformBuffer() = default;
+  template<class Create>
+  vk::Pipeline find(const PipelineKey &key, Create create) {
+    auto it = pipelines_.find(key.str());
+    if (it != pipelines_.end()) {
+      stats_.hits++;
+      it->second.lastUsed = generation_;
+      return *it->second.pipeline;
+    }
 
-  /// Device local uniform buffer.
-  UniformBuffer(const vk::Device &device, const vk::PhysicalDeviceMemoryProperties &memprops, size_t size) :
-  GenericBuffer(device, memprops, vk::BufferUsageFlagBits::eUniformBuffer|vk::BufferUsageFlagBits::eTransferDst, static_cast<vk::DeviceSize>(size), vk::MemoryPropertyFlagBits::eDeviceLocal) {
+    stats_.misses++;
+    auto pipeline = create();
+    if (!pipeline) {
+      throw std::runtime_error("vku::PipelineRegistry: pipeline creation failed");
+    }
+    vk::Pipeline result = *pipeline;
+    pipelines_.emplace(key.str(), Entry{std::move(pipeline), generation_});
+    return result;
   }
+
+  vk::Device device_;
+  vk::PipelineCache pipelineCache_;
+  std::unordered_map<std::string, Entry> pipelines_;
+  uint64_t generation_ = 0;
+  Stats stats_;
 };
 
-/// Convenience class for updating descriptor sets (uniforms)
-class DescriptorSetUpdater {
+/// Build graphics pipelines by linking cached VK_EXT_graphics_pipeline_library parts.
+/// Each of the four parts of a maker is keyed by the state it uses and built only once,
+/// so variants that differ only in, say, blend state compile just that part and link the rest.
+///
+/// Linking is fast but the result may run slower than a whole pipeline.
+/// With backgroundOptimize, an optimized link is started on another thread
+/// and get() returns it in place of the fast one once it is ready.
+///
+/// The device needs VK_EXT_graphics_pipeline_library and its graphicsPipelineLibrary feature.
+/// The library is not thread safe.
+///
+/// Example:
+///
+///     vku::PipelineLibrary library{device, fw.pipelineCache()};
+///     vk::Pipeline pipeline = library.get(pm, *pipelineLayout, renderPass);
+///
+class PipelineLibrary {
 public:
-  explicit DescriptorSetUpdater(int maxBuffers = 10, int maxImages = 10, int maxBufferViews = 0) {
-    // we must pre-size these buffers as we take pointers to their members.
-    bufferInfo_.resize(maxBuffers);
-    imageInfo_.resize(maxImages);
-    bufferViews_.resize(maxBufferViews);
-  }
+  struct Stats {
+    uint64_t partHits = 0;
+    uint64_t partMisses = 0;
+    uint64_t links = 0;
+    uint64_t optimized = 0;
+  };
 
-  /// Call this to begin a new descriptor set.
-  DescriptorSetUpdater& beginDescriptorSet(vk::DescriptorSet dstSet) {
-    dstSet_ = dstSet;
-    return *this;
-  }
+  PipelineLibrary() = default;
 
-  /// Call this to begin a new set of images.
-  DescriptorSetUpdater& beginImages(uint32_t dstBinding, uint32_t dstArrayElement, vk::DescriptorType descriptorType) {
-    vk::WriteDescriptorSet wdesc{};
-    wdesc.dstSet = dstSet_;
-    wdesc.dstBinding = dstBinding;
-    wdesc.dstArrayElement = dstArrayElement;
-    wdesc.descriptorCount = 0;
-    wdesc.descriptorType = descriptorType;
-    wdesc.pImageInfo = imageInfo_.data() + numImages_;
-    descriptorWrites_.push_back(wdesc);
-    return *this;
+  /// Build parts and links with the given cache.
+  explicit PipelineLibrary(vk::Device device, vk::PipelineCache pipelineCache = {}, bool backgroundOptimize = true)
+  : device_(device), pipelineCache_(pipelineCache), backgroundOptimize_(backgroundOptimize) {
   }
 
-  /// Call this to add a combined image sampler.
-  DescriptorSetUpdater& image(vk::Sampler sampler, vk::ImageView imageView, vk::ImageLayout imageLayout) {
-    if (!descriptorWrites_.empty() && numImages_ != imageInfo_.size() && descriptorWrites_.back().pImageInfo) {
-      descriptorWrites_.back().descriptorCount++;
-      imageInfo_[numImages_++] = vk::DescriptorImageInfo{sampler, imageView, imageLayout};
-    } else {
-      ok_ = false;
+  PipelineLibrary(const PipelineLibrary &) = delete;
+  PipelineLibrary &operator=(const PipelineLibrary &) = delete;
+
+  /// Get a pipeline for maker, building only the parts that are not already cached.
+  /// Call once per frame to pick up the optimized pipeline when it has been built.
+  vk::Pipeline get(const PipelineMaker &maker, const vk::PipelineLayout &pipelineLayout,
+                   const vk::RenderPass &renderPass, bool defaultBlend=true) {
+    // Keyed once, before any part is built, so the same maker always finds the same variant.
+    auto variantKey = maker.key(pipelineLayout, renderPass, defaultBlend).str();
+    auto &variant = variants_[variantKey];
+    if (variant.optimized) return *variant.optimized;
+
+    if (variant.pending.valid() && variant.pending.wait_for(std::chrono::seconds(0)) == std::future_status::ready) {
+      variant.optimized = variant.pending.get();
+      if (variant.optimized) {
+        stats_.optimized++;
+        return *variant.optimized;
+      }
+    }
+    if (variant.fast) return *variant.fast;
+
+    typedef vk::GraphicsPipelineLibraryFlagBitsEXT gpl;
+    std::array<vk::Pipeline, 4> libraries;
+    std::array<gpl, 4> parts{gpl::eVertexInputInterface, gpl::ePreRasterizationShaders, gpl::eFragmentShader, gpl::eFragmentOutputInterface};
+    for (size_t i = 0; i != parts.size(); ++i) {
+      auto &part = parts_[i][maker.key(pipelineLayout, renderPass, defaultBlend, parts[i]).str()];
+      if (part) {
+        stats_.partHits++;
+      } else {
+        stats_.partMisses++;
+        part = maker.createLibraryUnique(device_, pipelineCache_, pipelineLayout, renderPass, parts[i], defaultBlend);
+      }
+      if (!part) {
+        throw std::runtime_error("vku::PipelineLibrary: failed to build " + vk::to_string(parts[i]) + " library");
+      }
+      libraries[i] = *part;
     }
-    return *this;
-  }
 
-  /// Call this to start defining buffers.
-  DescriptorSetUpdater& beginBuffers(uint32_t dstBinding, uint32_t dstArrayElement, vk::DescriptorType descriptorType) {
-    vk::WriteDescriptorSet wdesc{};
-    wdesc.dstSet = dstSet_;
-    wdesc.dstBinding = dstBinding;
-    wdesc.dstArrayElement = dstArrayElement;
-    wdesc.descriptorCount = 0;
-    wdesc.descriptorType = descriptorType;
-    wdesc.pBufferInfo = bufferInfo_.data() + numBuffers_;
-    descriptorWrites_.push_back(wdesc);
-    return *this;
-  }
+    variant.fast = PipelineMaker::link(device_, pipelineCache_, pipelineLayout, libraries);
+    stats_.links++;
 
-  /// Call this to add a new buffer.
-  DescriptorSetUpdater& buffer(vk::Buffer buffer, vk::DeviceSize offset, vk::DeviceSize range) {
-    if (!descriptorWrites_.empty() && numBuffers_ != bufferInfo_.size() && descriptorWrites_.back().pBufferInfo) {
-      descriptorWrites_.back().descriptorCount++;
-      bufferInfo_[numBuffers_++] = vk::DescriptorBufferInfo{buffer, offset, range};
-    } else {
-      ok_ = false;
+    if (backgroundOptimize_) {
+      variant.pending = std::async(std::launch::async, [device = device_, cache = pipelineCache_, pipelineLayout, libraries]() {
+        return PipelineMaker::link(device, cache, pipelineLayout, libraries, true);
+      });
     }
-    return *this;
-  }
-
-  /// Call this to start adding buffer views. (for example, writable images).
-  void beginBufferViews(uint32_t dstBinding, uint32_t dstArrayElement, vk::DescriptorType descriptorType) {
-    vk::WriteDescriptorSet wdesc{};
-    wdesc.dstSet = dstSet_;
-    wdesc.dstBinding = dstBinding;
-    wdesc.dstArrayElement = dstArrayElement;
-    wdesc.descriptorCount = 0;
-    wdesc.descriptorType = descriptorType;
-    wdesc.pTexelBufferView = bufferViews_.data() + numBufferViews_;
-    descriptorWrites_.push_back(wdesc);
+    return *variant.fast;
   }
 
-  /// Call this to add a buffer view. (Texel images)
-  void bufferView(vk::BufferView view) {
-    if (!descriptorWrites_.empty() && numBufferViews_ != bufferViews_.size() && descriptorWrites_.back().pImageInfo) {
-      descriptorWrites_.back().descriptorCount++;
-      bufferViews_[numBufferViews_++] = view;
-    } else {
-      ok_ = false;
+  /// Wait for every background optimization to finish.
+  void wait() {
+    for (auto &[key, variant] : variants_) {
+      if (variant.pending.valid()) variant.pending.wait();
     }
   }
 
-  /// Copy an existing descriptor.
-  void copy(vk::DescriptorSet srcSet, uint32_t srcBinding, uint32_t srcArrayElement, vk::DescriptorSet dstSet, uint32_t dstBinding, uint32_t dstArrayElement, uint32_t descriptorCount) {
-    descriptorCopies_.emplace_back(srcSet, srcBinding, srcArrayElement, dstSet, dstBinding, dstArrayElement, descriptorCount);
-  }
+  [[nodiscard]] Stats stats() const { return stats_; }
 
-  /// Call this to update the descriptor sets with their pointers (but not data).
-  void update(const vk::Device &device) const {
-    device.updateDescriptorSets( descriptorWrites_, descriptorCopies_ );
+  ~PipelineLibrary() {
+    wait();
   }
-
-  /// Returns true if the updater is error free.
-  [[nodiscard]] bool ok() const { return ok_; }
 private:
-  std::vector<vk::DescriptorBufferInfo> bufferInfo_;
-  std::vector<vk::DescriptorImageInfo> imageInfo_;
-  std::vector<vk::WriteDescriptorSet> descriptorWrites_;
-  std::vector<vk::CopyDescriptorSet> descriptorCopies_;
-  std::vector<vk::BufferView> bufferViews_;
-  vk::DescriptorSet dstSet_;
-  int numBuffers_ = 0;
-  int numImages_ = 0;
-  int numBufferViews_ = 0;
-  bool ok_ = true;
+  struct Variant {
+    vk::UniquePipeline fast;
+    vk::UniquePipeline optimized;
+    std::future<vk::UniquePipeline> pending;
+  };
+
+  vk::Device device_;
+  vk::PipelineCache pipelineCache_;
+  bool backgroundOptimize_ = true;
+  std::array<std::unordered_map<std::string, vk::UniquePipeline>, 4> parts_;
+  std::unordered_map<std::string, Variant> variants_;
+  Stats stats_;
 };
 
-/// A factory class for descriptor set layouts. (An interface to the shaders)
-class DescriptorSetLayoutMaker {
+/// Find the fastest workgroup size for a compute shader on this device.
+/// Each candidate size is passed to the shader as specialization constants, so the shader
+/// declares its size as
+///
+///     layout(local_size_x_id = 0, local_size_y_id = 1, local_size_z_id = 2) in;
+///
+/// Every candidate pipeline is built, then timed on a representative dispatch using timestamp
+/// queries. The winner for each shader is saved to a small text file keyed by vendor, device
+/// and driver version, so later runs on the same device skip the timing.
+///
+/// Example:
+///
+///     vku::WorkgroupTuner tuner{device, fw.physicalDevice(), "workgroups.txt"};
+///     auto result = tuner.tune("blur", maker, *pipelineLayout, fw.computeQueue(), fw.computeQueueFamilyIndex(),
+///       vku::WorkgroupTuner::candidates(fw.physicalDevice(), 2),
+///       [&](vk::CommandBuffer cb, const vku::WorkgroupTuner::Size &size) {
+///         cb.bindDescriptorSets(vk::PipelineBindPoint::eCompute, *pipelineLayout, 0, descriptorSets, nullptr);
+///         cb.dispatch(width / size.x, height / size.y, 1);
+///       });
+///     maker.specConstant(0, result.size.x).specConstant(1, result.size.y).specConstant(2, result.size.z);
+///
+class WorkgroupTuner {
 public:
-  DescriptorSetLayoutMaker() = default;
+  /// A workgroup size.
+  struct Size {
+    uint32_t x = 1;
+    uint32_t y = 1;
+    uint32_t z = 1;
+  };
 
-  DescriptorSetLayoutMaker& buffer(uint32_t binding, vk::DescriptorType descriptorType, vk::ShaderStageFlags stageFlags, uint32_t descriptorCount) {
-    s.bindings.emplace_back(binding, descriptorType, descriptorCount, stageFlags, nullptr);
-    return *this;
+  struct Result {
+    /// The fastest size, or the first candidate if timing was not possible.
+    Size size;
+
+    /// Time for one dispatch with that size.
+    double microseconds = 0;
+
+    /// True if the size came from the cache file.
+    bool cached = false;
+
+    /// True if a size was measured or found in the cache.
+    bool ok = false;
+  };
+
+  /// Read previous results from cacheFilename, if given.
+  WorkgroupTuner(vk::Device device, vk::PhysicalDevice physicalDevice, const std::string &cacheFilename = "")
+  : device_(device), physicalDevice_(physicalDevice), cacheFilename_(cacheFilename) {
+    props_ = physicalDevice.getProperties();
+    load();
   }
 
-  DescriptorSetLayoutMaker& image(uint32_t binding, vk::DescriptorType descriptorType, vk::ShaderStageFlags stageFlags, uint32_t descriptorCount) {
-    s.bindings.emplace_back(binding, descriptorType, descriptorCount, stageFlags, nullptr);
+  /// Change the specialization constant ids used for x, y and z.
+  WorkgroupTuner &constantIds(uint32_t x, uint32_t y, uint32_t z) {
+    constantIds_ = {x, y, z};
     return *this;
   }
 
-  DescriptorSetLayoutMaker& samplers(uint32_t binding, vk::DescriptorType descriptorType, vk::ShaderStageFlags stageFlags, const std::vector<vk::Sampler>& immutableSamplers) {
-    s.samplers.push_back(immutableSamplers);
-    auto pImmutableSamplers = s.samplers.back().data();
-    s.bindings.emplace_back(binding, descriptorType, static_cast<uint32_t>(immutableSamplers.size()), stageFlags, pImmutableSamplers);
+  /// Power of two sizes from 32 to 1024 invocations that this device supports.
+  /// One dimensional sizes are long in x; two dimensional sizes are square or twice as wide as high.
+  static std::vector<Size> candidates(vk::PhysicalDevice physicalDevice, uint32_t dimensions = 1) {
+    auto limits = physicalDevice.getProperties().limits;
+    std::vector<Size> result;
+    for (uint32_t invocations = 32; invocations <= 1024; invocations *= 2) {
+      Size size;
+      if (dimensions == 1) {
+        size.x = invocations;
+      } else {
+        size.y = 1;
+        // Square or twice as wide as tall: 8x4, 8x8, 16x8 and so on.
+        while (size.y * 2 * size.y * 2 <= invocations) size.y *= 2;
+        size.x = invocations / size.y;
+      }
+      if (size.x * size.y * size.z <= limits.maxComputeWorkGroupInvocations
+        && size.x <= limits.maxComputeWorkGroupSize[0]
+        && size.y <= limits.maxComputeWorkGroupSize[1]
+        && size.z <= limits.maxComputeWorkGroupSize[2]) {
+        result.push_back(size);
+      }
+    }
+    return result;
+  }
+
+  /// Return the fastest of candidates for the shader in maker, timing them if name is not in the cache.
+  /// dispatch records the work to time for one size; the pipeline is already bound.
+  /// It is run once to warm up, then repeats times with barriers in between.
+  Result tune(const std::string &name, const ComputePipelineMaker &maker, vk::PipelineLayout pipelineLayout,
+              vk::Queue queue, uint32_t queueFamilyIndex, const std::vector<Size> &candidates,
+              const std::function<void (vk::CommandBuffer cb, const Size &size)> &dispatch, uint32_t repeats = 8) {
+    if (auto it = results_.find(name); it != results_.end()) {
+      Result result = it->second;
+      result.cached = true;
+      return result;
+    }
+
+    Result result;
+    if (candidates.empty()) return result;
+    result.size = candidates.front();
+
+    auto families = physicalDevice_.getQueueFamilyProperties();
+    if (queueFamilyIndex >= families.size() || families[queueFamilyIndex].timestampValidBits == 0 || props_.limits.timestampPeriod == 0) {
+      return result;
+    }
+    auto validBits = families[queueFamilyIndex].timestampValidBits;
+    uint64_t mask = validBits >= 64 ? ~0ULL : (1ULL << validBits) - 1;
+
+    // Build all the candidates in parallel.
+    std::vector<ComputePipelineMaker> makers;
+    for (auto &size : candidates) {
+      makers.push_back(maker);
+      makers.back().specConstant(constantIds_[0], size.x).specConstant(constantIds_[1], size.y).specConstant(constantIds_[2], size.z);
+    }
+    std::vector<vk::UniquePipeline> pipelines;
+    {
+      PipelineCompiler compiler{device_};
+      std::vector<std::future<vk::UniquePipeline>> futures;
+      for (auto &m : makers) futures.push_back(compiler.add(m, vk::PipelineCache{}, pipelineLayout));
+      compiler.compile();
+      for (auto &future : futures) pipelines.push_back(future.get());
+    }
+
+    vk::CommandPoolCreateInfo cpci{vk::CommandPoolCreateFlagBits::eTransient, queueFamilyIndex};
+    auto commandPool = device_.createCommandPoolUnique(cpci);
+    auto queryPool = device_.createQueryPoolUnique(vk::QueryPoolCreateInfo{{}, vk::QueryType::eTimestamp, 2});
+
+    vk::MemoryBarrier barrier{vk::AccessFlagBits::eShaderWrite, vk::AccessFlagBits::eShaderRead|vk::AccessFlagBits::eShaderWrite};
+    auto serialize = [&](vk::CommandBuffer cb) {
+      cb.pipelineBarrier(vk::PipelineStageFlagBits::eComputeShader, vk::PipelineStageFlagBits::eComputeShader, {}, barrier, nullptr, nullptr);
+    };
+
+    repeats = std::max(repeats, 1U);
+    for (size_t i = 0; i != candidates.size(); ++i) {
+      if (!pipelines[i]) continue;
+      vku::executeImmediately(device_, *commandPool, queue, [&](vk::CommandBuffer cb) {
+        cb.resetQueryPool(*queryPool, 0, 2);
+        cb.bindPipeline(vk::PipelineBindPoint::eCompute, *pipelines[i]);
+        dispatch(cb, candidates[i]);
+        serialize(cb);
+        cb.writeTimestamp(vk::PipelineStageFlagBits::eBottomOfPipe, *queryPool, 0);
+        for (uint32_t r = 0; r != repeats; ++r) {
+          if (r) serialize(cb);
+          dispatch(cb, candidates[i]);
+        }
+        cb.writeTimestamp(vk::PipelineStageFlagBits::eBottomOfPipe, *queryPool, 1);
+      });
+
+      uint64_t ticks[2] = {};
+      auto status = device_.getQueryPoolResults(*queryPool, 0, 2, sizeof(ticks), ticks, sizeof(uint64_t), vk::QueryResultFlagBits::e64|vk::QueryResultFlagBits::eWait);
+      if (status != vk::Result::eSuccess) continue;
+
+      double microseconds = ((ticks[1] - ticks[0]) & mask) * props_.limits.timestampPeriod / 1000.0 / repeats;
+      if (!result.ok || microseconds < result.microseconds) {
+        result.size = candidates[i];
+        result.microseconds = microseconds;
+        result.ok = true;
+      }
+    }
+
+    if (result.ok) {
+      results_[name] = result;
+      save();
+    }
+    return result;
+  }
+
+  /// The saved result for name, if any.
+  [[nodiscard]] const Result *find(const std::string &name) const {
+    auto it = results_.find(name);
+    return it == results_.end() ? nullptr : &it->second;
+  }
+private:
+  // Each line is: vendorID deviceID driverVersion "name" x y z microseconds
+  bool thisDevice(uint32_t vendorID, uint32_t deviceID, uint32_t driverVersion) const {
+    return vendorID == props_.vendorID && deviceID == props_.deviceID && driverVersion == props_.driverVersion;
+  }
+
+  void load() {
+    if (cacheFilename_.empty()) return;
+    std::ifstream is(cacheFilename_);
+    std::string line;
+    while (std::getline(is, line)) {
+      std::istringstream ls(line);
+      uint32_t vendorID = 0, deviceID = 0, driverVersion = 0;
+      std::string name;
+      Result result;
+      if (!(ls >> vendorID >> deviceID >> driverVersion >> std::quoted(name) >> result.size.x >> result.size.y >> result.size.z >> result.microseconds)) continue;
+      if (thisDevice(vendorID, deviceID, driverVersion)) {
+        result.ok = true;
+        results_[name] = result;
+      } else {
+        otherDevices_.push_back(line);
+      }
+    }
+  }
+
+  void save() const {
+    if (cacheFilename_.empty()) return;
+    std::ostringstream os;
+    for (auto &line : otherDevices_) os << line << "\n";
+    for (auto &[name, result] : results_) {
+      os << props_.vendorID << " " << props_.deviceID << " " << props_.driverVersion << " " << std::quoted(name) << " "
+         << result.size.x << " " << result.size.y << " " << result.size.z << " " << result.microseconds << "\n";
+    }
+    // The cache only saves time; the results are still returned if it can't be written.
+    auto text = os.str();
+    saveFileAtomic(cacheFilename_, text.data(), text.size());
+  }
+
+  vk::Device device_;
+  vk::PhysicalDevice physicalDevice_;
+  vk::PhysicalDeviceProperties props_;
+  std::string cacheFilename_;
+  std::array<uint32_t, 3> constantIds_ = {0, 1, 2};
+  std::map<std::string, Result> results_;
+  std::vector<std::string> otherDevices_;
+};
+
+#ifdef VOOKOO_SHADERC_SUPPORT
+/// Rebuild pipelines when their GLSL sources change.
+/// A background thread watches the sources and their includes, using inotify on Linux and
+/// modification times elsewhere. On a change it recompiles them and rebuilds each dependent
+/// pipeline from its PipelineMaker.
+/// beginFrame() swaps the rebuilt pipelines in, so drawing never waits for the compiler.
+/// A replaced pipeline is destroyed once no frame in flight can still use it.
+/// If a shader fails to compile, the errors are printed and the old pipeline stays.
+///
+/// Call add(), beginFrame() and pipeline() from the render thread.
+///
+/// Example:
+///
+///     vku::ShaderWatcher watcher{device, compiler, fw.pipelineCache()};
+///     vku::PipelineMaker pm{};
+///     pm.dynamicProfile().vertexBinding(0, sizeof(Vertex));   // everything but the shaders
+///     auto id = watcher.add(std::move(pm), {{SOURCE_DIR "a.vert", vk::ShaderStageFlagBits::eVertex},
+///                                           {SOURCE_DIR "a.frag", vk::ShaderStageFlagBits::eFragment}},
+///                           *pipelineLayout, window.renderPass());
+///     ...
+///     watcher.beginFrame();
+///     cb.bindPipeline(vk::PipelineBindPoint::eGraphics, watcher.pipeline(id));
+///
+class ShaderWatcher {
+public:
+  /// A GLSL source for one stage of a watched pipeline.
+  struct Source {
+    std::string filename;
+    vk::ShaderStageFlagBits stage;
+    ShaderCompileOptions options = {};
+    const char *entryPoint = "main";
+  };
+
+  static constexpr uint32_t invalidId = ~0U;
+
+  /// Keep replaced pipelines for framesInFlight calls to beginFrame() before destroying them.
+  ShaderWatcher(vk::Device device, const ShaderCompiler &compiler, vk::PipelineCache pipelineCache = {}, uint32_t framesInFlight = 3)
+  : device_(device), compiler_(compiler), pipelineCache_(pipelineCache), framesInFlight_(framesInFlight) {
+#ifdef __linux__
+    inotify_ = inotify_init1(IN_NONBLOCK|IN_CLOEXEC);
+#endif
+    thread_ = std::thread([this] { run(); });
+  }
+
+  ShaderWatcher(const ShaderWatcher &) = delete;
+  ShaderWatcher &operator=(const ShaderWatcher &) = delete;
+
+  /// Compile sources, build a pipeline from maker and keep it up to date.
+  /// maker has all the state except the shaders.
+  /// Returns an id for pipeline(), or invalidId if the first build fails.
+  uint32_t add(PipelineMaker maker, std::vector<Source> sources, vk::PipelineLayout pipelineLayout, vk::RenderPass renderPass) {
+    auto entry = std::make_unique<Entry>();
+    entry->maker = std::move(maker);
+    entry->sources = std::move(sources);
+    entry->layout = pipelineLayout;
+    entry->renderPass = renderPass;
+
+    std::vector<std::filesystem::path> files;
+    if (!compile(*entry, entry->modules, files)) return invalidId;
+    for (size_t i = 0; i != entry->sources.size(); ++i) {
+      auto &source = entry->sources[i];
+      entry->maker.shader(source.stage, entry->modules[i], source.entryPoint);
+    }
+    entry->current = entry->maker.createUnique(device_, pipelineCache_, entry->layout, entry->renderPass);
+    if (!entry->current) return invalidId;
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    setFiles(*entry, std::move(files));
+    entries_.push_back(std::move(entry));
+    return static_cast<uint32_t>(entries_.size() - 1);
+  }
+
+  /// Swap in pipelines rebuilt since the last call and destroy retired ones that are old enough.
+  /// Call once per frame before recording. Returns the number of pipelines swapped.
+  uint32_t beginFrame() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    frame_++;
+    uint32_t swapped = 0;
+    for (auto &entry : entries_) {
+      if (entry->pending) {
+        retired_.push_back(Retired{frame_, std::move(entry->current)});
+        entry->current = std::move(entry->pending);
+        swapped++;
+      }
+    }
+    while (!retired_.empty() && frame_ - retired_.front().frame > framesInFlight_) {
+      retired_.pop_front();
+    }
+    return swapped;
+  }
+
+  /// The current pipeline for id.
+  [[nodiscard]] vk::Pipeline pipeline(uint32_t id) const {
+    return id < entries_.size() ? *entries_[id]->current : vk::Pipeline{};
+  }
+
+  ~ShaderWatcher() {
+    stop_ = true;
+    thread_.join();
+#ifdef __linux__
+    if (inotify_ >= 0) close(inotify_);
+#endif
+  }
+private:
+  struct Entry {
+    PipelineMaker maker;
+    std::vector<Source> sources;
+    std::vector<ShaderModule> modules;
+    std::vector<std::filesystem::path> files;
+    vk::PipelineLayout layout;
+    vk::RenderPass renderPass;
+    vk::UniquePipeline current;
+    vk::UniquePipeline pending;
+  };
+
+  struct Retired {
+    uint64_t frame;
+    vk::UniquePipeline pipeline;
+  };
+
+  static std::filesystem::path canonical(const std::filesystem::path &path) {
+    std::error_code ec;
+    auto result = std::filesystem::weakly_canonical(path, ec);
+    return ec ? path : result;
+  }
+
+  // Compile every source of entry, listing the files it depends on.
+  bool compile(const Entry &entry, std::vector<ShaderModule> &modules, std::vector<std::filesystem::path> &files) const {
+    for (auto &source : entry.sources) {
+      auto result = compiler_.compileFile(source.filename, source.stage, source.options);
+      if (!result.ok) {
+        std::cout << "vku::ShaderWatcher: " << result.messages;
+        return false;
+      }
+      modules.emplace_back(device_, result.spirv.begin(), result.spirv.end());
+      files.push_back(canonical(source.filename));
+      for (auto &dependency : result.dependencies) files.push_back(canonical(dependency));
+    }
+    return true;
+  }
+
+  // Record the files entry depends on and start watching them. Called with the mutex held.
+  void setFiles(Entry &entry, std::vector<std::filesystem::path> files) {
+    for (auto &file : files) {
+      std::error_code ec;
+      auto time = std::filesystem::last_write_time(file, ec);
+      times_.emplace(file, time);
+#ifdef __linux__
+      // Watch the directory, as editors often replace files rather than writing them.
+      auto dir = file.parent_path();
+      if (inotify_ >= 0 && std::find(dirs_.begin(), dirs_.end(), dir) == dirs_.end()) {
+        int wd = inotify_add_watch(inotify_, dir.c_str(), IN_CLOSE_WRITE|IN_MOVED_TO|IN_CREATE);
+        if (wd >= 0) {
+          if (static_cast<size_t>(wd) >= dirs_.size()) dirs_.resize(wd + 1);
+          dirs_[wd] = dir;
+        }
+      }
+#endif
+    }
+    entry.files = std::move(files);
+  }
+
+  // Wait up to a fraction of a second for files to change.
+  std::vector<std::filesystem::path> changes() {
+    std::vector<std::filesystem::path> changed;
+#ifdef __linux__
+    if (inotify_ >= 0) {
+      pollfd pfd{inotify_, POLLIN, 0};
+      if (poll(&pfd, 1, 100) <= 0) return changed;
+
+      alignas(inotify_event) char buffer[4096];
+      ssize_t length;
+      while ((length = read(inotify_, buffer, sizeof(buffer))) > 0) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (char *p = buffer; p < buffer + length; ) {
+          auto event = reinterpret_cast<const inotify_event *>(p);
+          if (event->len && event->wd >= 0 && static_cast<size_t>(event->wd) < dirs_.size()) {
+            changed.push_back(dirs_[event->wd] / event->name);
+          }
+          p += sizeof(inotify_event) + event->len;
+        }
+      }
+      return changed;
+    }
+#endif
+    std::this_thread::sleep_for(std::chrono::milliseconds(250));
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (auto &[file, time] : times_) {
+      std::error_code ec;
+      auto now = std::filesystem::last_write_time(file, ec);
+      if (!ec && now != time) {
+        time = now;
+        changed.push_back(file);
+      }
+    }
+    return changed;
+  }
+
+  // Rebuild the pipelines that depend on any of the changed files.
+  void rebuild(const std::vector<std::filesystem::path> &changed) {
+    std::vector<Entry *> dirty;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      for (auto &entry : entries_) {
+        for (auto &file : entry->files) {
+          if (std::find(changed.begin(), changed.end(), file) != changed.end()) {
+            dirty.push_back(entry.get());
+            break;
+          }
+        }
+      }
+    }
+
+    for (auto entry : dirty) {
+      std::vector<ShaderModule> modules;
+      std::vector<std::filesystem::path> files;
+      vk::UniquePipeline pipeline;
+      try {
+        if (!compile(*entry, modules, files)) {
+          std::cout << "vku::ShaderWatcher: keeping the previous pipeline\n";
+          continue;
+        }
+
+        for (size_t i = 0; i != modules.size(); ++i) {
+          entry->maker.replaceShader(entry->modules[i].module(), modules[i].module());
+        }
+        pipeline = entry->maker.createUnique(device_, pipelineCache_, entry->layout, entry->renderPass);
+      } catch (const vk::SystemError &e) {
+        // This runs on the watcher thread, so a bad edit must not escape and terminate.
+        std::cout << "vku::ShaderWatcher: " << e.what() << ", keeping the previous pipeline\n";
+        // Point the maker back at the modules that are still alive.
+        for (size_t i = 0; i != modules.size() && i != entry->modules.size(); ++i) {
+          entry->maker.replaceShader(modules[i].module(), entry->modules[i].module());
+        }
+        continue;
+      }
+
+      // Modules are not needed once the pipeline is built, so the old ones can go now.
+      entry->modules = std::move(modules);
+
+      std::lock_guard<std::mutex> lock(mutex_);
+      setFiles(*entry, std::move(files));
+      if (pipeline) entry->pending = std::move(pipeline);
+    }
+  }
+
+  void run() {
+    while (!stop_) {
+      auto changed = changes();
+      if (changed.empty()) continue;
+
+      // Editors often save in several steps; let them finish.
+      std::this_thread::sleep_for(std::chrono::milliseconds(50));
+      for (auto &file : changes()) changed.push_back(file);
+      for (auto &file : changed) file = canonical(file);
+      rebuild(changed);
+    }
+  }
+
+  vk::Device device_;
+  const ShaderCompiler &compiler_;
+  vk::PipelineCache pipelineCache_;
+  uint32_t framesInFlight_ = 3;
+  uint64_t frame_ = 0;
+  std::vector<std::unique_ptr<Entry>> entries_;
+  std::deque<Retired> retired_;
+  std::map<std::filesystem::path, std::filesystem::file_time_type> times_;
+#ifdef __linux__
+  int inotify_ = -1;
+  std::vector<std::filesystem::path> dirs_;
+#endif
+  std::mutex mutex_;
+  std::atomic<bool> stop_ = false;
+  std::thread thread_;
+};
+#endif
+
+class MemoryAllocator;
+
+/// A range of device memory handed out by a MemoryAllocator.
+/// The range goes back to the allocator when this object is destroyed or reset.
+class MemoryAllocation {
+public:
+  MemoryAllocation() = default;
+  MemoryAllocation(const MemoryAllocation &) = delete;
+  MemoryAllocation &operator=(const MemoryAllocation &) = delete;
+
+  MemoryAllocation(MemoryAllocation &&rhs) noexcept { *this = std::move(rhs); }
+
+  MemoryAllocation &operator=(MemoryAllocation &&rhs) noexcept {
+    if (this != &rhs) {
+      reset();
+      allocator_ = std::exchange(rhs.allocator_, nullptr);
+      block_ = rhs.block_;
+      memoryTypeIndex_ = rhs.memoryTypeIndex_;
+      memory_ = rhs.memory_;
+      offset_ = rhs.offset_;
+      size_ = rhs.size_;
+      mapped_ = rhs.mapped_;
+    }
     return *this;
   }
 
-  DescriptorSetLayoutMaker& bufferView(uint32_t binding, vk::DescriptorType descriptorType, vk::ShaderStageFlags stageFlags, uint32_t descriptorCount) {
-    s.bindings.emplace_back(binding, descriptorType, descriptorCount, stageFlags, nullptr);
-    return *this;
+  ~MemoryAllocation() { reset(); }
+
+  /// Give the range back to the allocator.
+  inline void reset();
+
+  explicit operator bool() const { return allocator_ != nullptr; }
+
+  [[nodiscard]] vk::DeviceMemory memory() const { return memory_; }
+  [[nodiscard]] vk::DeviceSize offset() const { return offset_; }
+  [[nodiscard]] vk::DeviceSize size() const { return size_; }
+  [[nodiscard]] uint32_t memoryTypeIndex() const { return memoryTypeIndex_; }
+
+  /// Host address of the range, or nullptr if the memory is not host visible.
+  [[nodiscard]] void *mapped() const { return mapped_; }
+private:
+  friend class MemoryAllocator;
+  MemoryAllocator *allocator_ = nullptr;
+  uint32_t block_ = 0;
+  uint32_t memoryTypeIndex_ = 0;
+  vk::DeviceMemory memory_;
+  vk::DeviceSize offset_ = 0;
+  vk::DeviceSize size_ = 0;
+  void *mapped_ = nullptr;
+};
+
+/// Sub-allocating arena for device memory.
+/// Memory is reserved in large blocks per memory type and handed out as aligned ranges,
+/// so thousands of buffers and images do not each need their own vkAllocateMemory call.
+/// Linear resources (buffers, linear images) and optimal images never share a block,
+/// which keeps neighbours apart by bufferImageGranularity without extra padding.
+/// Host visible blocks are mapped once, for the lifetime of the block.
+/// A block is freed when its last range is, except for one spare empty block per memory type
+/// which is kept so that creating and destroying a single resource does not allocate every time.
+///
+///     vku::MemoryAllocator allocator{device, fw.physicalDevice()};
+///     vku::VertexBuffer vbo{device, allocator, size};
+class MemoryAllocator {
+public:
+  struct Stats {
+    uint32_t blockCount = 0;
+    uint32_t allocationCount = 0;
+    /// Total size of the device memory blocks.
+    vk::DeviceSize bytesReserved = 0;
+    /// Bytes handed out to allocations.
+    vk::DeviceSize bytesUsed = 0;
+    /// Free bytes which are not part of the largest free range of their block.
+    vk::DeviceSize bytesFragmented = 0;
+  };
+
+  MemoryAllocator(vk::Device device, vk::PhysicalDevice physicalDevice, vk::DeviceSize blockSize = 64 * 1024 * 1024)
+  : device_(device), blockSize_(blockSize) {
+    memprops_ = physicalDevice.getMemoryProperties();
+    auto limits = physicalDevice.getProperties().limits;
+    bufferImageGranularity_ = limits.bufferImageGranularity;
+    nonCoherentAtomSize_ = limits.nonCoherentAtomSize;
+  }
+
+  MemoryAllocator(const MemoryAllocator &) = delete;
+  MemoryAllocator &operator=(const MemoryAllocator &) = delete;
+
+  /// Allocate a range satisfying memreq from a memory type with the memflags properties.
+  /// Set linear to false for images with optimal tiling.
+  /// Throws std::runtime_error if no memory type matches and vk::SystemError if a new block can't be allocated.
+  MemoryAllocation allocate(const vk::MemoryRequirements &memreq, vk::MemoryPropertyFlags memflags, bool linear = true) {
+    auto typeIndex = vku::findMemoryTypeIndex(memprops_, memreq.memoryTypeBits, memflags);
+    if (typeIndex < 0) {
+      throw std::runtime_error("vku::MemoryAllocator: no memory type matches the requested properties");
+    }
+    auto memoryTypeIndex = static_cast<uint32_t>(typeIndex);
+    vk::DeviceSize alignment = std::max(memreq.alignment, vk::DeviceSize{1});
+    vk::DeviceSize size = memreq.size;
+
+    // Non-coherent ranges must be flushable on their own, so keep them in whole atoms.
+    auto flags = memprops_.memoryTypes[memoryTypeIndex].propertyFlags;
+    if ((flags & vk::MemoryPropertyFlagBits::eHostVisible) && !(flags & vk::MemoryPropertyFlagBits::eHostCoherent)) {
+      alignment = std::max(alignment, nonCoherentAtomSize_);
+      size = roundUp(size, nonCoherentAtomSize_);
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (uint32_t i = 0; i != blocks_.size(); ++i) {
+      auto &block = blocks_[i];
+      if (!block.memory || block.memoryTypeIndex != memoryTypeIndex || block.linear != linear) continue;
+      vk::DeviceSize offset = 0;
+      if (takeRange(block, size, alignment, offset)) {
+        return makeAllocation(i, offset, size);
+      }
+    }
+
+    // Nothing fits: reserve a new block, or a dedicated one for very large requests.
+    Block block{};
+    block.memoryTypeIndex = memoryTypeIndex;
+    block.linear = linear;
+    block.size = std::max(blockSize_, roundUp(size, bufferImageGranularity_));
+    vk::MemoryAllocateInfo mai{};
+    mai.allocationSize = block.size;
+    mai.memoryTypeIndex = memoryTypeIndex;
+    block.memory = device_.allocateMemoryUnique(mai);
+    if (memprops_.memoryTypes[memoryTypeIndex].propertyFlags & vk::MemoryPropertyFlagBits::eHostVisible) {
+      block.mapped = static_cast<uint8_t *>(device_.mapMemory(*block.memory, 0, VK_WHOLE_SIZE, vk::MemoryMapFlags{}));
+    }
+    block.freeRanges[0] = block.size;
+
+    // Reuse the slot of a freed block; allocations refer to blocks by index, so slots never move.
+    auto slot = std::find_if(blocks_.begin(), blocks_.end(), [](const Block &b) { return !b.memory; });
+    auto index = static_cast<uint32_t>(slot - blocks_.begin());
+    if (slot == blocks_.end()) {
+      blocks_.push_back(std::move(block));
+    } else {
+      *slot = std::move(block);
+    }
+    vk::DeviceSize offset = 0;
+    takeRange(blocks_[index], size, alignment, offset);
+    return makeAllocation(index, offset, size);
+  }
+
+  /// Usage counters for all blocks.
+  [[nodiscard]] Stats stats() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    Stats result{};
+    for (auto &block : blocks_) {
+      if (!block.memory) continue;
+      vk::DeviceSize largest = 0, free = 0;
+      for (auto &range : block.freeRanges) {
+        largest = std::max(largest, range.second);
+        free += range.second;
+      }
+      result.blockCount++;
+      result.allocationCount += block.allocationCount;
+      result.bytesReserved += block.size;
+      result.bytesUsed += block.size - free;
+      result.bytesFragmented += free - largest;
+    }
+    return result;
+  }
+
+  [[nodiscard]] vk::Device device() const { return device_; }
+  [[nodiscard]] const vk::PhysicalDeviceMemoryProperties &memprops() const { return memprops_; }
+  [[nodiscard]] vk::DeviceSize nonCoherentAtomSize() const { return nonCoherentAtomSize_; }
+private:
+  friend class MemoryAllocation;
+
+  struct Block {
+    vk::UniqueDeviceMemory memory;
+    uint32_t memoryTypeIndex = 0;
+    bool linear = true;
+    vk::DeviceSize size = 0;
+    uint32_t allocationCount = 0;
+    uint8_t *mapped = nullptr;
+    // offset -> size of each free range, kept coalesced.
+    std::map<vk::DeviceSize, vk::DeviceSize> freeRanges;
+  };
+
+  // First fit. Alignment padding in front of the range stays on the free list.
+  static bool takeRange(Block &block, vk::DeviceSize size, vk::DeviceSize alignment, vk::DeviceSize &result) {
+    for (auto it = block.freeRanges.begin(); it != block.freeRanges.end(); ++it) {
+      auto [start, length] = *it;
+      vk::DeviceSize offset = roundUp(start, alignment);
+      if (offset + size > start + length) continue;
+      block.freeRanges.erase(it);
+      if (offset != start) block.freeRanges[start] = offset - start;
+      if (offset + size != start + length) block.freeRanges[offset + size] = start + length - offset - size;
+      block.allocationCount++;
+      result = offset;
+      return true;
+    }
+    return false;
+  }
+
+  MemoryAllocation makeAllocation(uint32_t index, vk::DeviceSize offset, vk::DeviceSize size) {
+    auto &block = blocks_[index];
+    MemoryAllocation result;
+    result.allocator_ = this;
+    result.block_ = index;
+    result.memoryTypeIndex_ = block.memoryTypeIndex;
+    result.memory_ = *block.memory;
+    result.offset_ = offset;
+    result.size_ = size;
+    result.mapped_ = block.mapped ? block.mapped + offset : nullptr;
+    return result;
+  }
+
+  void free(uint32_t index, vk::DeviceSize offset, vk::DeviceSize size) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto &block = blocks_[index];
+    auto &ranges = block.freeRanges;
+    block.allocationCount--;
+    auto next = ranges.lower_bound(offset);
+    if (next != ranges.end() && offset + size == next->first) {
+      size += next->second;
+      next = ranges.erase(next);
+    }
+    auto prev = next != ranges.begin() ? std::prev(next) : ranges.end();
+    if (prev != ranges.end() && prev->first + prev->second == offset) {
+      prev->second += size;
+    } else {
+      ranges[offset] = size;
+    }
+    if (block.allocationCount == 0) release(index);
+  }
+
+  // Free an empty block unless it is the only spare of its memory type and kind.
+  // Dedicated blocks for large requests are never kept.
+  void release(uint32_t index) {
+    auto &block = blocks_[index];
+    bool keep = block.size == blockSize_;
+    for (uint32_t i = 0; keep && i != blocks_.size(); ++i) {
+      auto &other = blocks_[i];
+      if (i != index && other.memory && other.allocationCount == 0
+        && other.memoryTypeIndex == block.memoryTypeIndex && other.linear == block.linear) {
+        keep = false;
+      }
+    }
+    if (!keep) block = Block{};
+  }
+
+  vk::Device device_;
+  vk::PhysicalDeviceMemoryProperties memprops_;
+  vk::DeviceSize blockSize_;
+  vk::DeviceSize bufferImageGranularity_ = 1;
+  vk::DeviceSize nonCoherentAtomSize_ = 1;
+  std::vector<Block> blocks_;
+  mutable std::mutex mutex_;
+};
+
+inline void MemoryAllocation::reset() {
+  if (allocator_) {
+    allocator_->free(block_, offset_, size_);
+    allocator_ = nullptr;
+  }
+}
+
+/// A generic buffer that may be used as a vertex buffer, uniform buffer or other kinds of memory resident data.
+/// Buffers require memory objects which represent GPU and CPU resources.
+///
+/// Host visible buffers can be persistently mapped: the memory is mapped once at construction,
+/// span<T>() gives typed access and only the ranges passed to markDirty() are flushed.
+/// Sub-allocated buffers are always persistently mapped by their allocator.
+class GenericBuffer {
+public:
+  GenericBuffer() = default;
+
+  GenericBuffer(vk::Device device, const vk::PhysicalDeviceMemoryProperties &memprops, vk::BufferUsageFlags usage, vk::DeviceSize size, vk::MemoryPropertyFlags memflags = vk::MemoryPropertyFlagBits::eDeviceLocal, bool persistentMap = false) {
+    // Create the buffer object without memory.
+    vk::BufferCreateInfo ci{};
+    ci.size = size_ = size;
+    ci.usage = usage;
+    ci.sharingMode = vk::SharingMode::eExclusive;
+    buffer_ = device.createBufferUnique(ci);
+
+    // Find out how much memory and which heap to allocate from.
+    auto memreq = device.getBufferMemoryRequirements(*buffer_);
+
+    // Create a memory object to bind to the buffer.
+    vk::MemoryAllocateInfo mai{};
+    mai.allocationSize = memreq.size;
+    mai.memoryTypeIndex = vku::findMemoryTypeIndex(memprops, memreq.memoryTypeBits, memflags);
+    mem_ = device.allocateMemoryUnique(mai);
+    memSize_ = memreq.size;
+    if (mai.memoryTypeIndex < memprops.memoryTypeCount) {
+      coherent_ = bool(memprops.memoryTypes[mai.memoryTypeIndex].propertyFlags & vk::MemoryPropertyFlagBits::eHostCoherent);
+    }
+
+    device.bindBufferMemory(*buffer_, *mem_, 0);
+
+    if (persistentMap) {
+      mapped_ = device.mapMemory(*mem_, 0, VK_WHOLE_SIZE, vk::MemoryMapFlags{});
+    }
+  }
+
+  /// Create a buffer whose memory is a range of a larger block owned by allocator.
+  GenericBuffer(vk::Device device, vku::MemoryAllocator &allocator, vk::BufferUsageFlags usage, vk::DeviceSize size, vk::MemoryPropertyFlags memflags = vk::MemoryPropertyFlagBits::eDeviceLocal) {
+    vk::BufferCreateInfo ci{};
+    ci.size = size_ = size;
+    ci.usage = usage;
+    ci.sharingMode = vk::SharingMode::eExclusive;
+    buffer_ = device.createBufferUnique(ci);
+
+    auto memreq = device.getBufferMemoryRequirements(*buffer_);
+    alloc_ = allocator.allocate(memreq, memflags);
+    memSize_ = alloc_.size();
+    atomSize_ = allocator.nonCoherentAtomSize();
+    coherent_ = bool(allocator.memprops().memoryTypes[alloc_.memoryTypeIndex()].propertyFlags & vk::MemoryPropertyFlagBits::eHostCoherent);
+
+    device.bindBufferMemory(*buffer_, alloc_.memory(), alloc_.offset());
+  }
+
+  /// For a host visible buffer, copy memory to the buffer object.
+  /// Persistently mapped buffers skip the map and only flush the bytes written.
+  void updateLocal(const vk::Device &device, const void *value, vk::DeviceSize size) const {
+    if (void *ptr = mapped()) {
+      memcpy(ptr, value, (size_t)size);
+      if (!coherent_ && size != 0) {
+        device.flushMappedMemoryRanges(atomRange(0, size));
+      }
+      return;
+    }
+    void *ptr = map(device);
+    memcpy(ptr, value, (size_t)size);
+    flush(device);
+    unmap(device);
+  }
+
+  /// For a purely device local buffer, copy memory to the buffer object immediately.
+  /// Note that this will stall the pipeline!
+  void upload(vk::Device device, const vk::PhysicalDeviceMemoryProperties &memprops, vk::CommandPool commandPool, vk::Queue queue, const void *value, vk::DeviceSize size) const {
+    if (size == 0) return;
+    using buf = vk::BufferUsageFlagBits;
+    using pfb = vk::MemoryPropertyFlagBits;
+    auto tmp = vku::GenericBuffer(device, memprops, buf::eTransferSrc, size, pfb::eHostVisible);
+    tmp.updateLocal(device, value, size);
+
+    vku::executeImmediately(device, commandPool, queue, [&](vk::CommandBuffer cb) {
+      vk::BufferCopy bc{0, 0, size};
+      cb.copyBuffer(tmp.buffer(), *buffer_, bc);
+    });
+  }
+
+  template<typename T>
+  void upload(vk::Device device, const vk::PhysicalDeviceMemoryProperties &memprops, vk::CommandPool commandPool, vk::Queue queue, const std::vector<T> &value) const {
+    upload(device, memprops, commandPool, queue, value.data(), value.size() * sizeof(T));
+  }
+
+  template<typename T>
+  void upload(vk::Device device, const vk::PhysicalDeviceMemoryProperties &memprops, vk::CommandPool commandPool, vk::Queue queue, const T &value) const {
+    upload(device, memprops, commandPool, queue, &value, sizeof(value));
+  }
+
+  /// Copy memory to the buffer object through a SubmitPool without waiting.
+  /// The staging buffer is released by the pool when the copy completes.
+  SubmitPool::Submission upload(vk::Device device, const vk::PhysicalDeviceMemoryProperties &memprops, vku::SubmitPool &pool, const void *value, vk::DeviceSize size) const {
+    if (size == 0) return {};
+    using buf = vk::BufferUsageFlagBits;
+    using pfb = vk::MemoryPropertyFlagBits;
+    auto tmp = vku::GenericBuffer(device, memprops, buf::eTransferSrc, size, pfb::eHostVisible);
+    tmp.updateLocal(device, value, size);
+
+    vk::Buffer src = tmp.buffer();
+    vk::Buffer dst = *buffer_;
+    return pool.submit([=](vk::CommandBuffer cb) {
+      vk::BufferCopy bc{0, 0, size};
+      cb.copyBuffer(src, dst, bc);
+    }, std::move(tmp));
+  }
+
+  template<typename T>
+  SubmitPool::Submission upload(vk::Device device, const vk::PhysicalDeviceMemoryProperties &memprops, vku::SubmitPool &pool, const std::vector<T> &value) const {
+    return upload(device, memprops, pool, value.data(), value.size() * sizeof(T));
+  }
+
+  /// Copy a range of this buffer back to host memory without waiting.
+  /// The buffer needs eTransferSrc usage. Earlier work on the pool's queue is finished first.
+  Readback download(vk::Device device, const vk::PhysicalDeviceMemoryProperties &memprops, vku::SubmitPool &pool, vk::DeviceSize offset = 0, vk::DeviceSize size = VK_WHOLE_SIZE) const {
+    if (size == VK_WHOLE_SIZE) size = size_ - offset;
+    auto tmp = std::make_shared<GenericBuffer>(readbackBuffer(device, memprops, size));
+    vk::Buffer dst = tmp->buffer();
+    auto submission = pool.submit([&](vk::CommandBuffer cb) {
+      recordDownload(cb, dst, 0, offset, size);
+    }, tmp);
+    return tmp->readback(device, submission, tmp, 0, size);
+  }
+
+  /// Record a copy of a range of this buffer to dst, with barriers for earlier
+  /// writes on the queue and for reading the result on the host.
+  void recordDownload(vk::CommandBuffer cb, vk::Buffer dst, vk::DeviceSize dstOffset, vk::DeviceSize offset, vk::DeviceSize size) const {
+    vk::MemoryBarrier before{vk::AccessFlagBits::eMemoryWrite, vk::AccessFlagBits::eTransferRead};
+    cb.pipelineBarrier(vk::PipelineStageFlagBits::eAllCommands, vk::PipelineStageFlagBits::eTransfer, vk::DependencyFlags{}, before, nullptr, nullptr);
+    vk::BufferCopy bc{offset, dstOffset, size};
+    cb.copyBuffer(*buffer_, dst, bc);
+    vk::MemoryBarrier after{vk::AccessFlagBits::eTransferWrite, vk::AccessFlagBits::eHostRead};
+    cb.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eHost, vk::DependencyFlags{}, after, nullptr, nullptr);
+  }
+
+  /// Make a Readback for a range of this persistently mapped buffer that is valid once submission completes.
+  [[nodiscard]] Readback readback(vk::Device device, SubmitPool::Submission submission, std::shared_ptr<void> owner, vk::DeviceSize offset, vk::DeviceSize size) const {
+    return Readback{device, submission, static_cast<const uint8_t *>(mapped()) + offset, size, coherent_, atomRange(offset, size), std::move(owner)};
+  }
+
+  /// Make a persistently mapped buffer for reading results back on the host.
+  /// Host cached memory is used if there is any, as uncached reads are very slow.
+  static GenericBuffer readbackBuffer(vk::Device device, const vk::PhysicalDeviceMemoryProperties &memprops, vk::DeviceSize size) {
+    using pfb = vk::MemoryPropertyFlagBits;
+    vk::MemoryPropertyFlags flags = pfb::eHostVisible;
+    for (uint32_t i = 0; i != memprops.memoryTypeCount; ++i) {
+      if ((memprops.memoryTypes[i].propertyFlags & (pfb::eHostVisible|pfb::eHostCached)) == (pfb::eHostVisible|pfb::eHostCached)) {
+        flags |= pfb::eHostCached;
+        break;
+      }
+    }
+    return GenericBuffer(device, memprops, vk::BufferUsageFlagBits::eTransferDst, size, flags, true);
+  }
+
+  void barrier(vk::CommandBuffer cb, vk::PipelineStageFlags srcStageMask, vk::PipelineStageFlags dstStageMask, vk::DependencyFlags dependencyFlags, vk::AccessFlags srcAccessMask, vk::AccessFlags dstAccessMask, uint32_t srcQueueFamilyIndex, uint32_t dstQueueFamilyIndex) const {
+    vk::BufferMemoryBarrier bmb{srcAccessMask, dstAccessMask, srcQueueFamilyIndex, dstQueueFamilyIndex, *buffer_, 0, size_};
+    cb.pipelineBarrier(srcStageMask, dstStageMask, dependencyFlags, nullptr, bmb, nullptr);
+  }
+
+  template<class Type, class Allocator>
+  void updateLocal(const vk::Device &device, const std::vector<Type, Allocator> &value) const {
+    updateLocal(device, static_cast<const void*>(value.data()), static_cast<vk::DeviceSize>(value.size() * sizeof(Type)));
+  }
+
+  template<class Type>
+  void updateLocal(const vk::Device &device, const Type &value) const {
+    updateLocal(device, static_cast<const void*>(&value), static_cast<vk::DeviceSize>(sizeof(Type)));
+  }
+
+  /// Map the buffer for host access.
+  /// Persistently mapped buffers return their existing mapping.
+  [[nodiscard]] void *map(const vk::Device &device) const {
+    if (void *ptr = mapped()) return ptr;
+    return device.mapMemory(*mem_, 0, size_, vk::MemoryMapFlags{});
+  };
+
+  void unmap(const vk::Device &device) const {
+    if (!mapped()) device.unmapMemory(*mem_);
+  };
+
+  /// Host address of a persistently mapped buffer, or nullptr.
+  [[nodiscard]] void *mapped() const { return alloc_ ? alloc_.mapped() : mapped_; }
+
+  /// Typed view of a persistently mapped buffer.
+  /// Call markDirty() for the bytes you write and flushDirty() before submitting.
+  template<class Type>
+  [[nodiscard]] std::span<Type> span() const {
+    return std::span<Type>(static_cast<Type *>(mapped()), mapped() ? static_cast<size_t>(size_ / sizeof(Type)) : 0);
+  }
+
+  /// Record a byte range written through span() or mapped().
+  void markDirty(vk::DeviceSize offset, vk::DeviceSize size) {
+    if (coherent_ || size == 0) return;
+    for (auto &range : dirty_) {
+      // Merge with an overlapping or touching range.
+      if (offset <= range.first + range.second && range.first <= offset + size) {
+        auto end = std::max(range.first + range.second, offset + size);
+        range.first = std::min(range.first, offset);
+        range.second = end - range.first;
+        return;
+      }
+    }
+    dirty_.emplace_back(offset, size);
+  }
+
+  /// Flush the ranges recorded with markDirty(), rounded out to nonCoherentAtomSize.
+  /// Host coherent memory needs no flush and nothing is recorded for it.
+  void flushDirty(const vk::Device &device) {
+    if (dirty_.empty()) return;
+    std::vector<vk::MappedMemoryRange> ranges;
+    ranges.reserve(dirty_.size());
+    for (auto &range : dirty_) {
+      ranges.push_back(atomRange(range.first, range.second));
+    }
+    device.flushMappedMemoryRanges(ranges);
+    dirty_.clear();
+  }
+
+  /// Make device writes to a byte range of a mapped, non-coherent buffer visible to the host.
+  void invalidate(const vk::Device &device, vk::DeviceSize offset, vk::DeviceSize size) const {
+    if (coherent_ || size == 0) return;
+    device.invalidateMappedMemoryRanges(atomRange(offset, size));
+  }
+
+  /// True if the memory is host coherent and never needs flushing.
+  [[nodiscard]] bool coherent() const { return coherent_; }
+
+  void flush(const vk::Device &device) const {
+    vk::MappedMemoryRange mr{mem(), memOffset(), alloc_ ? alloc_.size() : VK_WHOLE_SIZE};
+    return device.flushMappedMemoryRanges(mr);
+  }
+
+  void invalidate(const vk::Device &device) const {
+    vk::MappedMemoryRange mr{mem(), memOffset(), alloc_ ? alloc_.size() : VK_WHOLE_SIZE};
+    return device.invalidateMappedMemoryRanges(mr);
+  }
+
+  [[nodiscard]] vk::Buffer buffer() const { return *buffer_; }
+  [[nodiscard]] vk::DeviceMemory mem() const { return alloc_ ? alloc_.memory() : *mem_; }
+  /// Offset of the buffer in mem(). Non-zero for sub-allocated buffers.
+  [[nodiscard]] vk::DeviceSize memOffset() const { return alloc_ ? alloc_.offset() : 0; }
+  [[nodiscard]] vk::DeviceSize size() const { return size_; }
+private:
+  // A range of the buffer grown to whole non-coherent atoms, in memory coordinates.
+  [[nodiscard]] vk::MappedMemoryRange atomRange(vk::DeviceSize offset, vk::DeviceSize size) const {
+    vk::DeviceSize begin = (memOffset() + offset) / atomSize_ * atomSize_;
+    vk::DeviceSize end = (memOffset() + offset + size + atomSize_ - 1) / atomSize_ * atomSize_;
+    // Past the end of a dedicated allocation, flush to the end of the memory object.
+    if (end > memOffset() + memSize_) return vk::MappedMemoryRange{mem(), begin, VK_WHOLE_SIZE};
+    return vk::MappedMemoryRange{mem(), begin, end - begin};
+  }
+
+  vk::UniqueBuffer buffer_;
+  vk::UniqueDeviceMemory mem_;
+  vku::MemoryAllocation alloc_;
+  vk::DeviceSize size_;
+  vk::DeviceSize memSize_ = 0;
+  // Largest nonCoherentAtomSize the spec allows, so it is a multiple of any device's value.
+  vk::DeviceSize atomSize_ = 256;
+  void *mapped_ = nullptr;
+  bool coherent_ = false;
+  std::vector<std::pair<vk::DeviceSize, vk::DeviceSize>> dirty_;
+};
+
+/// This class is a specialisation of GenericBuffer for high performance vertex buffers on the GPU.
+/// You must upload the contents before use.
+class VertexBuffer : public GenericBuffer {
+public:
+  VertexBuffer() = default;
+
+  VertexBuffer(const vk::Device &device, const vk::PhysicalDeviceMemoryProperties &memprops, size_t size) : GenericBuffer(device, memprops, vk::BufferUsageFlagBits::eVertexBuffer | vk::BufferUsageFlagBits::eTransferDst, size, vk::MemoryPropertyFlagBits::eDeviceLocal) {
+  }
+
+  VertexBuffer(const vk::Device &device, vku::MemoryAllocator &allocator, size_t size) : GenericBuffer(device, allocator, vk::BufferUsageFlagBits::eVertexBuffer | vk::BufferUsageFlagBits::eTransferDst, size, vk::MemoryPropertyFlagBits::eDeviceLocal) {
+  }
+};
+
+/// This class is a specialisation of GenericBuffer for low performance vertex buffers on the host.
+class HostVertexBuffer : public GenericBuffer {
+public:
+  HostVertexBuffer() = default;
+
+  template<class Type, class Allocator>
+  HostVertexBuffer(const vk::Device &device, const vk::PhysicalDeviceMemoryProperties &memprops, const std::vector<Type, Allocator> &value) : GenericBuffer(device, memprops, vk::BufferUsageFlagBits::eVertexBuffer, value.size() * sizeof(Type), vk::MemoryPropertyFlagBits::eHostVisible) {
+    updateLocal(device, value);
+  }
+
+  template<class Type, class Allocator>
+  HostVertexBuffer(const vk::Device &device, vku::MemoryAllocator &allocator, const std::vector<Type, Allocator> &value) : GenericBuffer(device, allocator, vk::BufferUsageFlagBits::eVertexBuffer, value.size() * sizeof(Type), vk::MemoryPropertyFlagBits::eHostVisible) {
+    updateLocal(device, value);
+  }
+};
+
+/// This class is a specialisation of GenericBuffer for high performance index buffers.
+/// You must upload the contents before use.
+class IndexBuffer : public GenericBuffer {
+public:
+  IndexBuffer() = default;
+
+  IndexBuffer(const vk::Device &device, const vk::PhysicalDeviceMemoryProperties &memprops, vk::DeviceSize size) : GenericBuffer(device, memprops, vk::BufferUsageFlagBits::eIndexBuffer | vk::BufferUsageFlagBits::eTransferDst, size, vk::MemoryPropertyFlagBits::eDeviceLocal) {
+  }
+
+  IndexBuffer(const vk::Device &device, vku::MemoryAllocator &allocator, vk::DeviceSize size) : GenericBuffer(device, allocator, vk::BufferUsageFlagBits::eIndexBuffer | vk::BufferUsageFlagBits::eTransferDst, size, vk::MemoryPropertyFlagBits::eDeviceLocal) {
+  }
+};
+
+/// This class is a specialisation of GenericBuffer for low performance vertex buffers in CPU memory.
+class HostIndexBuffer : public GenericBuffer {
+public:
+  HostIndexBuffer() = default;
+
+  template<class Type, class Allocator>
+  HostIndexBuffer(const vk::Device &device, const vk::PhysicalDeviceMemoryProperties &memprops, const std::vector<Type, Allocator> &value) : GenericBuffer(device, memprops, vk::BufferUsageFlagBits::eIndexBuffer, value.size() * sizeof(Type), vk::MemoryPropertyFlagBits::eHostVisible) {
+    updateLocal(device, value);
+  }
+
+  template<class Type, class Allocator>
+  HostIndexBuffer(const vk::Device &device, vku::MemoryAllocator &allocator, const std::vector<Type, Allocator> &value) : GenericBuffer(device, allocator, vk::BufferUsageFlagBits::eIndexBuffer, value.size() * sizeof(Type), vk::MemoryPropertyFlagBits::eHostVisible) {
+    updateLocal(device, value);
+  }
+};
+
+/// This class is a specialisation of GenericBuffer for uniform buffers.
+class UniformBuffer : public GenericBuffer {
+public:
+  UniformBuffer() = default;
+
+  /// Device local uniform buffer.
+  UniformBuffer(const vk::Device &device, const vk::PhysicalDeviceMemoryProperties &memprops, size_t size) :
+  GenericBuffer(device, memprops, vk::BufferUsageFlagBits::eUniformBuffer|vk::BufferUsageFlagBits::eTransferDst, static_cast<vk::DeviceSize>(size), vk::MemoryPropertyFlagBits::eDeviceLocal) {
+  }
+
+  /// Device local uniform buffer sub-allocated from allocator.
+  UniformBuffer(const vk::Device &device, vku::MemoryAllocator &allocator, size_t size) :
+  GenericBuffer(device, allocator, vk::BufferUsageFlagBits::eUniformBuffer|vk::BufferUsageFlagBits::eTransferDst, static_cast<vk::DeviceSize>(size), vk::MemoryPropertyFlagBits::eDeviceLocal) {
+  }
+};
+
+/// A persistently mapped, host coherent ring of transient memory for per-frame data.
+/// The ring is split into one slot per frame in flight. Each frame, allocate() hands out
+/// aligned ranges of the current slot which can be written directly through ptr and used
+/// as dynamic uniform/storage offsets, vertex buffer offsets or copyBuffer sources.
+/// No memory is mapped or allocated after construction.
+///
+///     vku::UploadRing ring{device, fw.physicalDevice(), window.framesInFlight(), 65536};
+///     ...
+///     ring.beginFrame(device, window.frameIndex());
+///     auto r = ring.push(uniform);
+///     cb.bindDescriptorSets(bindPoint, layout, 0, dset, ring.dynamicOffset(r));
+class UploadRing {
+public:
+  /// A range of the ring, ready to be written through ptr.
+  struct Range {
+    vk::Buffer buffer;
+    vk::DeviceSize offset = 0;
+    vk::DeviceSize size = 0;
+    void *ptr = nullptr;
+
+    explicit operator bool() const { return ptr != nullptr; }
+  };
+
+  UploadRing() = default;
+
+  /// Create a ring of frames slots, each frameBudget bytes.
+  UploadRing(vk::Device device, vk::PhysicalDevice physicalDevice, uint32_t frames, vk::DeviceSize frameBudget,
+             vk::BufferUsageFlags usage = vk::BufferUsageFlagBits::eUniformBuffer|vk::BufferUsageFlagBits::eStorageBuffer|vk::BufferUsageFlagBits::eVertexBuffer|vk::BufferUsageFlagBits::eIndexBuffer|vk::BufferUsageFlagBits::eTransferSrc) {
+    auto limits = physicalDevice.getProperties().limits;
+    alignment_ = std::max(limits.minUniformBufferOffsetAlignment, limits.minStorageBufferOffsetAlignment);
+    frames_ = std::max(frames, 1U);
+    frameBudget_ = roundUp(frameBudget, alignment_);
+
+    using pfb = vk::MemoryPropertyFlagBits;
+    buffer_ = GenericBuffer(device, physicalDevice.getMemoryProperties(), usage, frameBudget_ * frames_, pfb::eHostVisible|pfb::eHostCoherent, true);
+    base_ = static_cast<uint8_t *>(buffer_.mapped());
+  }
+
+  /// Start filling the slot for frame, discarding what it held.
+  /// The slot must no longer be in use by the GPU: pass the fences of the
+  /// frame's last submission (eg. window.frameFence(frame)) if they
+  /// have not already been waited on. Window::draw waits for the frame slot's
+  /// fence before calling the dynamic function.
+  void beginFrame(vk::Device device, uint32_t frame, vk::ArrayProxy<const vk::Fence> const &fences = nullptr) {
+    if (!fences.empty()) {
+      (void)device.waitForFences(fences, VK_TRUE, std::numeric_limits<uint64_t>::max());
+    }
+    frame_ = frame % frames_;
+    head_ = 0;
+  }
+
+  /// Allocate size bytes from the current frame slot.
+  /// The offset is at least minUniformBufferOffsetAlignment aligned.
+  /// Returns an empty range if the frame budget is exhausted.
+  Range allocate(vk::DeviceSize size, vk::DeviceSize alignment = 1) {
+    vk::DeviceSize offset = roundUp(head_, std::max(alignment, alignment_));
+    if (offset + size > frameBudget_) return Range{};
+    head_ = offset + size;
+    vk::DeviceSize base = frame_ * frameBudget_ + offset;
+    return Range{buffer_.buffer(), base, size, base_ + base};
+  }
+
+  /// Allocate and copy a value into the current frame slot.
+  template<class Type>
+  Range push(const Type &value) {
+    auto range = allocate(sizeof(Type), alignof(Type));
+    if (range) memcpy(range.ptr, &value, sizeof(Type));
+    return range;
+  }
+
+  /// Allocate and copy a vector into the current frame slot.
+  template<class Type, class Allocator>
+  Range push(const std::vector<Type, Allocator> &value) {
+    auto range = allocate(value.size() * sizeof(Type), alignof(Type));
+    if (range) memcpy(range.ptr, value.data(), value.size() * sizeof(Type));
+    return range;
+  }
+
+  /// Offset of a range in the form bindDescriptorSets expects for dynamic descriptors.
+  static uint32_t dynamicOffset(const Range &range) { return static_cast<uint32_t>(range.offset); }
+
+  [[nodiscard]] vk::Buffer buffer() const { return buffer_.buffer(); }
+  [[nodiscard]] uint32_t frames() const { return frames_; }
+  [[nodiscard]] vk::DeviceSize frameBudget() const { return frameBudget_; }
+  /// Bytes allocated from the current frame slot so far.
+  [[nodiscard]] vk::DeviceSize used() const { return head_; }
+private:
+  GenericBuffer buffer_;
+  uint8_t *base_ = nullptr;
+  vk::DeviceSize alignment_ = 1;
+  vk::DeviceSize frameBudget_ = 0;
+  vk::DeviceSize head_ = 0;
+  uint32_t frames_ = 1;
+  uint32_t frame_ = 0;
+};
+
+/// Convenience class for updating descriptor sets (uniforms)
+/// Any number of descriptors can be added; the info arrays grow as needed and
+/// the write structures only point into them when update() is called.
+class DescriptorSetUpdater {
+public:
+  /// The arguments are only hints for how much space to reserve.
+  explicit DescriptorSetUpdater(int maxBuffers = 10, int maxImages = 10, int maxBufferViews = 0) {
+    bufferInfo_.reserve(maxBuffers);
+    imageInfo_.reserve(maxImages);
+    bufferViews_.reserve(maxBufferViews);
+  }
+
+  /// Call this to begin a new descriptor set.
+  DescriptorSetUpdater& beginDescriptorSet(vk::DescriptorSet dstSet) {
+    dstSet_ = dstSet;
+    return *this;
+  }
+
+  /// Call this to begin a new set of images.
+  DescriptorSetUpdater& beginImages(uint32_t dstBinding, uint32_t dstArrayElement, vk::DescriptorType descriptorType) {
+    begin(dstBinding, dstArrayElement, descriptorType, Kind::image, imageInfo_.size());
+    return *this;
+  }
+
+  /// Call this to add a combined image sampler.
+  DescriptorSetUpdater& image(vk::Sampler sampler, vk::ImageView imageView, vk::ImageLayout imageLayout) {
+    if (add(Kind::image)) {
+      imageInfo_.emplace_back(sampler, imageView, imageLayout);
+    }
+    return *this;
+  }
+
+  /// Call this to start defining buffers.
+  DescriptorSetUpdater& beginBuffers(uint32_t dstBinding, uint32_t dstArrayElement, vk::DescriptorType descriptorType) {
+    begin(dstBinding, dstArrayElement, descriptorType, Kind::buffer, bufferInfo_.size());
+    return *this;
+  }
+
+  /// Call this to add a new buffer.
+  DescriptorSetUpdater& buffer(vk::Buffer buffer, vk::DeviceSize offset, vk::DeviceSize range) {
+    if (add(Kind::buffer)) {
+      bufferInfo_.emplace_back(buffer, offset, range);
+    }
+    return *this;
+  }
+
+  /// Call this to start adding buffer views. (for example, writable images).
+  void beginBufferViews(uint32_t dstBinding, uint32_t dstArrayElement, vk::DescriptorType descriptorType) {
+    begin(dstBinding, dstArrayElement, descriptorType, Kind::bufferView, bufferViews_.size());
+  }
+
+  /// Call this to add a buffer view. (Texel images)
+  void bufferView(vk::BufferView view) {
+    if (add(Kind::bufferView)) {
+      bufferViews_.push_back(view);
+    }
+  }
+
+  /// Copy an existing descriptor.
+  void copy(vk::DescriptorSet srcSet, uint32_t srcBinding, uint32_t srcArrayElement, vk::DescriptorSet dstSet, uint32_t dstBinding, uint32_t dstArrayElement, uint32_t descriptorCount) {
+    descriptorCopies_.emplace_back(srcSet, srcBinding, srcArrayElement, dstSet, dstBinding, dstArrayElement, descriptorCount);
+  }
+
+  /// Call this to update the descriptor sets with their pointers (but not data).
+  /// All the writes and copies go to the driver in one call.
+  void update(const vk::Device &device) const {
+    std::vector<vk::WriteDescriptorSet> writes = descriptorWrites_;
+    for (size_t i = 0; i != writes.size(); ++i) {
+      auto first = firstInfo_[i];
+      switch (kinds_[i]) {
+        case Kind::image: writes[i].pImageInfo = imageInfo_.data() + first; break;
+        case Kind::buffer: writes[i].pBufferInfo = bufferInfo_.data() + first; break;
+        case Kind::bufferView: writes[i].pTexelBufferView = bufferViews_.data() + first; break;
+      }
+    }
+    device.updateDescriptorSets( writes, descriptorCopies_ );
+  }
+
+  /// Forget all writes and copies so the updater can be reused without reallocating.
+  void clear() {
+    bufferInfo_.clear();
+    imageInfo_.clear();
+    bufferViews_.clear();
+    descriptorWrites_.clear();
+    descriptorCopies_.clear();
+    kinds_.clear();
+    firstInfo_.clear();
+    ok_ = true;
+  }
+
+  /// Returns true if the updater is error free.
+  [[nodiscard]] bool ok() const { return ok_; }
+private:
+  enum class Kind { image, buffer, bufferView };
+
+  void begin(uint32_t dstBinding, uint32_t dstArrayElement, vk::DescriptorType descriptorType, Kind kind, size_t first) {
+    vk::WriteDescriptorSet wdesc{};
+    wdesc.dstSet = dstSet_;
+    wdesc.dstBinding = dstBinding;
+    wdesc.dstArrayElement = dstArrayElement;
+    wdesc.descriptorCount = 0;
+    wdesc.descriptorType = descriptorType;
+    descriptorWrites_.push_back(wdesc);
+    kinds_.push_back(kind);
+    firstInfo_.push_back(first);
+  }
+
+  // Count one more descriptor in the current write if it is of the right kind.
+  bool add(Kind kind) {
+    if (descriptorWrites_.empty() || kinds_.back() != kind) {
+      ok_ = false;
+      return false;
+    }
+    descriptorWrites_.back().descriptorCount++;
+    return true;
+  }
+
+  std::vector<vk::DescriptorBufferInfo> bufferInfo_;
+  std::vector<vk::DescriptorImageInfo> imageInfo_;
+  std::vector<vk::WriteDescriptorSet> descriptorWrites_;
+  std::vector<vk::CopyDescriptorSet> descriptorCopies_;
+  std::vector<vk::BufferView> bufferViews_;
+  // For each write, which info array it uses and the index of its first element.
+  std::vector<Kind> kinds_;
+  std::vector<size_t> firstInfo_;
+  vk::DescriptorSet dstSet_;
+  bool ok_ = true;
+};
+
+/// One descriptor in the data read by a descriptor update template.
+struct DescriptorData {
+  union {
+    VkDescriptorImageInfo image;
+    VkDescriptorBufferInfo buffer;
+    VkBufferView bufferView;
+  };
+};
+
+/// A factory class for descriptor set layouts. (An interface to the shaders)
+class DescriptorSetLayoutMaker {
+public:
+  DescriptorSetLayoutMaker() = default;
+
+  DescriptorSetLayoutMaker& buffer(uint32_t binding, vk::DescriptorType descriptorType, vk::ShaderStageFlags stageFlags, uint32_t descriptorCount) {
+    s.bindings.emplace_back(binding, descriptorType, descriptorCount, stageFlags, nullptr);
+    return *this;
+  }
+
+  DescriptorSetLayoutMaker& image(uint32_t binding, vk::DescriptorType descriptorType, vk::ShaderStageFlags stageFlags, uint32_t descriptorCount) {
+    s.bindings.emplace_back(binding, descriptorType, descriptorCount, stageFlags, nullptr);
+    return *this;
+  }
+
+  DescriptorSetLayoutMaker& samplers(uint32_t binding, vk::DescriptorType descriptorType, vk::ShaderStageFlags stageFlags, const std::vector<vk::Sampler>& immutableSamplers) {
+    s.samplers.push_back(immutableSamplers);
+    auto pImmutableSamplers = s.samplers.back().data();
+    s.bindings.emplace_back(binding, descriptorType, static_cast<uint32_t>(immutableSamplers.size()), stageFlags, pImmutableSamplers);
+    return *this;
+  }
+
+  DescriptorSetLayoutMaker& bufferView(uint32_t binding, vk::DescriptorType descriptorType, vk::ShaderStageFlags stageFlags, uint32_t descriptorCount) {
+    s.bindings.emplace_back(binding, descriptorType, descriptorCount, stageFlags, nullptr);
+    return *this;
+  }
+
+  /// Create a self-deleting descriptor set object.
+  [[nodiscard]] vk::UniqueDescriptorSetLayout createUnique(vk::Device device) const {
+    vk::DescriptorSetLayoutCreateInfo dsci{};
+    dsci.bindingCount = static_cast<uint32_t>(s.bindings.size());
+    dsci.pBindings = s.bindings.data();
+    return device.createDescriptorSetLayoutUnique(dsci);
+  }
+
+  /// Create an update template for sets made with layout (which must come from this maker).
+  /// The template reads one DescriptorData per descriptor, binding after binding in the order
+  /// they were added. DescriptorTemplateData builds that array. Needs Vulkan 1.1.
+  [[nodiscard]] vk::UniqueDescriptorUpdateTemplate createUpdateTemplateUnique(vk::Device device, vk::DescriptorSetLayout layout) const {
+    std::vector<vk::DescriptorUpdateTemplateEntry> entries;
+    size_t offset = 0;
+    for (auto &b : s.bindings) {
+      if (!hasTemplateEntries(b)) continue;
+      entries.emplace_back(b.binding, 0, b.descriptorCount, b.descriptorType, offset, sizeof(DescriptorData));
+      offset += b.descriptorCount * sizeof(DescriptorData);
+    }
+
+    vk::DescriptorUpdateTemplateCreateInfo ci{};
+    ci.descriptorUpdateEntryCount = static_cast<uint32_t>(entries.size());
+    ci.pDescriptorUpdateEntries = entries.data();
+    ci.templateType = vk::DescriptorUpdateTemplateType::eDescriptorSet;
+    ci.descriptorSetLayout = layout;
+    return device.createDescriptorUpdateTemplateUnique(ci);
+  }
+
+  [[nodiscard]] const std::vector<vk::DescriptorSetLayoutBinding> &bindings() const { return s.bindings; }
+
+  /// The number of descriptors of each type in one set of this layout.
+  [[nodiscard]] std::vector<vk::DescriptorPoolSize> poolSizes() const {
+    std::vector<vk::DescriptorPoolSize> sizes;
+    for (auto &b : s.bindings) {
+      auto i = std::find_if(sizes.begin(), sizes.end(), [&b](const vk::DescriptorPoolSize &ps) { return ps.type == b.descriptorType; });
+      if (i == sizes.end()) {
+        sizes.emplace_back(b.descriptorType, b.descriptorCount);
+      } else {
+        i->descriptorCount += b.descriptorCount;
+      }
+    }
+    return sizes;
+  }
+
+  /// Bindings that only hold immutable samplers can't be written, so templates skip them.
+  static bool hasTemplateEntries(const vk::DescriptorSetLayoutBinding &binding) {
+    return !(binding.descriptorType == vk::DescriptorType::eSampler && binding.pImmutableSamplers);
+  }
+
+private:
+  struct State {
+    std::vector<vk::DescriptorSetLayoutBinding> bindings;
+    std::vector<std::vector<vk::Sampler> > samplers;
+    int numSamplers = 0;
+  };
+
+  State s;
+};
+
+/// The data for a descriptor update template made by DescriptorSetLayoutMaker::createUpdateTemplateUnique.
+/// Fill it in once, change the entries that move, then update a whole set in one call:
+///
+///     vku::DescriptorTemplateData data{dslm};
+///     data.buffer(0, 0, ubo.buffer(), 0, sizeof(Uniform)).image(1, 0, *sampler, texture.imageView(), vk::ImageLayout::eShaderReadOnlyOptimal);
+///     data.update(device, descriptorSet, *updateTemplate);
+class DescriptorTemplateData {
+public:
+  DescriptorTemplateData() = default;
+
+  /// Size the data for the bindings of maker.
+  explicit DescriptorTemplateData(const DescriptorSetLayoutMaker &maker) {
+    uint32_t index = 0;
+    for (auto &b : maker.bindings()) {
+      if (!DescriptorSetLayoutMaker::hasTemplateEntries(b)) continue;
+      first_[b.binding] = index;
+      index += b.descriptorCount;
+    }
+    data_.resize(index);
+  }
+
+  DescriptorTemplateData &image(uint32_t binding, uint32_t arrayElement, vk::Sampler sampler, vk::ImageView imageView, vk::ImageLayout imageLayout) {
+    at(binding, arrayElement).image = static_cast<VkDescriptorImageInfo>(vk::DescriptorImageInfo{sampler, imageView, imageLayout});
+    return *this;
+  }
+
+  DescriptorTemplateData &buffer(uint32_t binding, uint32_t arrayElement, vk::Buffer buffer, vk::DeviceSize offset, vk::DeviceSize range) {
+    at(binding, arrayElement).buffer = static_cast<VkDescriptorBufferInfo>(vk::DescriptorBufferInfo{buffer, offset, range});
+    return *this;
+  }
+
+  DescriptorTemplateData &bufferView(uint32_t binding, uint32_t arrayElement, vk::BufferView view) {
+    at(binding, arrayElement).bufferView = static_cast<VkBufferView>(view);
+    return *this;
+  }
+
+  /// Write every descriptor of set in one call.
+  void update(vk::Device device, vk::DescriptorSet set, vk::DescriptorUpdateTemplate updateTemplate) const {
+    device.updateDescriptorSetWithTemplate(set, updateTemplate, data_.data());
+  }
+
+  [[nodiscard]] const void *data() const { return data_.data(); }
+  [[nodiscard]] size_t size() const { return data_.size(); }
+private:
+  DescriptorData &at(uint32_t binding, uint32_t arrayElement) {
+    return data_[first_.at(binding) + arrayElement];
+  }
+
+  std::vector<DescriptorData> data_;
+  std::map<uint32_t, uint32_t> first_;
+};
+
+/// Allocates descriptor sets from chains of pools, adding a pool whenever the last one is full.
+/// New pools are sized from the descriptor types actually requested so far.
+/// Long-lived sets come from allocate() and are freed with the allocator.
+/// Transient sets come from allocateTransient() and are recycled a whole frame at a time
+/// by beginFrame(), which resets that frame's pools instead of freeing sets one by one.
+/// Not thread safe; use one allocator per thread.
+///
+///     auto set = allocator.allocate(dslm, *layout);
+///     ...
+///     allocator.beginFrame(imageIndex);
+///     auto perFrameSet = allocator.allocateTransient(dslm, *layout);
+class DescriptorAllocator {
+public:
+  struct Stats {
+    uint64_t setsAllocated = 0;
+    uint64_t poolsCreated = 0;
+    uint64_t poolResets = 0;
+  };
+
+  DescriptorAllocator() = default;
+
+  /// The first pool holds setsPerPool sets; each new pool doubles that, up to maxSetsPerPool.
+  explicit DescriptorAllocator(vk::Device device, uint32_t setsPerPool = 256, uint32_t maxSetsPerPool = 4096)
+  : device_(device), setsPerPool_(setsPerPool), maxSetsPerPool_(maxSetsPerPool) {
+  }
+
+  /// Allocate a set that lives as long as the allocator.
+  /// sizes (eg. from DescriptorSetLayoutMaker::poolSizes) are the descriptors in one set;
+  /// they size the pools, so they must cover every descriptor of the layout.
+  /// Throws std::runtime_error if the set is too large for a pool.
+  vk::DescriptorSet allocate(vk::DescriptorSetLayout layout, vk::ArrayProxy<const vk::DescriptorPoolSize> const &sizes) {
+    return allocate(persistent_, layout, sizes);
+  }
+
+  /// Allocate a set of a layout made by maker, taking the sizes from its bindings.
+  vk::DescriptorSet allocate(const vku::DescriptorSetLayoutMaker &maker, vk::DescriptorSetLayout layout) {
+    return allocate(persistent_, layout, maker.poolSizes());
+  }
+
+  /// Start using the transient pools of frame, resetting them.
+  /// Sets allocated for this frame last time round become invalid.
+  void beginFrame(uint32_t frame) {
+    if (frame >= frames_.size()) frames_.resize(frame + 1);
+    frame_ = frame;
+    frameStart_ = total_;
+    auto &chain = frames_[frame];
+    for (auto &pool : chain.pools) {
+      device_.resetDescriptorPool(*pool);
+      total_.poolResets++;
+    }
+    chain.current = 0;
+  }
+
+  /// Allocate a set that is valid until beginFrame() is next called for the current frame.
+  vk::DescriptorSet allocateTransient(vk::DescriptorSetLayout layout, vk::ArrayProxy<const vk::DescriptorPoolSize> const &sizes) {
+    if (frames_.empty()) frames_.resize(1);
+    return allocate(frames_[frame_], layout, sizes);
+  }
+
+  /// Allocate a transient set of a layout made by maker, taking the sizes from its bindings.
+  vk::DescriptorSet allocateTransient(const vku::DescriptorSetLayoutMaker &maker, vk::DescriptorSetLayout layout) {
+    return allocateTransient(layout, maker.poolSizes());
+  }
+
+  /// Counters since the allocator was made.
+  [[nodiscard]] const Stats &stats() const { return total_; }
+
+  /// Counters since the last beginFrame().
+  [[nodiscard]] Stats frameStats() const {
+    return Stats{total_.setsAllocated - frameStart_.setsAllocated, total_.poolsCreated - frameStart_.poolsCreated, total_.poolResets - frameStart_.poolResets};
+  }
+private:
+  struct Chain {
+    std::vector<vk::UniqueDescriptorPool> pools;
+    size_t current = 0;
+  };
+
+  vk::DescriptorSet allocate(Chain &chain, vk::DescriptorSetLayout layout, vk::ArrayProxy<const vk::DescriptorPoolSize> const &sizes) {
+    // Sets without descriptors would only dilute the averages.
+    if (!sizes.empty()) observedSets_++;
+    for (auto &size : sizes) {
+      observed_[size.type] += size.descriptorCount;
+    }
+
+    vk::DescriptorSetAllocateInfo dsai{};
+    dsai.descriptorSetCount = 1;
+    dsai.pSetLayouts = &layout;
+    vk::DescriptorSet set;
+    for (;;) {
+      bool fresh = chain.current == chain.pools.size();
+      if (fresh) {
+        chain.pools.push_back(createPool(sizes));
+      }
+      dsai.descriptorPool = *chain.pools[chain.current];
+      // The pointer form returns the result rather than throwing on a full pool.
+      auto result = device_.allocateDescriptorSets(&dsai, &set);
+      if (result == vk::Result::eSuccess) break;
+      if (result != vk::Result::eErrorOutOfPoolMemory && result != vk::Result::eErrorFragmentedPool) {
+        throw vk::SystemError(vk::make_error_code(result), "vku::DescriptorAllocator");
+      }
+      // A brand new pool that can't hold the set never will.
+      if (fresh) {
+        throw std::runtime_error("vku::DescriptorAllocator: set too large for a pool");
+      }
+      chain.current++;
+    }
+    total_.setsAllocated++;
+    return set;
+  }
+
+  // sizes are those of the set that needs the pool, which must always fit.
+  vk::UniqueDescriptorPool createPool(vk::ArrayProxy<const vk::DescriptorPoolSize> const &sizes) {
+    // Scale the average descriptors per set seen so far to the pool size, with a floor
+    // for the common types so early pools cope with layouts not yet seen.
+    std::map<vk::DescriptorType, uint32_t> counts = {
+      {vk::DescriptorType::eUniformBuffer, setsPerPool_ / 2},
+      {vk::DescriptorType::eCombinedImageSampler, setsPerPool_ / 2},
+      {vk::DescriptorType::eStorageBuffer, setsPerPool_ / 4},
+    };
+    for (auto &[type, count] : observed_) {
+      auto perPool = static_cast<uint32_t>((count * setsPerPool_ + observedSets_ - 1) / observedSets_);
+      counts[type] = std::max(counts[type], perPool);
+    }
+    for (auto &size : sizes) {
+      counts[size.type] = std::max(counts[size.type], size.descriptorCount);
+    }
+
+    std::vector<vk::DescriptorPoolSize> poolSizes;
+    for (auto &[type, count] : counts) {
+      poolSizes.emplace_back(type, std::max(count, 1U));
+    }
+
+    vk::DescriptorPoolCreateInfo ci{};
+    ci.maxSets = setsPerPool_;
+    ci.poolSizeCount = static_cast<uint32_t>(poolSizes.size());
+    ci.pPoolSizes = poolSizes.data();
+    auto pool = device_.createDescriptorPoolUnique(ci);
+
+    total_.poolsCreated++;
+    setsPerPool_ = std::min(setsPerPool_ * 2, std::max(maxSetsPerPool_, setsPerPool_));
+    return pool;
+  }
+
+  vk::Device device_;
+  Chain persistent_;
+  std::vector<Chain> frames_;
+  uint32_t frame_ = 0;
+  uint32_t setsPerPool_ = 256;
+  uint32_t maxSetsPerPool_ = 4096;
+  std::map<vk::DescriptorType, uint64_t> observed_;
+  uint64_t observedSets_ = 0;
+  Stats total_;
+  Stats frameStart_;
+};
+
+/// A factory class for descriptor sets (A set of uniform bindings)
+class DescriptorSetMaker {
+public:
+  // Construct a new, empty DescriptorSetMaker.
+  DescriptorSetMaker() = default;
+
+  /// Add another layout describing a descriptor set.
+  DescriptorSetMaker &layout(vk::DescriptorSetLayout layout) {
+    s.layouts.push_back(layout);
+    return *this;
+  }
+
+  /// Allocate a vector of non-self-deleting descriptor sets
+  /// Note: descriptor sets get freed with the pool, so this is the better choice.
+  [[nodiscard]] std::vector<vk::DescriptorSet> create(vk::Device device, vk::DescriptorPool descriptorPool) const {
+    vk::DescriptorSetAllocateInfo dsai{};
+    dsai.descriptorPool = descriptorPool;
+    dsai.descriptorSetCount = static_cast<uint32_t>(s.layouts.size());
+    dsai.pSetLayouts = s.layouts.data();
+    return device.allocateDescriptorSets(dsai);
+  }
+
+  /// Allocate a vector of self-deleting descriptor sets.
+  [[nodiscard]] std::vector<vk::UniqueDescriptorSet> createUnique(vk::Device device, vk::DescriptorPool descriptorPool) const {
+    vk::DescriptorSetAllocateInfo dsai{};
+    dsai.descriptorPool = descriptorPool;
+    dsai.descriptorSetCount = static_cast<uint32_t>(s.layouts.size());
+    dsai.pSetLayouts = s.layouts.data();
+    return device.allocateDescriptorSetsUnique(dsai);
+  }
+
+private:
+  struct State {
+    std::vector<vk::DescriptorSetLayout> layouts;
+  };
+
+  State s;
+};
+
+/// Generic image with a view and memory object.
+/// Vulkan images need a memory object to hold the data and a view object for the GPU to access the data.
+class MipDownsampler;
+
+class GenericImage {
+public:
+  GenericImage() = default;
+
+  GenericImage(vk::Device device, const vk::PhysicalDeviceMemoryProperties &memprops, const vk::ImageCreateInfo &info, vk::ImageViewType viewType, vk::ImageAspectFlags aspectMask, bool makeHostImage) {
+    create(device, memprops, info, viewType, aspectMask, makeHostImage);
+  }
+
+  /// Create an image whose memory is a range of a larger block owned by allocator.
+  GenericImage(vk::Device device, vku::MemoryAllocator &allocator, const vk::ImageCreateInfo &info, vk::ImageViewType viewType, vk::ImageAspectFlags aspectMask, bool makeHostImage) {
+    create(device, allocator, info, viewType, aspectMask, makeHostImage);
+  }
+
+  /// Create an image bound to offset in memory owned by the caller, eg. memory aliased by images that are never in use at the same time.
+  GenericImage(vk::Device device, vk::DeviceMemory memory, vk::DeviceSize offset, const vk::ImageCreateInfo &info, vk::ImageViewType viewType, vk::ImageAspectFlags aspectMask) {
+    create(device, memory, offset, info, viewType, aspectMask);
+  }
+
+  [[nodiscard]] vk::Image image() const { return *s.image; }
+  [[nodiscard]] vk::ImageView imageView() const { return *s.imageView; }
+  [[nodiscard]] vk::DeviceMemory mem() const { return s.alloc ? s.alloc.memory() : s.mem ? *s.mem : s.externalMem; }
+
+  /// Clear the colour of an image.
+  void clear(vk::CommandBuffer cb, const std::array<float,4> colour = {1, 1, 1, 1}, bool synchronization2 = false) {
+    setLayout(cb, vk::ImageLayout::eTransferDstOptimal, vk::ImageAspectFlagBits::eColor, synchronization2);
+    vk::ClearColorValue ccv(colour);
+    vk::ImageSubresourceRange range{vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1};
+    cb.clearColorImage(*s.image, vk::ImageLayout::eTransferDstOptimal, ccv, range);
+  }
+
+  /// Update the image with an array of pixels. (Currently 2D only)
+  void update(vk::Device device, const void *data, vk::DeviceSize bytesPerPixel) {
+    const auto *src = static_cast<const uint8_t *>(data);
+    auto *base = static_cast<uint8_t *>(s.alloc ? s.alloc.mapped() : device.mapMemory(*s.mem, 0, s.size, vk::MemoryMapFlags{}));
+    for (uint32_t mipLevel = 0; mipLevel != info().mipLevels; ++mipLevel) {
+      // Array images are layed out horizontally. eg. [left][front][right] etc.
+      for (uint32_t arrayLayer = 0; arrayLayer != info().arrayLayers; ++arrayLayer) {
+        vk::ImageSubresource subresource{vk::ImageAspectFlagBits::eColor, mipLevel, arrayLayer};
+        auto srlayout = device.getImageSubresourceLayout(*s.image, subresource);
+        auto *dest = base + srlayout.offset;
+        size_t bytesPerLine = s.info.extent.width * bytesPerPixel;
+        size_t srcStride = bytesPerLine * info().arrayLayers;
+        for (int y = 0; y != s.info.extent.height; ++y) {
+          memcpy(dest, src + arrayLayer * bytesPerLine, bytesPerLine);
+          src += srcStride;
+          dest += srlayout.rowPitch;
+        }
+      }
+    }
+    if (!s.alloc) device.unmapMemory(*s.mem);
+  }
+
+  /// Copy another image to this one. This also changes the layout.
+  void copy(vk::CommandBuffer cb, vku::GenericImage &srcImage, bool synchronization2 = false) {
+    vku::BarrierBatch batch{synchronization2};
+    srcImage.setLayout(batch, vk::ImageLayout::eTransferSrcOptimal);
+    setLayout(batch, vk::ImageLayout::eTransferDstOptimal);
+    batch.flush(cb);
+    for (uint32_t mipLevel = 0; mipLevel != info().mipLevels; ++mipLevel) {
+      vk::ImageCopy region{};
+      region.srcSubresource = {vk::ImageAspectFlagBits::eColor, mipLevel, 0, 1};
+      region.dstSubresource = {vk::ImageAspectFlagBits::eColor, mipLevel, 0, 1};
+      region.extent = s.info.extent;
+      cb.copyImage(srcImage.image(), vk::ImageLayout::eTransferSrcOptimal, *s.image, vk::ImageLayout::eTransferDstOptimal, region);
+    }
+  }
+
+  /// Copy a subimage in a buffer to this image.
+  void copy(vk::CommandBuffer cb, vk::Buffer buffer, uint32_t mipLevel, uint32_t arrayLayer, uint32_t width, uint32_t height, uint32_t depth, uint32_t offset, bool synchronization2 = false) {
+    setLayout(cb, vk::ImageLayout::eTransferDstOptimal, vk::ImageAspectFlagBits::eColor, synchronization2);
+    vk::BufferImageCopy region{};
+    region.bufferOffset = offset;
+    vk::Extent3D extent;
+    extent.width = width;
+    extent.height = height;
+    extent.depth = depth;
+    region.imageSubresource = {vk::ImageAspectFlagBits::eColor, mipLevel, arrayLayer, 1};
+    region.imageExtent = extent;
+    cb.copyBufferToImage(buffer, *s.image, vk::ImageLayout::eTransferDstOptimal, region);
+  }
+
+  /// Pass synchronization2 = true, here and below, to record the barriers with vkCmdPipelineBarrier2
+  /// on devices made with DeviceMaker::enableSynchronization2().
+  void upload(vk::Device device, const std::vector<uint8_t> &bytes, vk::CommandPool commandPool, const vk::PhysicalDeviceMemoryProperties& memprops, vk::Queue queue, vk::ImageLayout finalLayout=vk::ImageLayout::eShaderReadOnlyOptimal, bool synchronization2 = false) {
+	return upload(device, bytes.data(), bytes.size(), commandPool, memprops, queue, finalLayout, synchronization2);
+  }
+
+  void upload(vk::Device device, const uint8_t *bytes, size_t bytesSize, vk::CommandPool commandPool, const vk::PhysicalDeviceMemoryProperties& memprops, vk::Queue queue, vk::ImageLayout finalLayout=vk::ImageLayout::eShaderReadOnlyOptimal, bool synchronization2 = false) {
+    vku::GenericBuffer stagingBuffer(device, memprops, static_cast<vk::BufferUsageFlags>(vk::BufferUsageFlagBits::eTransferSrc), static_cast<vk::DeviceSize>(bytesSize), vk::MemoryPropertyFlagBits::eHostVisible);
+    stagingBuffer.updateLocal(device, (const void*)bytes, bytesSize);
+
+    // Copy the staging buffer to the GPU texture and set the layout.
+    vku::executeImmediately(device, commandPool, queue, [&](vk::CommandBuffer cb) {
+      recordUpload(cb, stagingBuffer.buffer(), finalLayout, 0, synchronization2);
+    });
+  }
+
+  /// Upload through a SubmitPool without waiting.
+  /// The staging buffer is released by the pool when the copy completes.
+  SubmitPool::Submission upload(vk::Device device, const uint8_t *bytes, size_t bytesSize, vku::SubmitPool &pool, const vk::PhysicalDeviceMemoryProperties& memprops, vk::ImageLayout finalLayout=vk::ImageLayout::eShaderReadOnlyOptimal, bool synchronization2 = false) {
+    vku::GenericBuffer stagingBuffer(device, memprops, static_cast<vk::BufferUsageFlags>(vk::BufferUsageFlagBits::eTransferSrc), static_cast<vk::DeviceSize>(bytesSize), vk::MemoryPropertyFlagBits::eHostVisible);
+    stagingBuffer.updateLocal(device, (const void*)bytes, bytesSize);
+
+    vk::Buffer buf = stagingBuffer.buffer();
+    return pool.submit([&](vk::CommandBuffer cb) {
+      recordUpload(cb, buf, finalLayout, 0, synchronization2);
+    }, std::move(stagingBuffer));
+  }
+
+  SubmitPool::Submission upload(vk::Device device, const std::vector<uint8_t> &bytes, vku::SubmitPool &pool, const vk::PhysicalDeviceMemoryProperties& memprops, vk::ImageLayout finalLayout=vk::ImageLayout::eShaderReadOnlyOptimal, bool synchronization2 = false) {
+    return upload(device, bytes.data(), bytes.size(), pool, memprops, finalLayout, synchronization2);
+  }
+
+  /// Copy one mip level and layer of this image back to host memory without waiting.
+  /// The data is tightly packed in texel blocks. The image layout is restored afterwards.
+  Readback download(vk::Device device, const vk::PhysicalDeviceMemoryProperties &memprops, vku::SubmitPool &pool, uint32_t mipLevel = 0, uint32_t arrayLayer = 0, bool synchronization2 = false) {
+    auto bp = getBlockParams(s.info.format);
+    uint32_t blockWidth = bp.blockWidth ? bp.blockWidth : 1;
+    uint32_t blockHeight = bp.blockHeight ? bp.blockHeight : 1;
+    auto width = mipScale(s.info.extent.width, mipLevel);
+    auto height = mipScale(s.info.extent.height, mipLevel);
+    auto depth = mipScale(s.info.extent.depth, mipLevel);
+    vk::DeviceSize size = vk::DeviceSize{(width + blockWidth - 1) / blockWidth} * ((height + blockHeight - 1) / blockHeight) * depth * bp.bytesPerBlock;
+
+    auto tmp = std::make_shared<vku::GenericBuffer>(vku::GenericBuffer::readbackBuffer(device, memprops, size));
+    vk::Buffer dst = tmp->buffer();
+    auto submission = pool.submit([&](vk::CommandBuffer cb) {
+      vk::ImageSubresourceRange range{vk::ImageAspectFlagBits::eColor, mipLevel, 1, arrayLayer, 1};
+      auto old = use(mipLevel, arrayLayer);
+      vku::BarrierBatch batch{synchronization2};
+      transition(batch, vku::ResourceUse::transferSrc(), range);
+      batch.flush(cb);
+      vk::BufferImageCopy region{};
+      region.imageSubresource = {vk::ImageAspectFlagBits::eColor, mipLevel, arrayLayer, 1};
+      region.imageExtent = vk::Extent3D{width, height, depth};
+      cb.copyImageToBuffer(*s.image, vk::ImageLayout::eTransferSrcOptimal, dst, region);
+      vk::MemoryBarrier after{vk::AccessFlagBits::eTransferWrite, vk::AccessFlagBits::eHostRead};
+      cb.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eHost, vk::DependencyFlags{}, after, nullptr, nullptr);
+      if (old.layout != vk::ImageLayout::eUndefined && old.layout != vk::ImageLayout::ePreinitialized) {
+        transition(batch, old, range);
+        batch.flush(cb);
+      }
+    }, tmp);
+    return tmp->readback(device, submission, tmp, 0, size);
+  }
+
+  /// Record copies of every mip level and layer from a tightly packed buffer, then set the layout.
+  void recordUpload(vk::CommandBuffer cb, vk::Buffer buf, vk::ImageLayout finalLayout, uint32_t baseOffset = 0, bool synchronization2 = false) {
+    auto bp = getBlockParams(s.info.format);
+    uint32_t offset = baseOffset;
+    for (uint32_t mipLevel = 0; mipLevel != s.info.mipLevels; ++mipLevel) {
+      auto width = mipScale(s.info.extent.width, mipLevel);
+      auto height = mipScale(s.info.extent.height, mipLevel);
+      auto depth = mipScale(s.info.extent.depth, mipLevel);
+      for (uint32_t face = 0; face != s.info.arrayLayers; ++face) {
+        copy(cb, buf, mipLevel, face, width, height, depth, offset, synchronization2);
+        offset += ((bp.bytesPerBlock + 3) & ~3) * (width * height);
+      }
+    }
+    setLayout(cb, finalLayout, vk::ImageAspectFlagBits::eColor, synchronization2);
+  }
+
+  /// Change the layout of this image using a memory barrier.
+  /// The barrier waits only for the tracked previous use of each mip level and layer.
+  /// Pass synchronization2 = true if the device was made with DeviceMaker::enableSynchronization2().
+  void setLayout(vk::CommandBuffer cb, vk::ImageLayout newLayout, vk::ImageAspectFlags aspectMask = vk::ImageAspectFlagBits::eColor, bool synchronization2 = false) {
+    vku::BarrierBatch batch{synchronization2};
+    setLayout(batch, newLayout, aspectMask);
+    batch.flush(cb);
+  }
+
+  /// As above, adding the barriers to batch, eg. to record them with those of other images.
+  void setLayout(vku::BarrierBatch &batch, vk::ImageLayout newLayout, vk::ImageAspectFlags aspectMask = vk::ImageAspectFlagBits::eColor) {
+    bool same = std::all_of(s.uses.begin(), s.uses.end(), [newLayout](const ResourceUse &use) { return use.layout == newLayout; });
+    if (same) return;
+    transition(batch, vku::ResourceUse::forLayout(newLayout), {aspectMask, 0, VK_REMAINING_MIP_LEVELS, 0, VK_REMAINING_ARRAY_LAYERS});
+  }
+
+  /// Add barriers to batch that move a range of mip levels and layers from their tracked use to next.
+  /// Subresources already in the right layout get no barrier unless either use writes.
+  void transition(vku::BarrierBatch &batch, const vku::ResourceUse &next, const vk::ImageSubresourceRange &range) {
+    uint32_t levelEnd = range.levelCount == VK_REMAINING_MIP_LEVELS ? s.info.mipLevels : range.baseMipLevel + range.levelCount;
+    uint32_t layerEnd = range.layerCount == VK_REMAINING_ARRAY_LAYERS ? s.info.arrayLayers : range.baseArrayLayer + range.layerCount;
+
+    auto emit = [&](const ResourceUse &prev, uint32_t mipLevel, uint32_t levelCount, uint32_t arrayLayer, uint32_t layerCount) {
+      bool barrier = prev.layout != next.layout || prev.writes() || next.writes();
+      if (barrier) {
+        vk::ImageMemoryBarrier2 imb{
+          prev.stages, prev.access, next.stages, next.access, prev.layout, next.layout,
+          VK_QUEUE_FAMILY_IGNORED, VK_QUEUE_FAMILY_IGNORED, *s.image,
+          {range.aspectMask, mipLevel, levelCount, arrayLayer, layerCount}
+        };
+        batch.image(imb);
+      }
+      // Reads that need no barrier accumulate, so a later write waits for all of them.
+      ResourceUse merged = barrier ? next : ResourceUse{prev.stages|next.stages, prev.access|next.access, next.layout};
+      for (uint32_t m = mipLevel; m != mipLevel + levelCount; ++m) {
+        for (uint32_t l = arrayLayer; l != arrayLayer + layerCount; ++l) {
+          use(m, l) = merged;
+        }
+      }
+    };
+
+    // Usually the whole range is in one state and needs a single barrier.
+    const ResourceUse first = use(range.baseMipLevel, range.baseArrayLayer);
+    bool uniform = true;
+    for (uint32_t m = range.baseMipLevel; m != levelEnd && uniform; ++m) {
+      for (uint32_t l = range.baseArrayLayer; l != layerEnd && uniform; ++l) {
+        uniform = use(m, l) == first;
+      }
+    }
+    if (uniform) {
+      emit(first, range.baseMipLevel, levelEnd - range.baseMipLevel, range.baseArrayLayer, layerEnd - range.baseArrayLayer);
+      return;
+    }
+
+    // Otherwise one barrier per run of layers in the same state in each mip level.
+    for (uint32_t m = range.baseMipLevel; m != levelEnd; ++m) {
+      uint32_t l = range.baseArrayLayer;
+      while (l != layerEnd) {
+        const ResourceUse prev = use(m, l);
+        uint32_t end = l + 1;
+        while (end != layerEnd && use(m, end) == prev) ++end;
+        emit(prev, m, 1, l, end - l);
+        l = end;
+      }
+    }
+  }
+
+  /// Transition the whole image.
+  void transition(vku::BarrierBatch &batch, const vku::ResourceUse &next, vk::ImageAspectFlags aspectMask = vk::ImageAspectFlagBits::eColor) {
+    transition(batch, next, {aspectMask, 0, VK_REMAINING_MIP_LEVELS, 0, VK_REMAINING_ARRAY_LAYERS});
+  }
+
+  /// Build mip levels 1..mipLevels-1 from level 0 by repeated downsampling blits.
+  /// All layers are processed together, so cube maps and arrays work too.
+  /// Level 0 must already hold the image and the image needs transfer src and dst usage.
+  /// The format must support blits, and linear filtering if filter is eLinear;
+  /// the overload taking the physical device checks this.
+  void generateMipmaps(vk::CommandBuffer cb, vk::Filter filter, vk::ImageLayout finalLayout = vk::ImageLayout::eShaderReadOnlyOptimal, bool synchronization2 = false) {
+    typedef vk::ImageAspectFlagBits iab;
+    vku::BarrierBatch batch{synchronization2};
+    if (s.info.mipLevels > 1) {
+      transition(batch, vku::ResourceUse::transferDst(), {iab::eColor, 1, VK_REMAINING_MIP_LEVELS, 0, VK_REMAINING_ARRAY_LAYERS});
+    }
+
+    auto mipOffset = [this](uint32_t level) {
+      return vk::Offset3D{
+        static_cast<int32_t>(mipScale(s.info.extent.width, level)),
+        static_cast<int32_t>(mipScale(s.info.extent.height, level)),
+        static_cast<int32_t>(mipScale(s.info.extent.depth, level))
+      };
+    };
+
+    for (uint32_t mipLevel = 1; mipLevel < s.info.mipLevels; ++mipLevel) {
+      // Only the level being read changes layout; the rest of the chain stays put.
+      transition(batch, vku::ResourceUse::transferSrc(), {iab::eColor, mipLevel - 1, 1, 0, VK_REMAINING_ARRAY_LAYERS});
+      batch.flush(cb);
+
+      vk::ImageBlit blit{};
+      blit.srcSubresource = {iab::eColor, mipLevel - 1, 0, s.info.arrayLayers};
+      blit.srcOffsets[1] = mipOffset(mipLevel - 1);
+      blit.dstSubresource = {iab::eColor, mipLevel, 0, s.info.arrayLayers};
+      blit.dstOffsets[1] = mipOffset(mipLevel);
+      cb.blitImage(*s.image, vk::ImageLayout::eTransferSrcOptimal, *s.image, vk::ImageLayout::eTransferDstOptimal, blit, filter);
+    }
+
+    transition(batch, vku::ResourceUse::forLayout(finalLayout));
+    batch.flush(cb);
+  }
+
+  /// As above, choosing a linear filter if the format supports it and nearest otherwise.
+  /// Formats that can't be blitted use the compute shader of downsampler instead, if one is given.
+  /// Returns false, recording nothing, if neither works (eg. compressed formats).
+  inline bool generateMipmaps(vk::CommandBuffer cb, vk::PhysicalDevice physicalDevice, vk::ImageLayout finalLayout = vk::ImageLayout::eShaderReadOnlyOptimal, vku::MipDownsampler *downsampler = nullptr, bool synchronization2 = false);
+
+  /// Number of mip levels in a full chain down to 1x1.
+  static uint32_t maxMipLevels(uint32_t width, uint32_t height, uint32_t depth = 1) {
+    uint32_t largest = std::max({width, height, depth, 1U});
+    uint32_t levels = 1;
+    while (largest >>= 1) ++levels;
+    return levels;
+  }
+
+  /// Set what the image thinks is its current layout (ie. the old layout in an image barrier).
+  /// The previous use is unknown, so the next barrier waits for all earlier work.
+  void setCurrentLayout(vk::ImageLayout oldLayout) {
+    std::fill(s.uses.begin(), s.uses.end(), vku::ResourceUse::unknown(oldLayout));
+  }
+
+  /// Set the use of every mip level and layer, eg. after a render pass has changed the layout.
+  void setCurrentUse(const vku::ResourceUse &use) {
+    std::fill(s.uses.begin(), s.uses.end(), use);
+  }
+
+  /// Get the tracked use of a mip level and layer.
+  [[nodiscard]] const vku::ResourceUse &currentUse(uint32_t mipLevel = 0, uint32_t arrayLayer = 0) const { return s.uses[mipLevel * s.info.arrayLayers + arrayLayer]; }
+
+  [[nodiscard]] vk::Format format() const { return s.info.format; }
+  [[nodiscard]] vk::Extent3D extent() const { return s.info.extent; }
+  [[nodiscard]] const vk::ImageCreateInfo &info() const { return s.info; }
+  [[nodiscard]] vk::ImageLayout layout(uint32_t mipLevel = 0, uint32_t arrayLayer = 0) const { return s.uses[mipLevel * s.info.arrayLayers + arrayLayer].layout; }
+protected:
+  void create(vk::Device device, const vk::PhysicalDeviceMemoryProperties &memprops, const vk::ImageCreateInfo &info, vk::ImageViewType viewType, vk::ImageAspectFlags aspectMask, bool hostImage) {
+    s.info = info;
+    resetUses();
+    s.image = device.createImageUnique(info);
+
+    // Find out how much memory and which heap to allocate from.
+    auto memreq = device.getImageMemoryRequirements(*s.image);
+    vk::MemoryPropertyFlags search{};
+    if (hostImage) search = vk::MemoryPropertyFlagBits::eHostCoherent | vk::MemoryPropertyFlagBits::eHostVisible;
+
+    // Create a memory object to bind to the buffer.
+    // Note: we don't expect to be able to map the buffer.
+    vk::MemoryAllocateInfo mai{};
+    mai.allocationSize = s.size = memreq.size;
+    mai.memoryTypeIndex = vku::findMemoryTypeIndex(memprops, memreq.memoryTypeBits, search);
+    s.mem = device.allocateMemoryUnique(mai);
+
+    device.bindImageMemory(*s.image, *s.mem, 0);
+
+    createView(device, info, viewType, aspectMask, hostImage);
+  }
+
+  void create(vk::Device device, vku::MemoryAllocator &allocator, const vk::ImageCreateInfo &info, vk::ImageViewType viewType, vk::ImageAspectFlags aspectMask, bool hostImage) {
+    s.info = info;
+    resetUses();
+    s.image = device.createImageUnique(info);
+
+    auto memreq = device.getImageMemoryRequirements(*s.image);
+    vk::MemoryPropertyFlags search{};
+    if (hostImage) search = vk::MemoryPropertyFlagBits::eHostCoherent | vk::MemoryPropertyFlagBits::eHostVisible;
+
+    s.size = memreq.size;
+    s.alloc = allocator.allocate(memreq, search, info.tiling == vk::ImageTiling::eLinear);
+
+    device.bindImageMemory(*s.image, s.alloc.memory(), s.alloc.offset());
+
+    createView(device, info, viewType, aspectMask, hostImage);
+  }
+
+  void create(vk::Device device, vk::DeviceMemory memory, vk::DeviceSize offset, const vk::ImageCreateInfo &info, vk::ImageViewType viewType, vk::ImageAspectFlags aspectMask) {
+    s.info = info;
+    resetUses();
+    s.image = device.createImageUnique(info);
+    s.size = device.getImageMemoryRequirements(*s.image).size;
+    s.externalMem = memory;
+
+    device.bindImageMemory(*s.image, memory, offset);
+
+    createView(device, info, viewType, aspectMask, false);
+  }
+
+  void createView(vk::Device device, const vk::ImageCreateInfo &info, vk::ImageViewType viewType, vk::ImageAspectFlags aspectMask, bool hostImage) {
+    if (!hostImage) {
+      vk::ImageViewCreateInfo viewInfo{};
+      viewInfo.image = *s.image;
+      viewInfo.viewType = viewType;
+      viewInfo.format = info.format;
+      viewInfo.components = { vk::ComponentSwizzle::eR, vk::ComponentSwizzle::eG, vk::ComponentSwizzle::eB, vk::ComponentSwizzle::eA };
+      viewInfo.subresourceRange = vk::ImageSubresourceRange{aspectMask, 0, info.mipLevels, 0, info.arrayLayers};
+      s.imageView = device.createImageViewUnique(viewInfo);
+    }
+  }
+
+  // Start every mip level and layer in the initial layout with no earlier use.
+  void resetUses() {
+    vku::ResourceUse initial{{}, {}, s.info.initialLayout};
+    if (s.info.initialLayout == vk::ImageLayout::ePreinitialized) {
+      initial = {vk::PipelineStageFlagBits2::eHost, vk::AccessFlagBits2::eHostWrite, s.info.initialLayout};
+    }
+    s.uses.assign(s.info.mipLevels * s.info.arrayLayers, initial);
+  }
+
+  ResourceUse &use(uint32_t mipLevel, uint32_t arrayLayer) { return s.uses[mipLevel * s.info.arrayLayers + arrayLayer]; }
+
+  struct State {
+    vk::UniqueImage image;
+    vk::UniqueImageView imageView;
+    vk::UniqueDeviceMemory mem;
+    vku::MemoryAllocation alloc;
+    // Memory owned by someone else, for images bound with the memory and offset constructor.
+    vk::DeviceMemory externalMem;
+    vk::DeviceSize size;
+    // The last use of each mip level and array layer, indexed by mipLevel * arrayLayers + arrayLayer.
+    std::vector<vku::ResourceUse> uses;
+    vk::ImageCreateInfo info;
+
+  };
+
+  State s;
+};
+
+
+/// A 2D texture image living on the GPU or a staging buffer visible to the CPU.
+class TextureImage2D : public GenericImage {
+public:
+  TextureImage2D() = default;
+
+  TextureImage2D(vk::Device device, const vk::PhysicalDeviceMemoryProperties &memprops, uint32_t width, uint32_t height, uint32_t mipLevels=1, vk::Format format = vk::Format::eR8G8B8A8Unorm, bool hostImage = false) {
+    create(device, memprops, makeInfo(width, height, mipLevels, format, hostImage), vk::ImageViewType::e2D, vk::ImageAspectFlagBits::eColor, hostImage);
+  }
+
+  TextureImage2D(vk::Device device, vku::MemoryAllocator &allocator, uint32_t width, uint32_t height, uint32_t mipLevels=1, vk::Format format = vk::Format::eR8G8B8A8Unorm, bool hostImage = false) {
+    create(device, allocator, makeInfo(width, height, mipLevels, format, hostImage), vk::ImageViewType::e2D, vk::ImageAspectFlagBits::eColor, hostImage);
+  }
+private:
+  static vk::ImageCreateInfo makeInfo(uint32_t width, uint32_t height, uint32_t mipLevels, vk::Format format, bool hostImage) {
+    vk::ImageCreateInfo info;
+    info.flags = {};
+    info.imageType = vk::ImageType::e2D;
+    info.format = format;
+    info.extent = vk::Extent3D{ width, height, 1U };
+    info.mipLevels = mipLevels;
+    info.arrayLayers = 1;
+    info.samples = vk::SampleCountFlagBits::e1;
+    info.tiling = hostImage ? vk::ImageTiling::eLinear : vk::ImageTiling::eOptimal;
+    info.usage = vk::ImageUsageFlagBits::eSampled|vk::ImageUsageFlagBits::eTransferSrc|vk::ImageUsageFlagBits::eTransferDst;
+    info.sharingMode = vk::SharingMode::eExclusive;
+    info.queueFamilyIndexCount = 0;
+    info.pQueueFamilyIndices = nullptr;
+    info.initialLayout = hostImage ? vk::ImageLayout::ePreinitialized : vk::ImageLayout::eUndefined;
+    return info;
+  }
+};
+
+/// A cube map texture image living on the GPU or a staging buffer visible to the CPU.
+class TextureImageCube : public GenericImage {
+public:
+  TextureImageCube() = default;
+
+  TextureImageCube(vk::Device device, const vk::PhysicalDeviceMemoryProperties &memprops, uint32_t width, uint32_t height, uint32_t mipLevels=1, vk::Format format = vk::Format::eR8G8B8A8Unorm, bool hostImage = false) {
+    create(device, memprops, makeInfo(width, height, mipLevels, format, hostImage), vk::ImageViewType::eCube, vk::ImageAspectFlagBits::eColor, hostImage);
+  }
+
+  TextureImageCube(vk::Device device, vku::MemoryAllocator &allocator, uint32_t width, uint32_t height, uint32_t mipLevels=1, vk::Format format = vk::Format::eR8G8B8A8Unorm, bool hostImage = false) {
+    create(device, allocator, makeInfo(width, height, mipLevels, format, hostImage), vk::ImageViewType::eCube, vk::ImageAspectFlagBits::eColor, hostImage);
+  }
+private:
+  static vk::ImageCreateInfo makeInfo(uint32_t width, uint32_t height, uint32_t mipLevels, vk::Format format, bool hostImage) {
+    vk::ImageCreateInfo info;
+    info.flags = {vk::ImageCreateFlagBits::eCubeCompatible};
+    info.imageType = vk::ImageType::e2D;
+    info.format = format;
+    info.extent = vk::Extent3D{ width, height, 1U };
+    info.mipLevels = mipLevels;
+    info.arrayLayers = 6;
+    info.samples = vk::SampleCountFlagBits::e1;
+    info.tiling = hostImage ? vk::ImageTiling::eLinear : vk::ImageTiling::eOptimal;
+    info.usage = vk::ImageUsageFlagBits::eColorAttachment|vk::ImageUsageFlagBits::eSampled|vk::ImageUsageFlagBits::eTransferSrc|vk::ImageUsageFlagBits::eTransferDst;
+    info.sharingMode = vk::SharingMode::eExclusive;
+    info.queueFamilyIndexCount = 0;
+    info.pQueueFamilyIndices = nullptr;
+    info.initialLayout = hostImage ? vk::ImageLayout::ePreinitialized : vk::ImageLayout::eUndefined;
+    //info.initialLayout = vk::ImageLayout::ePreinitialized;
+    return info;
+  }
+};
+
+/// An image to use as a depth buffer on a renderpass.
+class DepthStencilImage : public GenericImage {
+public:
+  DepthStencilImage() = default;
+
+  DepthStencilImage(vk::Device device, const vk::PhysicalDeviceMemoryProperties &memprops, uint32_t width, uint32_t height, vk::Format format = vk::Format::eD24UnormS8Uint) {
+    typedef vk::ImageAspectFlagBits iafb;
+    create(device, memprops, makeInfo(width, height, format), vk::ImageViewType::e2D, iafb::eDepth, false);
+  }
+
+  DepthStencilImage(vk::Device device, vku::MemoryAllocator &allocator, uint32_t width, uint32_t height, vk::Format format = vk::Format::eD24UnormS8Uint) {
+    typedef vk::ImageAspectFlagBits iafb;
+    create(device, allocator, makeInfo(width, height, format), vk::ImageViewType::e2D, iafb::eDepth, false);
   }
+private:
+  static vk::ImageCreateInfo makeInfo(uint32_t width, uint32_t height, vk::Format format) {
+    vk::ImageCreateInfo info;
+    info.flags = {};
 
-  /// Create a self-deleting descriptor set object.
-  [[nodiscard]] vk::UniqueDescriptorSetLayout createUnique(vk::Device device) const {
-    vk::DescriptorSetLayoutCreateInfo dsci{};
-    dsci.bindingCount = static_cast<uint32_t>(s.bindings.size());
-    dsci.pBindings = s.bindings.data();
-    return device.createDescriptorSetLayoutUnique(dsci);
+    info.imageType = vk::ImageType::e2D;
+    info.format = format;
+    info.extent = vk::Extent3D{ width, height, 1U };
+    info.mipLevels = 1;
+    info.arrayLayers = 1;
+    info.samples = vk::SampleCountFlagBits::e1;
+    info.tiling = vk::ImageTiling::eOptimal;
+    info.usage = vk::ImageUsageFlagBits::eDepthStencilAttachment|vk::ImageUsageFlagBits::eTransferSrc|vk::ImageUsageFlagBits::eSampled;
+    info.sharingMode = vk::SharingMode::eExclusive;
+    info.queueFamilyIndexCount = 0;
+    info.pQueueFamilyIndices = nullptr;
+    info.initialLayout = vk::ImageLayout::eUndefined;
+    return info;
+  }
+};
+
+/// An image to use as a colour buffer on a renderpass.
+class ColorAttachmentImage : public GenericImage {
+public:
+  ColorAttachmentImage() = default;
+
+  ColorAttachmentImage(vk::Device device, const vk::PhysicalDeviceMemoryProperties &memprops, uint32_t width, uint32_t height, vk::Format format = vk::Format::eR8G8B8A8Unorm) {
+    typedef vk::ImageAspectFlagBits iafb;
+    create(device, memprops, makeInfo(width, height, format), vk::ImageViewType::e2D, iafb::eColor, false);
   }
 
+  ColorAttachmentImage(vk::Device device, vku::MemoryAllocator &allocator, uint32_t width, uint32_t height, vk::Format format = vk::Format::eR8G8B8A8Unorm) {
+    typedef vk::ImageAspectFlagBits iafb;
+    create(device, allocator, makeInfo(width, height, format), vk::ImageViewType::e2D, iafb::eColor, false);
+  }
 private:
-  struct State {
-    std::vector<vk::DescriptorSetLayoutBinding> bindings;
-    std::vector<std::vector<vk::Sampler> > samplers;
-    int numSamplers = 0;
+  static vk::ImageCreateInfo makeInfo(uint32_t width, uint32_t height, vk::Format format) {
+    vk::ImageCreateInfo info;
+    info.flags = {};
+
+    info.imageType = vk::ImageType::e2D;
+    info.format = format;
+    info.extent = vk::Extent3D{ width, height, 1U };
+    info.mipLevels = 1;
+    info.arrayLayers = 1;
+    info.samples = vk::SampleCountFlagBits::e1;
+    info.tiling = vk::ImageTiling::eOptimal;
+    info.usage = vk::ImageUsageFlagBits::eColorAttachment|vk::ImageUsageFlagBits::eTransferSrc|vk::ImageUsageFlagBits::eTransferDst|vk::ImageUsageFlagBits::eSampled;
+    info.sharingMode = vk::SharingMode::eExclusive;
+    info.queueFamilyIndexCount = 0;
+    info.pQueueFamilyIndices = nullptr;
+    info.initialLayout = vk::ImageLayout::eUndefined;
+    return info;
+  }
+};
+
+/// Compute shader fallback for GenericImage::generateMipmaps, for formats that can be sampled
+/// and used as storage images but not blitted.
+/// Each level is a 2x2 box filter of the one above. 2D images, arrays and cube maps are supported.
+/// The image needs sampled and storage usage and the device the shaderStorageImageWriteWithoutFormat feature.
+/// The shader is include/vku/shaders/mipDownsample.comp, which the examples embed as <mipDownsample.comp.spv.hpp>.
+///
+///     vku::MipDownsampler downsampler{device, shaders::mipDownsample_comp};
+///     texture.generateMipmaps(cb, fw.physicalDevice(), vk::ImageLayout::eShaderReadOnlyOptimal, &downsampler);
+///     // once cb has finished executing:
+///     downsampler.reset();
+class MipDownsampler {
+public:
+  MipDownsampler() = default;
+
+  /// Build the pipeline from the SPIR-V of mipDownsample.comp.
+  /// Up to maxLevels levels can be generated between calls to reset().
+  MipDownsampler(vk::Device device, std::span<const uint32_t> spirv, vk::PipelineCache cache = vk::PipelineCache{}, uint32_t maxLevels = 256)
+  : device_(device), maxLevels_(maxLevels) {
+    using cs = vk::ShaderStageFlagBits;
+    using dt = vk::DescriptorType;
+
+    // texelFetch ignores the sampler, but combined image samplers still need one.
+    vk::SamplerCreateInfo sci{};
+    sci.magFilter = sci.minFilter = vk::Filter::eNearest;
+    sci.addressModeU = sci.addressModeV = sci.addressModeW = vk::SamplerAddressMode::eClampToEdge;
+    sampler_ = device.createSamplerUnique(sci);
+
+    vku::DescriptorSetLayoutMaker dslm{};
+    dslm.image(0, dt::eCombinedImageSampler, cs::eCompute, 1);
+    dslm.image(1, dt::eStorageImage, cs::eCompute, 1);
+    setLayout_ = dslm.createUnique(device);
+
+    vku::PipelineLayoutMaker plm{};
+    plm.descriptorSetLayout(*setLayout_);
+    pipelineLayout_ = plm.createUnique(device);
+
+    vku::ShaderModule shader{device, spirv};
+    vku::ComputePipelineMaker cpm{};
+    cpm.shader(cs::eCompute, shader);
+    pipeline_ = cpm.createUnique(device, cache, *pipelineLayout_);
+
+    std::array<vk::DescriptorPoolSize, 2> sizes{
+      vk::DescriptorPoolSize{dt::eCombinedImageSampler, maxLevels},
+      vk::DescriptorPoolSize{dt::eStorageImage, maxLevels}
+    };
+    pool_ = device.createDescriptorPoolUnique(vk::DescriptorPoolCreateInfo{vk::DescriptorPoolCreateFlags{}, maxLevels, sizes});
+  }
+
+  /// Returns true if images of format can be downsampled by the shader.
+  static bool supports(vk::PhysicalDevice physicalDevice, vk::Format format, vk::ImageTiling tiling = vk::ImageTiling::eOptimal) {
+    using ff = vk::FormatFeatureFlagBits;
+    auto props = physicalDevice.getFormatProperties(format);
+    auto features = tiling == vk::ImageTiling::eLinear ? props.linearTilingFeatures : props.optimalTilingFeatures;
+    return (features & ff::eSampledImage) && (features & ff::eStorageImage);
+  }
+
+  /// Record the building of mip levels 1..mipLevels-1 of image from level 0.
+  /// Returns false, recording nothing, if the image is not 2D or maxLevels would be exceeded.
+  bool generate(vk::CommandBuffer cb, vku::GenericImage &image, vk::ImageLayout finalLayout = vk::ImageLayout::eShaderReadOnlyOptimal, bool synchronization2 = false) {
+    typedef vk::ImageAspectFlagBits iab;
+    auto &info = image.info();
+    if (info.imageType != vk::ImageType::e2D) return false;
+    uint32_t levels = info.mipLevels;
+    if (used_ + levels - 1 > maxLevels_) return false;
+
+    // One view of every layer per level; the views live until reset().
+    size_t firstView = views_.size();
+    for (uint32_t level = 0; level != levels; ++level) {
+      vk::ImageViewCreateInfo viewInfo{};
+      viewInfo.image = image.image();
+      viewInfo.viewType = vk::ImageViewType::e2DArray;
+      viewInfo.format = info.format;
+      viewInfo.subresourceRange = vk::ImageSubresourceRange{iab::eColor, level, 1, 0, info.arrayLayers};
+      views_.push_back(device_.createImageViewUnique(viewInfo));
+    }
+
+    vku::BarrierBatch batch{synchronization2};
+    if (levels > 1) {
+      std::vector<vk::DescriptorSetLayout> layouts(levels - 1, *setLayout_);
+      auto sets = device_.allocateDescriptorSets(vk::DescriptorSetAllocateInfo{*pool_, layouts});
+      used_ += levels - 1;
+
+      vku::DescriptorSetUpdater update;
+      for (uint32_t level = 1; level != levels; ++level) {
+        update.beginDescriptorSet(sets[level - 1]);
+        update.beginImages(0, 0, vk::DescriptorType::eCombinedImageSampler);
+        update.image(*sampler_, *views_[firstView + level - 1], vk::ImageLayout::eShaderReadOnlyOptimal);
+        update.beginImages(1, 0, vk::DescriptorType::eStorageImage);
+        update.image(vk::Sampler{}, *views_[firstView + level], vk::ImageLayout::eGeneral);
+      }
+      update.update(device_);
+
+      cb.bindPipeline(vk::PipelineBindPoint::eCompute, *pipeline_);
+      image.transition(batch, vku::ResourceUse::storageWrite(), {iab::eColor, 1, VK_REMAINING_MIP_LEVELS, 0, VK_REMAINING_ARRAY_LAYERS});
+      for (uint32_t level = 1; level != levels; ++level) {
+        // Only the level being read changes layout; the rest of the chain stays put.
+        image.transition(batch, vku::ResourceUse::sampled(vk::PipelineStageFlagBits2::eComputeShader), {iab::eColor, level - 1, 1, 0, VK_REMAINING_ARRAY_LAYERS});
+        batch.flush(cb);
+
+        cb.bindDescriptorSets(vk::PipelineBindPoint::eCompute, *pipelineLayout_, 0, sets[level - 1], nullptr);
+        auto width = mipScale(info.extent.width, level);
+        auto height = mipScale(info.extent.height, level);
+        cb.dispatch((width + 7) / 8, (height + 7) / 8, info.arrayLayers);
+      }
+    }
+
+    image.transition(batch, vku::ResourceUse::forLayout(finalLayout));
+    batch.flush(cb);
+    return true;
+  }
+
+  /// Free the views and descriptor sets of earlier generate() calls.
+  /// Only call this once the command buffers they were recorded into have finished.
+  void reset() {
+    device_.resetDescriptorPool(*pool_);
+    views_.clear();
+    used_ = 0;
+  }
+private:
+  vk::Device device_;
+  uint32_t maxLevels_ = 0;
+  uint32_t used_ = 0;
+  vk::UniqueSampler sampler_;
+  vk::UniqueDescriptorSetLayout setLayout_;
+  vk::UniquePipelineLayout pipelineLayout_;
+  vk::UniquePipeline pipeline_;
+  vk::UniqueDescriptorPool pool_;
+  std::vector<vk::UniqueImageView> views_;
+};
+
+inline bool GenericImage::generateMipmaps(vk::CommandBuffer cb, vk::PhysicalDevice physicalDevice, vk::ImageLayout finalLayout, vku::MipDownsampler *downsampler, bool synchronization2) {
+  using ff = vk::FormatFeatureFlagBits;
+  auto props = physicalDevice.getFormatProperties(s.info.format);
+  auto features = s.info.tiling == vk::ImageTiling::eLinear ? props.linearTilingFeatures : props.optimalTilingFeatures;
+  if ((features & ff::eBlitSrc) && (features & ff::eBlitDst)) {
+    auto filter = (features & ff::eSampledImageFilterLinear) ? vk::Filter::eLinear : vk::Filter::eNearest;
+    generateMipmaps(cb, filter, finalLayout, synchronization2);
+    return true;
+  }
+  if (downsampler && MipDownsampler::supports(physicalDevice, s.info.format, s.info.tiling)) {
+    return downsampler->generate(cb, *this, finalLayout, synchronization2);
+  }
+  return false;
+}
+
+/// Collects many buffer and image uploads into one staging buffer and one command buffer.
+/// The copies may run on a dedicated transfer queue family. In that case ownership of each
+/// resource is released to the destination family and a semaphore is signalled for the
+/// destination queue to wait on.
+///
+///     vku::UploadBatch batch{device, fw.memprops(), fw.transferQueueFamilyIndex(), fw.graphicsQueueFamilyIndex()};
+///     batch.add(vertexBuffer, vertices);
+///     batch.add(texture, pixels);
+///     batch.submit(fw.transferQueue(), fw.graphicsQueue());
+class UploadBatch {
+public:
+  UploadBatch() = default;
+
+  /// Make an empty batch that copies on srcQueueFamilyIndex for use on dstQueueFamilyIndex.
+  /// Pass synchronization2 = true if the device was made with DeviceMaker::enableSynchronization2().
+  UploadBatch(vk::Device device, const vk::PhysicalDeviceMemoryProperties &memprops, uint32_t srcQueueFamilyIndex, uint32_t dstQueueFamilyIndex, bool synchronization2 = false)
+  : device_(device), memprops_(memprops), srcFamily_(srcQueueFamilyIndex), dstFamily_(dstQueueFamilyIndex), synchronization2_(synchronization2) {
+  }
+
+  UploadBatch(const UploadBatch &) = delete;
+  UploadBatch &operator=(const UploadBatch &) = delete;
+
+  /// Add a copy of size bytes to buffer at dstOffset. The data is copied into the batch now.
+  void add(vku::GenericBuffer &buffer, const void *data, vk::DeviceSize size, vk::DeviceSize dstOffset = 0) {
+    if (size == 0) return;
+    auto srcOffset = stage(data, size, 4);
+    buffers_.push_back(BufferUpload{buffer.buffer(), srcOffset, dstOffset, size});
+  }
+
+  template<typename T>
+  void add(vku::GenericBuffer &buffer, const std::vector<T> &value, vk::DeviceSize dstOffset = 0) {
+    add(buffer, value.data(), value.size() * sizeof(T), dstOffset);
+  }
+
+  /// Add an upload of every mip level and layer of image, packed as for GenericImage::upload.
+  /// The whole image is overwritten, so its previous contents are discarded.
+  /// The image must outlive the batch.
+  void add(vku::GenericImage &image, const uint8_t *bytes, size_t size, vk::ImageLayout finalLayout = vk::ImageLayout::eShaderReadOnlyOptimal) {
+    // Buffer offsets for image copies must be a multiple of both 4 and the texel block size.
+    auto bp = getBlockParams(image.format());
+    vk::DeviceSize blockBytes = bp.bytesPerBlock ? bp.bytesPerBlock : 1;
+    auto srcOffset = stage(bytes, size, std::lcm(blockBytes, vk::DeviceSize{16}));
+    images_.push_back(ImageUpload{&image, srcOffset, finalLayout});
+  }
+
+  void add(vku::GenericImage &image, const std::vector<uint8_t> &bytes, vk::ImageLayout finalLayout = vk::ImageLayout::eShaderReadOnlyOptimal) {
+    add(image, bytes.data(), bytes.size(), finalLayout);
+  }
+
+  /// Record all the copies and submit them to queue, which must be of the source family.
+  /// Returns a semaphore signalled when the copies finish.
+  /// If needsOwnershipTransfer(), submit a command buffer containing acquire() on the destination
+  /// family that waits on this semaphore before using any of the resources.
+  vk::Semaphore submit(vk::Queue queue) {
+    submitCopies(queue, true);
+    return *semaphore_;
+  }
+
+  /// Submit the copies on transferQueue and, if needed, the ownership acquire on dstQueue.
+  /// Work submitted to dstQueue afterwards is ordered after the uploads without a CPU wait.
+  void submit(vk::Queue transferQueue, vk::Queue dstQueue) {
+    bool signal = needsOwnershipTransfer() || transferQueue != dstQueue;
+    submitCopies(transferQueue, signal);
+    if (!signal) return;
+
+    vk::PipelineStageFlags waitStage = vk::PipelineStageFlagBits::eAllCommands;
+    vk::SubmitInfo si{};
+    si.waitSemaphoreCount = 1;
+    si.pWaitSemaphores = &*semaphore_;
+    si.pWaitDstStageMask = &waitStage;
+
+    vk::CommandBuffer cb;
+    if (needsOwnershipTransfer()) {
+      vk::CommandPoolCreateInfo cpci{ vk::CommandPoolCreateFlagBits::eTransient, dstFamily_ };
+      dstPool_ = device_.createCommandPoolUnique(cpci);
+      vk::CommandBufferAllocateInfo cbai{ *dstPool_, vk::CommandBufferLevel::ePrimary, 1 };
+      dstCb_ = std::move(device_.allocateCommandBuffersUnique(cbai)[0]);
+      cb = *dstCb_;
+      cb.begin(vk::CommandBufferBeginInfo{vk::CommandBufferUsageFlagBits::eOneTimeSubmit});
+      acquire(cb);
+      cb.end();
+      si.commandBufferCount = 1;
+      si.pCommandBuffers = &cb;
+    }
+    dstFence_ = device_.createFenceUnique(vk::FenceCreateInfo{});
+    dstQueue.submit(si, *dstFence_);
+  }
+
+  /// Record the acquire half of the queue family ownership transfer on the destination family.
+  /// Does nothing if both families are the same.
+  void acquire(vk::CommandBuffer cb) {
+    if (!needsOwnershipTransfer()) return;
+    auto [bmbs, imbs] = ownershipBarriers(false);
+    cb.pipelineBarrier(vk::PipelineStageFlagBits::eTopOfPipe, vk::PipelineStageFlagBits::eAllCommands, vk::DependencyFlags{}, nullptr, bmbs, imbs);
+    for (auto &img : images_) {
+      img.image->setCurrentLayout(img.finalLayout);
+    }
+  }
+
+  /// Wait for the copies, and the acquire on the destination queue if any, to finish.
+  /// The staging memory is released.
+  void wait() {
+    if (fence_) {
+      (void)device_.waitForFences(*fence_, VK_TRUE, std::numeric_limits<uint64_t>::max());
+    }
+    if (dstFence_) {
+      (void)device_.waitForFences(*dstFence_, VK_TRUE, std::numeric_limits<uint64_t>::max());
+    }
+    staging_ = vku::GenericBuffer{};
+  }
+
+  /// Returns true once the copies, and the acquire on the destination queue if any, have finished.
+  [[nodiscard]] bool ready() const {
+    auto done = [this](const vk::UniqueFence &fence) { return !fence || device_.getFenceStatus(*fence) == vk::Result::eSuccess; };
+    return done(fence_) && done(dstFence_);
+  }
+
+  /// Returns true if resources change queue family.
+  [[nodiscard]] bool needsOwnershipTransfer() const { return srcFamily_ != dstFamily_; }
+
+  /// Total bytes of staging memory used by the batch.
+  [[nodiscard]] vk::DeviceSize stagingSize() const { return arena_.size(); }
+
+  ~UploadBatch() {
+    // The semaphore, command buffers and staging buffer must outlive the GPU work.
+    if (fence_ || dstFence_) wait();
+  }
+private:
+  struct BufferUpload {
+    vk::Buffer buffer;
+    vk::DeviceSize srcOffset;
+    vk::DeviceSize dstOffset;
+    vk::DeviceSize size;
   };
 
-  State s;
+  struct ImageUpload {
+    vku::GenericImage *image;
+    vk::DeviceSize srcOffset;
+    vk::ImageLayout finalLayout;
+  };
+
+  vk::DeviceSize stage(const void *data, vk::DeviceSize size, vk::DeviceSize alignment) {
+    auto offset = (arena_.size() + alignment - 1) / alignment * alignment;
+    arena_.resize(offset + size);
+    memcpy(arena_.data() + offset, data, size);
+    return offset;
+  }
+
+  void submitCopies(vk::Queue queue, bool signal) {
+    staging_ = vku::GenericBuffer(device_, memprops_, vk::BufferUsageFlagBits::eTransferSrc, std::max<vk::DeviceSize>(arena_.size(), 4), vk::MemoryPropertyFlagBits::eHostVisible);
+    if (!arena_.empty()) staging_.updateLocal(device_, arena_.data(), arena_.size());
+    arena_ = std::vector<uint8_t>{};
+
+    vk::CommandPoolCreateInfo cpci{ vk::CommandPoolCreateFlagBits::eTransient, srcFamily_ };
+    srcPool_ = device_.createCommandPoolUnique(cpci);
+    vk::CommandBufferAllocateInfo cbai{ *srcPool_, vk::CommandBufferLevel::ePrimary, 1 };
+    srcCb_ = std::move(device_.allocateCommandBuffersUnique(cbai)[0]);
+    vk::CommandBuffer cb = *srcCb_;
+
+    cb.begin(vk::CommandBufferBeginInfo{vk::CommandBufferUsageFlagBits::eOneTimeSubmit});
+    for (auto &b : buffers_) {
+      vk::BufferCopy bc{b.srcOffset, b.dstOffset, b.size};
+      cb.copyBuffer(staging_.buffer(), b.buffer, bc);
+    }
+
+    for (auto &img : images_) {
+      img.image->setCurrentLayout(vk::ImageLayout::eUndefined);
+      auto layout = needsOwnershipTransfer() ? vk::ImageLayout::eTransferDstOptimal : img.finalLayout;
+      img.image->recordUpload(cb, staging_.buffer(), layout, static_cast<uint32_t>(img.srcOffset), synchronization2_);
+    }
+
+    if (needsOwnershipTransfer()) {
+      // Release half of the ownership transfer. The layout change happens here and in acquire().
+      auto [bmbs, imbs] = ownershipBarriers(true);
+      cb.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eBottomOfPipe, vk::DependencyFlags{}, nullptr, bmbs, imbs);
+    } else if (!buffers_.empty()) {
+      vk::MemoryBarrier mb{vk::AccessFlagBits::eTransferWrite, vk::AccessFlagBits::eMemoryRead};
+      cb.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eAllCommands, vk::DependencyFlags{}, mb, nullptr, nullptr);
+    }
+    cb.end();
+
+    fence_ = device_.createFenceUnique(vk::FenceCreateInfo{});
+    if (signal) semaphore_ = device_.createSemaphoreUnique(vk::SemaphoreCreateInfo{});
+
+    vk::SubmitInfo si{};
+    si.commandBufferCount = 1;
+    si.pCommandBuffers = &cb;
+    if (signal) {
+      si.signalSemaphoreCount = 1;
+      si.pSignalSemaphores = &*semaphore_;
+    }
+    queue.submit(si, *fence_);
+  }
+
+  std::pair<std::vector<vk::BufferMemoryBarrier>, std::vector<vk::ImageMemoryBarrier>> ownershipBarriers(bool release) const {
+    std::vector<vk::BufferMemoryBarrier> bmbs;
+    std::vector<vk::ImageMemoryBarrier> imbs;
+    vk::AccessFlags srcAccess = release ? vk::AccessFlags{vk::AccessFlagBits::eTransferWrite} : vk::AccessFlags{};
+    vk::AccessFlags dstAccess = release ? vk::AccessFlags{} : vk::AccessFlags{vk::AccessFlagBits::eMemoryRead};
+    for (auto &b : buffers_) {
+      bmbs.emplace_back(srcAccess, dstAccess, srcFamily_, dstFamily_, b.buffer, b.dstOffset, b.size);
+    }
+    for (auto &img : images_) {
+      auto &info = img.image->info();
+      vk::ImageSubresourceRange range{vk::ImageAspectFlagBits::eColor, 0, info.mipLevels, 0, info.arrayLayers};
+      imbs.emplace_back(srcAccess, dstAccess, vk::ImageLayout::eTransferDstOptimal, img.finalLayout, srcFamily_, dstFamily_, img.image->image(), range);
+    }
+    return {std::move(bmbs), std::move(imbs)};
+  }
+
+  vk::Device device_;
+  vk::PhysicalDeviceMemoryProperties memprops_;
+  uint32_t srcFamily_ = 0;
+  uint32_t dstFamily_ = 0;
+  bool synchronization2_ = false;
+  std::vector<uint8_t> arena_;
+  std::vector<BufferUpload> buffers_;
+  std::vector<ImageUpload> images_;
+  vku::GenericBuffer staging_;
+  vk::UniqueCommandPool srcPool_;
+  vk::UniqueCommandPool dstPool_;
+  vk::UniqueCommandBuffer srcCb_;
+  vk::UniqueCommandBuffer dstCb_;
+  vk::UniqueFence fence_;
+  vk::UniqueFence dstFence_;
+  vk::UniqueSemaphore semaphore_;
 };
 
-/// A factory class for descriptor sets (A set of uniform bindings)
-class DescriptorSetMaker {
+/// Streams large uploads through a small ring of fixed size staging buffers.
+/// While the GPU copies one chunk the CPU fills the next, so staging memory never
+/// exceeds chunkSize * chunks however big the payload is.
+///
+///     vku::StreamingUploader stream{device, fw.memprops(), fw.graphicsQueueFamilyIndex(), fw.graphicsQueue()};
+///     stream.upload(volume, voxels.data(), voxels.size());
+///     stream.wait();
+class StreamingUploader {
 public:
-  // Construct a new, empty DescriptorSetMaker.
-  DescriptorSetMaker() = default;
+  StreamingUploader() = default;
+
+  /// Make a ring of chunks staging buffers of chunkSize bytes each for queue.
+  /// Pass synchronization2 = true if the device was made with DeviceMaker::enableSynchronization2().
+  StreamingUploader(vk::Device device, const vk::PhysicalDeviceMemoryProperties &memprops, uint32_t queueFamilyIndex, vk::Queue queue, vk::DeviceSize chunkSize = 16 * 1024 * 1024, uint32_t chunks = 4, bool synchronization2 = false)
+  : device_(device), queue_(queue), chunkSize_(chunkSize), synchronization2_(synchronization2) {
+    vk::CommandPoolCreateInfo cpci{ vk::CommandPoolCreateFlagBits::eTransient|vk::CommandPoolCreateFlagBits::eResetCommandBuffer, queueFamilyIndex };
+    commandPool_ = device.createCommandPoolUnique(cpci);
+    vk::CommandBufferAllocateInfo cbai{ *commandPool_, vk::CommandBufferLevel::ePrimary, std::max(chunks, 2U) };
+    auto cbs = device.allocateCommandBuffersUnique(cbai);
+    for (auto &cb : cbs) {
+      Chunk chunk;
+      chunk.staging = vku::GenericBuffer(device, memprops, vk::BufferUsageFlagBits::eTransferSrc, chunkSize, vk::MemoryPropertyFlagBits::eHostVisible, true);
+      chunk.cb = std::move(cb);
+      chunk.fence = device.createFenceUnique(vk::FenceCreateInfo{vk::FenceCreateFlagBits::eSignaled});
+      chunks_.push_back(std::move(chunk));
+    }
+  }
 
-  /// Add another layout describing a descriptor set.
-  DescriptorSetMaker &layout(vk::DescriptorSetLayout layout) {
-    s.layouts.push_back(layout);
-    return *this;
+  StreamingUploader(const StreamingUploader &) = delete;
+  StreamingUploader &operator=(const StreamingUploader &) = delete;
+
+  /// Copy size bytes to buffer at dstOffset, one chunk at a time.
+  /// Returns once the last chunk has been recorded; call flush() or wait() to finish.
+  void upload(vku::GenericBuffer &buffer, const void *data, vk::DeviceSize size, vk::DeviceSize dstOffset = 0) {
+    auto src = static_cast<const uint8_t *>(data);
+    while (size) {
+      auto offset = reserve(1, 16);
+      auto bytes = std::min(size, chunkSize_ - offset);
+      auto &chunk = chunks_[current_];
+      write(offset, src, bytes);
+      vk::BufferCopy bc{offset, dstOffset, bytes};
+      chunk.cb->copyBuffer(chunk.staging.buffer(), buffer.buffer(), bc);
+      src += bytes;
+      dstOffset += bytes;
+      size -= bytes;
+    }
   }
 
-  /// Allocate a vector of non-self-deleting descriptor sets
-  /// Note: descriptor sets get freed with the pool, so this is the better choice.
-  [[nodiscard]] std::vector<vk::DescriptorSet> create(vk::Device device, vk::DescriptorPool descriptorPool) const {
-    vk::DescriptorSetAllocateInfo dsai{};
-    dsai.descriptorPool = descriptorPool;
-    dsai.descriptorSetCount = static_cast<uint32_t>(s.layouts.size());
-    dsai.pSetLayouts = s.layouts.data();
-    return device.allocateDescriptorSets(dsai);
+  template<typename T>
+  void upload(vku::GenericBuffer &buffer, const std::vector<T> &value, vk::DeviceSize dstOffset = 0) {
+    upload(buffer, value.data(), value.size() * sizeof(T), dstOffset);
   }
 
-  /// Allocate a vector of self-deleting descriptor sets.
-  [[nodiscard]] std::vector<vk::UniqueDescriptorSet> createUnique(vk::Device device, vk::DescriptorPool descriptorPool) const {
-    vk::DescriptorSetAllocateInfo dsai{};
-    dsai.descriptorPool = descriptorPool;
-    dsai.descriptorSetCount = static_cast<uint32_t>(s.layouts.size());
-    dsai.pSetLayouts = s.layouts.data();
-    return device.allocateDescriptorSetsUnique(dsai);
+  /// Upload every mip level and layer of image from bytes.
+  /// The source is tightly packed in whole texel blocks, mip level by mip level and layer by layer.
+  /// Chunks are split on rows of blocks, so each chunk must hold at least one row.
+  /// Returns false, without recording anything, if size is too small for the image
+  /// or a row does not fit in a chunk.
+  bool upload(vku::GenericImage &image, const uint8_t *bytes, size_t size, vk::ImageLayout finalLayout = vk::ImageLayout::eShaderReadOnlyOptimal) {
+    auto &info = image.info();
+    auto bp = getBlockParams(info.format);
+    vk::DeviceSize blockBytes = bp.bytesPerBlock ? bp.bytesPerBlock : 1;
+    uint32_t blockWidth = bp.blockWidth ? bp.blockWidth : 1;
+    uint32_t blockHeight = bp.blockHeight ? bp.blockHeight : 1;
+    auto alignment = std::lcm(blockBytes, vk::DeviceSize{16});
+
+    auto rowBytesOf = [&](uint32_t mipLevel) { return (mipScale(info.extent.width, mipLevel) + blockWidth - 1) / blockWidth * blockBytes; };
+    auto blockRowsOf = [&](uint32_t mipLevel) { return (mipScale(info.extent.height, mipLevel) + blockHeight - 1) / blockHeight; };
+
+    vk::DeviceSize total = 0;
+    for (uint32_t mipLevel = 0; mipLevel != info.mipLevels; ++mipLevel) {
+      if (rowBytesOf(mipLevel) > chunkSize_) return false;
+      total += rowBytesOf(mipLevel) * blockRowsOf(mipLevel) * mipScale(info.extent.depth, mipLevel) * info.arrayLayers;
+    }
+    if (size < total) return false;
+
+    for (uint32_t mipLevel = 0; mipLevel != info.mipLevels; ++mipLevel) {
+      auto width = mipScale(info.extent.width, mipLevel);
+      auto height = mipScale(info.extent.height, mipLevel);
+      auto depth = mipScale(info.extent.depth, mipLevel);
+      vk::DeviceSize rowBytes = rowBytesOf(mipLevel);
+      uint32_t blockRows = blockRowsOf(mipLevel);
+      for (uint32_t layer = 0; layer != info.arrayLayers; ++layer) {
+        for (uint32_t z = 0; z != depth; ++z) {
+          uint32_t row = 0;
+          while (row != blockRows) {
+            auto offset = reserve(rowBytes, alignment);
+            auto rows = static_cast<uint32_t>(std::min<vk::DeviceSize>(blockRows - row, (chunkSize_ - offset) / rowBytes));
+            auto bytesToCopy = rows * rowBytes;
+
+            auto &chunk = chunks_[current_];
+            write(offset, bytes, bytesToCopy);
+            image.setLayout(*chunk.cb, vk::ImageLayout::eTransferDstOptimal, vk::ImageAspectFlagBits::eColor, synchronization2_);
+            vk::BufferImageCopy region{};
+            region.bufferOffset = offset;
+            region.imageSubresource = {vk::ImageAspectFlagBits::eColor, mipLevel, layer, 1};
+            region.imageOffset = vk::Offset3D{0, static_cast<int32_t>(row * blockHeight), static_cast<int32_t>(z)};
+            region.imageExtent = vk::Extent3D{width, std::min(rows * blockHeight, height - row * blockHeight), 1};
+            chunk.cb->copyBufferToImage(chunk.staging.buffer(), image.image(), vk::ImageLayout::eTransferDstOptimal, region);
+
+            bytes += bytesToCopy;
+            row += rows;
+          }
+        }
+      }
+    }
+
+    if (recording_) image.setLayout(*chunks_[current_].cb, finalLayout, vk::ImageAspectFlagBits::eColor, synchronization2_);
+    return true;
+  }
+
+  bool upload(vku::GenericImage &image, const std::vector<uint8_t> &bytes, vk::ImageLayout finalLayout = vk::ImageLayout::eShaderReadOnlyOptimal) {
+    return upload(image, bytes.data(), bytes.size(), finalLayout);
   }
 
+  /// Submit the chunk being filled, if any.
+  void flush() {
+    if (!recording_) return;
+    auto &chunk = chunks_[current_];
+    chunk.staging.flushDirty(device_);
+
+    // Make the copies visible to whatever runs next on this queue.
+    vk::MemoryBarrier mb{vk::AccessFlagBits::eTransferWrite, vk::AccessFlagBits::eMemoryRead|vk::AccessFlagBits::eMemoryWrite};
+    chunk.cb->pipelineBarrier(vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eAllCommands, vk::DependencyFlags{}, mb, nullptr, nullptr);
+    chunk.cb->end();
+
+    device_.resetFences(*chunk.fence);
+    vk::CommandBuffer cb = *chunk.cb;
+    vk::SubmitInfo si{};
+    si.commandBufferCount = 1;
+    si.pCommandBuffers = &cb;
+    queue_.submit(si, *chunk.fence);
+
+    recording_ = false;
+    used_ = 0;
+    current_ = (current_ + 1) % static_cast<uint32_t>(chunks_.size());
+  }
+
+  /// Submit any pending chunk and wait for every copy to finish.
+  void wait() {
+    flush();
+    for (auto &chunk : chunks_) {
+      (void)device_.waitForFences(*chunk.fence, VK_TRUE, std::numeric_limits<uint64_t>::max());
+    }
+  }
+
+  /// Bytes of staging memory held by the ring.
+  [[nodiscard]] vk::DeviceSize stagingSize() const { return chunkSize_ * chunks_.size(); }
+
+  ~StreamingUploader() {
+    if (device_) wait();
+  }
 private:
-  struct State {
-    std::vector<vk::DescriptorSetLayout> layouts;
+  struct Chunk {
+    vku::GenericBuffer staging;
+    vk::UniqueCommandBuffer cb;
+    vk::UniqueFence fence;
   };
 
-  State s;
+  // Return an offset in the current chunk with at least minBytes free, starting a new chunk if need be.
+  vk::DeviceSize reserve(vk::DeviceSize minBytes, vk::DeviceSize alignment) {
+    auto offset = (used_ + alignment - 1) / alignment * alignment;
+    if (recording_ && offset + minBytes <= chunkSize_) return offset;
+
+    flush();
+
+    // Wait for the GPU to finish with the oldest chunk before refilling it.
+    auto &chunk = chunks_[current_];
+    (void)device_.waitForFences(*chunk.fence, VK_TRUE, std::numeric_limits<uint64_t>::max());
+    chunk.cb->reset(vk::CommandBufferResetFlags{});
+    chunk.cb->begin(vk::CommandBufferBeginInfo{vk::CommandBufferUsageFlagBits::eOneTimeSubmit});
+    recording_ = true;
+    return 0;
+  }
+
+  void write(vk::DeviceSize offset, const void *src, vk::DeviceSize bytes) {
+    auto &chunk = chunks_[current_];
+    memcpy(static_cast<uint8_t *>(chunk.staging.mapped()) + offset, src, bytes);
+    chunk.staging.markDirty(offset, bytes);
+    used_ = offset + bytes;
+  }
+
+  vk::Device device_;
+  vk::Queue queue_;
+  vk::DeviceSize chunkSize_ = 0;
+  bool synchronization2_ = false;
+  vk::UniqueCommandPool commandPool_;
+  std::vector<Chunk> chunks_;
+  uint32_t current_ = 0;
+  vk::DeviceSize used_ = 0;
+  bool recording_ = false;
 };
 
-/// Generic image with a view and memory object.
-/// Vulkan images need a memory object to hold the data and a view object for the GPU to access the data.
-class GenericImage {
+/// A ring of readback buffers for streaming results back to the host every frame.
+/// Up to slots copies can be in flight; download() only waits when they all are.
+///
+///     vku::ReadbackRing readbacks{device, fw.memprops(), fw.computeQueueFamilyIndex(), fw.computeQueue(), sizeof(Result)};
+///     // each frame, after submitting the compute work:
+///     pending.push_back(readbacks.download(results));
+///     while (!pending.empty() && pending.front().ready()) { use(pending.front().get<Result>()); pending.pop_front(); }
+class ReadbackRing {
 public:
-  GenericImage() = default;
+  /// Make slots buffers of slotSize bytes for copies on queue.
+  ReadbackRing(vk::Device device, const vk::PhysicalDeviceMemoryProperties &memprops, uint32_t queueFamilyIndex, vk::Queue queue, vk::DeviceSize slotSize, uint32_t slots = 3)
+  : device_(device), pool_(device, queueFamilyIndex, queue, slots), slotSize_(slotSize) {
+    for (uint32_t i = 0; i != std::max(slots, 1U); ++i) {
+      slots_.push_back(std::make_shared<vku::GenericBuffer>(vku::GenericBuffer::readbackBuffer(device, memprops, slotSize)));
+    }
+    pending_.resize(slots_.size());
+  }
 
-  GenericImage(vk::Device device, const vk::PhysicalDeviceMemoryProperties &memprops, const vk::ImageCreateInfo &info, vk::ImageViewType viewType, vk::ImageAspectFlags aspectMask, bool makeHostImage) {
-    create(device, memprops, info, viewType, aspectMask, makeHostImage);
+  ReadbackRing(const ReadbackRing &) = delete;
+  ReadbackRing &operator=(const ReadbackRing &) = delete;
+
+  /// Copy a range of buffer, at most slotSize bytes, into the next slot.
+  /// The result stays valid until the slot is reused slots downloads later,
+  /// and must not be waited on after the ring is destroyed.
+  Readback download(const vku::GenericBuffer &buffer, vk::DeviceSize offset = 0, vk::DeviceSize size = VK_WHOLE_SIZE) {
+    if (size == VK_WHOLE_SIZE) size = buffer.size() - offset;
+    size = std::min(size, slotSize_);
+
+    auto &slot = slots_[next_];
+    pending_[next_].wait();
+    vk::Buffer dst = slot->buffer();
+    auto submission = pool_.submit([&](vk::CommandBuffer cb) {
+      buffer.recordDownload(cb, dst, 0, offset, size);
+    });
+    pending_[next_] = slot->readback(device_, submission, slot, 0, size);
+    auto result = pending_[next_];
+    next_ = (next_ + 1) % static_cast<uint32_t>(slots_.size());
+    return result;
   }
 
-  [[nodiscard]] vk::Image image() const { return *s.image; }
-  [[nodiscard]] vk::ImageView imageView() const { return *s.imageView; }
-  [[nodiscard]] vk::DeviceMemory mem() const { return *s.mem; }
+  [[nodiscard]] vk::DeviceSize slotSize() const { return slotSize_; }
+  [[nodiscard]] uint32_t slots() const { return static_cast<uint32_t>(slots_.size()); }
+private:
+  // The buffers are declared first so the pool waits for the GPU before they are destroyed.
+  std::vector<std::shared_ptr<vku::GenericBuffer>> slots_;
+  std::vector<Readback> pending_;
+  vk::Device device_;
+  vku::SubmitPool pool_;
+  vk::DeviceSize slotSize_;
+  uint32_t next_ = 0;
+};
 
-  /// Clear the colour of an image.
-  void clear(vk::CommandBuffer cb, const std::array<float,4> colour = {1, 1, 1, 1}) {
-    setLayout(cb, vk::ImageLayout::eTransferDstOptimal);
-    vk::ClearColorValue ccv(colour);
-    vk::ImageSubresourceRange range{vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1};
-    cb.clearColorImage(*s.image, vk::ImageLayout::eTransferDstOptimal, ccv, range);
+/// A frame graph built from passes that declare the images and buffers they read and write.
+/// compile() turns the passes into a schedule:
+///   - passes whose results nobody uses are culled,
+///   - consecutive drawing passes that only share attachments become subpasses of one render pass,
+///   - transient images whose lifetimes don't overlap share memory.
+/// execute() then records the schedule, with one batch of barriers in front of each step.
+/// Passes run in the order they were added, so add a writer before its readers.
+///
+///     vku::RenderGraph graph{device, fw.physicalDevice(), fw.synchronization2()};
+///     auto gbuffer = graph.createImage("gbuffer", {vk::Format::eR16G16B16A16Sfloat, width, height});
+///     auto output = graph.importImage("output", outputImage);
+///     graph.addPass("geometry").colorAttachment(gbuffer, std::array<float, 4>{0, 0, 0, 1}).execute([&](vk::CommandBuffer cb) { ... });
+///     auto lighting = graph.addPass("lighting").inputAttachment(gbuffer).colorAttachment(output).execute([&](vk::CommandBuffer cb) { ... });
+///     graph.compile();
+///     ... make pipelines with graph.renderPass(lighting) and graph.subpass(lighting) ...
+///     graph.execute(cb);
+class RenderGraph {
+public:
+  static constexpr uint32_t invalidIndex = ~0U;
+
+  /// A handle to an image or buffer in the graph.
+  struct Resource {
+    uint32_t index = invalidIndex;
+    explicit operator bool() const { return index != invalidIndex; }
+  };
+
+  /// A handle to a pass in the graph.
+  struct Pass {
+    uint32_t index = invalidIndex;
+    explicit operator bool() const { return index != invalidIndex; }
+  };
+
+  /// Size and format of an image made by the graph.
+  struct ImageDesc {
+    vk::Format format = vk::Format::eR8G8B8A8Unorm;
+    uint32_t width = 0;
+    uint32_t height = 0;
+    vk::ImageAspectFlags aspectMask = vk::ImageAspectFlagBits::eColor;
+  };
+
+  /// What compile() made of the passes and what the last execute() recorded.
+  struct Stats {
+    uint32_t passes = 0;
+    uint32_t culledPasses = 0;
+    /// Number of steps: render passes plus passes run outside render passes.
+    uint32_t steps = 0;
+    uint32_t renderPasses = 0;
+    uint32_t subpasses = 0;
+    /// Number of barrier batches recorded by the last execute().
+    uint32_t barrierBatches = 0;
+    /// Device memory used by transient images.
+    vk::DeviceSize transientBytes = 0;
+    /// Device memory the transient images would use without aliasing.
+    vk::DeviceSize unaliasedBytes = 0;
+  };
+
+  /// Declares the uses of a pass. Finish with execute().
+  class PassBuilder {
+  public:
+    /// Draw to a colour attachment. Its contents are cleared to clearColour if given and kept otherwise.
+    PassBuilder &colorAttachment(Resource resource, std::optional<std::array<float, 4>> clearColour = {}) {
+      std::optional<vk::ClearValue> clear;
+      if (clearColour) clear = vk::ClearValue{vk::ClearColorValue{*clearColour}};
+      return use(resource, ResourceUse::colorAttachment(), vk::ImageUsageFlagBits::eColorAttachment, Kind::color, clear);
+    }
+
+    /// Use a depth attachment. Its contents are cleared to clearDepth if given and kept otherwise.
+    PassBuilder &depthAttachment(Resource resource, std::optional<float> clearDepth = {}) {
+      std::optional<vk::ClearValue> clear;
+      if (clearDepth) clear = vk::ClearValue{vk::ClearDepthStencilValue{*clearDepth, 0}};
+      return use(resource, ResourceUse::depthAttachment(), vk::ImageUsageFlagBits::eDepthStencilAttachment, Kind::depth, clear);
+    }
+
+    /// Read the pixel under each fragment of an attachment written by an earlier pass.
+    /// This lets the two passes become subpasses of one render pass.
+    PassBuilder &inputAttachment(Resource resource) {
+      if (!resource) return *this;
+      bool depth = bool(graph_->resources_[resource.index].desc.aspectMask & vk::ImageAspectFlagBits::eDepth);
+      auto layout = depth ? vk::ImageLayout::eDepthStencilReadOnlyOptimal : vk::ImageLayout::eShaderReadOnlyOptimal;
+      return use(resource, ResourceUse::inputAttachment(layout), vk::ImageUsageFlagBits::eInputAttachment, Kind::input);
+    }
+
+    PassBuilder &sampled(Resource resource, vk::PipelineStageFlags2 stages = vk::PipelineStageFlagBits2::eFragmentShader) {
+      return use(resource, ResourceUse::sampled(stages), vk::ImageUsageFlagBits::eSampled);
+    }
+
+    PassBuilder &storageRead(Resource resource, vk::PipelineStageFlags2 stages = vk::PipelineStageFlagBits2::eComputeShader) {
+      return use(resource, ResourceUse::storageRead(stages), vk::ImageUsageFlagBits::eStorage);
+    }
+
+    PassBuilder &storageWrite(Resource resource, vk::PipelineStageFlags2 stages = vk::PipelineStageFlagBits2::eComputeShader) {
+      return use(resource, ResourceUse::storageWrite(stages), vk::ImageUsageFlagBits::eStorage);
+    }
+
+    PassBuilder &transferSrc(Resource resource) {
+      return use(resource, ResourceUse::transferSrc(), vk::ImageUsageFlagBits::eTransferSrc);
+    }
+
+    PassBuilder &transferDst(Resource resource) {
+      return use(resource, ResourceUse::transferDst(), vk::ImageUsageFlagBits::eTransferDst);
+    }
+
+    /// Use a resource in some other way. usage is added to the flags of images made by the graph.
+    PassBuilder &use(Resource resource, const ResourceUse &use, vk::ImageUsageFlags usage = {}) {
+      return this->use(resource, use, usage, Kind::other);
+    }
+
+    /// Keep the pass even if nothing in the graph reads what it writes, eg. it writes to the host.
+    PassBuilder &sideEffects() {
+      graph_->passes_[pass_].sideEffects = true;
+      return *this;
+    }
+
+    /// Set the function that records the pass and return its handle.
+    /// Drawing passes are recorded inside their render pass and subpass.
+    Pass execute(const std::function<void (vk::CommandBuffer cb)> &func) {
+      graph_->passes_[pass_].func = func;
+      return Pass{pass_};
+    }
+  private:
+    friend class RenderGraph;
+    enum class Kind { color, depth, input, other };
+
+    PassBuilder(RenderGraph *graph, uint32_t pass) : graph_(graph), pass_(pass) {}
+
+    PassBuilder &use(Resource resource, const ResourceUse &use, vk::ImageUsageFlags usage, Kind kind, std::optional<vk::ClearValue> clear = {}) {
+      if (!resource) return *this;
+      graph_->resources_[resource.index].usage |= usage;
+      graph_->passes_[pass_].uses.push_back(Use{resource.index, use, kind, clear});
+      graph_->compiled_ = false;
+      return *this;
+    }
+
+    RenderGraph *graph_;
+    uint32_t pass_;
+  };
+
+  RenderGraph() = default;
+
+  /// Pass true for synchronization2 if the device was made with DeviceMaker::enableSynchronization2().
+  RenderGraph(vk::Device device, vk::PhysicalDevice physicalDevice, bool synchronization2 = false)
+  : device_(device), memprops_(physicalDevice.getMemoryProperties()), synchronization2_(synchronization2) {
+  }
+
+  RenderGraph(const RenderGraph &) = delete;
+  RenderGraph &operator=(const RenderGraph &) = delete;
+
+  /// Use an image owned by the caller. Its layout is tracked by the image itself.
+  /// Imported resources are results of the graph, so passes writing them are never culled.
+  Resource importImage(const std::string &name, vku::GenericImage &image, vk::ImageAspectFlags aspectMask = vk::ImageAspectFlagBits::eColor) {
+    ResourceData r;
+    r.name = name;
+    r.image = &image;
+    r.desc = ImageDesc{image.format(), image.extent().width, image.extent().height, aspectMask};
+    return addResource(std::move(r));
+  }
+
+  /// Use a buffer owned by the caller. The graph tracks its last use from frame to frame.
+  Resource importBuffer(const std::string &name, vku::GenericBuffer &buffer) {
+    ResourceData r;
+    r.name = name;
+    r.buffer = &buffer;
+    return addResource(std::move(r));
   }
 
-  /// Update the image with an array of pixels. (Currently 2D only)
-  void update(vk::Device device, const void *data, vk::DeviceSize bytesPerPixel) {
-    const auto *src = static_cast<const uint8_t *>(data);
-    for (uint32_t mipLevel = 0; mipLevel != info().mipLevels; ++mipLevel) {
-      // Array images are layed out horizontally. eg. [left][front][right] etc.
-      for (uint32_t arrayLayer = 0; arrayLayer != info().arrayLayers; ++arrayLayer) {
-        vk::ImageSubresource subresource{vk::ImageAspectFlagBits::eColor, mipLevel, arrayLayer};
-        auto srlayout = device.getImageSubresourceLayout(*s.image, subresource);
-        auto *dest = static_cast<uint8_t *>(device.mapMemory(*s.mem, 0, s.size, vk::MemoryMapFlags{})) + srlayout.offset;
-        size_t bytesPerLine = s.info.extent.width * bytesPerPixel;
-        size_t srcStride = bytesPerLine * info().arrayLayers;
-        for (int y = 0; y != s.info.extent.height; ++y) {
-          memcpy(dest, src + arrayLayer * bytesPerLine, bytesPerLine);
-          src += srcStride;
-          dest += srlayout.rowPitch;
-        }
-      }
-    }
-    device.unmapMemory(*s.mem);
+  /// Make an image that only lives inside the graph. compile() creates it with the usage flags its passes need.
+  Resource createImage(const std::string &name, const ImageDesc &desc) {
+    ResourceData r;
+    r.name = name;
+    r.desc = desc;
+    r.transient = true;
+    return addResource(std::move(r));
   }
 
-  /// Copy another image to this one. This also changes the layout.
-  void copy(vk::CommandBuffer cb, vku::GenericImage &srcImage) {
-    srcImage.setLayout(cb, vk::ImageLayout::eTransferSrcOptimal);
-    setLayout(cb, vk::ImageLayout::eTransferDstOptimal);
-    for (uint32_t mipLevel = 0; mipLevel != info().mipLevels; ++mipLevel) {
-      vk::ImageCopy region{};
-      region.srcSubresource = {vk::ImageAspectFlagBits::eColor, mipLevel, 0, 1};
-      region.dstSubresource = {vk::ImageAspectFlagBits::eColor, mipLevel, 0, 1};
-      region.extent = s.info.extent;
-      cb.copyImage(srcImage.image(), vk::ImageLayout::eTransferSrcOptimal, *s.image, vk::ImageLayout::eTransferDstOptimal, region);
-    }
+  /// Keep the passes that write resource, eg. a transient image read back by hand after execute().
+  void markOutput(Resource resource) {
+    if (resource) resources_[resource.index].output = true;
+    compiled_ = false;
   }
 
-  /// Copy a subimage in a buffer to this image.
-  void copy(vk::CommandBuffer cb, vk::Buffer buffer, uint32_t mipLevel, uint32_t arrayLayer, uint32_t width, uint32_t height, uint32_t depth, uint32_t offset) {
-    setLayout(cb, vk::ImageLayout::eTransferDstOptimal);
-    vk::BufferImageCopy region{};
-    region.bufferOffset = offset;
-    vk::Extent3D extent;
-    extent.width = width;
-    extent.height = height;
-    extent.depth = depth;
-    region.imageSubresource = {vk::ImageAspectFlagBits::eColor, mipLevel, arrayLayer, 1};
-    region.imageExtent = extent;
-    cb.copyBufferToImage(buffer, *s.image, vk::ImageLayout::eTransferDstOptimal, region);
+  /// Start a pass. Passes run in the order they are added.
+  PassBuilder addPass(const std::string &name) {
+    passes_.push_back(PassData{name});
+    compiled_ = false;
+    return PassBuilder{this, static_cast<uint32_t>(passes_.size() - 1)};
   }
 
-  void upload(vk::Device device, const std::vector<uint8_t> &bytes, vk::CommandPool commandPool, const vk::PhysicalDeviceMemoryProperties& memprops, vk::Queue queue, vk::ImageLayout finalLayout=vk::ImageLayout::eShaderReadOnlyOptimal) {
-	return upload(device, bytes.data(), bytes.size(), commandPool, memprops, queue, finalLayout);
+  /// Merge drawing passes into subpasses where possible. The default is true.
+  void setMergeSubpasses(bool value) { mergeSubpasses_ = value; compiled_ = false; }
+
+  /// Build the schedule, the render passes, the framebuffers and the transient images.
+  /// Call it again after changing the graph. The GPU must have finished with the previous build.
+  /// Throws std::runtime_error if the graph is invalid.
+  void compile() {
+    steps_.clear();
+    transientImages_.clear();
+    transientMemory_.clear();
+    stats_ = Stats{};
+    stats_.passes = static_cast<uint32_t>(passes_.size());
+    compiled_ = false;
+
+    cull();
+    schedule();
+    findLifetimes();
+    createTransients();
+    for (uint32_t s = 0; s != steps_.size(); ++s) {
+      if (!steps_[s].attachments.empty()) createRenderPass(s);
+    }
+
+    compiled_ = true;
   }
 
-  void upload(vk::Device device, const uint8_t *bytes, size_t bytesSize, vk::CommandPool commandPool, const vk::PhysicalDeviceMemoryProperties& memprops, vk::Queue queue, vk::ImageLayout finalLayout=vk::ImageLayout::eShaderReadOnlyOptimal) {
-    vku::GenericBuffer stagingBuffer(device, memprops, static_cast<vk::BufferUsageFlags>(vk::BufferUsageFlagBits::eTransferSrc), static_cast<vk::DeviceSize>(bytesSize), vk::MemoryPropertyFlagBits::eHostVisible);
-    stagingBuffer.updateLocal(device, (const void*)bytes, bytesSize);
+  /// Record the schedule made by compile().
+  void execute(vk::CommandBuffer cb) {
+    if (!compiled_) {
+      throw std::logic_error("vku::RenderGraph: execute() called before compile()");
+    }
 
-    // Copy the staging buffer to the GPU texture and set the layout.
-    vku::executeImmediately(device, commandPool, queue, [&](vk::CommandBuffer cb) {
-      auto bp = getBlockParams(s.info.format);
-      vk::Buffer buf = stagingBuffer.buffer();
-      uint32_t offset = 0;
-      for (uint32_t mipLevel = 0; mipLevel != s.info.mipLevels; ++mipLevel) {
-        auto width = mipScale(s.info.extent.width, mipLevel);
-        auto height = mipScale(s.info.extent.height, mipLevel);
-        auto depth = mipScale(s.info.extent.depth, mipLevel);
-        for (uint32_t face = 0; face != s.info.arrayLayers; ++face) {
-          copy(cb, buf, mipLevel, face, width, height, depth, offset);
-          offset += ((bp.bytesPerBlock + 3) & ~3) * (width * height);
+    stats_.barrierBatches = 0;
+    vku::BarrierBatch batch{synchronization2_};
+    for (uint32_t s = 0; s != steps_.size(); ++s) {
+      auto &step = steps_[s];
+
+      // Transition everything the step uses, once per resource, in one batch.
+      std::vector<uint32_t> seen;
+      for (auto p : step.passes) {
+        for (auto &use : passes_[p].uses) {
+          if (std::find(seen.begin(), seen.end(), use.resource) != seen.end()) continue;
+          seen.push_back(use.resource);
+          auto &r = resources_[use.resource];
+          bool attachment = use.kind == PassBuilder::Kind::color || use.kind == PassBuilder::Kind::depth;
+          bool discard = r.transient && r.firstStep == s;
+          if (attachment) {
+            auto a = std::find(step.attachments.begin(), step.attachments.end(), use.resource) - step.attachments.begin();
+            discard = discard || step.loadOps[a] != vk::AttachmentLoadOp::eLoad;
+          }
+          transition(batch, r, use.use, discard);
         }
       }
-      setLayout(cb, finalLayout);
-    });
+      if (!batch.empty()) stats_.barrierBatches++;
+      batch.flush(cb);
+
+      if (step.renderPass) {
+        vk::RenderPassBeginInfo rpbi;
+        rpbi.renderPass = *step.renderPass;
+        rpbi.framebuffer = *step.framebuffer;
+        rpbi.renderArea = vk::Rect2D{{0, 0}, step.extent};
+        rpbi.clearValueCount = static_cast<uint32_t>(step.clearValues.size());
+        rpbi.pClearValues = step.clearValues.data();
+        cb.beginRenderPass(rpbi, vk::SubpassContents::eInline);
+        for (uint32_t i = 0; i != step.passes.size(); ++i) {
+          if (i != 0) cb.nextSubpass(vk::SubpassContents::eInline);
+          auto &func = passes_[step.passes[i]].func;
+          if (func) func(cb);
+        }
+        cb.endRenderPass();
+
+        // The render pass has left each attachment in the layout of its last subpass.
+        for (uint32_t a = 0; a != step.attachments.size(); ++a) {
+          resources_[step.attachments[a]].image->setCurrentUse(step.finalUses[a]);
+        }
+      } else {
+        auto &func = passes_[step.passes[0]].func;
+        if (func) func(cb);
+      }
+    }
   }
 
-  /// Change the layout of this image using a memory barrier.
-  void setLayout(vk::CommandBuffer cb, vk::ImageLayout newLayout, vk::ImageAspectFlags aspectMask = vk::ImageAspectFlagBits::eColor) {
-    if (newLayout == s.currentLayout) return;
-    vk::ImageLayout oldLayout = s.currentLayout;
-    s.currentLayout = newLayout;
-
-    vk::ImageMemoryBarrier imageMemoryBarriers = {};
-    imageMemoryBarriers.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-    imageMemoryBarriers.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-    imageMemoryBarriers.oldLayout = oldLayout;
-    imageMemoryBarriers.newLayout = newLayout;
-    imageMemoryBarriers.image = *s.image;
-    imageMemoryBarriers.subresourceRange = {aspectMask, 0, s.info.mipLevels, 0, s.info.arrayLayers};
-
-    // Put barrier on top
-    // https://www.khronos.org/registry/vulkan/specs/1.2/html/chap7.html#synchronization-access-types-supported
-    vk::PipelineStageFlags srcStageMask{vk::PipelineStageFlagBits::eTopOfPipe};
-    vk::PipelineStageFlags dstStageMask{vk::PipelineStageFlagBits::eTopOfPipe};
-    vk::DependencyFlags dependencyFlags{};
-    vk::AccessFlags srcMask{};
-    vk::AccessFlags dstMask{};
+  /// Get an image of the graph. Images made by the graph exist after compile().
+  [[nodiscard]] vku::GenericImage &image(Resource resource) const { return *resources_[resource.index].image; }
 
-    typedef vk::ImageLayout il;
-    typedef vk::AccessFlagBits afb;
-
-    // Is it me, or are these the same?
-    switch (oldLayout) {
-      case il::eUndefined: break;
-      case il::eGeneral: srcMask = afb::eTransferWrite; srcStageMask=vk::PipelineStageFlagBits::eTransfer; break;
-      case il::eColorAttachmentOptimal: srcMask = afb::eColorAttachmentWrite; srcStageMask=vk::PipelineStageFlagBits::eColorAttachmentOutput; break;
-      case il::eDepthStencilAttachmentOptimal: srcMask = afb::eDepthStencilAttachmentWrite; srcStageMask=vk::PipelineStageFlagBits::eEarlyFragmentTests; break;
-      case il::eDepthStencilReadOnlyOptimal: srcMask = afb::eDepthStencilAttachmentRead; srcStageMask=vk::PipelineStageFlagBits::eEarlyFragmentTests; break;
-      case il::eShaderReadOnlyOptimal: srcMask = afb::eShaderRead; srcStageMask=vk::PipelineStageFlagBits::eVertexShader; break;
-      case il::eTransferSrcOptimal: srcMask = afb::eTransferRead; srcStageMask=vk::PipelineStageFlagBits::eTransfer; break;
-      case il::eTransferDstOptimal: srcMask = afb::eTransferWrite; srcStageMask=vk::PipelineStageFlagBits::eTransfer; break;
-      case il::ePreinitialized: srcMask = afb::eTransferWrite|afb::eHostWrite; srcStageMask=vk::PipelineStageFlagBits::eTransfer|vk::PipelineStageFlagBits::eHost; break;
-      case il::ePresentSrcKHR: srcMask = afb::eMemoryRead; break;
-      default: break;
-    }
-
-    switch (newLayout) {
-      case il::eUndefined: break;
-      case il::eGeneral: dstMask = afb::eTransferWrite; dstStageMask=vk::PipelineStageFlagBits::eTransfer; break;
-      case il::eColorAttachmentOptimal: dstMask = afb::eColorAttachmentWrite; dstStageMask=vk::PipelineStageFlagBits::eColorAttachmentOutput; break;
-      case il::eDepthStencilAttachmentOptimal: dstMask = afb::eDepthStencilAttachmentWrite; dstStageMask=vk::PipelineStageFlagBits::eEarlyFragmentTests; break;
-      case il::eDepthStencilReadOnlyOptimal: dstMask = afb::eDepthStencilAttachmentRead; dstStageMask=vk::PipelineStageFlagBits::eEarlyFragmentTests; break;
-      case il::eShaderReadOnlyOptimal: dstMask = afb::eShaderRead; dstStageMask=vk::PipelineStageFlagBits::eVertexShader; break;
-      case il::eTransferSrcOptimal: dstMask = afb::eTransferRead; dstStageMask=vk::PipelineStageFlagBits::eTransfer; break;
-      case il::eTransferDstOptimal: dstMask = afb::eTransferWrite; dstStageMask=vk::PipelineStageFlagBits::eTransfer; break; // NOLINT(*-branch-clone)
-      case il::ePreinitialized: dstMask = afb::eTransferWrite; dstStageMask=vk::PipelineStageFlagBits::eTransfer; break;
-      case il::ePresentSrcKHR: dstMask = afb::eMemoryRead; break;
-      default: break;
-    }
-//printf("%08x %08x\n", (VkFlags)srcMask, (VkFlags)dstMask);
-
-    imageMemoryBarriers.srcAccessMask = srcMask;
-    imageMemoryBarriers.dstAccessMask = dstMask;
-    auto memoryBarriers = nullptr;
-    auto bufferMemoryBarriers = nullptr;
-    cb.pipelineBarrier(srcStageMask, dstStageMask, dependencyFlags, memoryBarriers, bufferMemoryBarriers, imageMemoryBarriers);
-  }
+  /// Get a buffer imported into the graph.
+  [[nodiscard]] vku::GenericBuffer &buffer(Resource resource) const { return *resources_[resource.index].buffer; }
 
-  /// Set what the image thinks is its current layout (ie. the old layout in an image barrier).
-  void setCurrentLayout(vk::ImageLayout oldLayout) {
-    s.currentLayout = oldLayout;
+  /// Get the render pass a drawing pass is recorded in, for making its pipelines. Valid after compile().
+  [[nodiscard]] vk::RenderPass renderPass(Pass pass) const {
+    auto step = passes_[pass.index].step;
+    return step == invalidIndex ? vk::RenderPass{} : *steps_[step].renderPass;
   }
 
-  [[nodiscard]] vk::Format format() const { return s.info.format; }
-  [[nodiscard]] vk::Extent3D extent() const { return s.info.extent; }
-  [[nodiscard]] const vk::ImageCreateInfo &info() const { return s.info; }
-protected:
-  void create(vk::Device device, const vk::PhysicalDeviceMemoryProperties &memprops, const vk::ImageCreateInfo &info, vk::ImageViewType viewType, vk::ImageAspectFlags aspectMask, bool hostImage) {
-    s.currentLayout = info.initialLayout;
-    s.info = info;
-    s.image = device.createImageUnique(info);
+  /// Get the subpass of renderPass(pass) that pass is recorded in.
+  [[nodiscard]] uint32_t subpass(Pass pass) const { return passes_[pass.index].subpass; }
 
-    // Find out how much memory and which heap to allocate from.
-    auto memreq = device.getImageMemoryRequirements(*s.image);
-    vk::MemoryPropertyFlags search{};
-    if (hostImage) search = vk::MemoryPropertyFlagBits::eHostCoherent | vk::MemoryPropertyFlagBits::eHostVisible;
+  /// Get the size of the attachments of a drawing pass.
+  [[nodiscard]] vk::Extent2D extent(Pass pass) const {
+    auto step = passes_[pass.index].step;
+    return step == invalidIndex ? vk::Extent2D{} : steps_[step].extent;
+  }
 
-    // Create a memory object to bind to the buffer.
-    // Note: we don't expect to be able to map the buffer.
-    vk::MemoryAllocateInfo mai{};
-    mai.allocationSize = s.size = memreq.size;
-    mai.memoryTypeIndex = vku::findMemoryTypeIndex(memprops, memreq.memoryTypeBits, search);
-    s.mem = device.allocateMemoryUnique(mai);
+  /// Returns true if compile() culled the pass.
+  [[nodiscard]] bool culled(Pass pass) const { return passes_[pass.index].culled; }
 
-    device.bindImageMemory(*s.image, *s.mem, 0);
+  [[nodiscard]] const Stats &stats() const { return stats_; }
 
-    if (!hostImage) {
-      vk::ImageViewCreateInfo viewInfo{};
-      viewInfo.image = *s.image;
-      viewInfo.viewType = viewType;
-      viewInfo.format = info.format;
-      viewInfo.components = { vk::ComponentSwizzle::eR, vk::ComponentSwizzle::eG, vk::ComponentSwizzle::eB, vk::ComponentSwizzle::eA };
-      viewInfo.subresourceRange = vk::ImageSubresourceRange{aspectMask, 0, info.mipLevels, 0, info.arrayLayers};
-      s.imageView = device.createImageViewUnique(viewInfo);
+  /// Print the schedule, eg. to check which passes were merged or culled.
+  void dump(std::ostream &os) const {
+    for (auto &pass : passes_) {
+      if (pass.culled) os << "culled " << pass.name << "\n";
+    }
+    for (uint32_t s = 0; s != steps_.size(); ++s) {
+      auto &step = steps_[s];
+      os << "step " << s << (step.renderPass ? " render pass" : "") << "\n";
+      for (auto p : step.passes) {
+        os << "  " << passes_[p].name << "\n";
+      }
+    }
+    for (auto &r : resources_) {
+      if (r.transient && r.firstStep != invalidIndex) {
+        os << r.name << " steps " << r.firstStep << ".." << r.lastStep << " memory type " << r.memoryTypeIndex << " offset " << r.offset << " size " << r.size << "\n";
+      }
     }
   }
+private:
+  struct Use {
+    uint32_t resource;
+    ResourceUse use;
+    PassBuilder::Kind kind;
+    std::optional<vk::ClearValue> clear;
+
+    // Attachments that are not cleared are read too, as their contents are loaded.
+    [[nodiscard]] bool reads() const {
+      if (kind == PassBuilder::Kind::color || kind == PassBuilder::Kind::depth) return !clear;
+      typedef vk::AccessFlagBits2 afb;
+      const vk::AccessFlags2 writeOnly = afb::eColorAttachmentWrite|afb::eDepthStencilAttachmentWrite|afb::eTransferWrite|afb::eHostWrite|afb::eShaderWrite|afb::eShaderStorageWrite|afb::eMemoryWrite;
+      return bool(use.access & ~writeOnly);
+    }
 
-  struct State {
-    vk::UniqueImage image;
-    vk::UniqueImageView imageView;
-    vk::UniqueDeviceMemory mem;
-    vk::DeviceSize size;
-    vk::ImageLayout currentLayout;
-    vk::ImageCreateInfo info;
+    [[nodiscard]] bool attachment() const { return kind != PassBuilder::Kind::other; }
+  };
 
+  struct PassData {
+    std::string name;
+    std::vector<Use> uses;
+    std::function<void (vk::CommandBuffer cb)> func;
+    bool sideEffects = false;
+    bool culled = false;
+    uint32_t step = invalidIndex;
+    uint32_t subpass = 0;
   };
 
-  State s;
-};
+  struct ResourceData {
+    std::string name;
+    vku::GenericImage *image = nullptr;
+    vku::GenericBuffer *buffer = nullptr;
+    ImageDesc desc;
+    vk::ImageUsageFlags usage;
+    bool transient = false;
+    bool output = false;
+    // Buffers have no use tracking of their own.
+    ResourceUse bufferUse = ResourceUse::unknown();
+    // Steps of the first and last use, or invalidIndex if unused.
+    uint32_t firstStep = invalidIndex;
+    uint32_t lastStep = invalidIndex;
+    // Placement of transient images.
+    uint32_t memoryTypeIndex = 0;
+    vk::DeviceSize offset = 0;
+    vk::DeviceSize size = 0;
+    vk::DeviceSize alignment = 1;
+    // Transient images sharing some of this one's memory.
+    std::vector<uint32_t> aliases;
+  };
 
+  // A render pass holding one or more passes, or a single pass run outside a render pass.
+  struct Step {
+    std::vector<uint32_t> passes;
+    vk::Extent2D extent;
+    std::vector<uint32_t> attachments;
+    std::vector<vk::AttachmentLoadOp> loadOps;
+    std::vector<vk::ClearValue> clearValues;
+    std::vector<ResourceUse> finalUses;
+    vk::UniqueRenderPass renderPass;
+    vk::UniqueFramebuffer framebuffer;
+  };
 
-/// A 2D texture image living on the GPU or a staging buffer visible to the CPU.
-class TextureImage2D : public GenericImage {
-public:
-  TextureImage2D() = default;
+  Resource addResource(ResourceData &&r) {
+    resources_.push_back(std::move(r));
+    compiled_ = false;
+    return Resource{static_cast<uint32_t>(resources_.size() - 1)};
+  }
 
-  TextureImage2D(vk::Device device, const vk::PhysicalDeviceMemoryProperties &memprops, uint32_t width, uint32_t height, uint32_t mipLevels=1, vk::Format format = vk::Format::eR8G8B8A8Unorm, bool hostImage = false) {
-    vk::ImageCreateInfo info;
-    info.flags = {};
-    info.imageType = vk::ImageType::e2D;
-    info.format = format;
-    info.extent = vk::Extent3D{ width, height, 1U };
-    info.mipLevels = mipLevels;
-    info.arrayLayers = 1;
-    info.samples = vk::SampleCountFlagBits::e1;
-    info.tiling = hostImage ? vk::ImageTiling::eLinear : vk::ImageTiling::eOptimal;
-    info.usage = vk::ImageUsageFlagBits::eSampled|vk::ImageUsageFlagBits::eTransferSrc|vk::ImageUsageFlagBits::eTransferDst;
-    info.sharingMode = vk::SharingMode::eExclusive;
-    info.queueFamilyIndexCount = 0;
-    info.pQueueFamilyIndices = nullptr;
-    info.initialLayout = hostImage ? vk::ImageLayout::ePreinitialized : vk::ImageLayout::eUndefined;
-    create(device, memprops, info, vk::ImageViewType::e2D, vk::ImageAspectFlagBits::eColor, hostImage);
+  // Walk back from the results, keeping passes that write something a kept pass or the caller reads.
+  void cull() {
+    std::vector<bool> needed(resources_.size());
+    for (uint32_t i = 0; i != resources_.size(); ++i) {
+      needed[i] = resources_[i].output || !resources_[i].transient;
+    }
+
+    for (uint32_t p = static_cast<uint32_t>(passes_.size()); p-- != 0; ) {
+      auto &pass = passes_[p];
+      pass.culled = !pass.sideEffects && std::none_of(pass.uses.begin(), pass.uses.end(), [&](const Use &use) {
+        return use.use.writes() && needed[use.resource];
+      });
+      if (pass.culled) {
+        stats_.culledPasses++;
+        continue;
+      }
+      for (auto &use : pass.uses) {
+        if (use.reads()) needed[use.resource] = true;
+      }
+    }
   }
-private:
-};
 
-/// A cube map texture image living on the GPU or a staging buffer visible to the CPU.
-class TextureImageCube : public GenericImage {
-public:
-  TextureImageCube() = default;
+  // Group the kept passes into steps, merging drawing passes into subpasses.
+  void schedule() {
+    for (uint32_t p = 0; p != passes_.size(); ++p) {
+      auto &pass = passes_[p];
+      pass.step = invalidIndex;
+      pass.subpass = 0;
+      if (pass.culled) continue;
+
+      std::vector<uint32_t> attachments;
+      vk::Extent2D extent{};
+      for (auto &use : pass.uses) {
+        if (!use.attachment()) continue;
+        auto &r = resources_[use.resource];
+        if (!r.image && !r.transient) {
+          throw std::runtime_error("vku::RenderGraph: attachment " + r.name + " of pass " + pass.name + " is not an image");
+        }
+        vk::Extent2D e{r.desc.width, r.desc.height};
+        if (extent != vk::Extent2D{} && e != extent) {
+          throw std::runtime_error("vku::RenderGraph: attachments of pass " + pass.name + " differ in size");
+        }
+        extent = e;
+      }
+      bool draws = std::any_of(pass.uses.begin(), pass.uses.end(), [](const Use &use) {
+        return use.kind == PassBuilder::Kind::color || use.kind == PassBuilder::Kind::depth;
+      });
+      if (!draws && extent != vk::Extent2D{}) {
+        throw std::runtime_error("vku::RenderGraph: pass " + pass.name + " has input attachments but nothing to draw to");
+      }
 
-  TextureImageCube(vk::Device device, const vk::PhysicalDeviceMemoryProperties &memprops, uint32_t width, uint32_t height, uint32_t mipLevels=1, vk::Format format = vk::Format::eR8G8B8A8Unorm, bool hostImage = false) {
-    vk::ImageCreateInfo info;
-    info.flags = {vk::ImageCreateFlagBits::eCubeCompatible};
-    info.imageType = vk::ImageType::e2D;
-    info.format = format;
-    info.extent = vk::Extent3D{ width, height, 1U };
-    info.mipLevels = mipLevels;
-    info.arrayLayers = 6;
-    info.samples = vk::SampleCountFlagBits::e1;
-    info.tiling = hostImage ? vk::ImageTiling::eLinear : vk::ImageTiling::eOptimal;
-    info.usage = vk::ImageUsageFlagBits::eColorAttachment|vk::ImageUsageFlagBits::eSampled|vk::ImageUsageFlagBits::eTransferSrc|vk::ImageUsageFlagBits::eTransferDst;
-    info.sharingMode = vk::SharingMode::eExclusive;
-    info.queueFamilyIndexCount = 0;
-    info.pQueueFamilyIndices = nullptr;
-    info.initialLayout = hostImage ? vk::ImageLayout::ePreinitialized : vk::ImageLayout::eUndefined;
-    //info.initialLayout = vk::ImageLayout::ePreinitialized;
-    create(device, memprops, info, vk::ImageViewType::eCube, vk::ImageAspectFlagBits::eColor, hostImage);
+      if (draws && !steps_.empty() && canMerge(steps_.back(), pass, extent)) {
+        pass.subpass = static_cast<uint32_t>(steps_.back().passes.size());
+      } else {
+        steps_.emplace_back();
+        steps_.back().extent = draws ? extent : vk::Extent2D{};
+      }
+      auto &step = steps_.back();
+      pass.step = static_cast<uint32_t>(steps_.size() - 1);
+      step.passes.push_back(p);
+      if (draws) {
+        for (auto &use : pass.uses) {
+          if (use.attachment() && std::find(step.attachments.begin(), step.attachments.end(), use.resource) == step.attachments.end()) {
+            step.attachments.push_back(use.resource);
+          }
+        }
+      }
+    }
+
+    stats_.steps = static_cast<uint32_t>(steps_.size());
+    for (auto &step : steps_) {
+      if (!step.attachments.empty()) {
+        stats_.renderPasses++;
+        stats_.subpasses += static_cast<uint32_t>(step.passes.size());
+      }
+    }
   }
-private:
-};
 
-/// An image to use as a depth buffer on a renderpass.
-class DepthStencilImage : public GenericImage {
-public:
-  DepthStencilImage() = default;
+  // A drawing pass can join a render pass if it draws at the same size and shares resources with
+  // the earlier subpasses only as attachments. A barrier would be needed otherwise.
+  bool canMerge(const Step &step, const PassData &pass, vk::Extent2D extent) const {
+    if (!mergeSubpasses_ || step.attachments.empty() || step.extent != extent) return false;
+    for (auto &use : pass.uses) {
+      for (auto p : step.passes) {
+        for (auto &earlier : passes_[p].uses) {
+          if (earlier.resource != use.resource) continue;
+          if (use.attachment() && earlier.attachment()) continue;
+          // Plain reads of something nobody in the render pass writes can share a barrier.
+          if (!use.attachment() && !earlier.attachment() && !use.use.writes() && !earlier.use.writes() && use.use.layout == earlier.use.layout) continue;
+          return false;
+        }
+      }
+    }
+    return true;
+  }
 
-  DepthStencilImage(vk::Device device, const vk::PhysicalDeviceMemoryProperties &memprops, uint32_t width, uint32_t height, vk::Format format = vk::Format::eD24UnormS8Uint) {
-    vk::ImageCreateInfo info;
-    info.flags = {};
+  void findLifetimes() {
+    for (auto &r : resources_) {
+      r.firstStep = r.lastStep = invalidIndex;
+    }
+    for (uint32_t s = 0; s != steps_.size(); ++s) {
+      for (auto p : steps_[s].passes) {
+        for (auto &use : passes_[p].uses) {
+          auto &r = resources_[use.resource];
+          if (r.firstStep == invalidIndex) r.firstStep = s;
+          r.lastStep = s;
+        }
+      }
+    }
+  }
 
+  vk::ImageCreateInfo transientInfo(const ResourceData &r) const {
+    vk::ImageCreateInfo info{};
     info.imageType = vk::ImageType::e2D;
-    info.format = format;
-    info.extent = vk::Extent3D{ width, height, 1U };
+    info.format = r.desc.format;
+    info.extent = vk::Extent3D{r.desc.width, r.desc.height, 1U};
     info.mipLevels = 1;
     info.arrayLayers = 1;
     info.samples = vk::SampleCountFlagBits::e1;
     info.tiling = vk::ImageTiling::eOptimal;
-    info.usage = vk::ImageUsageFlagBits::eDepthStencilAttachment|vk::ImageUsageFlagBits::eTransferSrc|vk::ImageUsageFlagBits::eSampled;
+    info.usage = r.usage;
     info.sharingMode = vk::SharingMode::eExclusive;
-    info.queueFamilyIndexCount = 0;
-    info.pQueueFamilyIndices = nullptr;
     info.initialLayout = vk::ImageLayout::eUndefined;
-    typedef vk::ImageAspectFlagBits iafb;
-    create(device, memprops, info, vk::ImageViewType::e2D, iafb::eDepth, false);
+    return info;
   }
-private:
-};
 
-/// An image to use as a colour buffer on a renderpass.
-class ColorAttachmentImage : public GenericImage {
-public:
-  ColorAttachmentImage() = default;
+  // Place each used transient image in a memory heap per memory type, largest first.
+  // An image may reuse memory held by images whose steps don't overlap its own.
+  void createTransients() {
+    std::vector<uint32_t> order;
+    for (uint32_t i = 0; i != resources_.size(); ++i) {
+      auto &r = resources_[i];
+      if (!r.transient) continue;
+      r.image = nullptr;
+      r.aliases.clear();
+      if (r.firstStep == invalidIndex) continue;
+
+      // Make a throwaway image to find the memory requirements.
+      auto probe = device_.createImageUnique(transientInfo(r));
+      auto memreq = device_.getImageMemoryRequirements(*probe);
+      int memoryTypeIndex = vku::findMemoryTypeIndex(memprops_, memreq.memoryTypeBits, vk::MemoryPropertyFlagBits::eDeviceLocal);
+      if (memoryTypeIndex < 0) memoryTypeIndex = vku::findMemoryTypeIndex(memprops_, memreq.memoryTypeBits, {});
+      if (memoryTypeIndex < 0) {
+        throw std::runtime_error("vku::RenderGraph: no memory type for " + r.name);
+      }
+      r.memoryTypeIndex = static_cast<uint32_t>(memoryTypeIndex);
+      r.size = memreq.size;
+      r.alignment = memreq.alignment;
+      order.push_back(i);
+      stats_.unaliasedBytes += memreq.size;
+    }
+    std::stable_sort(order.begin(), order.end(), [this](uint32_t a, uint32_t b) { return resources_[a].size > resources_[b].size; });
+
+    std::map<uint32_t, vk::DeviceSize> heapSizes;
+    std::vector<uint32_t> placed;
+    for (auto i : order) {
+      auto &r = resources_[i];
+      vk::DeviceSize alignment = std::max(r.alignment, vk::DeviceSize{1});
+
+      // Ranges already taken by images in use at the same time, sorted by offset.
+      std::vector<std::pair<vk::DeviceSize, vk::DeviceSize>> taken;
+      for (auto j : placed) {
+        auto &other = resources_[j];
+        bool overlaps = other.firstStep <= r.lastStep && r.firstStep <= other.lastStep;
+        if (other.memoryTypeIndex == r.memoryTypeIndex && overlaps) {
+          taken.emplace_back(other.offset, other.offset + other.size);
+        }
+      }
+      std::sort(taken.begin(), taken.end());
 
-  ColorAttachmentImage(vk::Device device, const vk::PhysicalDeviceMemoryProperties &memprops, uint32_t width, uint32_t height, vk::Format format = vk::Format::eR8G8B8A8Unorm) {
-    vk::ImageCreateInfo info;
-    info.flags = {};
+      vk::DeviceSize offset = 0;
+      for (auto &range : taken) {
+        if (offset + r.size <= range.first) break;
+        offset = std::max(offset, roundUp(range.second, alignment));
+      }
+      r.offset = offset;
+      placed.push_back(i);
+      auto &heapSize = heapSizes[r.memoryTypeIndex];
+      heapSize = std::max(heapSize, offset + r.size);
+    }
 
-    info.imageType = vk::ImageType::e2D;
-    info.format = format;
-    info.extent = vk::Extent3D{ width, height, 1U };
-    info.mipLevels = 1;
-    info.arrayLayers = 1;
-    info.samples = vk::SampleCountFlagBits::e1;
-    info.tiling = vk::ImageTiling::eOptimal;
-    info.usage = vk::ImageUsageFlagBits::eColorAttachment|vk::ImageUsageFlagBits::eTransferSrc|vk::ImageUsageFlagBits::eTransferDst|vk::ImageUsageFlagBits::eSampled;
-    info.sharingMode = vk::SharingMode::eExclusive;
-    info.queueFamilyIndexCount = 0;
-    info.pQueueFamilyIndices = nullptr;
-    info.initialLayout = vk::ImageLayout::eUndefined;
-    typedef vk::ImageAspectFlagBits iafb;
-    create(device, memprops, info, vk::ImageViewType::e2D, iafb::eColor, false);
+    for (auto &[memoryTypeIndex, size] : heapSizes) {
+      vk::MemoryAllocateInfo mai{size, memoryTypeIndex};
+      transientMemory_[memoryTypeIndex] = device_.allocateMemoryUnique(mai);
+      stats_.transientBytes += size;
+    }
+
+    transientImages_.reserve(placed.size());
+    for (auto i : placed) {
+      auto &r = resources_[i];
+      transientImages_.emplace_back(device_, *transientMemory_[r.memoryTypeIndex], r.offset, transientInfo(r), vk::ImageViewType::e2D, r.desc.aspectMask);
+      r.image = &transientImages_.back();
+      for (auto j : placed) {
+        auto &other = resources_[j];
+        if (j != i && other.memoryTypeIndex == r.memoryTypeIndex && other.offset < r.offset + r.size && r.offset < other.offset + other.size) {
+          r.aliases.push_back(j);
+        }
+      }
+    }
   }
-private:
+
+  // Make the render pass and framebuffer of a step from the uses of its passes.
+  void createRenderPass(uint32_t s) {
+    auto &step = steps_[s];
+    auto numAttachments = step.attachments.size();
+    step.loadOps.assign(numAttachments, vk::AttachmentLoadOp::eDontCare);
+    step.clearValues.assign(numAttachments, vk::ClearValue{});
+    step.finalUses.assign(numAttachments, ResourceUse{});
+
+    auto attachmentIndex = [&](uint32_t resource) {
+      return static_cast<uint32_t>(std::find(step.attachments.begin(), step.attachments.end(), resource) - step.attachments.begin());
+    };
+
+    // The first use in the render pass decides the load op and initial layout, the last the final layout.
+    // Also note the first and last subpass referencing each attachment.
+    std::vector<ResourceUse> firstUses(numAttachments);
+    std::vector<bool> started(numAttachments);
+    std::vector<uint32_t> firstSubpass(numAttachments), lastSubpass(numAttachments);
+    for (uint32_t i = 0; i != step.passes.size(); ++i) {
+      for (auto &use : passes_[step.passes[i]].uses) {
+        if (!use.attachment()) continue;
+        auto a = attachmentIndex(use.resource);
+        lastSubpass[a] = i;
+        if (!started[a]) {
+          started[a] = true;
+          firstSubpass[a] = i;
+          firstUses[a] = use.use;
+          auto &r = resources_[use.resource];
+          if (use.clear) {
+            step.loadOps[a] = vk::AttachmentLoadOp::eClear;
+            step.clearValues[a] = *use.clear;
+          } else if (!r.transient || r.firstStep != s) {
+            step.loadOps[a] = vk::AttachmentLoadOp::eLoad;
+          }
+        }
+        step.finalUses[a] = use.use;
+      }
+    }
+
+    vku::RenderpassMaker rpm;
+    for (uint32_t a = 0; a != numAttachments; ++a) {
+      auto &r = resources_[step.attachments[a]];
+      // Contents only need storing if something later reads them.
+      bool keep = !r.transient || r.output || r.lastStep != s;
+      auto storeOp = keep ? vk::AttachmentStoreOp::eStore : vk::AttachmentStoreOp::eDontCare;
+      bool stencil = bool(r.desc.aspectMask & vk::ImageAspectFlagBits::eStencil);
+      rpm.attachmentBegin(r.desc.format);
+      rpm.attachmentLoadOp(step.loadOps[a]);
+      rpm.attachmentStoreOp(storeOp);
+      rpm.attachmentStencilLoadOp(stencil ? step.loadOps[a] : vk::AttachmentLoadOp::eDontCare);
+      rpm.attachmentStencilStoreOp(stencil ? storeOp : vk::AttachmentStoreOp::eDontCare);
+      rpm.attachmentInitialLayout(firstUses[a].layout);
+      rpm.attachmentFinalLayout(step.finalUses[a].layout);
+    }
+
+    // Colour, input and depth references are each added one after another, as RenderpassMaker needs.
+    std::map<std::pair<uint32_t, uint32_t>, vk::SubpassDependency> dependencies;
+    for (uint32_t i = 0; i != step.passes.size(); ++i) {
+      auto &pass = passes_[step.passes[i]];
+      pass.subpass = i;
+      rpm.subpassBegin(vk::PipelineBindPoint::eGraphics);
+      for (auto &use : pass.uses) {
+        if (use.kind == PassBuilder::Kind::color) rpm.subpassColorAttachment(use.use.layout, attachmentIndex(use.resource));
+      }
+      for (auto &use : pass.uses) {
+        if (use.kind == PassBuilder::Kind::input) rpm.subpassInputAttachment(use.use.layout, attachmentIndex(use.resource));
+      }
+      for (auto &use : pass.uses) {
+        if (use.kind == PassBuilder::Kind::depth) rpm.subpassDepthStencilAttachment(use.use.layout, attachmentIndex(use.resource));
+      }
+
+      // Attachments live across this subpass but not referenced by it would otherwise be undefined.
+      for (uint32_t a = 0; a != numAttachments; ++a) {
+        if (firstSubpass[a] >= i || lastSubpass[a] <= i) continue;
+        bool referenced = std::any_of(pass.uses.begin(), pass.uses.end(), [&](const Use &u) {
+          return u.attachment() && u.resource == step.attachments[a];
+        });
+        if (!referenced) rpm.subpassPreserveAttachment(a);
+      }
+
+      // Depend on the latest earlier subpass that used each resource, if either use writes.
+      for (auto &use : pass.uses) {
+        for (uint32_t j = i; j-- != 0; ) {
+          auto &earlier = passes_[step.passes[j]].uses;
+          auto it = std::find_if(earlier.begin(), earlier.end(), [&](const Use &u) { return u.resource == use.resource; });
+          if (it == earlier.end()) continue;
+          if (it->use.writes() || use.use.writes()) {
+            auto &dep = dependencies[{j, i}];
+            dep.srcSubpass = j;
+            dep.dstSubpass = i;
+            dep.srcStageMask |= vku::BarrierBatch::legacyStages(it->use.stages);
+            dep.dstStageMask |= vku::BarrierBatch::legacyStages(use.use.stages);
+            dep.srcAccessMask |= vku::BarrierBatch::legacyAccess(it->use.access);
+            dep.dstAccessMask |= vku::BarrierBatch::legacyAccess(use.use.access);
+            dep.dependencyFlags = vk::DependencyFlagBits::eByRegion;
+          }
+          break;
+        }
+      }
+    }
+    for (auto &[key, dep] : dependencies) {
+      rpm.dependencyBegin(dep.srcSubpass, dep.dstSubpass)
+        .dependencySrcStageMask(dep.srcStageMask)
+        .dependencyDstStageMask(dep.dstStageMask)
+        .dependencySrcAccessMask(dep.srcAccessMask)
+        .dependencyDstAccessMask(dep.dstAccessMask)
+        .dependencyDependencyFlags(dep.dependencyFlags);
+    }
+    step.renderPass = rpm.createUnique(device_);
+
+    std::vector<vk::ImageView> views;
+    for (auto resource : step.attachments) {
+      views.push_back(resources_[resource].image->imageView());
+    }
+    vk::FramebufferCreateInfo fci{{}, *step.renderPass, views, step.extent.width, step.extent.height, 1};
+    step.framebuffer = device_.createFramebufferUnique(fci);
+  }
+
+  // Add the barrier for the next use of a resource.
+  // Discarded contents are not kept, but the barrier still waits for the last use of the memory,
+  // including uses by images aliasing it.
+  void transition(vku::BarrierBatch &batch, ResourceData &r, const ResourceUse &next, bool discard) {
+    if (r.buffer) {
+      auto &prev = r.bufferUse;
+      if (prev.writes() || next.writes()) {
+        batch.buffer(r.buffer->buffer(), prev, next);
+        prev = next;
+      } else {
+        prev = ResourceUse{prev.stages|next.stages, prev.access|next.access};
+      }
+      return;
+    }
+
+    if (discard) {
+      ResourceUse last = r.image->currentUse();
+      for (auto j : r.aliases) {
+        auto &alias = resources_[j].image->currentUse();
+        last.stages |= alias.stages;
+        last.access |= alias.access;
+      }
+      r.image->setCurrentUse(ResourceUse{last.stages, last.access, vk::ImageLayout::eUndefined});
+    }
+    r.image->transition(batch, next, r.desc.aspectMask);
+  }
+
+  vk::Device device_;
+  vk::PhysicalDeviceMemoryProperties memprops_;
+  bool synchronization2_ = false;
+  bool mergeSubpasses_ = true;
+  bool compiled_ = false;
+  std::vector<PassData> passes_;
+  std::vector<ResourceData> resources_;
+  std::map<uint32_t, vk::UniqueDeviceMemory> transientMemory_;
+  std::vector<vku::GenericImage> transientImages_;
+  std::vector<Step> steps_;
+  Stats stats_;
 };
 
 /// A class to help build samplers.
@@ -2149,25 +7321,41 @@ public:
   [[nodiscard]] uint32_t height(uint32_t mipLevel) const { return mipScale(header.pixelHeight, mipLevel); }
   [[nodiscard]] uint32_t depth(uint32_t mipLevel) const { return mipScale(header.pixelDepth, mipLevel); }
 
-  void upload(vk::Device device, vku::GenericImage &image, const std::vector<uint8_t> &bytes, vk::CommandPool commandPool, const vk::PhysicalDeviceMemoryProperties& memprops, vk::Queue queue) const {
+  void upload(vk::Device device, vku::GenericImage &image, const std::vector<uint8_t> &bytes, vk::CommandPool commandPool, const vk::PhysicalDeviceMemoryProperties& memprops, vk::Queue queue, bool synchronization2 = false) const {
     vku::GenericBuffer stagingBuffer(device, memprops, static_cast<vk::BufferUsageFlags>(vk::BufferUsageFlagBits::eTransferSrc), bytes.size(), vk::MemoryPropertyFlagBits::eHostVisible);
     stagingBuffer.updateLocal(device, (const void*)bytes.data(), bytes.size());
 
     // Copy the staging buffer to the GPU texture and set the layout.
     vku::executeImmediately(device, commandPool, queue, [&](vk::CommandBuffer cb) {
-      vk::Buffer buf = stagingBuffer.buffer();
-      for (uint32_t mipLevel = 0; mipLevel != mipLevels(); ++mipLevel) {
-        auto width = this->width(mipLevel);
-        auto height = this->height(mipLevel);
-        auto depth = this->depth(mipLevel);
-        for (uint32_t face = 0; face != faces(); ++face) {
-          image.copy(cb, buf, mipLevel, face, width, height, depth, offset(mipLevel, 0, face));
-        }
-      }
-      image.setLayout(cb, vk::ImageLayout::eShaderReadOnlyOptimal);
+      recordUpload(cb, image, stagingBuffer.buffer(), synchronization2);
     });
   }
 
+  /// Upload through a SubmitPool without waiting.
+  /// The staging buffer is released by the pool when the copy completes.
+  SubmitPool::Submission upload(vk::Device device, vku::GenericImage &image, const std::vector<uint8_t> &bytes, vku::SubmitPool &pool, const vk::PhysicalDeviceMemoryProperties& memprops, bool synchronization2 = false) const {
+    vku::GenericBuffer stagingBuffer(device, memprops, static_cast<vk::BufferUsageFlags>(vk::BufferUsageFlagBits::eTransferSrc), bytes.size(), vk::MemoryPropertyFlagBits::eHostVisible);
+    stagingBuffer.updateLocal(device, (const void*)bytes.data(), bytes.size());
+
+    vk::Buffer buf = stagingBuffer.buffer();
+    return pool.submit([&](vk::CommandBuffer cb) {
+      recordUpload(cb, image, buf, synchronization2);
+    }, std::move(stagingBuffer));
+  }
+
+  /// Record copies of every mip level and face from the file bytes in buf, then set the layout.
+  void recordUpload(vk::CommandBuffer cb, vku::GenericImage &image, vk::Buffer buf, bool synchronization2 = false) const {
+    for (uint32_t mipLevel = 0; mipLevel != mipLevels(); ++mipLevel) {
+      auto width = this->width(mipLevel);
+      auto height = this->height(mipLevel);
+      auto depth = this->depth(mipLevel);
+      for (uint32_t face = 0; face != faces(); ++face) {
+        image.copy(cb, buf, mipLevel, face, width, height, depth, offset(mipLevel, 0, face), synchronization2);
+      }
+    }
+    image.setLayout(cb, vk::ImageLayout::eShaderReadOnlyOptimal, vk::ImageAspectFlagBits::eColor, synchronization2);
+  }
+
 private:
   static void swap(uint32_t &value) {
     value = value >> 24 | (value & 0xff0000) >> 8 | (value & 0xff00) << 8 | value << 24;
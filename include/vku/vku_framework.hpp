@@ -45,6 +45,7 @@
 #include <chrono>
 #include <functional>
 #include <cstddef>
+#include <string>
 
 #include <vulkan/vulkan.hpp>
 #include "vku.hpp"
@@ -55,6 +56,15 @@ struct FrameworkOptions
 {
 	int deviceID = 0;
 	bool useCompute = true;
+	bool useTransferQueue = true;
+	// If set, the pipeline cache is loaded from here at startup and saved on exit.
+	std::string pipelineCachePath;
+	// Enable whichever extended dynamic states the device supports, for PipelineMaker::dynamicProfile().
+	bool useExtendedDynamicState = false;
+	// Enable synchronization2 if the instance and device have Vulkan 1.3, so windows can use vkQueueSubmit2.
+	bool useSynchronization2 = false;
+	// Enable timeline semaphores if the instance and device have Vulkan 1.2, and make a TimelineQueue for each queue.
+	bool useTimelineSemaphores = false;
 } ;
 
 /// This class provides an optional interface to the vulkan instance, devices and queues.
@@ -82,6 +92,7 @@ public:
     const auto badQueue = ~(uint32_t)0;
     graphicsQueueFamilyIndex_ = badQueue;
     computeQueueFamilyIndex_ = badQueue;
+    transferQueueFamilyIndex_ = badQueue;
     
     vk::QueueFlags search = vk::QueueFlagBits::eGraphics;
     if (options.useCompute)
@@ -118,6 +129,19 @@ public:
       return;
     }
 
+    // A transfer-only family usually maps to the DMA engines, so copies can overlap rendering.
+    // Fall back to the graphics family if there isn't one.
+    transferQueueFamilyIndex_ = graphicsQueueFamilyIndex_;
+    if (options.useTransferQueue) {
+      for (uint32_t qi = 0; qi != qprops.size(); ++qi) {
+        auto flags = qprops[qi].queueFlags;
+        if ((flags & vk::QueueFlagBits::eTransfer) && !(flags & (vk::QueueFlagBits::eGraphics|vk::QueueFlagBits::eCompute))) {
+          transferQueueFamilyIndex_ = qi;
+          break;
+        }
+      }
+    }
+
     memprops_ = physical_device_.getMemoryProperties();
 
     // todo: find optimal texture format
@@ -129,10 +153,54 @@ public:
 		if (computeQueueFamilyIndex_ != graphicsQueueFamilyIndex_)
 			dm.queue(computeQueueFamilyIndex_);
 
+    if (transferQueueFamilyIndex_ != graphicsQueueFamilyIndex_)
+      dm.queue(transferQueueFamilyIndex_);
+
+    if (options.useExtendedDynamicState) {
+      dynamicStateSupport_ = vku::DynamicStateSupport::query(physical_device_, im.apiVersion());
+      dm.enableExtendedDynamicState(dynamicStateSupport_);
+    }
+
+    if (options.useSynchronization2 && std::min(im.apiVersion(), physical_device_.getProperties().apiVersion) >= VK_API_VERSION_1_3) {
+      auto features = physical_device_.getFeatures2<vk::PhysicalDeviceFeatures2, vk::PhysicalDeviceVulkan13Features>();
+      if (features.get<vk::PhysicalDeviceVulkan13Features>().synchronization2) {
+        dm.enableSynchronization2();
+        synchronization2_ = true;
+      }
+    }
+
+    bool timelines = false;
+    if (options.useTimelineSemaphores && std::min(im.apiVersion(), physical_device_.getProperties().apiVersion) >= VK_API_VERSION_1_2) {
+      auto features = physical_device_.getFeatures2<vk::PhysicalDeviceFeatures2, vk::PhysicalDeviceVulkan12Features>();
+      if (features.get<vk::PhysicalDeviceVulkan12Features>().timelineSemaphore) {
+        dm.enableTimelineSemaphore();
+        timelines = true;
+      }
+    }
+
     device_ = dm.createUnique(physical_device_);
 
-    vk::PipelineCacheCreateInfo pipelineCacheInfo{};
-    pipelineCache_ = device_->createPipelineCacheUnique(pipelineCacheInfo);
+    // Queues from the same family are the same queue, so they share a timeline.
+    if (timelines) {
+      graphicsTimeline_ = std::make_shared<vku::TimelineQueue>(*device_, graphicsQueue(), graphicsQueueFamilyIndex_);
+      computeTimeline_ = graphicsTimeline_;
+      if (options.useCompute && computeQueueFamilyIndex_ != graphicsQueueFamilyIndex_) {
+        computeTimeline_ = std::make_shared<vku::TimelineQueue>(*device_, computeQueue(), computeQueueFamilyIndex_);
+      }
+      transferTimeline_ = graphicsTimeline_;
+      if (transferQueueFamilyIndex_ != graphicsQueueFamilyIndex_) {
+        transferTimeline_ = std::make_shared<vku::TimelineQueue>(*device_, transferQueue(), transferQueueFamilyIndex_);
+      }
+    }
+    dynamicStateRecorder_ = vku::DynamicStateRecorder(*device_, dynamicStateSupport_);
+
+    if (!options.pipelineCachePath.empty()) {
+      pipelineCache_ = vku::loadPipelineCache(*device_, physical_device_, options.pipelineCachePath);
+    } else {
+      vk::PipelineCacheCreateInfo pipelineCacheInfo{};
+      pipelineCache_ = device_->createPipelineCacheUnique(pipelineCacheInfo);
+    }
+    pipelineRegistry_ = vku::PipelineRegistry(*device_, *pipelineCache_);
 
     std::vector<vk::DescriptorPoolSize> poolSizes;
     poolSizes.emplace_back(vk::DescriptorType::eUniformBuffer, 128);
@@ -148,6 +216,9 @@ public:
     descriptorPoolInfo.pPoolSizes = poolSizes.data();
     descriptorPool_ = device_->createDescriptorPoolUnique(descriptorPoolInfo);
 
+    // A growable allocator for scenes that outgrow the pool above.
+    descriptorAllocator_ = vku::DescriptorAllocator(*device_);
+
     ok_ = true;
   }
 
@@ -174,33 +245,89 @@ public:
   /// Get the queue used to submit compute jobs
   vk::Queue computeQueue() const { return device_->getQueue(computeQueueFamilyIndex_, 0); }
 
+  /// Get the queue used to submit transfer jobs. This is the graphics queue if there is no transfer-only family.
+  vk::Queue transferQueue() const { return device_->getQueue(transferQueueFamilyIndex_, 0); }
+
   /// Get the physical device.
   const vk::PhysicalDevice &physicalDevice() const { return physical_device_; }
 
   /// Get the default pipeline cache (you can use your own if you like).
   vk::PipelineCache pipelineCache() const { return *pipelineCache_; }
 
+  /// Make an empty pipeline cache, eg. one per thread that builds pipelines.
+  /// Merge them back with mergePipelineCaches() so they get saved.
+  vk::UniquePipelineCache createPipelineCache() const {
+    return device_->createPipelineCacheUnique(vk::PipelineCacheCreateInfo{});
+  }
+
+  /// Merge other caches into the default pipeline cache.
+  void mergePipelineCaches(vk::ArrayProxy<const vk::PipelineCache> const &caches) const {
+    if (!caches.empty()) device_->mergePipelineCaches(*pipelineCache_, caches);
+  }
+
+  /// Save the default pipeline cache to options.pipelineCachePath now.
+  bool savePipelineCache() const {
+    if (options.pipelineCachePath.empty() || !pipelineCache_) return false;
+    return vku::savePipelineCache(*device_, *pipelineCache_, options.pipelineCachePath);
+  }
+
+  /// Returns true if synchronization2 was enabled on the device. Pass this to Window::setSynchronization2() and BarrierBatch.
+  bool synchronization2() const { return synchronization2_; }
+
+  /// Returns true if timeline semaphores were enabled and the TimelineQueues below exist.
+  bool timelineSemaphores() const { return graphicsTimeline_ != nullptr; }
+
+  /// Get the timeline for the graphics queue. Only if timelineSemaphores() is true.
+  vku::TimelineQueue &graphicsTimeline() const { return *graphicsTimeline_; }
+
+  /// Get the timeline for the compute queue. This is the graphics timeline if they share a family.
+  vku::TimelineQueue &computeTimeline() const { return *computeTimeline_; }
+
+  /// Get the timeline for the transfer queue. This is the graphics timeline if they share a family.
+  vku::TimelineQueue &transferTimeline() const { return *transferTimeline_; }
+
+  /// Get the extended dynamic states enabled on the device. Pass this to PipelineMaker::dynamicProfile().
+  const vku::DynamicStateSupport &dynamicStateSupport() const { return dynamicStateSupport_; }
+
+  /// Get a recorder for the extended dynamic states enabled on the device.
+  const vku::DynamicStateRecorder &dynamicStateRecorder() const { return dynamicStateRecorder_; }
+
+  /// Get the default pipeline registry, which shares identical pipelines built with the default cache.
+  vku::PipelineRegistry &pipelineRegistry() { return pipelineRegistry_; }
+
   /// Get the default descriptor pool (you can use your own if you like).
   vk::DescriptorPool descriptorPool() const { return *descriptorPool_; }
 
+  /// Get the default descriptor allocator, which adds pools as needed and has per-frame pools.
+  vku::DescriptorAllocator &descriptorAllocator() { return descriptorAllocator_; }
+
   /// Get the family index for the graphics queues.
   uint32_t graphicsQueueFamilyIndex() const { return graphicsQueueFamilyIndex_; }
 
   /// Get the family index for the compute queues.
   uint32_t computeQueueFamilyIndex() const { return computeQueueFamilyIndex_; }
 
+  /// Get the family index for the transfer queues.
+  uint32_t transferQueueFamilyIndex() const { return transferQueueFamilyIndex_; }
+
   const vk::PhysicalDeviceMemoryProperties &memprops() const { return memprops_; }
 
   /// Clean up the framework satisfying the Vulkan verification layers.
   ~Framework() {
     if (device_) {
       device_->waitIdle();
+      graphicsTimeline_.reset();
+      computeTimeline_.reset();
+      transferTimeline_.reset();
+      pipelineRegistry_ = vku::PipelineRegistry{};
       if (pipelineCache_) {
+        savePipelineCache();
         pipelineCache_.reset();
       }
       if (descriptorPool_) {
         descriptorPool_.reset();
       }
+      descriptorAllocator_ = vku::DescriptorAllocator{};
       device_.reset();
     }
 
@@ -222,10 +349,19 @@ private:
   //vk::DebugReportCallbackEXT callback_;
   vk::PhysicalDevice physical_device_;
   vk::UniquePipelineCache pipelineCache_;
+  vku::PipelineRegistry pipelineRegistry_;
+  vku::DynamicStateSupport dynamicStateSupport_;
+  vku::DynamicStateRecorder dynamicStateRecorder_;
   vk::UniqueDescriptorPool descriptorPool_;
+  vku::DescriptorAllocator descriptorAllocator_;
+  std::shared_ptr<vku::TimelineQueue> graphicsTimeline_;
+  std::shared_ptr<vku::TimelineQueue> computeTimeline_;
+  std::shared_ptr<vku::TimelineQueue> transferTimeline_;
   uint32_t graphicsQueueFamilyIndex_;
   uint32_t computeQueueFamilyIndex_;
+  uint32_t transferQueueFamilyIndex_;
   vk::PhysicalDeviceMemoryProperties memprops_;
+  bool synchronization2_ = false;
   bool ok_ = false;
 };
 
@@ -315,27 +451,14 @@ public:
 
 	  createFrameBuffers();
 
-	  vk::SemaphoreCreateInfo sci;
-    imageAcquireSemaphore_ = device.createSemaphoreUnique(sci);
-    commandCompleteSemaphore_ = device.createSemaphoreUnique(sci);
-    dynamicSemaphore_ = device.createSemaphoreUnique(sci);
-
     typedef vk::CommandPoolCreateFlagBits ccbits;
 
     vk::CommandPoolCreateInfo cpci{ ccbits::eTransient|ccbits::eResetCommandBuffer, graphicsQueueFamilyIndex };
     commandPool_ = device.createCommandPoolUnique(cpci);
 
-    // Create static draw buffers
+    // Create static draw buffers, one per swapchain image.
     vk::CommandBufferAllocateInfo cbai{ *commandPool_, vk::CommandBufferLevel::ePrimary, (uint32_t)framebuffers_.size() };
     staticDrawBuffers_ = device.allocateCommandBuffersUnique(cbai);
-    dynamicDrawBuffers_ = device.allocateCommandBuffersUnique(cbai);
-
-    // Create a set of fences to protect the command buffers from re-writing.
-    for (int i = 0; i != staticDrawBuffers_.size(); ++i) {
-      vk::FenceCreateInfo fci;
-      fci.flags = vk::FenceCreateFlagBits::eSignaled;
-      commandBufferFences_.emplace_back(device.createFence(fci));
-    }
 
     for (int i = 0; i != staticDrawBuffers_.size(); ++i) {
       vk::CommandBuffer cb = *staticDrawBuffers_[i];
@@ -344,23 +467,61 @@ public:
       cb.end();
     }
 
-    // Create a set of fences to protect the dynamic command buffers from re-writing.
-    for (int i = 0; i != dynamicDrawBuffers_.size(); ++i) {
-      vk::FenceCreateInfo fci;
-      fci.flags = vk::FenceCreateFlagBits::eSignaled;
-      dynamicCommandBufferFences_.emplace_back(device.createFence(fci));
-    }
+    createImageSync();
 
-    for (int i = 0; i != dynamicDrawBuffers_.size(); ++i) {
-      vk::CommandBuffer cb = *dynamicDrawBuffers_[i];
-      vk::CommandBufferBeginInfo bi{};
-      cb.begin(bi);
-      cb.end();
-    }
+    createFrames();
 
     ok_ = true;
   }
 
+  /// Set the number of frames the CPU may record ahead of the GPU. The default is two.
+  /// Waits for the GPU to finish the frames in flight.
+  void setFramesInFlight(uint32_t count) {
+    waitFrames();
+    framesInFlight_ = std::max(count, 1U);
+    createFrames();
+  }
+
+  /// Return the number of frames the CPU may record ahead of the GPU.
+  uint32_t framesInFlight() const { return framesInFlight_; }
+
+  /// Return the frame slot, 0..framesInFlight()-1, that draw() is recording, or will record next.
+  /// Use it to index per-frame resources such as an UploadRing.
+  uint32_t frameIndex() const { return frameIndex_; }
+
+  /// Submit frames with vkQueueSubmit2. Only for devices made with synchronization2 enabled.
+  void setSynchronization2(bool value) { synchronization2_ = value; }
+
+  /// Submit cb with the next frame, before its dynamic command buffer, eg. a compute pre-pass.
+  /// It must stay valid until frameFence(frameIndex()) for that frame is signalled.
+  void queueCommandBuffer(vk::CommandBuffer cb) { queued_.push_back(cb); }
+
+  /// Signal timeline as each frame finishes, eg. Framework::graphicsTimeline().
+  /// It must belong to the queue passed to draw(). Pass nullptr to stop.
+  void setTimeline(vku::TimelineQueue *timeline) { timeline_ = timeline; }
+
+  /// Make the next frame wait for a timeline point, eg. an upload on the transfer timeline.
+  /// Needs a device made with timeline semaphores enabled.
+  void waitTimeline(const vku::TimelineWait &wait) { if (wait.point) timelineWaits_.push_back(wait); }
+
+  /// Return the timeline value signalled by the last frame drawn, or zero without setTimeline().
+  uint64_t frameTimelineValue() const { return lastTimelineValue_; }
+
+  /// How the last frame was submitted.
+  struct SubmitStats {
+    /// Number of vkQueueSubmit or vkQueueSubmit2 calls.
+    uint32_t submits = 0;
+
+    /// Number of command buffers submitted, including those from queueCommandBuffer().
+    uint32_t commandBuffers = 0;
+
+    /// CPU time spent submitting.
+    std::chrono::nanoseconds cpuTime{};
+  };
+
+  /// Return how the last frame was submitted.
+  const SubmitStats &submitStats() const { return submitStats_; }
+
 	/// Dump the capabilities of the physical device used by this window.
   void dumpCaps(std::ostream &os, vk::PhysicalDevice pd) const {
     os << "Surface formats\n";
@@ -415,6 +576,8 @@ public:
 
   /// Queue the static command buffer for the next image in the swap chain. Optionally call a function to create a dynamic command buffer
   /// for uploading textures, changing uniforms etc.
+  /// Frame resources are used in rotation by frame slot (see frameIndex()), so the CPU can record
+  /// the next frame while the GPU is still drawing up to framesInFlight()-1 earlier ones.
   void draw(const vk::Device &device, const vk::Queue &graphicsQueue, const std::function<void (vk::CommandBuffer cb, int imageIndex, vk::RenderPassBeginInfo &rpbi)> &dynamic = defaultRenderFunc) {
     static auto start = std::chrono::high_resolution_clock::now();
     auto time = std::chrono::high_resolution_clock::now();
@@ -424,24 +587,29 @@ public:
     //std::cout << std::chrono::duration_cast<std::chrono::microseconds>(delta).count() << "us frame time\n";
 
     auto umax = std::numeric_limits<uint64_t>::max();
+    auto &frame = frames_[frameIndex_];
+
+    // Wait until the GPU has finished with this slot's command buffer and semaphores.
+    vk::Fence fence = *frame.fence;
+    (void)device.waitForFences(fence, VK_TRUE, umax);
+
     uint32_t imageIndex = 0;
-    auto acquired = device.acquireNextImageKHR(*swapchain_, umax, *imageAcquireSemaphore_, vk::Fence(), &imageIndex);
-    if (acquired != vk::Result::eSuccess) {
+    auto acquired = device.acquireNextImageKHR(*swapchain_, umax, *frame.acquireSemaphore, vk::Fence(), &imageIndex);
+    if (acquired != vk::Result::eSuccess && acquired != vk::Result::eSuboptimalKHR) {
       recreate();
       return;
     }
-    vk::PipelineStageFlags waitStages = vk::PipelineStageFlagBits::eColorAttachmentOutput;
-    vk::Semaphore ccSema = *commandCompleteSemaphore_;
-    vk::Semaphore iaSema = *imageAcquireSemaphore_;
-    vk::Semaphore psSema = *dynamicSemaphore_;
-    vk::CommandBuffer cb = *staticDrawBuffers_[imageIndex];
-    vk::CommandBuffer pscb = *dynamicDrawBuffers_[imageIndex];
 
+    // The static command buffer belongs to the image; another slot may still be using it.
+    if (imageFences_[imageIndex] && imageFences_[imageIndex] != fence) {
+      (void)device.waitForFences(imageFences_[imageIndex], VK_TRUE, umax);
+    }
+    imageFences_[imageIndex] = fence;
+    device.resetFences(fence);
 
-    vk::Fence rpcbFence = dynamicCommandBufferFences_[imageIndex];
-    device.waitForFences(rpcbFence, 1, umax);
-    device.resetFences(rpcbFence);
-
+    vk::Semaphore ccSema = *renderSemaphores_[imageIndex];
+    vk::CommandBuffer cb = *staticDrawBuffers_[imageIndex];
+    vk::CommandBuffer pscb = *frame.dynamicDrawBuffer;
 
     vk::ClearDepthStencilValue clearDepthValue{ 1.0f, 0 };
     std::array<vk::ClearValue, 2> clearColours{vk::ClearValue{clearColorValue()}, clearDepthValue};
@@ -453,30 +621,13 @@ public:
     rpbi.pClearValues = clearColours.data();
     dynamic(pscb, imageIndex, rpbi);
 
-    vk::SubmitInfo submit;
-    submit.waitSemaphoreCount = 1;
-    submit.pWaitSemaphores = &iaSema;
-    submit.pWaitDstStageMask = &waitStages;
-    submit.commandBufferCount = 1;
-    submit.pCommandBuffers = &pscb;
-    submit.signalSemaphoreCount = 1;
-    submit.pSignalSemaphores = &psSema;
-    graphicsQueue.submit(1, &submit, rpcbFence);
-
-
-    vk::Fence cbFence = commandBufferFences_[imageIndex];
-    device.waitForFences(cbFence, 1, umax);
-    device.resetFences(cbFence);
+    auto submitStart = std::chrono::steady_clock::now();
+    submitFrame(graphicsQueue, pscb, cb, ccSema);
+    submitStats_.cpuTime = std::chrono::steady_clock::now() - submitStart;
+    queued_.clear();
+    timelineWaits_.clear();
 
-
-    submit.waitSemaphoreCount = 1;
-    submit.pWaitSemaphores = &psSema;
-    submit.pWaitDstStageMask = &waitStages;
-    submit.commandBufferCount = 1;
-    submit.pCommandBuffers = &cb;
-    submit.signalSemaphoreCount = 1;
-    submit.pSignalSemaphores = &ccSema;
-    graphicsQueue.submit(1, &submit, cbFence);
+    frameIndex_ = (frameIndex_ + 1) % framesInFlight_;
 
     vk::PresentInfoKHR presentInfo;
     vk::SwapchainKHR swapchain = *swapchain_;
@@ -512,12 +663,6 @@ public:
     for (auto &iv : imageViews_) {
       device_.destroyImageView(iv);
     }
-    for (auto &f : commandBufferFences_) {
-      device_.destroyFence(f);
-    }
-    for (auto &f : dynamicCommandBufferFences_) {
-      device_.destroyFence(f);
-    }
     swapchain_ = vk::UniqueSwapchainKHR{};
   }
 
@@ -529,6 +674,16 @@ public:
   /// Return the height of the display.
   uint32_t height() const { return height_; }
 
+  /// Return a viewport covering the whole display.
+  vk::Viewport viewport() const { return vk::Viewport{0.0f, 0.0f, static_cast<float>(width_), static_cast<float>(height_), 0.0f, 1.0f}; }
+
+  /// Set the viewport and scissor to cover the whole display.
+  /// Use with pipelines made with PipelineMaker::dynamicProfile() so they survive resizing.
+  void setViewport(vk::CommandBuffer cb) const {
+    cb.setViewport(0, viewport());
+    cb.setScissor(0, vk::Rect2D{{0, 0}, {width_, height_}});
+  }
+
   /// Return the format of the back buffer.
   vk::Format swapchainImageFormat() const { return swapchainImageFormat_; }
 
@@ -547,17 +702,17 @@ public:
   /// Return the static command buffers.
   const std::vector<vk::UniqueCommandBuffer> &commandBuffers() const { return staticDrawBuffers_; }
 
-  /// Return the fences used to control the static buffers.
-  const std::vector<vk::Fence> &commandBufferFences() const { return commandBufferFences_; }
+  /// Return the fence signalled when the frame in slot frameIndex has been drawn.
+  vk::Fence frameFence(uint32_t frameIndex) const { return *frames_[frameIndex].fence; }
 
-  /// Return the fences used to control the dynamic buffers.
-  const std::vector<vk::Fence> &dynamicCommandBufferFences() const { return dynamicCommandBufferFences_; }
+  /// Return the fence of the last frame to draw into each swapchain image, or null if none has.
+  const std::vector<vk::Fence> &imageFences() const { return imageFences_; }
 
-  /// Return the semaphore signalled when an image is acquired.
-  vk::Semaphore imageAcquireSemaphore() const { return *imageAcquireSemaphore_; }
+  /// Return the semaphore signalled when an image is acquired for the frame in slot frameIndex.
+  vk::Semaphore imageAcquireSemaphore(uint32_t frameIndex) const { return *frames_[frameIndex].acquireSemaphore; }
 
-  /// Return the semaphore signalled when the command buffers are finished.
-  vk::Semaphore commandCompleteSemaphore() const { return *commandCompleteSemaphore_; }
+  /// Return the semaphore signalled when the command buffers drawing into an image are finished.
+  vk::Semaphore commandCompleteSemaphore(uint32_t imageIndex) const { return *renderSemaphores_[imageIndex]; }
 
   /// Return a defult command Pool to use to create new command buffers.
   vk::CommandPool commandPool() const { return *commandPool_; }
@@ -675,8 +830,7 @@ public:
   }
 
   void recreate() {
-    device_.waitForFences(commandBufferFences_, VK_TRUE,
-                          std::numeric_limits<uint64_t>::max());
+    waitFrames();
 
     createSwapchain();
 
@@ -686,9 +840,182 @@ public:
 
     createFrameBuffers();
 
+    createImageSync();
+
     buildStaticCBs();
   }
 
+  /// Wait for every frame in flight to finish on the GPU.
+  void waitFrames() const {
+    std::vector<vk::Fence> fences;
+    for (auto &frame : frames_) fences.push_back(*frame.fence);
+    if (!fences.empty()) {
+      (void)device_.waitForFences(fences, VK_TRUE, std::numeric_limits<uint64_t>::max());
+    }
+  }
+
+  /// Submit a frame as one vkQueueSubmit or vkQueueSubmit2 call signalling the slot's fence.
+  /// It holds up to three batches, run in order and chained by semaphores: the queued
+  /// command buffers, the dynamic command buffer and the static command buffer.
+  /// Timeline waits go on the first batch, and the static batch signals the timeline.
+  void submitFrame(vk::Queue queue, vk::CommandBuffer dynamicCb, vk::CommandBuffer staticCb, vk::Semaphore renderSemaphore) {
+    if (timeline_) {
+      lastTimelineValue_ = timeline_->submitWith([&](uint64_t value) {
+        submitBatches(queue, dynamicCb, staticCb, renderSemaphore, value);
+      });
+    } else {
+      submitBatches(queue, dynamicCb, staticCb, renderSemaphore, 0);
+    }
+
+    submitStats_.submits = 1;
+    submitStats_.commandBuffers = static_cast<uint32_t>(queued_.size()) + 2;
+  }
+
+  void submitBatches(vk::Queue queue, vk::CommandBuffer dynamicCb, vk::CommandBuffer staticCb, vk::Semaphore renderSemaphore, uint64_t timelineValue) {
+    typedef vk::PipelineStageFlagBits psfb;
+    auto &frame = frames_[frameIndex_];
+    vk::Semaphore queuedSema = *frame.queuedSemaphore;
+    vk::Semaphore acquireSema = *frame.acquireSemaphore;
+    vk::Semaphore dynamicSema = *frame.dynamicSemaphore;
+    bool hasQueued = !queued_.empty();
+
+    if (synchronization2_) {
+      typedef vk::PipelineStageFlagBits2 psfb2;
+      std::vector<vk::SemaphoreSubmitInfo> timelineWaits;
+      for (auto &wait : timelineWaits_) {
+        vk::PipelineStageFlags2 stage{static_cast<VkPipelineStageFlags2>(static_cast<VkPipelineStageFlags>(wait.stage))};
+        timelineWaits.emplace_back(wait.point.semaphore, wait.point.value, stage);
+      }
+
+      std::vector<vk::CommandBufferSubmitInfo> queuedInfos;
+      for (auto qcb : queued_) queuedInfos.emplace_back(qcb);
+      vk::CommandBufferSubmitInfo dynamicInfo{dynamicCb}, staticInfo{staticCb};
+      vk::SemaphoreSubmitInfo queuedSignal{queuedSema, 0, psfb2::eAllCommands};
+      std::vector<vk::SemaphoreSubmitInfo> dynamicWaits{vk::SemaphoreSubmitInfo{acquireSema, 0, psfb2::eColorAttachmentOutput}};
+      if (hasQueued) {
+        dynamicWaits.emplace_back(queuedSema, 0, psfb2::eAllCommands);
+      } else {
+        dynamicWaits.insert(dynamicWaits.end(), timelineWaits.begin(), timelineWaits.end());
+      }
+      vk::SemaphoreSubmitInfo dynamicSignal{dynamicSema, 0, psfb2::eAllCommands};
+      vk::SemaphoreSubmitInfo staticWait{dynamicSema, 0, psfb2::eAllCommands};
+      std::vector<vk::SemaphoreSubmitInfo> staticSignals{vk::SemaphoreSubmitInfo{renderSemaphore, 0, psfb2::eAllCommands}};
+      if (timeline_) {
+        staticSignals.emplace_back(timeline_->semaphore(), timelineValue, psfb2::eAllCommands);
+      }
+
+      std::vector<vk::SubmitInfo2> submits;
+      submits.reserve(3);
+      if (hasQueued) {
+        submits.emplace_back().setWaitSemaphoreInfos(timelineWaits).setCommandBufferInfos(queuedInfos).setSignalSemaphoreInfos(queuedSignal);
+      }
+      submits.emplace_back().setWaitSemaphoreInfos(dynamicWaits).setCommandBufferInfos(dynamicInfo).setSignalSemaphoreInfos(dynamicSignal);
+      submits.emplace_back().setCommandBufferInfos(staticInfo).setWaitSemaphoreInfos(staticWait).setSignalSemaphoreInfos(staticSignals);
+      queue.submit2(submits, *frame.fence);
+    } else {
+      // Timeline values are only chained on when there are timeline semaphores.
+      // Binary semaphores in the same batch take a value of zero, which is ignored.
+      bool useTimeline = timeline_ || !timelineWaits_.empty();
+      std::vector<vk::Semaphore> timelineWaits;
+      std::vector<vk::PipelineStageFlags> timelineWaitStages;
+      std::vector<uint64_t> timelineWaitValues;
+      for (auto &wait : timelineWaits_) {
+        timelineWaits.push_back(wait.point.semaphore);
+        timelineWaitStages.push_back(wait.stage);
+        timelineWaitValues.push_back(wait.point.value);
+      }
+
+      std::vector<vk::Semaphore> dynamicWaits{acquireSema};
+      std::vector<vk::PipelineStageFlags> dynamicWaitStages{psfb::eColorAttachmentOutput};
+      std::vector<uint64_t> dynamicWaitValues{0};
+      if (hasQueued) {
+        dynamicWaits.push_back(queuedSema);
+        dynamicWaitStages.push_back(psfb::eAllCommands);
+        dynamicWaitValues.push_back(0);
+      } else {
+        dynamicWaits.insert(dynamicWaits.end(), timelineWaits.begin(), timelineWaits.end());
+        dynamicWaitStages.insert(dynamicWaitStages.end(), timelineWaitStages.begin(), timelineWaitStages.end());
+        dynamicWaitValues.insert(dynamicWaitValues.end(), timelineWaitValues.begin(), timelineWaitValues.end());
+      }
+      vk::PipelineStageFlags staticWaitStage = psfb::eAllCommands;
+      std::vector<vk::Semaphore> staticSignals{renderSemaphore};
+      std::vector<uint64_t> staticSignalValues{0};
+      if (timeline_) {
+        staticSignals.push_back(timeline_->semaphore());
+        staticSignalValues.push_back(timelineValue);
+      }
+
+      std::array<vk::TimelineSemaphoreSubmitInfo, 3> timelineInfos;
+      timelineInfos[0].setWaitSemaphoreValues(timelineWaitValues);
+      timelineInfos[1].setWaitSemaphoreValues(dynamicWaitValues);
+      timelineInfos[2].setSignalSemaphoreValues(staticSignalValues);
+
+      std::vector<vk::SubmitInfo> submits;
+      submits.reserve(3);
+      if (hasQueued) {
+        auto &submit = submits.emplace_back();
+        if (useTimeline) submit.pNext = &timelineInfos[0];
+        submit.waitSemaphoreCount = static_cast<uint32_t>(timelineWaits.size());
+        submit.pWaitSemaphores = timelineWaits.data();
+        submit.pWaitDstStageMask = timelineWaitStages.data();
+        submit.commandBufferCount = static_cast<uint32_t>(queued_.size());
+        submit.pCommandBuffers = queued_.data();
+        submit.signalSemaphoreCount = 1;
+        submit.pSignalSemaphores = &queuedSema;
+      }
+
+      auto &dynamicSubmit = submits.emplace_back();
+      if (useTimeline) dynamicSubmit.pNext = &timelineInfos[1];
+      dynamicSubmit.waitSemaphoreCount = static_cast<uint32_t>(dynamicWaits.size());
+      dynamicSubmit.pWaitSemaphores = dynamicWaits.data();
+      dynamicSubmit.pWaitDstStageMask = dynamicWaitStages.data();
+      dynamicSubmit.commandBufferCount = 1;
+      dynamicSubmit.pCommandBuffers = &dynamicCb;
+      dynamicSubmit.signalSemaphoreCount = 1;
+      dynamicSubmit.pSignalSemaphores = &dynamicSema;
+
+      // Wait for all of the dynamic commands, as they may update buffers the static ones read.
+      auto &staticSubmit = submits.emplace_back();
+      if (useTimeline) staticSubmit.pNext = &timelineInfos[2];
+      staticSubmit.waitSemaphoreCount = 1;
+      staticSubmit.pWaitSemaphores = &dynamicSema;
+      staticSubmit.pWaitDstStageMask = &staticWaitStage;
+      staticSubmit.commandBufferCount = 1;
+      staticSubmit.pCommandBuffers = &staticCb;
+      staticSubmit.signalSemaphoreCount = static_cast<uint32_t>(staticSignals.size());
+      staticSubmit.pSignalSemaphores = staticSignals.data();
+      queue.submit(submits, *frame.fence);
+    }
+  }
+
+  /// Make the resources for each frame slot.
+  void createFrames() {
+    frames_.clear();
+    frameIndex_ = 0;
+    std::fill(imageFences_.begin(), imageFences_.end(), vk::Fence{});
+
+    vk::CommandBufferAllocateInfo cbai{ *commandPool_, vk::CommandBufferLevel::ePrimary, framesInFlight_ };
+    auto dynamicDrawBuffers = device_.allocateCommandBuffersUnique(cbai);
+    for (auto &dynamicDrawBuffer : dynamicDrawBuffers) {
+      Frame frame;
+      frame.dynamicDrawBuffer = std::move(dynamicDrawBuffer);
+      frame.acquireSemaphore = device_.createSemaphoreUnique(vk::SemaphoreCreateInfo{});
+      frame.queuedSemaphore = device_.createSemaphoreUnique(vk::SemaphoreCreateInfo{});
+      frame.dynamicSemaphore = device_.createSemaphoreUnique(vk::SemaphoreCreateInfo{});
+      frame.fence = device_.createFenceUnique(vk::FenceCreateInfo{vk::FenceCreateFlagBits::eSignaled});
+      frames_.push_back(std::move(frame));
+    }
+  }
+
+  /// Make the semaphores and fence slots for each swapchain image.
+  /// Present has no fence, so a semaphore it waits on is only reused with its image.
+  void createImageSync() {
+    imageFences_.assign(images_.size(), vk::Fence{});
+    while (renderSemaphores_.size() < images_.size()) {
+      renderSemaphores_.push_back(device_.createSemaphoreUnique(vk::SemaphoreCreateInfo{}));
+    }
+  }
+
   vk::Device device() const { return device_; }
 
   std::array<float,4> &clearColorValue() { return clearColorValue_; }
@@ -700,18 +1027,32 @@ private:
   vk::UniqueSurfaceKHR surface_;
   vk::UniqueSwapchainKHR swapchain_;
   vk::UniqueRenderPass renderPass_;
-  vk::UniqueSemaphore imageAcquireSemaphore_;
-  vk::UniqueSemaphore commandCompleteSemaphore_;
-  vk::UniqueSemaphore dynamicSemaphore_;
   vk::UniqueCommandPool commandPool_;
 
+  /// Resources used by one frame in flight.
+  struct Frame {
+    vk::UniqueCommandBuffer dynamicDrawBuffer;
+    vk::UniqueSemaphore acquireSemaphore;
+    vk::UniqueSemaphore queuedSemaphore;
+    vk::UniqueSemaphore dynamicSemaphore;
+    vk::UniqueFence fence;
+  };
+
   std::vector<vk::ImageView> imageViews_;
   std::vector<vk::Image> images_;
-  std::vector<vk::Fence> commandBufferFences_;
-  std::vector<vk::Fence> dynamicCommandBufferFences_;
   std::vector<vk::UniqueFramebuffer> framebuffers_;
   std::vector<vk::UniqueCommandBuffer> staticDrawBuffers_;
-  std::vector<vk::UniqueCommandBuffer> dynamicDrawBuffers_;
+  std::vector<Frame> frames_;
+  std::vector<vk::Fence> imageFences_;
+  std::vector<vk::UniqueSemaphore> renderSemaphores_;
+  uint32_t framesInFlight_ = 2;
+  uint32_t frameIndex_ = 0;
+  std::vector<vk::CommandBuffer> queued_;
+  std::vector<vku::TimelineWait> timelineWaits_;
+  vku::TimelineQueue *timeline_ = nullptr;
+  uint64_t lastTimelineValue_ = 0;
+  SubmitStats submitStats_;
+  bool synchronization2_ = false;
   /// \brief Function called to recreate the static buffers on window size
   /// change.
   std::function<renderFunc_t> func;